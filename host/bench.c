@@ -0,0 +1,66 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include "bench.h"
+
+double Bench_Now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+double Bench_NowOverhead(void)
+{
+  double start, elapsed = 0;
+  unsigned count;
+
+  for (count = 0; count < 1000000; count++)
+  {
+    start = Bench_Now();
+    elapsed += Bench_Now() - start;
+  }
+
+  return elapsed / count;
+}
+
+int Bench_Report(unsigned passed, unsigned count, const char *note, ...)
+{
+  va_list args;
+
+  printf("%u of %u cases passed", passed, count);
+  if (note)
+  {
+    va_start(args, note);
+    vprintf(note, args);
+    va_end(args);
+  }
+  printf("\n");
+
+  return (passed == count) ? 0 : 1;
+}
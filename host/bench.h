@@ -0,0 +1,47 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    timing and pass/fail reporting shared by the benches in host/
+
+    Each bench keeps its own cases[] and the checks run() makes of each; what they all need besides is here.  Build
+    host/bench.c along with the bench.
+*/
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/* entries in a bench's cases[] */
+#define BENCH_CASES(cases) ((unsigned)(sizeof(cases) / sizeof((cases)[0])))
+
+/* seconds on the monotonic clock */
+extern double Bench_Now(void);
+
+/* the time Bench_Now() itself adds to an interval, to be taken off intervals too short for it not to matter */
+extern double Bench_NowOverhead(void);
+
+/* prints "passed of count cases passed" and then the note, if any, as printf() would; returns the bench's exit status */
+extern int Bench_Report(unsigned passed, unsigned count, const char *note, ...) __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,228 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    scaling benchmark of cancolumns.c
+
+      cancolumnbench [megabytes [directory [threads]]]
+
+    Writes a text capture of about megabytes (default 1024) as the sniffer sends it with 'Z2' and 'q1' (capture.log, 
+    in directory, by default the current one): busy 1Mbit traffic, with the odd 'u' record and command response in 
+    among it, and the sniffer's clock starting just short of wrapping.  It is then decoded into capture.col with 1, 
+    2, 4, ... up to threads threads (by default, one per core), reporting the time taken and the speed-up over one 
+    thread, and each output is read back and checked, row by row in order, against the frames as they were made.  
+    Exits non-zero if any output is wrong.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cancolumns.h"
+#include "bench.h"
+
+#define DEVICE_START 0xFFF00000UL  /* the sniffer's clock at the first frame */
+#define OUTPUT_SIZE (1 << 20)
+
+/* a running check of the rows, in order */
+static uint64_t row_sum(uint64_t sum, uint64_t time, uint32_t id, uint8_t flags, uint8_t dlc, uint16_t sequence, const uint8_t *data)
+{
+  unsigned index;
+
+  sum = (sum ^ time) * 0x100000001B3ULL;
+  sum = (sum ^ id) * 0x100000001B3ULL;
+  sum = (sum ^ ((unsigned)flags << 24 | (unsigned)dlc << 16 | sequence)) * 0x100000001B3ULL;
+  for (index = 0; index < CANMESSAGE_DATA_MAX; index++)
+    sum = (sum ^ data[index]) * 0x100000001B3ULL;
+
+  return sum;
+}
+
+static void hex(char *text, uint32_t value, unsigned digits)
+{
+  static const char digit[] = "0123456789ABCDEF";
+
+  while (digits--)
+  {
+    text[digits] = digit[value & 15];
+    value >>= 4;
+  }
+}
+
+static uint64_t generate(const char *path, uint64_t target, uint64_t *frames)
+{
+  uint8_t data[CANMESSAGE_DATA_MAX];
+  char *buffer, *line;
+  uint64_t bytes = 0, time = 0, sum = 0;
+  uint32_t id;
+  unsigned dlc, byte, length = 0, extended;
+  uint16_t sequence = 0;
+  FILE *file;
+
+  file = fopen(path, "wb");
+  buffer = malloc(OUTPUT_SIZE);
+  if (!file || !buffer)
+  {
+    perror(path);
+    exit(1);
+  }
+
+  *frames = 0;
+  while (bytes < target)
+  {
+    if (length > OUTPUT_SIZE - 64)
+    {
+      fwrite(buffer, 1, length, file);
+      bytes += length;
+      length = 0;
+    }
+    line = buffer + length;
+
+    /* now and then, something other than a message record */
+    if (0 == rand() % 5000)
+    {
+      memcpy(line, (rand() & 1) ? "u1A3" "00C0FFEE\r" : "I0B00000000\r", 13);
+      length += ('u' == line[0]) ? 13 : 12;
+      continue;
+    }
+
+    extended = (0 == rand() % 4);
+    id = (extended) ? 0x18DA0000UL + rand() % 256 : 0x100UL + rand() % 64;
+    dlc = rand() % 9;
+    memset(data, 0, sizeof(data));
+    for (byte = 0; byte < dlc; byte++)
+      data[byte] = (uint8_t)rand();
+
+    line[0] = (extended) ? 'T' : 't';
+    hex(line + 1, id, (extended) ? 8 : 3);
+    line += (extended) ? 9 : 4;
+    *line++ = '0' + dlc;
+    for (byte = 0; byte < dlc; byte++, line += 2)
+      hex(line, data[byte], 2);
+    hex(line, (uint32_t)(DEVICE_START + time), 8);
+    hex(line + 8, sequence, 4);
+    line[12] = '\r';
+    length = line + 13 - buffer;
+
+    sum = row_sum(sum, DEVICE_START + time, id | ((extended) ? CANCOLUMNS_ID_EXT : 0), 0, (uint8_t)dlc, sequence, data);
+    sequence++;
+    (*frames)++;
+    time += 100 + rand() % 51;
+  }
+  fwrite(buffer, 1, length, file);
+  fclose(file);
+  free(buffer);
+
+  return sum;
+}
+
+/* the rows of the output, in order, or 0 with *rows of -1 if it could not be read */
+static uint64_t check(const char *path, uint64_t *rows)
+{
+  static struct cancolumns_group group;
+  uint64_t sum = 0;
+  unsigned flags;
+  uint32_t row;
+  FILE *file;
+  int got;
+
+  *rows = 0;
+  file = fopen(path, "rb");
+  if ( !file || !CANcolumns_ReadHeader(file, &flags) || (flags != (CANCOLUMNS_TIMED | CANCOLUMNS_SEQUENCED)) )
+  {
+    *rows = (uint64_t)-1;
+    if (file)
+      fclose(file);
+    return 0;
+  }
+  while (1 == (got = CANcolumns_ReadGroup(file, &group)))
+  {
+    for (row = 0; row < group.Rows; row++)
+      sum = row_sum(sum, group.Time[row], group.Id[row], group.Flags[row], group.DLC[row], group.Sequence[row], group.Data + (size_t)row * CANMESSAGE_DATA_MAX);
+    *rows += group.Rows;
+  }
+  if (got < 0)
+    *rows = (uint64_t)-1;
+  fclose(file);
+
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  struct lawicel_format format = { 8, 1 };
+  struct cancolumns_stats stats;
+  unsigned long megabytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024;
+  const char *directory = (argc > 2) ? argv[2] : ".";
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned max_threads = (argc > 3) ? (unsigned)atoi(argv[3]) : (cores > 0) ? (unsigned)cores : 1, threads, wrong = 0;
+  char path[4096], output_path[4096];
+  uint64_t frames, expected, sum, rows;
+  double start, elapsed, single = 0;
+  FILE *output;
+
+  if ( !megabytes || !max_threads )
+  {
+    fprintf(stderr, "usage: %s [megabytes [directory [threads]]]\n", argv[0]);
+    return 1;
+  }
+  snprintf(path, sizeof(path), "%s/capture.log", directory);
+  snprintf(output_path, sizeof(output_path), "%s/capture.col", directory);
+
+  srand(1);
+  start = Bench_Now();
+  expected = generate(path, (uint64_t)megabytes << 20, &frames);
+  printf("generated %llu frames (%lu MB) in %.1f s; %ld cores\n\n", (unsigned long long)frames, megabytes, Bench_Now() - start, cores);
+
+  for (threads = 1; ; threads = (2 * threads < max_threads) ? 2 * threads : max_threads)
+  {
+    output = fopen(output_path, "wb");
+    if (!output)
+    {
+      perror(output_path);
+      return 1;
+    }
+    setvbuf(output, NULL, _IOFBF, OUTPUT_SIZE);
+
+    start = Bench_Now();
+    if ( !CANcolumns_Decode(path, output, &format, threads, &stats) || fclose(output) )
+    {
+      perror(path);
+      return 1;
+    }
+    elapsed = Bench_Now() - start;
+    if (1 == threads)
+      single = elapsed;
+
+    sum = check(output_path, &rows);
+    printf("%2u threads  %6.2f s  %6.0f MB/s  %5.1f M frames/s  %4.2fx  %s\n", threads, elapsed, megabytes / elapsed, frames / elapsed / 1e6, single / elapsed, ((rows == frames) && (sum == expected) && !stats.Errors) ? "ok" : "WRONG");
+    if ( (rows != frames) || (sum != expected) || stats.Errors )
+      wrong++;
+
+    if (threads == max_threads)
+      break;
+  }
+
+  return (wrong) ? 1 : 0;
+}
@@ -0,0 +1,376 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cancolumns.h"
+
+/* a chunk, decoded; its times are from its first timestamp until it is written */
+struct chunk
+{
+  struct cancolumns_group Group;
+  uint32_t FirstTimestamp, LastTimestamp;
+  uint64_t Span;
+  unsigned long Errors;
+  int Done;
+};
+
+struct pool
+{
+  const char *Data;
+  size_t Size;
+  char LineEnd;
+  const struct lawicel_format *Format;
+  uint64_t Wrap;
+  unsigned long Chunks, Next, Written;
+  unsigned Slots;
+  struct chunk *Slot;       /* chunk n is decoded into Slot[n % Slots] */
+  int Failed;               /* out of memory */
+  pthread_mutex_t Lock;
+  pthread_cond_t Decoded, Room;
+};
+
+static int group_grow(struct cancolumns_group *group, uint32_t size)
+{
+  void *time, *id, *flags, *dlc, *sequence, *data;
+
+  time = realloc(group->Time, size * sizeof(*group->Time));
+  if (time)
+    group->Time = time;
+  id = realloc(group->Id, size * sizeof(*group->Id));
+  if (id)
+    group->Id = id;
+  flags = realloc(group->Flags, size);
+  if (flags)
+    group->Flags = flags;
+  dlc = realloc(group->DLC, size);
+  if (dlc)
+    group->DLC = dlc;
+  sequence = realloc(group->Sequence, size * sizeof(*group->Sequence));
+  if (sequence)
+    group->Sequence = sequence;
+  data = realloc(group->Data, (size_t)size * CANMESSAGE_DATA_MAX);
+  if (data)
+    group->Data = data;
+
+  if (!time || !id || !flags || !dlc || !sequence || !data)
+    return 0;
+  group->Size = size;
+  return 1;
+}
+
+void CANcolumns_FreeGroup(struct cancolumns_group *group)
+{
+  free(group->Time);
+  free(group->Id);
+  free(group->Flags);
+  free(group->DLC);
+  free(group->Sequence);
+  free(group->Data);
+  memset(group, 0, sizeof(*group));
+}
+
+static int decode_chunk(struct pool *pool, unsigned long number, struct chunk *chunk)
+{
+  struct cancolumns_group *group = &chunk->Group;
+  struct lawicel_clock clock = { 0, 0, 0 };
+  const char *data = pool->Data, *end;
+  size_t offset, stop;
+  struct CANmessage msg;
+  uint32_t row;
+  int timed;
+
+  offset = LAWICEL_LineStart(data, pool->Size, pool->LineEnd, number * (size_t)CANCOLUMNS_CHUNK);
+  stop = LAWICEL_LineStart(data, pool->Size, pool->LineEnd, (number + 1) * (size_t)CANCOLUMNS_CHUNK);
+  group->Rows = 0;
+  chunk->Errors = 0;
+  chunk->Span = 0;
+
+  while (offset < stop)
+  {
+    /* a line without its end (the capture was cut short) is left be */
+    end = memchr(data + offset, pool->LineEnd, pool->Size - offset);
+    if (!end)
+      break;
+
+    if (LAWICEL_Parse(data + offset, pool->Format, &msg, &timed))
+    {
+      if ( (group->Rows == group->Size) && !group_grow(group, (group->Size) ? 2 * group->Size : 65536) )
+        return 0;
+      row = group->Rows++;
+
+      if (timed)
+      {
+        if (!clock.Started)
+          chunk->FirstTimestamp = msg.Timestamp;
+        group->Time[row] = LAWICEL_Unwrap(&clock, msg.Timestamp, pool->Wrap) - chunk->FirstTimestamp;
+        chunk->LastTimestamp = msg.Timestamp;
+        chunk->Span = group->Time[row];
+      }
+      else
+      {
+        group->Time[row] = chunk->Span; /* a record without its timestamp is taken to be at the time of the one before */
+      }
+      group->Id[row] = msg.Id | ((msg.flags & CANMESSAGE_FLAG_STDID) ? 0 : CANCOLUMNS_ID_EXT);
+      group->Flags[row] = msg.flags & (CANMESSAGE_FLAG_FD | CANMESSAGE_FLAG_BRS | CANMESSAGE_FLAG_ESI);
+      group->DLC[row] = msg.DLC;
+      group->Sequence[row] = msg.Sequence;
+      memcpy(group->Data + (size_t)row * CANMESSAGE_DATA_MAX, msg.Data, CANMESSAGE_LENGTH(&msg));
+      memset(group->Data + (size_t)row * CANMESSAGE_DATA_MAX + CANMESSAGE_LENGTH(&msg), 0, CANMESSAGE_DATA_MAX - CANMESSAGE_LENGTH(&msg));
+    }
+    else if ( ('t' == data[offset]) || ('T' == data[offset]) || ('d' == data[offset]) || ('D' == data[offset]) )
+    {
+      chunk->Errors++;
+    }
+
+    offset = end - data + 1;
+    if ( ('\r' == pool->LineEnd) && (offset < pool->Size) && ('\n' == data[offset]) )
+      offset++;
+  }
+
+  return 1;
+}
+
+static void *decode_thread(void *context)
+{
+  struct pool *pool = context;
+  struct chunk *chunk;
+  unsigned long number;
+  int ok;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&pool->Lock);
+    while ( !pool->Failed && (pool->Next < pool->Chunks) && (pool->Next >= pool->Written + pool->Slots) )
+      pthread_cond_wait(&pool->Room, &pool->Lock);
+    if ( pool->Failed || (pool->Next >= pool->Chunks) )
+    {
+      pthread_mutex_unlock(&pool->Lock);
+      return NULL;
+    }
+    number = pool->Next++;
+    pthread_mutex_unlock(&pool->Lock);
+
+    chunk = &pool->Slot[number % pool->Slots];
+    ok = decode_chunk(pool, number, chunk);
+
+    pthread_mutex_lock(&pool->Lock);
+    if (ok)
+      chunk->Done = 1;
+    else
+      pool->Failed = 1;
+    pthread_cond_broadcast(&pool->Decoded);
+    pthread_mutex_unlock(&pool->Lock);
+  }
+}
+
+static int write_group(FILE *output, const struct cancolumns_group *group)
+{
+  uint32_t rows = group->Rows;
+
+  if (1 != fwrite(&rows, sizeof(rows), 1, output))
+    return 0;
+  if (!rows)
+    return 1;
+
+  return (rows == fwrite(group->Time, sizeof(*group->Time), rows, output)) && (rows == fwrite(group->Id, sizeof(*group->Id), rows, output)) && (rows == fwrite(group->Flags, 1, rows, output)) && (rows == fwrite(group->DLC, 1, rows, output)) && (rows == fwrite(group->Sequence, sizeof(*group->Sequence), rows, output)) && (rows == fwrite(group->Data, CANMESSAGE_DATA_MAX, rows, output));
+}
+
+int CANcolumns_Decode(const char *path, FILE *output, const struct lawicel_format *format, unsigned threads, struct cancolumns_stats *stats)
+{
+  static const struct cancolumns_group end_group;
+  struct pool pool;
+  struct chunk *chunk;
+  struct stat status;
+  pthread_t *thread;
+  uint32_t header[2], row;
+  uint64_t base = 0, elapsed;
+  unsigned long number;
+  unsigned index, started = 0;
+  int fd, ok = 1, have_time = 0;
+  uint32_t last_timestamp = 0;
+  uint64_t last_span = 0;
+  void *map = NULL;
+
+  memset(stats, 0, sizeof(*stats));
+  memset(&pool, 0, sizeof(pool));
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &status))
+  {
+    close(fd);
+    return 0;
+  }
+  pool.Size = status.st_size;
+  if (pool.Size)
+  {
+    map = mmap(NULL, pool.Size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == map)
+    {
+      close(fd);
+      return 0;
+    }
+    madvise(map, pool.Size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  if (!threads)
+    threads = 1;
+  pool.Data = map;
+  pool.LineEnd = LAWICEL_LineEnd(pool.Data, pool.Size);
+  pool.Format = format;
+  pool.Wrap = LAWICEL_Wrap(format);
+  pool.Chunks = (pool.Size + CANCOLUMNS_CHUNK - 1) / CANCOLUMNS_CHUNK;
+  pool.Slots = CANCOLUMNS_IN_FLIGHT * threads;
+  pool.Slot = calloc(pool.Slots, sizeof(*pool.Slot));
+  thread = calloc(threads, sizeof(*thread));
+  pthread_mutex_init(&pool.Lock, NULL);
+  pthread_cond_init(&pool.Decoded, NULL);
+  pthread_cond_init(&pool.Room, NULL);
+
+  memcpy(header, CANCOLUMNS_MAGIC, sizeof(header));
+  if ( !pool.Slot || !thread || (1 != fwrite(header, sizeof(header), 1, output)) )
+    ok = 0;
+  header[0] = CANMESSAGE_DATA_MAX;
+  header[1] = ((format->TimestampDigits) ? CANCOLUMNS_TIMED : 0) | ((format->Sequence) ? CANCOLUMNS_SEQUENCED : 0);
+  if ( ok && (1 != fwrite(header, sizeof(header), 1, output)) )
+    ok = 0;
+
+  for (index = 0; ok && (index < threads); index++, started++)
+    if (pthread_create(&thread[index], NULL, decode_thread, &pool))
+      break;
+  if (!started)
+    ok = 0;
+
+  /* write out each chunk in turn, as soon as it is done */
+  for (number = 0; ok && (number < pool.Chunks); number++)
+  {
+    chunk = &pool.Slot[number % pool.Slots];
+    pthread_mutex_lock(&pool.Lock);
+    while ( !chunk->Done && !pool.Failed )
+      pthread_cond_wait(&pool.Decoded, &pool.Lock);
+    ok = !pool.Failed;
+    pthread_mutex_unlock(&pool.Lock);
+    if (!ok)
+      break;
+
+    /* on from the end of the chunk before, as LAWICEL_Unwrap() would have it */
+    if ( format->TimestampDigits && chunk->Group.Rows )
+    {
+      if (!have_time)
+      {
+        base = chunk->FirstTimestamp;
+        have_time = 1;
+      }
+      else
+      {
+        elapsed = (chunk->FirstTimestamp >= last_timestamp) ? chunk->FirstTimestamp - last_timestamp : chunk->FirstTimestamp + pool.Wrap - last_timestamp;
+        base += last_span + ((elapsed < pool.Wrap / 2) ? elapsed : 0);
+      }
+      for (row = 0; row < chunk->Group.Rows; row++)
+        chunk->Group.Time[row] += base;
+      last_timestamp = chunk->LastTimestamp;
+      last_span = chunk->Span;
+    }
+
+    if (chunk->Group.Rows && !write_group(output, &chunk->Group))
+      ok = 0;
+    stats->Frames += chunk->Group.Rows;
+    stats->Errors += chunk->Errors;
+    stats->Chunks++;
+
+    pthread_mutex_lock(&pool.Lock);
+    chunk->Done = 0;
+    pool.Written++;
+    if (!ok)
+      pool.Failed = 1;
+    pthread_cond_broadcast(&pool.Room);
+    pthread_mutex_unlock(&pool.Lock);
+  }
+
+  if (!ok)
+  {
+    pthread_mutex_lock(&pool.Lock);
+    pool.Failed = 1;
+    pthread_cond_broadcast(&pool.Room);
+    pthread_mutex_unlock(&pool.Lock);
+  }
+  for (index = 0; index < started; index++)
+    pthread_join(thread[index], NULL);
+
+  if ( ok && !write_group(output, &end_group) )
+    ok = 0;
+
+  for (index = 0; pool.Slot && (index < pool.Slots); index++)
+    CANcolumns_FreeGroup(&pool.Slot[index].Group);
+  free(pool.Slot);
+  free(thread);
+  pthread_mutex_destroy(&pool.Lock);
+  pthread_cond_destroy(&pool.Decoded);
+  pthread_cond_destroy(&pool.Room);
+  if (map)
+    munmap(map, pool.Size);
+
+  if (!ok && !errno)
+    errno = ENOMEM;
+  return ok;
+}
+
+int CANcolumns_ReadHeader(FILE *input, unsigned *flags)
+{
+  uint32_t header[4];
+
+  if ( (1 != fread(header, sizeof(header), 1, input)) || memcmp(header, CANCOLUMNS_MAGIC, 8) || (CANMESSAGE_DATA_MAX != header[2]) )
+    return 0;
+  *flags = header[3];
+
+  return 1;
+}
+
+int CANcolumns_ReadGroup(FILE *input, struct cancolumns_group *group)
+{
+  uint32_t rows;
+
+  if (1 != fread(&rows, sizeof(rows), 1, input))
+    return -1;
+  group->Rows = 0;
+  if (!rows)
+    return 0;
+  if ( (rows > group->Size) && !group_grow(group, rows) )
+    return -1;
+
+  if ( (rows != fread(group->Time, sizeof(*group->Time), rows, input)) || (rows != fread(group->Id, sizeof(*group->Id), rows, input)) || (rows != fread(group->Flags, 1, rows, input)) || (rows != fread(group->DLC, 1, rows, input)) || (rows != fread(group->Sequence, sizeof(*group->Sequence), rows, input)) || (rows != fread(group->Data, CANMESSAGE_DATA_MAX, rows, input)) )
+    return -1;
+  group->Rows = rows;
+
+  return 1;
+}
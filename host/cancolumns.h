@@ -0,0 +1,89 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANCOLUMNS_H_
+#define CANCOLUMNS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "lawicel.h"
+
+/*
+    decoding of a capture of the sniffer's text output into columns, on several threads at once
+
+    The capture is mapped into memory and cut into chunks of about CANCOLUMNS_CHUNK bytes, each ending at the end of 
+    a line (the CR after a record), so that every record is whole in the one chunk.  A pool of threads decode the 
+    chunks, each into columns of its own; the calling thread writes them out in the order of the capture as soon as 
+    each next one is done.  No more than CANCOLUMNS_IN_FLIGHT chunks a thread are held at once, however far ahead 
+    the pool gets.  Timestamps are unwrapped within each chunk as it is decoded, and from one chunk to the next as 
+    it is written.
+
+    The output is a header, a group of rows for each chunk, and a group of no rows to end it, all little endian:
+
+      header  "CANCOL01", uint32 data bytes per row (CANMESSAGE_DATA_MAX), uint32 CANCOLUMNS_TIMED | CANCOLUMNS_SEQUENCED
+      group   uint32 rows, then each column in turn, rows long:
+                uint64 time      microseconds, unwrapped from the capture's first timestamp (0 without timestamps; 
+                                 a record that lacks one is given that of the record before)
+                uint32 id        ORed with CANCOLUMNS_ID_EXT for an extended ID
+                uint8  flags     CANMESSAGE_FLAG_FD, _BRS and _ESI, as in canbus.h
+                uint8  dlc
+                uint16 sequence  (0 without sequence numbers)
+                uint8  data[data bytes per row], zero past the length the DLC gives
+*/
+
+#define CANCOLUMNS_MAGIC "CANCOL01"
+#define CANCOLUMNS_CHUNK (4 << 20)
+#define CANCOLUMNS_IN_FLIGHT 2
+#define CANCOLUMNS_ID_EXT 0x80000000UL
+
+#define CANCOLUMNS_TIMED     0x01
+#define CANCOLUMNS_SEQUENCED 0x02
+
+struct cancolumns_group
+{
+  uint32_t Rows, Size;      /* Size is the rows there is room for */
+  uint64_t *Time;
+  uint32_t *Id;
+  uint8_t *Flags;
+  uint8_t *DLC;
+  uint16_t *Sequence;
+  uint8_t *Data;            /* CANMESSAGE_DATA_MAX a row */
+};
+
+struct cancolumns_stats
+{
+  uint64_t Frames;
+  unsigned long Chunks;
+  unsigned long Errors;     /* lines that looked like message records but were not */
+};
+
+/* decode the capture at path into output; returns zero (with errno set) if it could not be read, or output written */
+extern int CANcolumns_Decode(const char *path, FILE *output, const struct lawicel_format *format, unsigned threads, struct cancolumns_stats *stats);
+
+/* read back what CANcolumns_Decode() wrote: the header, and then each group in turn (1), until the end (0) or an error (-1) */
+extern int CANcolumns_ReadHeader(FILE *input, unsigned *flags);
+extern int CANcolumns_ReadGroup(FILE *input, struct cancolumns_group *group);
+extern void CANcolumns_FreeGroup(struct cancolumns_group *group);
+
+#endif
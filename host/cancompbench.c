@@ -0,0 +1,249 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    compression benchmark for output mode D4
+
+    Reads recorded traffic, encodes it with the firmware's own src/cancomp.c into blocks the way CANbus_Service() 
+    does, decodes the blocks again with candecomp.c to check that every frame comes back as it went in, and reports 
+    how the size compares with the text output (mode D0) and with struct CANmessage as it is, and the time taken to 
+    encode each frame.
+
+    Traces are read from the files named on the command line (or standard input), one frame per line, as either:
+
+      (1436509052.249713) can0 123#DEADBEEF        candump -l log
+      (1436509052.249713) can0 123##1DEADBEEF      candump -l log of a CAN FD frame (BRS and ESI in the digit after 
+                                                   "##"); only if built with CANMESSAGE_DATA_MAX of 64
+      t1232DEAD                                    LAWICEL / mode D0 text, optionally followed by 4 hex digits of 
+                                                   millisecond timestamp (as 'Z1'); 'd'/'D' FD records too, if 
+                                                   built with CANMESSAGE_DATA_MAX of 64
+
+    Lines that are neither are ignored.  Frames without a timestamp are taken to be 200us apart.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "candecomp.h"
+#include "cancomp.h"
+#include "lawicel.h"
+#include "bench.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#endif
+
+#ifndef INBOUND_RECORD_MAX
+#define INBOUND_RECORD_MAX 64
+#endif
+#define BLOCK_SIZE (INBOUND_RECORD_MAX - 2) /* COMPRESSED_BLOCK_SIZE of canbus.c */
+#define DEFAULT_SPACING 200
+
+struct trace
+{
+  struct CANmessage *frame;
+  size_t count, allocated;
+  unsigned long text_bytes;
+};
+
+static const struct lawicel_format trace_format = { 4, 0 }; /* LAWICEL text is taken to have 'Z1' timestamps, if any */
+
+static void read_trace(struct trace *trace, FILE *file)
+{
+  char line[256];
+  struct CANmessage msg;
+  uint32_t last_time = 0, last_raw = 0, raw, wrap;
+  uint64_t time;
+  int timed;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    memset(&msg, 0, sizeof(msg));
+    if (LAWICEL_ParseCandump(line, &msg, &time))
+    {
+      timed = 1;
+      wrap = 0; /* the low 32 bits of microseconds wrap as the firmware's own do */
+    }
+    else if (LAWICEL_Parse(line, &trace_format, &msg, &timed))
+    {
+      wrap = (uint32_t)LAWICEL_Wrap(&trace_format); /* the millisecond count goes back to zero each minute */
+    }
+    else
+    {
+      continue;
+    }
+
+    /* only the differences between timestamps are of use, as the firmware's own wrap */
+    raw = msg.Timestamp;
+    if (!timed)
+      msg.Timestamp = last_time + DEFAULT_SPACING;
+    else if (trace->count)
+      msg.Timestamp = last_time + ((wrap && (raw < last_raw)) ? raw + wrap - last_raw : raw - last_raw);
+    if (timed)
+      last_raw = raw;
+    last_time = msg.Timestamp;
+
+    if (trace->count == trace->allocated)
+    {
+      trace->allocated = (trace->allocated) ? 2 * trace->allocated : 4096;
+      trace->frame = realloc(trace->frame, trace->allocated * sizeof(*trace->frame));
+      if (!trace->frame)
+      {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+      }
+    }
+
+    msg.Sequence = (uint16_t)trace->count;
+    trace->frame[trace->count++] = msg;
+    trace->text_bytes += 1 + ((msg.flags & CANMESSAGE_FLAG_STDID) ? 3 : 8) + ((msg.flags & CANMESSAGE_FLAG_FD) ? 1 : 0) + 1 + 2 * CANMESSAGE_LENGTH(&msg) + 1;
+  }
+}
+
+struct blocks
+{
+  struct candecomp *decomp;
+  uint8_t stream[2 + BLOCK_SIZE + CANCOMP_RECORD_MAX];
+  unsigned Length, Full;
+  unsigned long bytes, count;
+};
+
+/* as CANbus_CompressedFlush(), but handing the block straight to the decoder */
+static void flush_block(struct blocks *blocks)
+{
+  unsigned length = (blocks->Full) ? blocks->Full : blocks->Length;
+
+  blocks->stream[0] = 0;
+  blocks->stream[1] = (uint8_t)length;
+  CANdecomp_Feed(blocks->decomp, blocks->stream, 2 + length);
+  blocks->bytes += 2 + length;
+  blocks->count++;
+
+  memmove(blocks->stream + 2, blocks->stream + 2 + length, blocks->Length - length);
+  blocks->Length -= length;
+  blocks->Full = 0;
+}
+
+struct verify
+{
+  const struct trace *trace;
+  size_t next;
+  unsigned long mismatches;
+};
+
+static void verify_frame(void *context, const struct candecomp_frame *frame)
+{
+  struct verify *verify = context;
+  const struct CANmessage *msg;
+  unsigned flags;
+
+  if (verify->next >= verify->trace->count)
+  {
+    verify->mismatches++;
+    return;
+  }
+
+  msg = &verify->trace->frame[verify->next++];
+  flags = ((msg->flags & CANMESSAGE_FLAG_FD) ? CANDECOMP_FD : 0) | ((msg->flags & CANMESSAGE_FLAG_BRS) ? CANDECOMP_BRS : 0) | ((msg->flags & CANMESSAGE_FLAG_ESI) ? CANDECOMP_ESI : 0);
+  if ( (frame->Id != msg->Id) || (frame->Extended != !(msg->flags & CANMESSAGE_FLAG_STDID)) || (frame->Flags != flags) || (frame->DLC != msg->DLC) || (frame->Length != CANMESSAGE_LENGTH(msg)) || memcmp(frame->Data, msg->Data, frame->Length) || (frame->Timestamp != msg->Timestamp) || frame->Lost )
+    verify->mismatches++;
+}
+
+int main(int argc, char *argv[])
+{
+  static struct cancomp_state state;
+  static struct candecomp decomp;
+  static struct blocks blocks;
+  struct trace trace = { 0 };
+  struct verify verify = { &trace, 0, 0 };
+  double start, seconds;
+  unsigned length;
+  size_t index;
+  FILE *file;
+  int arg;
+#ifdef CYCLES
+  unsigned long long cycles = 0, before;
+#endif
+
+  if (argc < 2)
+    read_trace(&trace, stdin);
+  for (arg = 1; arg < argc; arg++)
+  {
+    file = fopen(argv[arg], "r");
+    if (!file)
+    {
+      perror(argv[arg]);
+      return 1;
+    }
+    read_trace(&trace, file);
+    fclose(file);
+  }
+
+  if (!trace.count)
+  {
+    fprintf(stderr, "no frames found\n");
+    return 1;
+  }
+
+  CANdecomp_Init(&decomp, verify_frame, NULL, &verify);
+  blocks.decomp = &decomp;
+  CANcomp_Init(&state);
+
+  start = Bench_Now();
+  for (index = 0; index < trace.count; index++)
+  {
+    if (blocks.Full)
+      flush_block(&blocks);
+
+#ifdef CYCLES
+    before = CYCLES();
+#endif
+    length = CANcomp_Encode(&state, blocks.stream + 2 + blocks.Length, &trace.frame[index]);
+#ifdef CYCLES
+    cycles += CYCLES() - before;
+#endif
+
+    if (blocks.Length + length > BLOCK_SIZE)
+      blocks.Full = blocks.Length;
+    blocks.Length += length;
+  }
+  while (blocks.Length)
+    flush_block(&blocks);
+  seconds = Bench_Now() - start;
+
+  printf("frames            %zu\n", trace.count);
+  printf("decoded           %zu (%lu mismatched, %lu decode errors)\n", verify.next, verify.mismatches, decomp.Errors);
+  printf("text (D0) bytes   %lu\n", trace.text_bytes);
+  printf("binary bytes      %lu (%u per frame)\n", (unsigned long)(trace.count * sizeof(struct CANmessage)), (unsigned)sizeof(struct CANmessage));
+  printf("compressed bytes  %lu in %lu blocks (%.2f per frame)\n", blocks.bytes, blocks.count, (double)blocks.bytes / trace.count);
+  printf("ratio vs text     %.2f\n", (double)trace.text_bytes / blocks.bytes);
+  printf("ratio vs binary   %.2f\n", (double)(trace.count * sizeof(struct CANmessage)) / blocks.bytes);
+  printf("encode+decode     %.1f ns per frame\n", 1e9 * seconds / trace.count);
+#ifdef CYCLES
+  printf("encode            %.1f cycles per frame\n", (double)cycles / trace.count);
+#endif
+
+  return ((verify.next == trace.count) && !verify.mismatches && !decomp.Errors) ? 0 : 1;
+}
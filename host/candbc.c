@@ -0,0 +1,458 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "candbc.h"
+
+static uint64_t load_le(const uint8_t *data)
+{
+  return (uint64_t)data[0] | (uint64_t)data[1] << 8 | (uint64_t)data[2] << 16 | (uint64_t)data[3] << 24 | 
+    (uint64_t)data[4] << 32 | (uint64_t)data[5] << 40 | (uint64_t)data[6] << 48 | (uint64_t)data[7] << 56;
+}
+
+static uint64_t load_be(const uint8_t *data)
+{
+  return (uint64_t)data[0] << 56 | (uint64_t)data[1] << 48 | (uint64_t)data[2] << 40 | (uint64_t)data[3] << 32 | 
+    (uint64_t)data[4] << 24 | (uint64_t)data[5] << 16 | (uint64_t)data[6] << 8 | (uint64_t)data[7];
+}
+
+static unsigned hash(uint32_t id, unsigned bits)
+{
+  return (unsigned)((id * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - bits);
+}
+
+/* work out where a signal is read from, returning zero if it does not fit in a frame */
+static int plan(struct candbc_signal *signal)
+{
+  unsigned first, last, end;
+
+  if ( (signal->Length < 1) || (signal->Length > 64) || (signal->StartBit >= 8 * CANMESSAGE_DATA_MAX) )
+    return 0;
+
+  first = signal->StartBit / 8;
+  if (signal->Motorola)
+    end = first * 8 + (7 - signal->StartBit % 8) + signal->Length - 1;  /* counting from the top of byte 0 down */
+  else
+    end = signal->StartBit + signal->Length - 1;
+  last = end / 8;
+  if (last >= CANMESSAGE_DATA_MAX)
+    return 0;
+
+  signal->Base = (uint8_t)((first + 8 <= CANMESSAGE_DATA_MAX) ? first : CANMESSAGE_DATA_MAX - 8);
+  signal->Need = (uint8_t)(last + 1);
+  signal->Slow = (last >= signal->Base + 8U);
+  signal->Shift = (uint8_t)((signal->Motorola) ? 63 - (end - 8 * signal->Base) : signal->StartBit - 8 * signal->Base);
+  if (signal->Slow)
+    signal->Shift = 0;
+  signal->Mask = (64 == signal->Length) ? ~(uint64_t)0 : ((uint64_t)1 << signal->Length) - 1;
+  signal->SignBit = (signal->Signed) ? (uint64_t)1 << (signal->Length - 1) : 0;
+
+  return 1;
+}
+
+uint64_t CANdbc_Raw(const struct candbc_signal *signal, const uint8_t *data)
+{
+  uint64_t raw;
+  unsigned bit, position;
+
+  if (!signal->Slow)
+  {
+    raw = (signal->Motorola) ? load_be(data + signal->Base) : load_le(data + signal->Base);
+    raw = (raw >> signal->Shift) & signal->Mask;
+  }
+  else
+  {
+    raw = 0;
+    for (bit = 0; bit < signal->Length; bit++)
+    {
+      if (signal->Motorola)
+      {
+        /* counting from the top of byte 0 down, and then back to the bit of the byte */
+        position = (signal->StartBit / 8) * 8 + (7 - signal->StartBit % 8) + bit;
+        position = (position & ~7U) | (7 - (position & 7));
+      }
+      else
+        position = signal->StartBit + signal->Length - 1 - bit;
+      raw = raw << 1 | ((data[position / 8] >> (position % 8)) & 1);
+    }
+  }
+
+  return (raw ^ signal->SignBit) - signal->SignBit;
+}
+
+static double value(const struct candbc_signal *signal, uint64_t raw)
+{
+  uint32_t single;
+  float f;
+  double d;
+
+  switch (signal->ValueType)
+  {
+  case CANDBC_FLOAT:
+    single = (uint32_t)raw;
+    memcpy(&f, &single, sizeof(f));
+    d = f;
+    break;
+  case CANDBC_DOUBLE:
+    memcpy(&d, &raw, sizeof(d));
+    break;
+  default:
+    d = (signal->Signed) ? (double)(int64_t)raw : (double)raw;
+    break;
+  }
+
+  return d * signal->Factor + signal->Offset;
+}
+
+const struct candbc_message *CANdbc_Lookup(const struct candbc *dbc, uint32_t id)
+{
+  unsigned index, mask = (1U << dbc->TableBits) - 1;
+
+  for (index = hash(id, dbc->TableBits); dbc->Table[index]; index = (index + 1) & mask)
+    if (dbc->Message[dbc->Table[index] - 1].Id == id)
+      return &dbc->Message[dbc->Table[index] - 1];
+
+  return NULL;
+}
+
+int CANdbc_Find(const struct candbc *dbc, const char *name)
+{
+  unsigned index;
+
+  for (index = 0; index < dbc->Signals; index++)
+    if (!strcmp(dbc->Signal[index].Name, name))
+      return (int)index;
+
+  return -1;
+}
+
+unsigned CANdbc_Decode(const struct candbc *dbc, const struct CANmessage *msg, struct candbc_sample *sample)
+{
+  const struct candbc_message *message;
+  const struct candbc_signal *signal, *end;
+  unsigned length = CANMESSAGE_LENGTH(msg), count = 0;
+  long mux = -1;
+
+  message = CANdbc_Lookup(dbc, msg->Id | ((msg->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANDBC_ID_EXT));
+  if (!message)
+    return 0;
+
+  if ( (message->Mux >= 0) && (dbc->Signal[message->Mux].Need <= length) )
+    mux = (long)CANdbc_Raw(&dbc->Signal[message->Mux], msg->Data);
+
+  for (signal = dbc->Signal + message->First, end = signal + message->Count; signal < end; signal++)
+  {
+    if ( (signal->Need > length) || ((signal->MuxValue >= 0) && (signal->MuxValue != mux)) )
+      continue;
+    sample[count].Signal = (unsigned)(signal - dbc->Signal);
+    sample[count].Value = value(signal, CANdbc_Raw(signal, msg->Data));
+    count++;
+  }
+
+  return count;
+}
+
+/* skip spaces and tabs */
+static const char *space(const char *text)
+{
+  while ( (' ' == *text) || ('\t' == *text) )
+    text++;
+  return text;
+}
+
+/* copy a name (up to a space, colon or end of line) of at most size - 1 characters, returning what follows it */
+static const char *name(const char *text, char *copy, unsigned size)
+{
+  unsigned length = 0;
+
+  for (; *text && !strchr(" \t:;\r\n", *text); text++)
+    if (length + 1 < size)
+      copy[length++] = *text;
+  copy[length] = '\0';
+
+  return text;
+}
+
+static int message_line(struct candbc *dbc, const char *line, unsigned *room)
+{
+  struct candbc_message *message;
+  unsigned long id;
+  char *end;
+
+  id = strtoul(space(line + 4), &end, 10);
+  if ( (end == line + 4) || ((' ' != *end) && ('\t' != *end)) )
+    return 0;
+
+  if (dbc->Messages == *room)
+  {
+    *room = (*room) ? 2 * *room : 64;
+    message = realloc(dbc->Message, *room * sizeof(*message));
+    if (!message)
+      return -1;
+    dbc->Message = message;
+  }
+  message = &dbc->Message[dbc->Messages];
+  name(space(end), message->Name, sizeof(message->Name));
+  if (!message->Name[0])
+    return 0;
+  message->Id = (id & CANDBC_ID_EXT) ? (uint32_t)(id & 0x9FFFFFFFUL) : (uint32_t)(id & 0x7FF);
+  message->First = dbc->Signals;
+  message->Count = 0;
+  message->Mux = -1;
+  dbc->Messages++;
+
+  return 1;
+}
+
+/* " SG_ name [M|mN] : start|length@order sign (factor,offset) [min|max] "unit" receivers" */
+static int signal_line(struct candbc *dbc, const char *line, unsigned *room)
+{
+  struct candbc_signal *signal, parsed;
+  struct candbc_message *message;
+  char signal_name[CANDBC_NAME_MAX], order, sign;
+  const char *pnt, *unit;
+  unsigned length;
+  char *end;
+
+  if ( !dbc->Messages || (dbc->Message[dbc->Messages - 1].Count >= CANDBC_SAMPLES_MAX) )
+    return 0;
+  message = &dbc->Message[dbc->Messages - 1];
+
+  memset(&parsed, 0, sizeof(parsed));
+  pnt = space(name(space(line + 4), signal_name, sizeof(signal_name)));
+  parsed.MuxValue = -1;
+  if ( ('M' == pnt[0]) && (' ' == pnt[1] || '\t' == pnt[1] || ':' == pnt[1]) )
+  {
+    if (message->Mux >= 0)
+      return 0;
+    parsed.Multiplexor = 1;
+    pnt = space(pnt + 1);
+  }
+  else if ( ('m' == pnt[0]) && (pnt[1] >= '0') && (pnt[1] <= '9') )
+  {
+    parsed.MuxValue = strtol(pnt + 1, &end, 10);
+    if ( (' ' != *end) && ('\t' != *end) && (':' != *end) )
+      return 0; /* as "m3M", of extended multiplexing */
+    pnt = space(end);
+  }
+
+  if (6 != sscanf(pnt, ": %u|%u@%c%c (%lf,%lf)", &parsed.StartBit, &parsed.Length, &order, &sign, &parsed.Factor, &parsed.Offset))
+    return 0;
+  if ( (('0' != order) && ('1' != order)) || (('+' != sign) && ('-' != sign)) )
+    return 0;
+  parsed.Motorola = ('0' == order);
+  parsed.Signed = ('-' == sign);
+  parsed.Message = dbc->Messages - 1;
+  if (!plan(&parsed))
+    return 0;
+
+  snprintf(parsed.Name, sizeof(parsed.Name), "%s.%s", message->Name, signal_name);
+  unit = strchr(pnt, '"');
+  if (unit)
+  {
+    for (unit++, length = 0; *unit && ('"' != *unit) && (length + 1 < sizeof(parsed.Unit)); unit++)
+      parsed.Unit[length++] = *unit;
+    parsed.Unit[length] = '\0';
+  }
+
+  if (dbc->Signals == *room)
+  {
+    *room = (*room) ? 2 * *room : 256;
+    signal = realloc(dbc->Signal, *room * sizeof(*signal));
+    if (!signal)
+      return -1;
+    dbc->Signal = signal;
+  }
+  if (parsed.Multiplexor)
+    message->Mux = (int)dbc->Signals;
+  dbc->Signal[dbc->Signals++] = parsed;
+  message->Count++;
+
+  return 1;
+}
+
+/* "SIG_VALTYPE_ id name : type;" */
+static int valtype_line(struct candbc *dbc, const char *line)
+{
+  const struct candbc_message *message;
+  struct candbc_signal *signal;
+  char signal_name[CANDBC_NAME_MAX], full[sizeof(signal->Name)];
+  unsigned long id;
+  unsigned type, index;
+  const char *pnt;
+  char *end;
+
+  id = strtoul(space(line + 13), &end, 10);
+  pnt = space(name(space(end), signal_name, sizeof(signal_name)));
+  if ( (1 != sscanf(pnt, ": %u", &type)) || (type > CANDBC_DOUBLE) )
+    return 0;
+
+  message = CANdbc_Lookup(dbc, (id & CANDBC_ID_EXT) ? (uint32_t)(id & 0x9FFFFFFFUL) : (uint32_t)(id & 0x7FF));
+  if (!message)
+    return 0;
+  snprintf(full, sizeof(full), "%s.%s", message->Name, signal_name);
+  for (index = message->First; index < message->First + message->Count; index++)
+  {
+    signal = &dbc->Signal[index];
+    if (strcmp(signal->Name, full))
+      continue;
+    if ( (CANDBC_INTEGER != type) && (signal->Length != ((CANDBC_FLOAT == type) ? 32U : 64U)) )
+      return 0;
+    signal->ValueType = (int)type;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int build_table(struct candbc *dbc)
+{
+  unsigned index, slot, mask;
+
+  for (dbc->TableBits = 4; (1U << dbc->TableBits) < 2 * dbc->Messages; dbc->TableBits++);
+  dbc->Table = calloc(1U << dbc->TableBits, sizeof(*dbc->Table));
+  if (!dbc->Table)
+    return 0;
+  mask = (1U << dbc->TableBits) - 1;
+
+  for (index = 0; index < dbc->Messages; index++)
+  {
+    if (CANdbc_Lookup(dbc, dbc->Message[index].Id))
+    {
+      dbc->Errors++;  /* the same ID twice: the first is kept */
+      continue;
+    }
+    for (slot = hash(dbc->Message[index].Id, dbc->TableBits); dbc->Table[slot]; slot = (slot + 1) & mask);
+    dbc->Table[slot] = index + 1;
+  }
+
+  return 1;
+}
+
+/*
+    each pass goes through the lines of text, passing over those within a quoted string (a comment, say, that runs 
+    onto several lines): the first for messages and signals, and the second, once they can be looked up, for 
+    SIG_VALTYPE_
+*/
+int CANdbc_Compile(struct candbc *dbc, const char *text)
+{
+  unsigned message_room = 0, signal_room = 0, pass;
+  unsigned long number;
+  const char *line, *pnt;
+  int quoted, result;
+
+  memset(dbc, 0, sizeof(*dbc));
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    quoted = 0;
+    for (line = text, number = 1; *line; number++)
+    {
+      result = 1;
+      if (!quoted)
+      {
+        pnt = space(line);
+        if ( (0 == pass) && !strncmp(pnt, "BO_ ", 4) )
+          result = message_line(dbc, pnt, &message_room);
+        else if ( (0 == pass) && !strncmp(pnt, "SG_ ", 4) )
+          result = signal_line(dbc, pnt, &signal_room);
+        else if ( (1 == pass) && !strncmp(pnt, "SIG_VALTYPE_ ", 13) )
+          result = valtype_line(dbc, pnt);
+      }
+      if (result < 0)
+      {
+        CANdbc_Free(dbc);
+        return 0;
+      }
+      if (!result && !dbc->Errors++)
+        dbc->FirstError = number;
+
+      for (; *line && ('\n' != *line) && ('\r' != *line); line++)
+      {
+        if ('\\' == *line && line[1])
+          line++;
+        else if ('"' == *line)
+          quoted = !quoted;
+      }
+      if ( ('\r' == line[0]) && ('\n' == line[1]) )
+        line++;
+      if (*line)
+        line++;
+    }
+
+    if ( (0 == pass) && (!dbc->Messages || !build_table(dbc)) )
+    {
+      if (!dbc->Messages)
+        errno = EINVAL;
+      CANdbc_Free(dbc);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int CANdbc_Load(struct candbc *dbc, const char *path)
+{
+  FILE *file;
+  char *text;
+  long size;
+  int result;
+
+  file = fopen(path, "rb");
+  if (!file)
+    return 0;
+  if ( fseek(file, 0, SEEK_END) || ((size = ftell(file)) < 0) || fseek(file, 0, SEEK_SET) )
+  {
+    fclose(file);
+    return 0;
+  }
+  text = malloc((size_t)size + 1);
+  if ( !text || ((size_t)size != fread(text, 1, (size_t)size, file)) )
+  {
+    if (text)
+      errno = EIO;
+    free(text);
+    fclose(file);
+    return 0;
+  }
+  fclose(file);
+  text[size] = '\0';
+
+  result = CANdbc_Compile(dbc, text);
+  free(text);
+
+  return result;
+}
+
+void CANdbc_Free(struct candbc *dbc)
+{
+  free(dbc->Message);
+  free(dbc->Signal);
+  free(dbc->Table);
+  memset(dbc, 0, sizeof(*dbc));
+}
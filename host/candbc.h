@@ -0,0 +1,125 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANDBC_H_
+#define CANDBC_H_
+
+#include <stdint.h>
+#include "canbus.h"
+
+/*
+    decoding of signals from frames, as laid out by a DBC file
+
+    CANdbc_Load() reads the messages (BO_) and signals (SG_) of a DBC, along with any SIG_VALTYPE_ saying a signal 
+    is an IEEE float, and compiles each signal into a plan: the first of the eight data bytes it is read from, as 
+    one little endian (Intel, @1) or big endian (Motorola, @0) word, the shift and mask that leave its raw value, 
+    its sign bit, and its factor and offset.  Frames are looked up by ID in a hash table, and each signal of the 
+    message then costs a load, a shift, a mask and a multiply-add.  A signal spread over more than eight bytes (one 
+    of more than 57 bits not on a byte boundary) is read a bit at a time instead.
+
+    Simple multiplexing is understood: a message's multiplexor (M) is read first, and a signal multiplexed on a 
+    value of it (m3, say) is only decoded from frames that carry that value.  Extended multiplexing 
+    (SG_MUL_VAL_) is not, nor are value tables; what is not understood is passed over.
+
+    Start bits are as the DBC has them: the least significant bit of an Intel signal, and the most significant of a 
+    Motorola one, counting bits 0 to 7 of byte 0 from its least significant, then byte 1, and so on.
+*/
+
+#define CANDBC_NAME_MAX 64
+#define CANDBC_UNIT_MAX 16
+#define CANDBC_ID_EXT 0x80000000UL  /* as in the DBC, set in the ID of a message with an extended ID */
+
+/* the most signals one frame may yield, being at least a bit each */
+#define CANDBC_SAMPLES_MAX (8 * CANMESSAGE_DATA_MAX)
+
+#define CANDBC_INTEGER 0
+#define CANDBC_FLOAT   1
+#define CANDBC_DOUBLE  2
+
+struct candbc_signal
+{
+  char Name[2 * CANDBC_NAME_MAX]; /* message and signal, as "EEC1.EngineSpeed" */
+  char Unit[CANDBC_UNIT_MAX];
+  unsigned Message;            /* index into Message[] */
+  /* as the DBC has it */
+  unsigned StartBit, Length;
+  int Motorola, Signed, ValueType;
+  double Factor, Offset;
+  int Multiplexor;             /* non-zero for the message's multiplexor */
+  long MuxValue;               /* -1 if not multiplexed */
+  /* the plan */
+  uint8_t Base;                /* first of the eight bytes it is read from */
+  uint8_t Shift;               /* of its least significant bit in them */
+  uint8_t Need;                /* bytes a frame must carry for it to be there */
+  uint8_t Slow;                /* spread over more than eight bytes */
+  uint64_t Mask, SignBit;
+};
+
+struct candbc_message
+{
+  char Name[CANDBC_NAME_MAX];
+  uint32_t Id;                 /* ORed with CANDBC_ID_EXT for an extended ID */
+  unsigned First, Count;       /* its signals, in Signal[] */
+  int Mux;                     /* index into Signal[] of its multiplexor, or -1 */
+};
+
+struct candbc
+{
+  struct candbc_message *Message;
+  unsigned Messages;
+  struct candbc_signal *Signal; /* grouped by message, in the order the DBC gives them */
+  unsigned Signals;
+  uint32_t *Table;             /* hash table of message index + 1, by ID; 0 if empty */
+  unsigned TableBits;
+  unsigned long Errors;        /* lines that were passed over as not understood (signals that do not fit, say) */
+  unsigned long FirstError;    /* line number of the first of them */
+};
+
+struct candbc_sample
+{
+  unsigned Signal;             /* index into Signal[] */
+  double Value;                /* raw value times factor plus offset */
+};
+
+/* compile the DBC in text (nul terminated); returns zero (with errno set) if out of memory, or if it has no messages */
+extern int CANdbc_Compile(struct candbc *dbc, const char *text);
+
+/* read the DBC file at path and compile it; returns zero (with errno set) if it could not be read, or as CANdbc_Compile() */
+extern int CANdbc_Load(struct candbc *dbc, const char *path);
+
+extern void CANdbc_Free(struct candbc *dbc);
+
+/* the message for a frame's ID (ORed with CANDBC_ID_EXT if extended), or NULL */
+extern const struct candbc_message *CANdbc_Lookup(const struct candbc *dbc, uint32_t id);
+
+/* index into Signal[] of the signal named "message.signal", or -1 */
+extern int CANdbc_Find(const struct candbc *dbc, const char *name);
+
+/* the raw value of a signal in a frame's data, sign extended if signed (before factor and offset) */
+extern uint64_t CANdbc_Raw(const struct candbc_signal *signal, const uint8_t *data);
+
+/* decode every signal of a frame into sample[] (with room for CANDBC_SAMPLES_MAX), returning how many there are */
+extern unsigned CANdbc_Decode(const struct candbc *dbc, const struct CANmessage *msg, struct candbc_sample *sample);
+
+#endif
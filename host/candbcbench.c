@@ -0,0 +1,472 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    correctness tests and benchmark of candbc.c
+
+      candbcbench [seconds]
+
+    First decodes a few frames by hand-worked signals in both byte orders (signed and not, across byte boundaries, 
+    multiplexed, as floats, and in frames too short to carry them all), and then, for a great many signals of 
+    random length, position, order and sign, checks the raw value read from frames of otherwise random bits against 
+    a bit at a time reading of the DBC's layout.
+
+    It then makes a trace of seconds (default 300) of a 1Mbit bus kept busy by 64 messages, each packed with 
+    signals, as the sniffer would send it with 'Z2', and times decoding it: from the text, as cansignals does, and 
+    from frames already parsed.  It reports signals a second and how many times faster than the bus that is.
+
+    Exits non-zero if any value is wrong.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "candbc.h"
+#include "lawicel.h"
+#include "bench.h"
+
+#define RANDOM_MESSAGES 1000   /* a DBC, each with one signal */
+#define RANDOM_ROUNDS 50
+#define BENCH_MESSAGES 64
+#define BENCH_CHECKED 100000   /* frames of the trace checked against the bit at a time reading */
+#define TOLERANCE 1e-9
+
+static uint64_t random64(void)
+{
+  return (uint64_t)(rand() & 0xFFFF) << 48 | (uint64_t)(rand() & 0xFFFF) << 32 | (uint64_t)(rand() & 0xFFFF) << 16 | (uint64_t)(rand() & 0xFFFF);
+}
+
+/* where bit (counting from the least significant) of a signal is in the data, counting bits 0 to 7 of byte 0 and so on */
+static unsigned bit_position(int motorola, unsigned start, unsigned length, unsigned bit)
+{
+  unsigned position;
+
+  if (!motorola)
+    return start + bit;
+
+  /* counting from the top of byte 0 down, the most significant bit is at start's place, and the rest follow it */
+  position = (start / 8) * 8 + (7 - start % 8) + (length - 1 - bit);
+  return (position / 8) * 8 + (7 - position % 8);
+}
+
+static void put_bits(uint8_t *data, int motorola, unsigned start, unsigned length, uint64_t raw)
+{
+  unsigned bit, position;
+
+  for (bit = 0; bit < length; bit++)
+  {
+    position = bit_position(motorola, start, length, bit);
+    data[position / 8] = (uint8_t)((data[position / 8] & ~(1U << (position % 8))) | (((raw >> bit) & 1) << (position % 8)));
+  }
+}
+
+static uint64_t get_bits(const uint8_t *data, int motorola, unsigned start, unsigned length, int sign)
+{
+  unsigned bit, position;
+  uint64_t raw = 0;
+
+  for (bit = 0; bit < length; bit++)
+  {
+    position = bit_position(motorola, start, length, bit);
+    raw |= (uint64_t)((data[position / 8] >> (position % 8)) & 1) << bit;
+  }
+  if ( sign && (length < 64) && ((raw >> (length - 1)) & 1) )
+    raw |= ~(uint64_t)0 << length;
+
+  return raw;
+}
+
+/* the start bit of a signal whose most (Motorola) or least (Intel) significant bit is at position bits into the frame, in the order of its bits */
+static unsigned start_bit(int motorola, unsigned position)
+{
+  return (motorola) ? (position / 8) * 8 + (7 - position % 8) : position;
+}
+
+static const char hand_dbc[] =
+  "VERSION \"\"\r\n"
+  "\r\n"
+  "BO_ 256 Intel: 8 ECU\r\n"
+  " SG_ U16 : 0|16@1+ (1,0) [0|65535] \"\" Vector__XXX\r\n"
+  " SG_ U4 : 20|4@1+ (1,0) [0|15] \"\" Vector__XXX\r\n"
+  " SG_ S12 : 28|12@1- (0.5,-10) [-1034|1013.5] \"V\" Vector__XXX\r\n"
+  " SG_ U24 : 40|24@1+ (1,0) [0|16777215] \"\" Vector__XXX\r\n"
+  "\r\n"
+  "BO_ 512 Motorola: 8 ECU\r\n"
+  " SG_ U16 : 7|16@0+ (1,0) [0|65535] \"\" Vector__XXX\r\n"
+  " SG_ U12 : 23|12@0+ (1,0) [0|4095] \"\" Vector__XXX\r\n"
+  " SG_ S4 : 27|4@0- (1,0) [-8|7] \"\" Vector__XXX\r\n"
+  " SG_ U3 : 34|3@0+ (1,0) [0|7] \"\" Vector__XXX\r\n"
+  " SG_ U8 : 45|8@0+ (1,0) [0|255] \"\" Vector__XXX\r\n"
+  " SG_ S10 : 53|10@0- (0.25,0) [-128|127.75] \"\" Vector__XXX\r\n"
+  "\r\n"
+  "BO_ 768 Muxed: 8 ECU\r\n"
+  " SG_ Select M : 0|2@1+ (1,0) [0|3] \"\" Vector__XXX\r\n"
+  " SG_ Low m0 : 8|16@1+ (1,0) [0|65535] \"\" Vector__XXX\r\n"
+  " SG_ High m1 : 15|16@0+ (1,0) [0|65535] \"\" Vector__XXX\r\n"
+  " SG_ Always : 56|8@1- (1,0) [-128|127] \"\" Vector__XXX\r\n"
+  " SG_ Nested m1M : 40|4@1+ (1,0) [0|15] \"\" Vector__XXX\r\n"
+  "\r\n"
+  "BO_ 2147484672 Floats: 8 ECU\r\n"
+  " SG_ Intel : 0|32@1- (1,0) [0|0] \"\" Vector__XXX\r\n"
+  " SG_ Motorola : 39|32@0- (2,1) [0|0] \"\" Vector__XXX\r\n"
+  "\r\n"
+  "CM_ SG_ 256 U16 \"a comment that runs onto a line\r\n"
+  " SG_ Bogus : 0|8@1+ (1,0) [0|0] \"\" Vector__XXX\r\n"
+  "that would be a signal\";\r\n"
+  "SIG_VALTYPE_ 2147484672 Intel : 1;\r\n"
+  "SIG_VALTYPE_ 2147484672 Motorola : 1;\r\n";
+
+struct hand_case
+{
+  const char *Record;
+  unsigned Count;
+  const char *Name[6];
+  double Value[6];
+};
+
+static const struct hand_case hand_case[] =
+{
+  { "t10083412A570FF010203", 4, { "Intel.U16", "Intel.U4", "Intel.S12", "Intel.U24" }, { 4660, 10, -14.5, 197121 } },
+  { "t20081234ABCE052DE010", 6, { "Motorola.U16", "Motorola.U12", "Motorola.S4", "Motorola.U3", "Motorola.U8", "Motorola.S10" }, { 4660, 2748, -2, 5, 183, -127.75 } },
+  { "t30080034120000000080", 3, { "Muxed.Select", "Muxed.Low", "Muxed.Always" }, { 0, 4660, -128 } },
+  { "t3008013412000000007F", 3, { "Muxed.Select", "Muxed.High", "Muxed.Always" }, { 1, 13330, 127 } },
+  { "t30020034", 1, { "Muxed.Select" }, { 0 } },
+  { "t100100", 0, { NULL }, { 0 } },
+  { "T0000040080000C03F40200000", 2, { "Floats.Intel", "Floats.Motorola" }, { 1.5, 6 } },
+  { "t4008FFFFFFFFFFFFFFFF", 0, { NULL }, { 0 } },
+};
+
+static unsigned check_hand(void)
+{
+  struct lawicel_format format = { 0, 0 };
+  struct candbc dbc;
+  struct candbc_sample sample[CANDBC_SAMPLES_MAX];
+  struct CANmessage msg;
+  unsigned index, count, which, wrong = 0;
+  int timed;
+
+  if (!CANdbc_Compile(&dbc, hand_dbc))
+  {
+    printf("hand-worked DBC: could not be compiled\n");
+    return 1;
+  }
+  if ( (1 != dbc.Errors) || (4 != dbc.Messages) || (16 != dbc.Signals) )
+  {
+    printf("hand-worked DBC: %u messages, %u signals and %lu errors\n", dbc.Messages, dbc.Signals, dbc.Errors);
+    wrong++;
+  }
+
+  for (index = 0; index < sizeof(hand_case) / sizeof(hand_case[0]); index++)
+  {
+    if (!LAWICEL_Parse(hand_case[index].Record, &format, &msg, &timed))
+    {
+      printf("%s: could not be parsed\n", hand_case[index].Record);
+      wrong++;
+      continue;
+    }
+    count = CANdbc_Decode(&dbc, &msg, sample);
+    if (count != hand_case[index].Count)
+    {
+      printf("%s: %u signals, not %u\n", hand_case[index].Record, count, hand_case[index].Count);
+      wrong++;
+      continue;
+    }
+    for (which = 0; which < count; which++)
+    {
+      if ( strcmp(dbc.Signal[sample[which].Signal].Name, hand_case[index].Name[which]) || (fabs(sample[which].Value - hand_case[index].Value[which]) > TOLERANCE) )
+      {
+        printf("%s: %s is %g, not %s %g\n", hand_case[index].Record, dbc.Signal[sample[which].Signal].Name, sample[which].Value, hand_case[index].Name[which], hand_case[index].Value[which]);
+        wrong++;
+      }
+    }
+  }
+
+  CANdbc_Free(&dbc);
+  return wrong;
+}
+
+/* signals of random layout, one to a message, read from frames of random bits */
+static unsigned check_random(unsigned long *checked, unsigned long *slow)
+{
+  static char text[RANDOM_MESSAGES * 128];
+  static uint8_t data[RANDOM_MESSAGES][CANMESSAGE_DATA_MAX];
+  static uint64_t expected[RANDOM_MESSAGES];
+  struct candbc dbc;
+  struct candbc_sample sample[CANDBC_SAMPLES_MAX];
+  struct candbc_signal *signal;
+  struct CANmessage msg;
+  unsigned round, index, byte, length, position, start, wrong = 0, size;
+  int motorola, sign;
+  double value;
+
+  for (round = 0; round < RANDOM_ROUNDS; round++)
+  {
+    size = 0;
+    for (index = 0; index < RANDOM_MESSAGES; index++)
+    {
+      motorola = rand() & 1;
+      sign = rand() & 1;
+      length = (rand() & 3) ? 1 + rand() % 16 : 1 + rand() % 64;
+      position = rand() % (8 * CANMESSAGE_DATA_MAX - length + 1);
+      start = start_bit(motorola, position);
+
+      for (byte = 0; byte < CANMESSAGE_DATA_MAX; byte++)
+        data[index][byte] = (uint8_t)rand();
+      put_bits(data[index], motorola, start, length, random64());
+      expected[index] = get_bits(data[index], motorola, start, length, sign);
+
+      size += sprintf(text + size, "BO_ %u M%u: %u X\n SG_ S : %u|%u@%c%c (1,0) [0|0] \"\" X\n", 
+        (index & 1) ? 0x80000000U | (index * 0x10101U) : index, index, CANMESSAGE_DATA_MAX, start, length, (motorola) ? '0' : '1', (sign) ? '-' : '+');
+    }
+
+    if ( !CANdbc_Compile(&dbc, text) || dbc.Errors || (RANDOM_MESSAGES != dbc.Signals) )
+    {
+      printf("random DBC: could not be compiled\n");
+      return wrong + 1;
+    }
+
+    for (index = 0; index < RANDOM_MESSAGES; index++)
+    {
+      signal = &dbc.Signal[index];
+      msg.Id = (index & 1) ? index * 0x10101U : index;
+      msg.flags = (index & 1) ? 0 : CANMESSAGE_FLAG_STDID;
+      msg.DLC = (CANMESSAGE_DATA_MAX > 8) ? 15 : 8;
+      if (CANMESSAGE_DATA_MAX > 8)
+        msg.flags |= CANMESSAGE_FLAG_FD;
+      memcpy(msg.Data, data[index], CANMESSAGE_DATA_MAX);
+
+      value = (signal->Signed) ? (double)(int64_t)expected[index] : (double)expected[index];
+      if ( (CANdbc_Raw(signal, msg.Data) != expected[index]) || (1 != CANdbc_Decode(&dbc, &msg, sample)) || (sample[0].Value != value) )
+      {
+        if (wrong++ < 10)
+          printf("%s %u|%u@%c%c: read %016llX, not %016llX\n", signal->Name, signal->StartBit, signal->Length, (signal->Motorola) ? '0' : '1', (signal->Signed) ? '-' : '+', 
+            (unsigned long long)CANdbc_Raw(signal, msg.Data), (unsigned long long)expected[index]);
+      }
+      (*checked)++;
+      *slow += signal->Slow;
+    }
+
+    CANdbc_Free(&dbc);
+  }
+
+  return wrong;
+}
+
+/* a DBC of BENCH_MESSAGES messages, each with its 8 bytes packed with signals, all of one byte order or the other */
+static char *bench_dbc(void)
+{
+  static const unsigned lengths[] = { 1, 2, 3, 4, 8, 8, 10, 12, 16, 16, 24, 32 };
+  char *text = malloc(BENCH_MESSAGES * 64 * 96), *line;
+  unsigned message, position, length, count;
+  uint32_t id;
+  int motorola;
+
+  if (!text)
+    return NULL;
+  line = text;
+  for (message = 0; message < BENCH_MESSAGES; message++)
+  {
+    id = (3 == (message & 3)) ? 0x98FF0000UL + message : 0x100 + 3 * message;
+    motorola = message & 1;
+    line += sprintf(line, "BO_ %lu Message%u: 8 ECU\r\n", (unsigned long)id, message);
+    for (position = 0, count = 0; position < 64; position += length, count++)
+    {
+      length = lengths[rand() % (sizeof(lengths) / sizeof(lengths[0]))];
+      if (length > 64 - position)
+        length = 64 - position;
+      line += sprintf(line, " SG_ Signal%u : %u|%u@%c%c (%g,%d) [0|0] \"\" Vector__XXX\r\n", count, start_bit(motorola, position), length, 
+        (motorola) ? '0' : '1', (rand() & 1) ? '-' : '+', (rand() & 1) ? 0.125 * (1 + rand() % 8) : 1.0, (rand() & 1) ? -40 : 0);
+    }
+  }
+
+  return text;
+}
+
+static void hex(char *text, uint32_t value, unsigned digits)
+{
+  static const char digit[] = "0123456789ABCDEF";
+
+  while (digits--)
+  {
+    text[digits] = digit[value & 15];
+    value >>= 4;
+  }
+}
+
+/* a trace of seconds of a busy 1Mbit bus as the sniffer sends it with 'Z2', and the frames in it */
+static char *bench_trace(const struct candbc *dbc, unsigned seconds, struct CANmessage **frames, size_t *count, size_t *size)
+{
+  const struct candbc_message *message;
+  struct CANmessage *msg;
+  uint64_t time = 0;
+  size_t room = (size_t)seconds * 8000 + 1;
+  unsigned byte, bits;
+  char *text, *line;
+
+  text = malloc(room * 32);
+  *frames = malloc(room * sizeof(**frames));
+  if ( !text || !*frames )
+    return NULL;
+
+  line = text;
+  for (*count = 0; (time < seconds * 1000000ULL) && (*count < room); (*count)++)
+  {
+    message = &dbc->Message[rand() % dbc->Messages];
+    msg = &(*frames)[*count];
+    msg->Id = message->Id & ~CANDBC_ID_EXT;
+    msg->flags = (message->Id & CANDBC_ID_EXT) ? 0 : CANMESSAGE_FLAG_STDID;
+    msg->DLC = 8;
+    msg->Timestamp = (uint32_t)time;
+    msg->Sequence = 0;
+    for (byte = 0; byte < 8; byte++)
+      msg->Data[byte] = (uint8_t)rand();
+
+    *line = (msg->flags & CANMESSAGE_FLAG_STDID) ? 't' : 'T';
+    hex(line + 1, msg->Id, (msg->flags & CANMESSAGE_FLAG_STDID) ? 3 : 8);
+    line += (msg->flags & CANMESSAGE_FLAG_STDID) ? 4 : 9;
+    *line++ = '8';
+    for (byte = 0; byte < 8; byte++, line += 2)
+      hex(line, msg->Data[byte], 2);
+    hex(line, msg->Timestamp, 8);
+    line[8] = '\r';
+    line += 9;
+
+    /* the frame's bits, with a stuff bit in five of those that may have one, and the gap between frames */
+    bits = ((msg->flags & CANMESSAGE_FLAG_STDID) ? 44 : 64) + 64;
+    time += bits + (bits - 10) / 5 + 3;
+  }
+  *size = (size_t)(line - text);
+
+  return text;
+}
+
+int main(int argc, char *argv[])
+{
+  struct lawicel_format format = { 8, 0 };
+  struct lawicel_clock clock = { 0, 0, 0 };
+  struct candbc dbc;
+  struct candbc_sample sample[CANDBC_SAMPLES_MAX];
+  struct candbc_signal *signal;
+  struct CANmessage msg, *frames;
+  unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 300;
+  unsigned long checked = 0, slow = 0, wrong;
+  size_t frame_count, size, index, expected = 0, decoded[2] = { 0, 0 };
+  unsigned count, which;
+  double sum[2] = { 0, 0 }, elapsed[2], start, value;
+  uint64_t raw, time = 0;
+  char *text, *line, *end;
+  int timed, failed = 0;
+
+  srand(1);
+
+  wrong = check_hand();
+  printf("hand-worked frames:  %s\n", (wrong) ? "WRONG" : "ok");
+  failed |= (0 != wrong);
+
+  wrong = check_random(&checked, &slow);
+  printf("random signals:      %lu (%lu read a bit at a time), %lu wrong\n", checked, slow, wrong);
+  failed |= (0 != wrong);
+
+  text = bench_dbc();
+  if ( !text || !CANdbc_Compile(&dbc, text) || dbc.Errors )
+  {
+    printf("benchmark DBC could not be compiled\n");
+    return 1;
+  }
+  free(text);
+
+  text = bench_trace(&dbc, seconds, &frames, &frame_count, &size);
+  if (!text)
+  {
+    perror(argv[0]);
+    return 1;
+  }
+  for (index = 0; index < frame_count; index++)
+    expected += CANdbc_Lookup(&dbc, frames[index].Id | ((frames[index].flags & CANMESSAGE_FLAG_STDID) ? 0 : CANDBC_ID_EXT))->Count;
+  printf("trace:               %u s of 1Mbit bus, %u messages of %u signals, %lu frames (%.1f MB of text) of %lu signals\n", 
+    seconds, dbc.Messages, dbc.Signals, (unsigned long)frame_count, size / 1e6, (unsigned long)expected);
+
+  /* the frames the trace starts with, against the bit at a time reading */
+  wrong = 0;
+  for (index = 0; (index < frame_count) && (index < BENCH_CHECKED); index++)
+  {
+    count = CANdbc_Decode(&dbc, &frames[index], sample);
+    for (which = 0; which < count; which++)
+    {
+      signal = &dbc.Signal[sample[which].Signal];
+      raw = get_bits(frames[index].Data, signal->Motorola, signal->StartBit, signal->Length, signal->Signed);
+      value = ((signal->Signed) ? (double)(int64_t)raw : (double)raw) * signal->Factor + signal->Offset;
+      if (fabs(sample[which].Value - value) > TOLERANCE * (1 + fabs(value)))
+        wrong++;
+    }
+  }
+  printf("checked:             %lu frames, %lu values wrong\n", (unsigned long)index, wrong);
+  failed |= (0 != wrong);
+
+  /* from the text, as cansignals does it */
+  start = Bench_Now();
+  for (line = text, end = text + size; line < end; line++)
+  {
+    if (LAWICEL_Parse(line, &format, &msg, &timed))
+    {
+      time = LAWICEL_Unwrap(&clock, msg.Timestamp, LAWICEL_Wrap(&format));
+      count = CANdbc_Decode(&dbc, &msg, sample);
+      for (which = 0; which < count; which++)
+        sum[0] += sample[which].Value;
+      decoded[0] += count;
+    }
+    line = memchr(line, '\r', end - line);
+    if (!line)
+      break;
+  }
+  elapsed[0] = Bench_Now() - start;
+  if ( frame_count && ((uint32_t)time != frames[frame_count - 1].Timestamp) )
+    decoded[0] = 0;  /* the timestamps were not read as they were made */
+
+  /* from frames already parsed */
+  start = Bench_Now();
+  for (index = 0; index < frame_count; index++)
+  {
+    count = CANdbc_Decode(&dbc, &frames[index], sample);
+    for (which = 0; which < count; which++)
+      sum[1] += sample[which].Value;
+    decoded[1] += count;
+  }
+  elapsed[1] = Bench_Now() - start;
+
+  for (which = 0; which < 2; which++)
+  {
+    printf("%s %6.3f s, %9.0f frames/s, %10.0f signals/s, %6.0f times the bus%s\n", (which) ? "from frames:        " : "from text:          ", 
+      elapsed[which], frame_count / elapsed[which], decoded[which] / elapsed[which], seconds / elapsed[which], 
+      ( (decoded[which] != expected) || (sum[which] != sum[0]) ) ? " WRONG" : "");
+    failed |= ( (decoded[which] != expected) || (sum[which] != sum[0]) );
+  }
+
+  CANdbc_Free(&dbc);
+  free(frames);
+  free(text);
+
+  return failed;
+}
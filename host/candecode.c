@@ -0,0 +1,96 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    decode a capture of the sniffer's text output into columns (cancolumns.h), on several threads at once
+
+      candecode [-z0|-z1|-z2] [-q] [-j threads] capture output
+
+    -z and -q say what the records carry, as the sniffer was told (by default 'Z2' and no sequence numbers); -j is 
+    how many threads decode (by default, one per core).  A summary goes to stderr.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cancolumns.h"
+
+#define OUTPUT_BUFFER (1 << 20)
+
+int main(int argc, char *argv[])
+{
+  struct lawicel_format format = { 8, 0 };
+  struct cancolumns_stats stats;
+  struct timespec start, stop;
+  unsigned threads = 0;
+  double seconds;
+  FILE *output;
+  int arg;
+
+  for (arg = 1; (arg < argc) && ('-' == argv[arg][0]); arg++)
+  {
+    if ( !strcmp(argv[arg], "-z0") || !strcmp(argv[arg], "-z1") || !strcmp(argv[arg], "-z2") )
+      format.TimestampDigits = ('0' == argv[arg][2]) ? 0 : ('1' == argv[arg][2]) ? 4 : 8;
+    else if (!strcmp(argv[arg], "-q"))
+      format.Sequence = 1;
+    else if ( !strcmp(argv[arg], "-j") && (arg + 1 < argc) )
+      threads = atoi(argv[++arg]);
+    else
+      break;
+  }
+  if (arg + 2 != argc)
+  {
+    fprintf(stderr, "usage: %s [-z0|-z1|-z2] [-q] [-j threads] capture output\n", argv[0]);
+    return 1;
+  }
+  if (!threads)
+    threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+
+  output = fopen(argv[arg + 1], "wb");
+  if (!output)
+  {
+    perror(argv[arg + 1]);
+    return 1;
+  }
+  setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ( !CANcolumns_Decode(argv[arg], output, &format, threads, &stats) || fclose(output) )
+  {
+    fprintf(stderr, "%s: %s\n", argv[arg], strerror(errno));
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  seconds = (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+
+  fprintf(stderr, "%llu frames in %lu chunks, %.2f s with %u threads (%.0f frames per second)", (unsigned long long)stats.Frames, stats.Chunks, seconds, threads, stats.Frames / seconds);
+  if (stats.Errors)
+    fprintf(stderr, "; %lu records could not be read", stats.Errors);
+  fprintf(stderr, "\n");
+
+  return 0;
+}
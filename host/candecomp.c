@@ -0,0 +1,228 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "candecomp.h"
+
+enum feed_states
+{
+  FEED_TEXT,
+  FEED_LENGTH,
+  FEED_BLOCK,
+};
+
+void CANdecomp_Init(struct candecomp *decomp, void (*frame)(void *, const struct candecomp_frame *), void (*text)(void *, const uint8_t *, unsigned), void *context)
+{
+  memset(decomp, 0, sizeof(*decomp));
+  decomp->Frame = frame;
+  decomp->Text = text;
+  decomp->Context = context;
+}
+
+static int CANdecomp_Varint(const uint8_t **pnt, const uint8_t *end, uint32_t *value)
+{
+  unsigned shift;
+
+  *value = 0;
+  for (shift = 0; shift < 35; shift += 7)
+  {
+    if (*pnt >= end)
+      return 0;
+    *value |= (uint32_t)(**pnt & 0x7F) << shift;
+    if (!(*(*pnt)++ & 0x80))
+      return 1;
+  }
+
+  return 0;
+}
+
+/* data bytes given by the DLC, as CANMESSAGE_LENGTH() */
+
+static unsigned CANdecomp_Length(unsigned dlc, unsigned flags)
+{
+  static const uint8_t fd_lengths[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+  if (flags & CANDECOMP_FD)
+    return fd_lengths[dlc];
+
+  return (dlc > 8) ? 8 : dlc;
+}
+
+int CANdecomp_Block(struct candecomp *decomp, const uint8_t *block, unsigned length)
+{
+  const uint8_t *pnt = block, *end = block + length;
+  struct candecomp_entry *entry;
+  struct candecomp_frame frame;
+  uint32_t value;
+  unsigned tag, index, mask = 0;
+
+  while (pnt < end)
+  {
+    tag = *pnt++;
+
+    if (0x40 == tag) /* reset */
+    {
+      if (!CANdecomp_Varint(&pnt, end, &decomp->Time))
+        goto error;
+      memset(decomp->entry, 0, sizeof(decomp->entry));
+      decomp->Synchronized = 1;
+      continue;
+    }
+
+    if (0x41 == tag) /* gap */
+    {
+      if (!CANdecomp_Varint(&pnt, end, &value))
+        goto error;
+      decomp->Lost += value;
+      continue;
+    }
+
+    if (0x40 == (tag & 0xC0)) /* a tag for which there is (as yet) no meaning */
+      goto error;
+
+    entry = &decomp->entry[tag & 0x3F];
+
+    if (tag & 0x80) /* message of a defined entry */
+    {
+      if (!CANdecomp_Varint(&pnt, end, &value))
+        goto error;
+      if (!entry->Defined)
+        goto error;
+      if (!(tag & 0x40))
+      {
+        /* a mask byte for each 8 data bytes, each followed by the changes it marks */
+        for (index = 0; index < entry->Length; index++)
+        {
+          if (0 == (index & 7))
+          {
+            if (pnt >= end)
+              goto error;
+            mask = *pnt++;
+          }
+          if (!(mask & (1U << (index & 7))))
+            continue;
+          if (pnt >= end)
+            goto error;
+          entry->Data[index] ^= *pnt++;
+        }
+      }
+    }
+    else /* define */
+    {
+      if (pnt >= end)
+        goto error;
+      entry->DLC = *pnt & 0x0F;
+      entry->Flags = *pnt & (CANDECOMP_FD | CANDECOMP_BRS | CANDECOMP_ESI);
+      entry->Extended = (*pnt++ & 0x80) ? 1 : 0;
+      entry->Length = (uint8_t)CANdecomp_Length(entry->DLC, entry->Flags);
+      if ((end - pnt) < (entry->Extended ? 4 : 2))
+        goto error;
+      entry->Id = pnt[0] | (pnt[1] << 8);
+      pnt += 2;
+      if (entry->Extended)
+      {
+        entry->Id |= ((uint32_t)pnt[0] << 16) | ((uint32_t)pnt[1] << 24);
+        pnt += 2;
+      }
+      if (!CANdecomp_Varint(&pnt, end, &value) || ((unsigned)(end - pnt) < entry->Length))
+        goto error;
+      memcpy(entry->Data, pnt, entry->Length);
+      pnt += entry->Length;
+      entry->Defined = 1;
+    }
+
+    decomp->Time += value;
+
+    /* everything up to the first reset is relative to what this decoder never saw */
+    if (!decomp->Synchronized)
+      continue;
+
+    frame.Id = entry->Id;
+    frame.Extended = entry->Extended;
+    frame.Flags = entry->Flags;
+    frame.DLC = entry->DLC;
+    frame.Length = entry->Length;
+    memcpy(frame.Data, entry->Data, sizeof(frame.Data));
+    frame.Timestamp = decomp->Time;
+    frame.Lost = decomp->Lost;
+    decomp->Lost = 0;
+    if (decomp->Frame)
+      decomp->Frame(decomp->Context, &frame);
+  }
+
+  return 1;
+
+error:
+  /* nothing decoded after this can be trusted until the next reset */
+  decomp->Errors++;
+  decomp->Synchronized = 0;
+  return 0;
+}
+
+void CANdecomp_Feed(struct candecomp *decomp, const uint8_t *data, unsigned length)
+{
+  const uint8_t *text = data;
+  unsigned text_length = 0;
+
+  while (length--)
+  {
+    switch (decomp->State)
+    {
+    case FEED_TEXT:
+      if (*data)
+      {
+        text_length++;
+        break;
+      }
+      if (text_length && decomp->Text)
+        decomp->Text(decomp->Context, text, text_length);
+      text_length = 0;
+      decomp->State = FEED_LENGTH;
+      break;
+    case FEED_LENGTH:
+      decomp->BlockLength = *data;
+      decomp->BlockIndex = 0;
+      decomp->State = FEED_BLOCK;
+      if (decomp->BlockLength)
+        break;
+      /* fall through */
+    case FEED_BLOCK:
+      if (decomp->BlockIndex < decomp->BlockLength)
+        decomp->Block[decomp->BlockIndex++] = *data;
+      if (decomp->BlockIndex == decomp->BlockLength)
+      {
+        CANdecomp_Block(decomp, decomp->Block, decomp->BlockLength);
+        decomp->State = FEED_TEXT;
+        text = data + 1;
+      }
+      break;
+    }
+    if (FEED_TEXT != decomp->State)
+      text = data + 1;
+    data++;
+  }
+
+  if (text_length && decomp->Text)
+    decomp->Text(decomp->Context, text, text_length);
+}
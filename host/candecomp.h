@@ -0,0 +1,82 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANDECOMP_H_
+#define CANDECOMP_H_
+
+#include <stdint.h>
+
+/*
+    host-side decoder of the D4 output mode (see src/cancomp.h for the record format)
+
+    Bytes from the serial port are fed in as they arrive, in pieces of any size.  Blocks ("\0", a length byte, and 
+    that many bytes of records) are decoded into frames; everything else is text (command responses, 'b' records, 
+    and so on) and is handed on as it is.
+*/
+
+/* Flags of a frame */
+#define CANDECOMP_FD  0x10 /* CAN FD frame */
+#define CANDECOMP_BRS 0x20 /* (CAN FD) data phase sent at the faster bitrate */
+#define CANDECOMP_ESI 0x40 /* (CAN FD) sender was error passive */
+
+struct candecomp_frame
+{
+  uint32_t Id;
+  uint32_t Timestamp;   /* microseconds, as that of the sniffer */
+  uint8_t Extended;
+  uint8_t Flags;
+  uint8_t DLC;          /* as on the bus */
+  uint8_t Length;       /* data bytes, as given by DLC */
+  uint8_t Data[64];
+  uint32_t Lost;        /* messages the sniffer did not send ahead of this one */
+};
+
+struct candecomp_entry
+{
+  uint32_t Id;
+  uint8_t Extended, Flags, DLC, Length, Defined;
+  uint8_t Data[64];
+};
+
+struct candecomp
+{
+  struct candecomp_entry entry[64];
+  uint32_t Time;
+  uint32_t Lost;
+  int Synchronized;     /* zero until the first reset record; records before it cannot be decoded */
+  unsigned BlockLength, BlockIndex, State;
+  uint8_t Block[256];
+  void (*Frame)(void *context, const struct candecomp_frame *frame);
+  void (*Text)(void *context, const uint8_t *text, unsigned length);
+  void *Context;
+  unsigned long Errors; /* records that made no sense (a block cut short, an undefined entry, ...) */
+};
+
+extern void CANdecomp_Init(struct candecomp *decomp, void (*frame)(void *, const struct candecomp_frame *), void (*text)(void *, const uint8_t *, unsigned), void *context);
+extern void CANdecomp_Feed(struct candecomp *decomp, const uint8_t *data, unsigned length);
+
+/* decode one block's worth of records; returns zero if they did not all make sense */
+extern int CANdecomp_Block(struct candecomp *decomp, const uint8_t *block, unsigned length);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of candelta.c on replayed traffic
+
+      candeltabench [trace ...]
+
+    Replays each trace named on the command line (in the forms cancompbench takes), or if none is, a set of made-up 
+    ones, through the firmware's own src/candelta.c as CANbus_Service() does in mode 'D2': a message is looked up, 
+    dropped if it repeats the one before it with that ID, and otherwise sent and stored as the reference.
+
+    Every message dropped is checked against the last one with that ID, as kept for every ID in a table as large as 
+    need be: a cache miss or eviction may cost a message that could have been dropped, but nothing may be dropped 
+    that differs.  Reports the messages and text (mode D0) bytes sent against those of the trace, the messages an 
+    unbounded cache would send, and the time taken per message.
+
+    A made-up trace has seconds (MADE_UP_SECONDS) of a number of periodic IDs, each with a mix of bytes that never 
+    change, counters, and signals that change now and then.  Built with CANMESSAGE_DATA_MAX of 64, one ID in three 
+    is CAN FD, of any length, and now and then changes length.  Exits non-zero if anything is wrongly dropped, or if 
+    the cache costs a single message on a made-up trace with fewer IDs than half its entries (CANDELTA_ENTRIES).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "candelta.h"
+#include "lawicel.h"
+#include "bench.h"
+
+#define DEFAULT_SPACING 200
+#define MADE_UP_SECONDS 300
+#define REFERENCE_ENTRIES 65536 /* must be a power of two; the most distinct IDs a trace may have is half that */
+
+struct trace
+{
+  const char *Name;
+  struct CANmessage *frame;
+  size_t count, allocated;
+  unsigned Ids;        /* of a made-up trace */
+};
+
+struct reference_entry
+{
+  uint32_t Key;        /* CANDELTA_KEY_EMPTY if unused */
+  uint8_t DLC;
+  uint8_t Flags;
+  uint8_t Data[CANMESSAGE_DATA_MAX];
+};
+
+static struct reference_entry reference[REFERENCE_ENTRIES];
+
+static const struct lawicel_format trace_format = { 4, 0 }; /* LAWICEL text is taken to have 'Z1' timestamps, if any */
+
+static void add_frame(struct trace *trace, const struct CANmessage *msg)
+{
+  if (trace->count == trace->allocated)
+  {
+    trace->allocated = (trace->allocated) ? 2 * trace->allocated : 4096;
+    trace->frame = realloc(trace->frame, trace->allocated * sizeof(*trace->frame));
+    if (!trace->frame)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  trace->frame[trace->count++] = *msg;
+}
+
+/* as cancompbench; only the order of frames matters here, so timestamps are kept as they come */
+static void read_trace(struct trace *trace, FILE *file)
+{
+  char line[256];
+  struct CANmessage msg;
+  uint64_t time;
+  int timed;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    memset(&msg, 0, sizeof(msg));
+    timed = 1;
+    if (!LAWICEL_ParseCandump(line, &msg, &time) && !LAWICEL_Parse(line, &trace_format, &msg, &timed))
+      continue;
+    if (!timed)
+      msg.Timestamp = trace->count * DEFAULT_SPACING;
+    add_frame(trace, &msg);
+  }
+}
+
+static int by_timestamp(const void *a, const void *b)
+{
+  const struct CANmessage *x = a, *y = b;
+
+  return (x->Timestamp > y->Timestamp) - (x->Timestamp < y->Timestamp);
+}
+
+/*
+    ids periodic IDs, each with a period of 10ms to 1s and a layout of its own: each data byte either never changes, 
+    counts up with every message, or changes now and then (at random, one message in 2 to 64); a CAN FD ID changes 
+    its DLC one message in 16
+*/
+static void make_up(struct trace *trace, unsigned ids)
+{
+  static const uint32_t periods[] = { 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+  uint32_t period, time;
+  unsigned id, byte, change[CANMESSAGE_DATA_MAX];
+  struct CANmessage msg;
+
+  for (id = 0; id < ids; id++)
+  {
+    memset(&msg, 0, sizeof(msg));
+    msg.Id = (id < ids / 2) ? 0x100 + 5 * id : 0x18FF0000UL + 0x100 * id; /* half standard, half extended */
+    msg.flags = (id < ids / 2) ? CANMESSAGE_FLAG_STDID : 0;
+    msg.DLC = 1 + rand() % 8;
+    if ((CANMESSAGE_DATA_MAX > 8) && !(rand() % 3))
+    {
+      msg.flags |= CANMESSAGE_FLAG_FD | ((rand() & 1) ? CANMESSAGE_FLAG_BRS : 0);
+      msg.DLC = 1 + rand() % 15;
+    }
+    period = periods[rand() % (sizeof(periods) / sizeof(periods[0]))];
+    for (byte = 0; byte < CANMESSAGE_DATA_MAX; byte++)
+    {
+      msg.Data[byte] = (uint8_t)rand();
+      switch (rand() % 4)
+      {
+      case 0: change[byte] = 1; break;              /* a counter */
+      case 1: change[byte] = 2 + rand() % 63; break; /* a signal */
+      default: change[byte] = 0; break;             /* a constant */
+      }
+    }
+
+    for (time = rand() % period; time < MADE_UP_SECONDS * 1000000UL; time += period)
+    {
+      msg.Timestamp = time;
+      if ((msg.flags & CANMESSAGE_FLAG_FD) && !(rand() % 16))
+        msg.DLC = 1 + rand() % 15;
+      for (byte = 0; byte < CANMESSAGE_DATA_MAX; byte++)
+        if (1 == change[byte])
+          msg.Data[byte]++;
+        else if (change[byte] && !(rand() % change[byte]))
+          msg.Data[byte] = (uint8_t)rand();
+      add_frame(trace, &msg);
+    }
+  }
+
+  qsort(trace->frame, trace->count, sizeof(struct CANmessage), by_timestamp);
+}
+
+static unsigned long text_bytes(const struct CANmessage *msg)
+{
+  return 1 + ((msg->flags & CANMESSAGE_FLAG_STDID) ? 3 : 8) + ((msg->flags & CANMESSAGE_FLAG_FD) ? 1 : 0) + 1 + 2 * CANMESSAGE_LENGTH(msg) + 1;
+}
+
+/* the last message seen with the message's ID, or where it is to go; NULL if the table is full */
+static struct reference_entry *reference_find(const struct CANmessage *msg)
+{
+  uint32_t key = msg->Id | ((msg->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANDELTA_KEY_EXT);
+  unsigned index = (key * 2654435761UL) & (REFERENCE_ENTRIES - 1), probe;
+
+  for (probe = 0; probe < REFERENCE_ENTRIES / 2; probe++, index = (index + 1) & (REFERENCE_ENTRIES - 1))
+  {
+    if (CANDELTA_KEY_EMPTY == reference[index].Key)
+    {
+      reference[index].Key = key;
+      reference[index].DLC = CANDELTA_DLC_NONE;
+      return &reference[index];
+    }
+    if (key == reference[index].Key)
+      return &reference[index];
+  }
+
+  return NULL;
+}
+
+static int run(const struct trace *trace)
+{
+  static struct candelta_cache cache;
+  struct reference_entry *last;
+  struct candelta_entry *entry;
+  const struct CANmessage *msg;
+  unsigned long sent = 0, needed = 0, wrong = 0, bytes = 0, trace_bytes = 0;
+  unsigned length;
+  double start, elapsed;
+  size_t index;
+
+  memset(reference, 0xFF, sizeof(reference));
+  CANdelta_Init(&cache);
+
+  for (index = 0; index < trace->count; index++)
+  {
+    msg = &trace->frame[index];
+    length = CANMESSAGE_LENGTH(msg);
+    trace_bytes += text_bytes(msg);
+
+    last = reference_find(msg);
+    if (!last)
+    {
+      fprintf(stderr, "%s: more than %u IDs\n", trace->Name, REFERENCE_ENTRIES / 2);
+      return 0;
+    }
+
+    entry = CANdelta_Lookup(&cache, msg);
+    if (CANdelta_Repeated(entry, msg))
+    {
+      cache.Suppressed++;
+      if ( (last->DLC != msg->DLC) || (last->Flags != (msg->flags & CANDELTA_FLAGS)) || memcmp(last->Data, msg->Data, length) )
+        wrong++;
+    }
+    else
+    {
+      sent++;
+      bytes += text_bytes(msg);
+      CANdelta_Store(entry, msg);
+    }
+
+    if ( (last->DLC != msg->DLC) || (last->Flags != (msg->flags & CANDELTA_FLAGS)) || memcmp(last->Data, msg->Data, length) )
+      needed++;
+    last->DLC = msg->DLC;
+    last->Flags = msg->flags & CANDELTA_FLAGS;
+    memcpy(last->Data, msg->Data, length);
+  }
+
+  /* and again, for the time taken alone */
+  CANdelta_Init(&cache);
+  start = Bench_Now();
+  for (index = 0; index < trace->count; index++)
+  {
+    entry = CANdelta_Lookup(&cache, &trace->frame[index]);
+    if (CANdelta_Repeated(entry, &trace->frame[index]))
+      cache.Suppressed++;
+    else
+      CANdelta_Store(entry, &trace->frame[index]);
+  }
+  elapsed = Bench_Now() - start;
+
+  printf("%-20s %9zu %9lu %6.2f %6.2f  %9lu %6.3f%%  %5.1f ns\n", trace->Name, trace->count, sent, (double)trace->count / sent,
+    (double)trace_bytes / bytes, needed, 100.0 * (sent - needed) / needed, 1e9 * elapsed / trace->count);
+
+  if (wrong)
+  {
+    printf("%s: %lu messages dropped that differ from the last with their ID\n", trace->Name, wrong);
+    return 0;
+  }
+
+  if (trace->Ids && (trace->Ids <= CANDELTA_ENTRIES / 2) && (sent != needed))
+  {
+    printf("%s: %lu messages sent that repeat the last, with the cache no more than half full\n", trace->Name, sent - needed);
+    return 0;
+  }
+
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned made_up[] = { 4, 16, 32, 64, 128, 256 };
+  static char names[sizeof(made_up) / sizeof(made_up[0])][32];
+  struct trace trace;
+  unsigned passed = 0, runs, index;
+  FILE *file;
+
+  printf("trace                   frames      sent  ratio  bytes  unbounded    extra  per frame\n");
+
+  if (argc > 1)
+  {
+    for (index = 1; index < (unsigned)argc; index++)
+    {
+      memset(&trace, 0, sizeof(trace));
+      trace.Name = argv[index];
+      file = fopen(argv[index], "r");
+      if (!file)
+      {
+        perror(argv[index]);
+        return 1;
+      }
+      read_trace(&trace, file);
+      fclose(file);
+      if (!trace.count)
+      {
+        fprintf(stderr, "%s: no frames found\n", argv[index]);
+        return 1;
+      }
+      passed += run(&trace);
+      free(trace.frame);
+    }
+    runs = argc - 1;
+  }
+  else
+  {
+    srand(1);
+    for (index = 0; index < sizeof(made_up) / sizeof(made_up[0]); index++)
+    {
+      memset(&trace, 0, sizeof(trace));
+      snprintf(names[index], sizeof(names[index]), "made up, %u IDs", made_up[index]);
+      trace.Name = names[index];
+      trace.Ids = made_up[index];
+      make_up(&trace, made_up[index]);
+      passed += run(&trace);
+      free(trace.frame);
+    }
+    runs = sizeof(made_up) / sizeof(made_up[0]);
+  }
+
+  return Bench_Report(passed, runs, " (%u entries, probing at most %u)", CANDELTA_ENTRIES, CANDELTA_PROBE_LIMIT);
+}
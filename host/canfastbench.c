@@ -0,0 +1,222 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    model of the flash wait states saved for each message by running the code marked FAST_CODE from SRAM
+
+      canfastbench [messages]
+
+    Built with -fsanitize-coverage=trace-pc and -finstrument-functions, so that the compiler reports every basic block
+    entered, and every function returned from (inlined or not), to the functions below.  Runs messages (default 10000)
+    through the code that FAST_CODE places in SRAM, canfast.c, canlimit.c and canqueue.c as they are (built against
+    host/mock): first CANfast_Receive() as the receive interrupt calls it, and then CANqueue_Get() and
+    CANfast_EncodeMessage() as CANbus_Service() does in mode D0.
+
+    At 48 MHz, run from flash, the Cortex-M0 waits a cycle whenever the prefetch cannot have fetched what comes next.
+    Each basic block entered is charged as such (as if reached by a taken branch; some are only fallen into, so this
+    errs high), as is each return, and each lookup in canfast.c's hexdigits[], which was in flash while const (one for
+    every character of a record but the first and the CR).  Literal pool
+    loads, which depend on the compiler, are left out (erring low).  Run from SRAM, none of this costs anything, but
+    CANbus_Service(), still in flash, then reaches CANqueue_Get() and CANbus_EncodeMessage() through a veneer (an
+    indirect branch, as SRAM is out of reach of a BL from flash), charged 7 cycles each.
+
+    Reports, for each case, the cycles saved for each message, on the interrupt and on the CANbus_Service() side, and
+    what share this is of the time the shortest frame of the case takes on a 1 Mbit/s bus.  Checks that every message
+    comes out of the queue, and every record is encoded, just as expected, and exits non-zero if any check fails or
+    SRAM saves nothing in any case.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canfast.h"
+#include "bench.h"
+
+#define VENEER_CYCLES 7
+#define CPU_CYCLES_PER_BIT 48 /* at 1 Mbit/s */
+
+static struct
+{
+  unsigned long Blocks, Returns;
+  int On;
+} counted;
+
+/* called by the compiler at the start of every basic block, and on entry to and return from every function */
+__attribute__((no_sanitize_coverage, no_instrument_function)) void __sanitizer_cov_trace_pc(void)
+{
+  counted.Blocks += counted.On;
+}
+
+__attribute__((no_sanitize_coverage, no_instrument_function)) void __cyg_profile_func_enter(void *function, void *caller)
+{
+  (void)function;
+  (void)caller;
+}
+
+__attribute__((no_sanitize_coverage, no_instrument_function)) void __cyg_profile_func_exit(void *function, void *caller)
+{
+  (void)function;
+  (void)caller;
+  counted.Returns += counted.On;
+}
+
+struct fast_case
+{
+  const char *Name;
+  uint8_t Lowest, Highest; /* DLC */
+  uint8_t Timestamps;      /* as timestamp_output, 'Z' */
+  uint8_t Sequence;        /* as sequence_output, 'q' */
+  uint8_t Rules;           /* rate limit rules set, none of which any message matches */
+};
+
+static const struct fast_case cases[] =
+{
+  { "DLC 0", 0, 0, 0, 0, 0 },
+  { "DLC 4", 4, 4, 0, 0, 0 },
+  { "DLC 8", 8, 8, 0, 0, 0 },
+  { "DLC 0 to 8", 0, 8, 0, 0, 0 },
+  { "DLC 8, Z2 q1", 8, 8, 2, 1, 0 },
+  { "DLC 8, 8 rules idle", 8, 8, 0, 0, CANLIMIT_RULES },
+};
+
+/* as CANqueue[] is with the code in SRAM */
+static uint32_t CANqueue[SRAM_SHARED_WORDS - FAST_CODE_SRAM_WORDS];
+
+/* referred to by CANx_RX_IRQHandler(), which is not run here */
+CAN_TypeDef *CAN;
+TIM_TypeDef *TIM2;
+
+/* the counts charged, so far */
+static unsigned long charged(void)
+{
+  return counted.Blocks + counted.Returns;
+}
+
+/* the record the host should receive for the message */
+static unsigned expected(char *record, uint32_t id, unsigned dlc, const uint8_t *data, uint32_t timestamp, uint32_t sequence)
+{
+  unsigned length, index;
+
+  length = sprintf(record, "t%03X%X", (unsigned)id, dlc);
+  for (index = 0; index < dlc; index++)
+    length += sprintf(record + length, "%02X", data[index]);
+  if (2 == CANfast.TimestampOutput)
+    length += sprintf(record + length, "%08X", (unsigned)timestamp);
+  else if (CANfast.TimestampOutput)
+    length += sprintf(record + length, "%04X", (unsigned)((timestamp / 1000) % 60000));
+  if (CANfast.SequenceOutput)
+    length += sprintf(record + length, "%04X", (unsigned)(sequence & 0xFFFF));
+  record[length++] = 13;
+
+  return length;
+}
+
+static int run(const struct fast_case *fast, unsigned long messages)
+{
+  CAN_FIFOMailBox_TypeDef mailbox;
+  struct CANmessage message;
+  char record[64], check[64];
+  uint8_t data[8];
+  unsigned long count, interrupt = 0, service = 0, veneers = 0, before;
+  unsigned index, dlc, length, shortest;
+  uint32_t id, timestamp;
+  double saved;
+
+  CANqueue_Init(&CANfast.Queue, CANqueue, sizeof(CANqueue));
+  CANlimit_Init(&CANfast.Limits);
+  for (index = 0; index < fast->Rules; index++)
+    CANlimit_Set(&CANfast.Limits, index, 0x700 + index, 0x7FF, 1000, 1, 0);
+  CANfast.RetainRoom = CANFAST_RETAIN_UNLIMITED;
+  CANfast.Sequence = CANfast.QueueDrops = 0;
+  CANfast.TimestampOutput = fast->Timestamps;
+  CANfast.SequenceOutput = fast->Sequence;
+
+  for (count = 0; count < messages; count++)
+  {
+    /* a message in the FIFO's mailbox */
+    id = 0x100 + (count & 31);
+    dlc = fast->Lowest + rand() % (fast->Highest - fast->Lowest + 1);
+    timestamp = (uint32_t)count * 137;
+    for (index = 0; index < 8; index++)
+      data[index] = (uint8_t)rand();
+    mailbox.RIR = id << 21;
+    mailbox.RDTR = dlc;
+    mailbox.RDLR = data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+    mailbox.RDHR = data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+
+    /* as the receive interrupt */
+    before = charged();
+    counted.On = 1;
+    CANfast_Receive(&mailbox, timestamp);
+    counted.On = 0;
+    interrupt += charged() - before;
+
+    /* as CANbus_Service() */
+    before = charged();
+    counted.On = 1;
+    CANfast.Queue.ReadIndex = CANqueue_Get(&CANfast.Queue, CANfast.Queue.ReadIndex, &message);
+    length = CANfast_EncodeMessage(record, &message);
+    counted.On = 0;
+    service += charged() - before + (length - 2);
+    veneers += 2;
+
+    if ( CANfast.QueueDrops || (CANfast.Queue.ReadIndex != CANfast.Queue.WriteIndex) || (length != expected(check, id, dlc, data, timestamp, count)) || memcmp(record, check, length) )
+    {
+      printf("%s: message %lu did not come out as expected\n", fast->Name, count);
+      return 0;
+    }
+  }
+
+  if (!counted.Blocks || !counted.Returns)
+  {
+    printf("%s: nothing counted; build with -fsanitize-coverage=trace-pc -finstrument-functions\n", fast->Name);
+    return 0;
+  }
+
+  shortest = 47 + 8 * fast->Lowest; /* bits, with a standard ID, no stuffing, and the interframe space */
+  saved = (double)(interrupt + service - VENEER_CYCLES * veneers) / messages;
+  printf("%-24s %10.1f %10.1f %10.1f %9.1f%%\n", fast->Name, (double)interrupt / messages, (double)service / messages - (double)VENEER_CYCLES * veneers / messages,
+    saved, 100.0 * saved / (shortest * CPU_CYCLES_PER_BIT));
+
+  return saved > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long messages = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000;
+  unsigned index, passed = 0;
+
+  if (messages < 1)
+  {
+    fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("cycles saved per message  interrupt    service      total  of a frame\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], messages);
+
+  return Bench_Report(passed, BENCH_CASES(cases), NULL);
+}
@@ -0,0 +1,189 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test of cangen.c, driven as the benchmark's compare interrupt drives it
+
+      cangenbench [seconds]
+
+    For each of a set of cases, runs seconds (default 60) of a simulated 32-bit TIMESTAMPx, starting just short of 
+    wrapping.  The compare interrupt is entered late by a random amount up to the case's latency (and, in some cases, 
+    held off altogether for a stretch every second, as a flash erase would), and does as CANbus_Generate() does: 
+    delivers at most BENCH_FIFO_DEPTH of the messages due, skips the rest, sets the compare for the next, and has the 
+    interrupt happen again straight away should that be due already.
+
+    Checks that at each interrupt, CANgen_Due() counts just the messages due since the last; that each one is either 
+    delivered or skipped; that each one delivered has the timestamp it was due at (no later than it was delivered), 
+    the next ID in turn, the next DLC of the mask, and a payload that differs from that of the last one with its ID; 
+    and that nothing is skipped in a case whose interrupt is never late by BENCH_FIFO_DEPTH periods.  Reports the 
+    messages due, delivered and skipped, and the latest a message was delivered.  Exits non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cangen.h"
+#include "bench.h"
+
+#define EPOCH 0xFFF00000UL     /* TIMESTAMPx at the start */
+#define BENCH_FIFO_DEPTH 3     /* as in canbus.c */
+
+struct generator_case
+{
+  const char *Name;
+  uint32_t Period;
+  uint32_t DLCMask;
+  uint32_t Latency;     /* most microseconds the interrupt is entered late by */
+  uint32_t Blocked;     /* microseconds of every second the interrupt is held off for */
+};
+
+static const struct generator_case cases[] =
+{
+  { "10us, prompt", 10, 0x1FF, 5, 0 },
+  { "10us, up to 40us late", 10, 0x1FF, 40, 0 },
+  { "20us, DLC 0 and 8", 20, 0x101, 30, 0 },
+  { "100us, flash erase", 100, 0x1FF, 50, 40000 },
+  { "1ms, DLC 8", 1000, 0x100, 200, 0 },
+  { "33us, odd DLCs", 33, 0x0AA, 120, 5000 },
+};
+
+static unsigned next_dlc(unsigned dlc, uint32_t mask)
+{
+  do
+  {
+    dlc = (dlc >= 8) ? 0 : dlc + 1;
+  } while (!(mask & (1U << dlc)));
+
+  return dlc;
+}
+
+/* when (in microseconds since the start) the interrupt is next entered, if asked for at time */
+static uint64_t entry_time(const struct generator_case *generator, uint64_t time)
+{
+  time += (generator->Latency) ? rand() % (generator->Latency + 1) : 0;
+  if (time % 1000000 < generator->Blocked)
+    time += generator->Blocked - time % 1000000;
+
+  return time;
+}
+
+static int run(const struct generator_case *generator, unsigned seconds)
+{
+  static uint8_t last_data[CANGEN_IDS][8];
+  static int seen[CANGEN_IDS];
+  struct cangen gen;
+  struct CANmessage msg;
+  uint64_t time, end = (uint64_t)seconds * 1000000, latest = 0;
+  uint32_t now = EPOCH, due, delivered, index, expected_id = 0, sequence = 0;
+  unsigned long total_delivered = 0, total_skipped = 0, wrong = 0;
+  unsigned dlc = 8, slot;
+
+  memset(seen, 0, sizeof(seen));
+  CANgen_Start(&gen, generator->Period, generator->DLCMask, EPOCH);
+  time = entry_time(generator, generator->Period);
+
+  while (time < end)
+  {
+    now = (uint32_t)(EPOCH + time);
+    if (time - (uint64_t)(sequence + 1) * generator->Period > latest)
+      latest = time - (uint64_t)(sequence + 1) * generator->Period;
+
+    /* CANbus_Generate() */
+    due = CANgen_Due(&gen, now);
+    if (due != time / generator->Period - sequence)
+    {
+      printf("%s: %u messages due at %08X, not %u\n", generator->Name, (unsigned)due, (unsigned)now, (unsigned)(time / generator->Period - sequence));
+      return 0;
+    }
+    delivered = (due > BENCH_FIFO_DEPTH) ? BENCH_FIFO_DEPTH : due;
+
+    for (index = 0; index < delivered; index++)
+    {
+      CANgen_Next(&gen, &msg);
+      dlc = next_dlc(dlc, gen.DLCMask);
+      slot = msg.Id - CANGEN_ID_BASE;
+
+      if ( (msg.Timestamp != (uint32_t)(EPOCH + (uint64_t)(sequence + 1) * generator->Period)) || ((int32_t)(now - msg.Timestamp) < 0) ||
+        (msg.Id != CANGEN_ID_BASE + expected_id) || !(msg.flags & CANMESSAGE_FLAG_STDID) || (msg.DLC != dlc) ||
+        (seen[slot] && !memcmp(last_data[slot], msg.Data, 8)) )
+      {
+        if (!wrong)
+          printf("%s: message %u (ID %03X, DLC %u, at %08X) delivered at %08X is wrong\n", generator->Name, (unsigned)sequence, (unsigned)msg.Id, msg.DLC, (unsigned)msg.Timestamp, (unsigned)now);
+        wrong++;
+      }
+
+      memcpy(last_data[slot], msg.Data, 8);
+      seen[slot] = 1;
+      sequence++;
+      expected_id = (expected_id + 1) % CANGEN_IDS;
+    }
+
+    CANgen_Skip(&gen, due - delivered);
+    sequence += due - delivered;
+    expected_id = (expected_id + due - delivered) % CANGEN_IDS;
+    total_delivered += delivered;
+    total_skipped += due - delivered;
+
+    /* the compare is set for the next message; should that be due already, the interrupt happens again at once */
+    if (CANgen_Due(&gen, now))
+      time = entry_time(generator, time);
+    else
+      time = entry_time(generator, time + (uint32_t)(gen.NextTime - now));
+  }
+
+  printf("%-24s %10lu %10lu %10lu %8.3f%%  %7.0f us\n", generator->Name, total_delivered + total_skipped, total_delivered, total_skipped,
+    100.0 * total_skipped / (total_delivered + total_skipped), (double)latest);
+
+  /* every message due by the last interrupt has been delivered or skipped */
+  if (gen.Sequence != sequence)
+  {
+    printf("%s: the generator counts %u messages, not %u\n", generator->Name, (unsigned)gen.Sequence, (unsigned)sequence);
+    return 0;
+  }
+  if ( total_skipped && (latest < (uint64_t)BENCH_FIFO_DEPTH * generator->Period) )
+  {
+    printf("%s: %lu messages skipped, though the interrupt was never %u periods late\n", generator->Name, total_skipped, BENCH_FIFO_DEPTH);
+    return 0;
+  }
+
+  return !wrong;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned seconds = (argc > 1) ? atoi(argv[1]) : 60, index, passed = 0;
+
+  if (seconds < 1)
+  {
+    fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case                            due  delivered    skipped  skipped  latest\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], seconds);
+
+  return Bench_Report(passed, BENCH_CASES(cases), NULL);
+}
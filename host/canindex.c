@@ -0,0 +1,850 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "canindex.h"
+#include "candecomp.h"
+#include "cancomp.h"
+
+#define KEY_EMPTY CANINDEX_KEY_ANY
+
+struct posting_list
+{
+  uint32_t Key;
+  uint32_t Count, Size;
+  uint32_t *Segment;      /* numbered from the thread's first */
+};
+
+struct worker_segment
+{
+  uint64_t Offset;
+  uint64_t Span;          /* from its first frame to its last, unwrapped */
+  uint32_t Frames, FirstTimestamp, LastTimestamp;
+};
+
+struct worker
+{
+  const uint8_t *Data;
+  size_t Size, Begin, End;
+  const struct canindex_options *Options;
+  uint8_t LineEnd;
+  uint64_t Wrap;
+  size_t First, Stop;     /* the offsets of its first segment, and of the one after its last (the next thread's first) */
+  struct worker_segment *Segment;
+  uint32_t Segments, SegmentSize;
+  int Pending;            /* a segment starts at PendingOffset, once it has a frame */
+  uint64_t PendingOffset;
+  struct posting_list *List;
+  uint32_t Lists, ListSize; /* ListSize is a power of two, at least twice Lists */
+  struct lawicel_clock Clock;
+  struct candecomp Decomp;
+  uint64_t Frames;
+  unsigned long Errors;
+  int Failed;             /* out of memory */
+};
+
+static int list_grow(struct worker *worker)
+{
+  struct posting_list *old = worker->List, *list;
+  uint32_t old_size = worker->ListSize, size = (old_size) ? 2 * old_size : 256, index, slot;
+
+  list = malloc(size * sizeof(*list));
+  if (!list)
+    return 0;
+  for (index = 0; index < size; index++)
+    list[index].Key = KEY_EMPTY;
+
+  for (index = 0; index < old_size; index++)
+  {
+    if (KEY_EMPTY == old[index].Key)
+      continue;
+    slot = (old[index].Key * 2654435761UL) & (size - 1);
+    while (KEY_EMPTY != list[slot].Key)
+      slot = (slot + 1) & (size - 1);
+    list[slot] = old[index];
+  }
+
+  free(old);
+  worker->List = list;
+  worker->ListSize = size;
+  return 1;
+}
+
+/* the posting list of key, made if need be; NULL if out of memory */
+static struct posting_list *list_find(struct worker *worker, uint32_t key, int make)
+{
+  uint32_t slot;
+
+  if ( make && (2 * (worker->Lists + 1) > worker->ListSize) && !list_grow(worker) )
+    return NULL;
+  if (!worker->ListSize)
+    return NULL;
+
+  for (slot = (key * 2654435761UL) & (worker->ListSize - 1); KEY_EMPTY != worker->List[slot].Key; slot = (slot + 1) & (worker->ListSize - 1))
+    if (key == worker->List[slot].Key)
+      return &worker->List[slot];
+
+  if (!make)
+    return NULL;
+
+  worker->Lists++;
+  worker->List[slot].Key = key;
+  worker->List[slot].Count = worker->List[slot].Size = 0;
+  worker->List[slot].Segment = NULL;
+  return &worker->List[slot];
+}
+
+static void add_frame(struct worker *worker, uint32_t key, uint32_t timestamp)
+{
+  struct worker_segment *segment;
+  struct posting_list *list;
+  uint32_t *grown, size;
+
+  if (worker->Pending)
+  {
+    if (worker->Segments == worker->SegmentSize)
+    {
+      size = (worker->SegmentSize) ? 2 * worker->SegmentSize : 1024;
+      segment = realloc(worker->Segment, size * sizeof(*segment));
+      if (!segment)
+      {
+        worker->Failed = 1;
+        return;
+      }
+      worker->Segment = segment;
+      worker->SegmentSize = size;
+    }
+    segment = &worker->Segment[worker->Segments++];
+    segment->Offset = worker->PendingOffset;
+    segment->Frames = 0;
+    segment->FirstTimestamp = timestamp;
+    worker->Clock.Started = 0;
+    worker->Pending = 0;
+  }
+
+  segment = &worker->Segment[worker->Segments - 1];
+  segment->Span = LAWICEL_Unwrap(&worker->Clock, timestamp, worker->Wrap) - segment->FirstTimestamp;
+  segment->LastTimestamp = timestamp;
+  segment->Frames++;
+  worker->Frames++;
+
+  list = list_find(worker, key, 1);
+  if (!list)
+  {
+    worker->Failed = 1;
+    return;
+  }
+  if ( list->Count && (list->Segment[list->Count - 1] == worker->Segments - 1) )
+    return;
+  if (list->Count == list->Size)
+  {
+    size = (list->Size) ? 2 * list->Size : 16;
+    grown = realloc(list->Segment, size * sizeof(*grown));
+    if (!grown)
+    {
+      worker->Failed = 1;
+      return;
+    }
+    list->Segment = grown;
+    list->Size = size;
+  }
+  list->Segment[list->Count++] = worker->Segments - 1;
+}
+
+/* the key and timestamp of a message record of length characters, without reading its data; zero if it is not one with a timestamp */
+static int peek_record(const uint8_t *line, size_t length, const struct lawicel_format *format, uint32_t *key, uint32_t *timestamp)
+{
+  const char *text = (const char *)line;
+  unsigned id_digits, fd, data;
+  uint32_t id, dlc, value;
+
+  switch (text[0])
+  {
+  case 't': id_digits = 3; fd = 0; break;
+  case 'T': id_digits = 8; fd = 0; break;
+  case 'd': id_digits = 3; fd = 1; break;
+  case 'D': id_digits = 8; fd = 1; break;
+  default: return 0;
+  }
+  if ( (fd && (CANMESSAGE_DATA_MAX <= 8)) || !format->TimestampDigits || (length < 2 + id_digits + fd) )
+    return 0;
+  if ( !LAWICEL_Hex(text + 1, id_digits, &id) || !LAWICEL_Hex(text + 1 + id_digits + fd, 1, &dlc) )
+    return 0;
+
+  /* the data as CANMESSAGE_LENGTH(), and the line no longer or shorter than with everything the format says */
+  data = (dlc <= 8) ? dlc : (fd) ? CANMESSAGE_FD_LENGTH(dlc) : 8;
+  text += 1 + id_digits + fd + 1 + 2 * data;
+  if ( (size_t)(text - (const char *)line) + format->TimestampDigits + ((format->Sequence) ? 4 : 0) != length )
+    return 0;
+  if ( !LAWICEL_Hex(text, format->TimestampDigits, &value) || (format->Sequence && !LAWICEL_Hex(text + format->TimestampDigits, 4, &dlc)) )
+    return 0;
+
+  *key = id | (('t' == line[0]) || ('d' == line[0]) ? 0 : CANINDEX_KEY_EXT);
+  *timestamp = (4 == format->TimestampDigits) ? value * 1000 : value;
+  return 1;
+}
+
+static void start_segment(struct worker *worker, uint64_t offset)
+{
+  worker->Pending = 1;
+  worker->PendingOffset = offset;
+}
+
+static void *index_text(void *context)
+{
+  struct worker *worker = context;
+  const uint8_t *data = worker->Data, *end;
+  size_t offset, boundary;
+  uint32_t key, timestamp;
+
+  offset = worker->First = LAWICEL_LineStart((const char *)data, worker->Size, worker->LineEnd, worker->Begin);
+  worker->Stop = LAWICEL_LineStart((const char *)data, worker->Size, worker->LineEnd, worker->End);
+  boundary = 0;
+
+  while (offset < worker->Stop)
+  {
+    /* a line without its end (the capture was cut short) is left be */
+    end = memchr(data + offset, worker->LineEnd, worker->Size - offset);
+    if (!end)
+      break;
+
+    if (offset >= boundary)
+    {
+      start_segment(worker, offset);
+      boundary = (offset / CANINDEX_SEGMENT + 1) * CANINDEX_SEGMENT;
+    }
+
+    if (peek_record(data + offset, end - (data + offset), &worker->Options->Format, &key, &timestamp))
+      add_frame(worker, key, timestamp);
+    else if ( ('t' == data[offset]) || ('T' == data[offset]) || ('d' == data[offset]) || ('D' == data[offset]) )
+      worker->Errors++; /* including records with no timestamp, as the index cannot place them */
+    if (worker->Failed)
+      break;
+
+    offset = end - data + 1;
+    if ( ('\r' == worker->LineEnd) && (offset < worker->Size) && ('\n' == data[offset]) )
+      offset++;
+  }
+
+  return NULL;
+}
+
+/* does a run of count D4 blocks (with nothing but text between them) start at offset? */
+static int block_run(const uint8_t *data, size_t size, size_t offset, unsigned count)
+{
+  unsigned byte;
+
+  while (count--)
+  {
+    if (offset == size)
+      return 1;
+    if ( (offset + 2 > size) || data[offset] || !data[offset + 1] || (offset + 2 + data[offset + 1] > size) )
+      return 0;
+    for (offset += 2 + data[offset + 1]; (offset < size) && data[offset]; offset++)
+    {
+      byte = data[offset];
+      if ( ((byte < ' ') || (byte > '~')) && ('\r' != byte) && ('\n' != byte) && (7 != byte) )
+        return 0;
+    }
+  }
+
+  return 1;
+}
+
+static void index_frame(void *context, const struct candecomp_frame *frame)
+{
+  struct worker *worker = context;
+
+  add_frame(worker, frame->Id | ((frame->Extended) ? CANINDEX_KEY_EXT : 0), frame->Timestamp);
+}
+
+static void *index_binary(void *context)
+{
+  struct worker *worker = context;
+  const uint8_t *data = worker->Data, *zero;
+  size_t offset = worker->Begin, size = worker->Size;
+  int started = 0;
+
+  CANdecomp_Init(&worker->Decomp, index_frame, NULL, worker);
+
+  /* find our way into the blocks */
+  for (;;)
+  {
+    zero = (offset < size) ? memchr(data + offset, 0, size - offset) : NULL;
+    if (!zero)
+    {
+      offset = size;
+      break;
+    }
+    offset = zero - data;
+    if (block_run(data, size, offset, CANINDEX_SYNC_BLOCKS))
+      break;
+    offset++;
+  }
+
+  worker->First = worker->Stop = size;
+  while ( (offset + 2 <= size) && (offset + 2 + data[offset + 1] <= size) )
+  {
+    if (CANCOMP_TAG_RESET == data[offset + 2])
+    {
+      if (offset >= worker->End)
+        break;
+      if (!started)
+        worker->First = offset;
+      started = 1;
+      start_segment(worker, offset);
+    }
+
+    if ( started && !CANdecomp_Block(&worker->Decomp, data + offset + 2, data[offset + 1]) )
+      worker->Errors++;
+    if (worker->Failed)
+      return NULL;
+
+    /* past the block, and any text after it */
+    offset += 2 + data[offset + 1];
+    zero = (offset < size) ? memchr(data + offset, 0, size - offset) : NULL;
+    offset = (zero) ? (size_t)(zero - data) : size;
+  }
+  worker->Stop = (offset + 2 <= size) ? offset : size;
+  if (!started)
+    worker->First = worker->Stop;
+
+  return NULL;
+}
+
+static void free_worker(struct worker *worker)
+{
+  uint32_t index;
+
+  for (index = 0; index < worker->ListSize; index++)
+    if (KEY_EMPTY != worker->List[index].Key)
+      free(worker->List[index].Segment);
+  free(worker->List);
+  free(worker->Segment);
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+  uint32_t ka = *(const uint32_t *)a, kb = *(const uint32_t *)b;
+
+  return (ka > kb) - (ka < kb);
+}
+
+static size_t put_varint(uint8_t *output, uint32_t value)
+{
+  size_t length = 0;
+
+  while (value >= 0x80)
+  {
+    output[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  output[length++] = (uint8_t)value;
+
+  return length;
+}
+
+/* gather the threads' segments and posting lists into the index file */
+static int write_index(const char *index_path, const struct canindex_options *options, struct worker *worker, unsigned threads, size_t size, uint8_t line_end, uint64_t wrap, struct canindex_stats *stats)
+{
+  struct canindex_header header;
+  struct canindex_segment *segment = NULL, *last;
+  struct canindex_key *key = NULL;
+  const struct worker_segment *from, *previous = NULL;
+  struct posting_list *list;
+  uint32_t *keys = NULL, segments = 0, count = 0, base, index, previous_segment, number;
+  uint8_t *postings = NULL, *grown;
+  size_t posting_bytes = 0, posting_size = 0;
+  unsigned thread;
+  uint64_t elapsed;
+  FILE *file = NULL;
+  int ok = 0;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, CANINDEX_MAGIC, sizeof(header.Magic));
+  header.CaptureSize = size;
+  header.Binary = options->Binary;
+  header.TimestampDigits = options->Format.TimestampDigits;
+  header.Sequence = options->Format.Sequence;
+  header.LineEnd = line_end;
+
+  for (thread = 0; thread < threads; thread++)
+  {
+    segments += worker[thread].Segments;
+    count += worker[thread].Lists;
+    header.Frames += worker[thread].Frames;
+    stats->Errors += worker[thread].Errors;
+  }
+
+  segment = malloc((segments + 1) * sizeof(*segment));
+  keys = malloc((count + 1) * sizeof(*keys));
+  if (!segment || !keys)
+    goto done;
+
+  /* the segments, unwrapping each one's time from the end of the one before */
+  for (segments = thread = 0; thread < threads; thread++)
+  {
+    for (index = 0; index < worker[thread].Segments; index++, segments++)
+    {
+      from = &worker[thread].Segment[index];
+      segment[segments].Offset = from->Offset;
+      segment[segments].Frames = from->Frames;
+      segment[segments].FirstTimestamp = from->FirstTimestamp;
+      if (!previous)
+      {
+        segment[segments].Time = from->FirstTimestamp;
+      }
+      else
+      {
+        last = &segment[segments - 1];
+        elapsed = (from->FirstTimestamp >= previous->LastTimestamp) ? from->FirstTimestamp - previous->LastTimestamp : from->FirstTimestamp + wrap - previous->LastTimestamp;
+        segment[segments].Time = last->Time + previous->Span + ((elapsed < wrap / 2) ? elapsed : 0);
+      }
+      previous = from;
+    }
+  }
+
+  /* every key any thread saw, once each */
+  for (count = thread = 0; thread < threads; thread++)
+    for (index = 0; index < worker[thread].ListSize; index++)
+      if (KEY_EMPTY != worker[thread].List[index].Key)
+        keys[count++] = worker[thread].List[index].Key;
+  qsort(keys, count, sizeof(*keys), compare_keys);
+  for (number = index = 0; index < count; index++)
+    if ( (0 == index) || (keys[index] != keys[number - 1]) )
+      keys[number++] = keys[index];
+  count = number;
+
+  key = malloc((count + 1) * sizeof(*key));
+  if (!key)
+    goto done;
+
+  /* each key's posting lists, thread after thread, as differences from the one before */
+  for (index = 0; index < count; index++)
+  {
+    key[index].Key = keys[index];
+    key[index].Segments = 0;
+    key[index].Postings = posting_bytes;
+    previous_segment = 0;
+    for (base = thread = 0; thread < threads; base += worker[thread++].Segments)
+    {
+      list = list_find(&worker[thread], keys[index], 0);
+      if (!list)
+        continue;
+      if (posting_size - posting_bytes < 5 * (size_t)list->Count)
+      {
+        posting_size = 2 * posting_size + 5 * (size_t)list->Count + 65536;
+        grown = realloc(postings, posting_size);
+        if (!grown)
+          goto done;
+        postings = grown;
+      }
+      for (number = 0; number < list->Count; number++)
+      {
+        posting_bytes += put_varint(postings + posting_bytes, base + list->Segment[number] - previous_segment);
+        previous_segment = base + list->Segment[number];
+      }
+      key[index].Segments += list->Count;
+    }
+  }
+
+  header.Segments = segments;
+  header.Keys = count;
+  header.PostingBytes = posting_bytes;
+
+  file = fopen(index_path, "wb");
+  if (!file)
+    goto done;
+  if ( (1 != fwrite(&header, sizeof(header), 1, file)) || (segments != fwrite(segment, sizeof(*segment), segments, file)) || (count != fwrite(key, sizeof(*key), count, file)) || (posting_bytes != fwrite(postings, 1, posting_bytes, file)) )
+    goto done;
+
+  stats->Frames = header.Frames;
+  stats->Segments = segments;
+  stats->Keys = count;
+  stats->IndexBytes = sizeof(header) + segments * sizeof(*segment) + count * sizeof(*key) + posting_bytes;
+  ok = 1;
+
+done:
+  if ( file && fclose(file) )
+    ok = 0;
+  if (!ok && !errno)
+    errno = ENOMEM;
+  free(segment);
+  free(keys);
+  free(key);
+  free(postings);
+  return ok;
+}
+
+static int map_file(const char *path, const uint8_t **map, size_t *size, int advice)
+{
+  struct stat status;
+  void *address;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &status))
+  {
+    close(fd);
+    return 0;
+  }
+
+  *size = status.st_size;
+  *map = NULL;
+  if (*size)
+  {
+    address = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == address)
+    {
+      close(fd);
+      return 0;
+    }
+    madvise(address, *size, advice);
+    *map = address;
+  }
+
+  close(fd);
+  return 1;
+}
+
+static void unmap_file(const uint8_t *map, size_t size)
+{
+  if (map)
+    munmap((void *)map, size);
+}
+
+int CANindex_Build(const char *path, const char *index_path, const struct canindex_options *options, struct canindex_stats *stats)
+{
+  struct worker *worker;
+  pthread_t *thread;
+  const uint8_t *data;
+  size_t size, chunk;
+  unsigned threads = (options->Threads) ? options->Threads : 1, index, split;
+  uint8_t line_end;
+  uint64_t wrap = (options->Binary) ? (1ULL << 32) : LAWICEL_Wrap(&options->Format);
+  int ok = 1;
+
+  memset(stats, 0, sizeof(*stats));
+  if (!map_file(path, &data, &size, MADV_SEQUENTIAL))
+    return 0;
+
+  line_end = (uint8_t)LAWICEL_LineEnd((const char *)data, size);
+
+  for (split = 1; ; split = 0)
+  {
+    /* chunks of whole text segments; no less than a segment each, so as not to have more threads than there is work for */
+    chunk = ((size / threads) / CANINDEX_SEGMENT + 1) * CANINDEX_SEGMENT;
+    if ( (threads > 1) && (chunk * (threads - 1) >= size) )
+      threads = (unsigned)((size + chunk - 1) / chunk);
+
+    worker = calloc(threads, sizeof(*worker));
+    thread = calloc(threads, sizeof(*thread));
+    if (!worker || !thread)
+    {
+      free(worker);
+      free(thread);
+      unmap_file(data, size);
+      errno = ENOMEM;
+      return 0;
+    }
+
+    for (index = 0; index < threads; index++)
+    {
+      worker[index].Data = data;
+      worker[index].Size = size;
+      worker[index].Begin = index * chunk;
+      worker[index].End = (index + 1 == threads) ? size : (index + 1) * chunk;
+      worker[index].Options = options;
+      worker[index].LineEnd = line_end;
+      worker[index].Wrap = wrap;
+      if ( index && pthread_create(&thread[index], NULL, (options->Binary) ? index_binary : index_text, &worker[index]) )
+        worker[index].Failed = 1;
+    }
+    if (options->Binary)
+      index_binary(&worker[0]);
+    else
+      index_text(&worker[0]);
+    for (index = 1; index < threads; index++)
+      if (!worker[index].Failed)
+        pthread_join(thread[index], NULL);
+
+    for (index = 0; index < threads; index++)
+      if (worker[index].Failed)
+        ok = 0;
+
+    /* each thread found its own way in; they should have met where one left off and the next began */
+    for (index = 1; ok && split && (index < threads); index++)
+      if (worker[index - 1].Stop != worker[index].First)
+        split = 0;
+
+    if ( ok && (split || (1 == threads)) )
+      ok = write_index(index_path, options, worker, threads, size, line_end, wrap, stats);
+
+    for (index = 0; index < threads; index++)
+      free_worker(&worker[index]);
+    free(worker);
+    free(thread);
+
+    /* should D4 have fooled a thread into finding blocks where there were none, go over it all in one */
+    if ( !ok || split || (1 == threads) )
+      break;
+    threads = 1;
+  }
+
+  unmap_file(data, size);
+  if (!ok && !errno)
+    errno = ENOMEM;
+  return ok;
+}
+
+int CANindex_Open(struct canindex *index, const char *path, const char *index_path)
+{
+  const struct canindex_header *header;
+  size_t need;
+
+  memset(index, 0, sizeof(*index));
+  if (!map_file(path, &index->Capture, &index->CaptureSize, MADV_RANDOM))
+    return 0;
+  if (!map_file(index_path, &index->Map, &index->MapSize, MADV_WILLNEED))
+  {
+    CANindex_Close(index);
+    return 0;
+  }
+
+  header = (const struct canindex_header *)index->Map;
+  if ( (index->MapSize < sizeof(*header)) || memcmp(header->Magic, CANINDEX_MAGIC, sizeof(header->Magic)) || (header->CaptureSize != index->CaptureSize) )
+  {
+    CANindex_Close(index);
+    errno = ESTALE;
+    return 0;
+  }
+  need = sizeof(*header) + header->Segments * sizeof(struct canindex_segment) + header->Keys * sizeof(struct canindex_key) + header->PostingBytes;
+  if (index->MapSize != need)
+  {
+    CANindex_Close(index);
+    errno = ESTALE;
+    return 0;
+  }
+
+  index->Header = header;
+  index->Segment = (const struct canindex_segment *)(header + 1);
+  index->Key = (const struct canindex_key *)(index->Segment + header->Segments);
+  index->Postings = (const uint8_t *)(index->Key + header->Keys);
+
+  return 1;
+}
+
+void CANindex_Close(struct canindex *index)
+{
+  unmap_file(index->Capture, index->CaptureSize);
+  unmap_file(index->Map, index->MapSize);
+  memset(index, 0, sizeof(*index));
+}
+
+struct query
+{
+  const struct canindex *Index;
+  uint32_t Key;
+  uint64_t From, To;
+  struct lawicel_clock Clock;
+  uint64_t Wrap;
+  int Done;               /* past To */
+  void (*Frame)(void *, uint64_t, const struct CANmessage *);
+  void *Context;
+};
+
+/* every frame is unwrapped, in order, but only those asked for are wanted */
+static int query_wants(struct query *query, uint32_t key, uint32_t timestamp, uint64_t *time)
+{
+  *time = LAWICEL_Unwrap(&query->Clock, timestamp, query->Wrap);
+
+  if (*time > query->To)
+    query->Done = 1;
+  else if ( (*time >= query->From) && ((CANINDEX_KEY_ANY == query->Key) || (key == query->Key)) )
+    return 1;
+
+  return 0;
+}
+
+static void query_decoded(void *context, const struct candecomp_frame *frame)
+{
+  struct query *query = context;
+  struct CANmessage msg;
+  unsigned length = (frame->Length < CANMESSAGE_DATA_MAX) ? frame->Length : CANMESSAGE_DATA_MAX;
+  uint64_t time;
+
+  if ( query->Done || !query_wants(query, frame->Id | ((frame->Extended) ? CANINDEX_KEY_EXT : 0), frame->Timestamp, &time) )
+    return;
+
+  msg.Id = frame->Id;
+  msg.Timestamp = frame->Timestamp;
+  msg.Sequence = 0;
+  msg.flags = ((frame->Extended) ? 0 : CANMESSAGE_FLAG_STDID) | ((frame->Flags & CANDECOMP_FD) ? CANMESSAGE_FLAG_FD : 0) | ((frame->Flags & CANDECOMP_BRS) ? CANMESSAGE_FLAG_BRS : 0) | ((frame->Flags & CANDECOMP_ESI) ? CANMESSAGE_FLAG_ESI : 0);
+  msg.DLC = frame->DLC;
+  memcpy(msg.Data, frame->Data, length);
+
+  query->Frame(query->Context, time, &msg);
+}
+
+static void query_segment(struct query *query, uint32_t number)
+{
+  struct candecomp decomp;
+  const struct canindex *index = query->Index;
+  const struct canindex_segment *segment = &index->Segment[number];
+  const uint8_t *data = index->Capture, *end, *zero;
+  size_t offset = segment->Offset, stop = (number + 1 < index->Header->Segments) ? index->Segment[number + 1].Offset : index->CaptureSize;
+  uint8_t line_end = (uint8_t)index->Header->LineEnd;
+  struct lawicel_format format;
+  struct CANmessage msg;
+  uint32_t key, timestamp;
+  uint64_t time;
+  int timed;
+
+  query->Clock.Time = segment->Time;
+  query->Clock.Last = segment->FirstTimestamp;
+  query->Clock.Started = 1;
+  query->Done = 0;
+
+  if (index->Header->Binary)
+  {
+    CANdecomp_Init(&decomp, query_decoded, NULL, query);
+    while ( !query->Done && (offset + 2 <= stop) && (offset + 2 + data[offset + 1] <= stop) )
+    {
+      CANdecomp_Block(&decomp, data + offset + 2, data[offset + 1]);
+      offset += 2 + data[offset + 1];
+      zero = (offset < stop) ? memchr(data + offset, 0, stop - offset) : NULL;
+      offset = (zero) ? (size_t)(zero - data) : stop;
+    }
+    return;
+  }
+
+  format.TimestampDigits = index->Header->TimestampDigits;
+  format.Sequence = index->Header->Sequence;
+  while ( !query->Done && (offset < stop) )
+  {
+    end = memchr(data + offset, line_end, index->CaptureSize - offset);
+    if (!end)
+      break;
+    /* only the frames wanted are read in full */
+    if ( peek_record(data + offset, end - (data + offset), &format, &key, &timestamp) && query_wants(query, key, timestamp, &time) && LAWICEL_Parse((const char *)data + offset, &format, &msg, &timed) )
+      query->Frame(query->Context, time, &msg);
+    offset = end - data + 1;
+    if ( ('\r' == line_end) && (offset < stop) && ('\n' == data[offset]) )
+      offset++;
+  }
+}
+
+/* the first segment whose first frame is after time */
+static uint32_t segment_after(const struct canindex *index, uint64_t time)
+{
+  uint32_t low = 0, high = index->Header->Segments, middle;
+
+  while (low < high)
+  {
+    middle = low + (high - low) / 2;
+    if (index->Segment[middle].Time > time)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+
+  return low;
+}
+
+unsigned long CANindex_Query(const struct canindex *index, uint32_t key, uint64_t from, uint64_t to, void (*frame)(void *, uint64_t, const struct CANmessage *), void *context)
+{
+  struct query query;
+  struct lawicel_format format = { index->Header->TimestampDigits, index->Header->Sequence };
+  const struct canindex_key *entry;
+  const uint8_t *pnt;
+  uint32_t first, last, low, high, middle, number, count, value;
+  unsigned long read = 0;
+  unsigned shift;
+
+  if ( !index->Header->Segments || (from > to) )
+    return 0;
+
+  query.Index = index;
+  query.Key = key;
+  query.From = from;
+  query.To = to;
+  query.Wrap = (index->Header->Binary) ? (1ULL << 32) : LAWICEL_Wrap(&format);
+  query.Frame = frame;
+  query.Context = context;
+
+  /* from the segment that from falls in, up to (but not including) the first to start after to */
+  first = segment_after(index, from);
+  if (first)
+    first--;
+  last = segment_after(index, to);
+
+  if (CANINDEX_KEY_ANY == key)
+  {
+    for (number = first; number < last; number++, read++)
+      query_segment(&query, number);
+    return read;
+  }
+
+  for (low = 0, high = index->Header->Keys; low < high; )
+  {
+    middle = low + (high - low) / 2;
+    if (index->Key[middle].Key < key)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if ( (low == index->Header->Keys) || (index->Key[low].Key != key) )
+    return 0;
+  entry = &index->Key[low];
+
+  pnt = index->Postings + entry->Postings;
+  for (number = count = 0; count < entry->Segments; count++)
+  {
+    for (value = shift = 0; ; shift += 7)
+    {
+      value |= (uint32_t)(*pnt & 0x7F) << shift;
+      if (!(*pnt++ & 0x80))
+        break;
+    }
+    number += value;
+    if (number < first)
+      continue;
+    if (number >= last)
+      break;
+    query_segment(&query, number);
+    read++;
+  }
+
+  return read;
+}
@@ -0,0 +1,125 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANINDEX_H_
+#define CANINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lawicel.h"
+
+/*
+    sidecar index of a capture from the sniffer, for finding the frames of one ID in a range of time without reading 
+    all of it
+
+    A capture is either the text output (message records with 'Z2' or 'Z1' timestamps, and 'q1' sequence numbers if 
+    the index is told so), or the D4 output as read from the port: blocks, with any text between them.  It is mapped 
+    into memory and divided into segments: for text, at the first line after every CANINDEX_SEGMENT bytes; for D4, at 
+    each block that starts with a reset record, as decoding can start there (about once a second of traffic).  The 
+    index holds, for each segment, its offset and the time of its first frame (unwrapped over the whole capture), and 
+    for each ID, a posting list of the segments holding at least one of its frames, as varints of the difference from 
+    the one before.  A query finds the segments of its time range by binary search, walks the ID's postings across 
+    that range, and reads only those segments.
+
+    Building splits the capture into a chunk per thread.  Each thread finds the first segment start in its chunk on 
+    its own (for D4, by finding a run of CANINDEX_SYNC_BLOCKS blocks that follow on from one another, and then the 
+    first of them to start with a reset), and indexes up to the one that starts the next chunk.  Times are unwrapped 
+    within each segment as it goes, and across segments once all threads are done.
+*/
+
+#define CANINDEX_MAGIC "CANIDX01"
+#define CANINDEX_SEGMENT 16384     /* bytes of text per segment, at the least */
+#define CANINDEX_SYNC_BLOCKS 16
+#define CANINDEX_KEY_EXT 0x80000000UL /* ORed into the key of an extended ID, as CANCOMP_KEY_EXT */
+#define CANINDEX_KEY_ANY 0xFFFFFFFFUL /* the key that a query for every ID asks for */
+
+/* the index file: this header, then Segments of struct canindex_segment, Keys of struct canindex_key (in order of key), and the postings */
+struct canindex_header
+{
+  char Magic[8];
+  uint64_t CaptureSize;
+  uint32_t Binary;          /* non-zero for D4 */
+  uint32_t TimestampDigits; /* for text, as struct lawicel_format */
+  uint32_t Sequence;
+  uint32_t Segments;
+  uint32_t Keys;
+  uint32_t LineEnd;         /* for text, the character that ends lines: CR as from the sniffer, or LF as in a file converted since */
+  uint64_t Frames;
+  uint64_t PostingBytes;
+};
+
+struct canindex_segment
+{
+  uint64_t Offset;          /* in the capture; the segment runs up to the next one's */
+  uint64_t Time;            /* of its first frame, unwrapped from the first frame of the capture (as LAWICEL_Unwrap()) */
+  uint32_t Frames;
+  uint32_t FirstTimestamp;  /* of its first frame, as in the capture */
+};
+
+struct canindex_key
+{
+  uint32_t Key;             /* the ID, ORed with CANINDEX_KEY_EXT for an extended one */
+  uint32_t Segments;        /* in its posting list */
+  uint64_t Postings;        /* where its posting list starts, from the start of the postings */
+};
+
+struct canindex_options
+{
+  int Binary;
+  struct lawicel_format Format;
+  unsigned Threads;
+};
+
+struct canindex_stats
+{
+  uint64_t Frames;
+  uint32_t Segments, Keys;
+  uint64_t IndexBytes;
+  unsigned long Errors;     /* lines that looked like message records but were not, D4 records that made no sense */
+};
+
+/* an open index, with its capture */
+struct canindex
+{
+  const uint8_t *Capture;
+  size_t CaptureSize;
+  const uint8_t *Map;
+  size_t MapSize;
+  const struct canindex_header *Header;
+  const struct canindex_segment *Segment;
+  const struct canindex_key *Key;
+  const uint8_t *Postings;
+};
+
+/* index the capture at path into index_path; returns zero (with errno set) if either could not be read or written */
+extern int CANindex_Build(const char *path, const char *index_path, const struct canindex_options *options, struct canindex_stats *stats);
+
+/* map a capture and its index; returns zero if either could not be, or the index is not of this capture as it now is */
+extern int CANindex_Open(struct canindex *index, const char *path, const char *index_path);
+extern void CANindex_Close(struct canindex *index);
+
+/* call frame() for each frame of key (or CANINDEX_KEY_ANY) with from <= time <= to, in order; returns how many segments were read */
+extern unsigned long CANindex_Query(const struct canindex *index, uint32_t key, uint64_t from, uint64_t to, void (*frame)(void *, uint64_t, const struct CANmessage *), void *context);
+
+#endif
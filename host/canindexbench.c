@@ -0,0 +1,450 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    benchmark of canindex.c on generated captures
+
+      canindexbench [megabytes [directory [threads]]]
+
+    Writes a text capture of about megabytes (default 2048) of busy 1Mbit traffic as the sniffer sends it with 'Z2' 
+    (capture.log), and the same frames in D4 form (capture.d4, blocks flushed part full now and then, as 
+    CANbus_Service() does), into directory (default the current one).  The traffic is 256 IDs of very different rates 
+    and a few rare ones, and the sniffer's clock starts just short of wrapping (and wraps again every 71 minutes).
+
+    Each capture is indexed with 1, 2, 4, ... up to threads threads (default one per core), reporting the time taken 
+    and the size of the index.  Then a set of queries (an ID over ten seconds, a rare ID over the whole capture, every 
+    ID over a tenth of a second) is answered from the index, checked against the frames counted as they were made, 
+    and timed, as is a scan of the whole capture for comparison.  Exits non-zero if any answer is wrong.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "canindex.h"
+#include "cancomp.h"
+#include "bench.h"
+
+#define IDS 256                     /* periodic, of very different rates */
+#define RARE_IDS 16                 /* sent now and then, as on an event or a diagnostic request */
+#define RARE_ONE_IN 50000           /* frames */
+#define DEVICE_START 0xF0000000UL  /* the sniffer's clock at the first frame */
+#define FRAME_SPACING 125           /* microseconds between frames, on average: a busy 1Mbit bus */
+#define TEXT_BYTES_PER_FRAME 30     /* about, for working out how long the capture will last */
+#define QUERIES 40
+#define RANDOM_QUERIES 1000
+#define BLOCK_SIZE 62               /* COMPRESSED_BLOCK_SIZE of canbus.c */
+#define OUTPUT_SIZE (1 << 20)
+
+struct test_query
+{
+  const char *Kind;
+  uint32_t Key;
+  uint64_t From, To;        /* microseconds after the first frame */
+  unsigned long Frames;     /* as generated */
+  uint64_t Sum;
+  unsigned long Got;        /* as answered */
+  uint64_t GotSum;
+  double Seconds;
+};
+
+static uint32_t keys[IDS + RARE_IDS];
+static uint16_t pick[4096];  /* index into keys[], weighted as 1 / (rank + 1) */
+static struct test_query queries[QUERIES];
+
+static uint64_t frame_sum(uint64_t time, uint32_t key, const struct CANmessage *msg)
+{
+  uint64_t sum = time * 0x9E3779B97F4A7C15ULL ^ key;
+  unsigned index;
+
+  for (index = 0; index < CANMESSAGE_LENGTH(msg); index++)
+    sum = sum * 31 + msg->Data[index];
+
+  return sum;
+}
+
+static void make_ids(void)
+{
+  double weight[IDS], total = 0, cumulative = 0;
+  unsigned index, slot = 0;
+
+  for (index = 0; index < IDS; index++)
+  {
+    keys[index] = (index % 4 == 3) ? (0x18DA0000UL + index) | CANINDEX_KEY_EXT : 0x100 + 5 * index;
+    weight[index] = 1.0 / (index + 1);
+    total += weight[index];
+  }
+  for (index = 0; index < RARE_IDS; index++)
+    keys[IDS + index] = 0x700 + index;
+  for (index = 0; index < IDS; index++)
+  {
+    cumulative += weight[index] / total;
+    while ( (slot < 4096) && (slot < cumulative * 4096 + 1) )
+      pick[slot++] = index;
+  }
+  while (slot < 4096)
+    pick[slot++] = IDS - 1;
+}
+
+static void make_queries(uint64_t duration)
+{
+  unsigned index;
+  struct test_query *query;
+
+  for (index = 0; index < QUERIES; index++)
+  {
+    query = &queries[index];
+    if (index < 30)
+    {
+      query->Kind = "one ID, 10 s";
+      query->Key = keys[rand() % IDS];
+      query->From = (uint64_t)(rand() / (double)RAND_MAX * duration);
+      query->To = query->From + 10000000;
+    }
+    else if (index < 35)
+    {
+      query->Kind = "rare ID, all";
+      query->Key = keys[IDS + index % RARE_IDS];
+      query->From = 0;
+      query->To = UINT64_MAX / 2;
+    }
+    else
+    {
+      query->Kind = "all IDs, 0.1 s";
+      query->Key = CANINDEX_KEY_ANY;
+      query->From = (uint64_t)(rand() / (double)RAND_MAX * duration);
+      query->To = query->From + 100000;
+    }
+  }
+}
+
+static void hex(char *text, uint32_t value, unsigned digits)
+{
+  static const char digit[] = "0123456789ABCDEF";
+
+  while (digits--)
+  {
+    text[digits] = digit[value & 15];
+    value >>= 4;
+  }
+}
+
+struct output
+{
+  FILE *file;
+  char *buffer;
+  size_t length;
+  uint64_t bytes;
+};
+
+static void put(struct output *output, const void *data, size_t length)
+{
+  if (output->length + length > OUTPUT_SIZE)
+  {
+    fwrite(output->buffer, 1, output->length, output->file);
+    output->length = 0;
+  }
+  memcpy(output->buffer + output->length, data, length);
+  output->length += length;
+  output->bytes += length;
+}
+
+static void flush(struct output *output)
+{
+  fwrite(output->buffer, 1, output->length, output->file);
+  output->length = 0;
+}
+
+struct blocks
+{
+  uint8_t stream[2 + BLOCK_SIZE + CANCOMP_RECORD_MAX];
+  unsigned Length, Full;
+};
+
+/* as CANbus_CompressedFlush() */
+static void flush_block(struct blocks *blocks, struct output *output)
+{
+  unsigned length = (blocks->Full) ? blocks->Full : blocks->Length;
+
+  blocks->stream[0] = 0;
+  blocks->stream[1] = (uint8_t)length;
+  put(output, blocks->stream, 2 + length);
+  memmove(blocks->stream + 2, blocks->stream + 2 + length, blocks->Length - length);
+  blocks->Length -= length;
+  blocks->Full = 0;
+}
+
+static void generate(const char *text_path, const char *binary_path, uint64_t target, unsigned long *frame_count)
+{
+  static struct cancomp_state state;
+  static struct blocks blocks;
+  struct output text = { 0 }, binary = { 0 };
+  struct CANmessage msg;
+  char line[64];
+  uint64_t time = 0;
+  uint32_t key;
+  unsigned length, byte, index;
+  unsigned long frames = 0;
+  uint64_t sum;
+
+  text.file = fopen(text_path, "wb");
+  binary.file = fopen(binary_path, "wb");
+  text.buffer = malloc(OUTPUT_SIZE);
+  binary.buffer = malloc(OUTPUT_SIZE);
+  if (!text.file || !binary.file || !text.buffer || !binary.buffer)
+  {
+    perror("writing the captures");
+    exit(1);
+  }
+  CANcomp_Init(&state);
+
+  while (text.bytes < target)
+  {
+    key = (0 == rand() % RARE_ONE_IN) ? keys[IDS + rand() % RARE_IDS] : keys[pick[rand() & 4095]];
+    memset(&msg, 0, sizeof(msg));
+    msg.Id = key & ~CANINDEX_KEY_EXT;
+    msg.flags = (key & CANINDEX_KEY_EXT) ? 0 : CANMESSAGE_FLAG_STDID;
+    msg.DLC = (key & 7) ? 8 : key % 9;
+    msg.Timestamp = (uint32_t)(DEVICE_START + time);
+    msg.Sequence = (uint16_t)frames;
+    for (byte = 0; byte < CANMESSAGE_LENGTH(&msg); byte++)
+      msg.Data[byte] = (byte < 2) ? (uint8_t)(frames >> (8 * byte)) : (uint8_t)(key + byte);
+
+    /* as the sniffer would send it with 'Z2' */
+    length = 0;
+    line[length++] = (msg.flags & CANMESSAGE_FLAG_STDID) ? 't' : 'T';
+    hex(line + length, msg.Id, (msg.flags & CANMESSAGE_FLAG_STDID) ? 3 : 8);
+    length += (msg.flags & CANMESSAGE_FLAG_STDID) ? 3 : 8;
+    line[length++] = '0' + msg.DLC;
+    for (byte = 0; byte < CANMESSAGE_LENGTH(&msg); byte++, length += 2)
+      hex(line + length, msg.Data[byte], 2);
+    hex(line + length, msg.Timestamp, 8);
+    length += 8;
+    line[length++] = '\r';
+    put(&text, line, length);
+
+    /* and in D4, with the block sent part full one time in four */
+    if (blocks.Full)
+      flush_block(&blocks, &binary);
+    length = CANcomp_Encode(&state, blocks.stream + 2 + blocks.Length, &msg);
+    if (blocks.Length + length > BLOCK_SIZE)
+      blocks.Full = blocks.Length;
+    blocks.Length += length;
+    if ( !blocks.Full && (0 == (rand() & 3)) )
+      flush_block(&blocks, &binary);
+
+    sum = 0;
+    for (index = 0; index < QUERIES; index++)
+    {
+      if ( (time < queries[index].From) || (time > queries[index].To) || ((CANINDEX_KEY_ANY != queries[index].Key) && (key != queries[index].Key)) )
+        continue;
+      if (!sum)
+        sum = frame_sum(time, key, &msg);
+      queries[index].Frames++;
+      queries[index].Sum += sum;
+    }
+
+    frames++;
+    time += FRAME_SPACING - 20 + rand() % 41;
+  }
+  while (blocks.Length)
+    flush_block(&blocks, &binary);
+
+  flush(&text);
+  flush(&binary);
+  fclose(text.file);
+  fclose(binary.file);
+  free(text.buffer);
+  free(binary.buffer);
+  *frame_count = frames;
+}
+
+struct answer
+{
+  struct test_query *Query;
+  uint64_t Start;           /* of the capture */
+};
+
+static void check_frame(void *context, uint64_t time, const struct CANmessage *msg)
+{
+  struct answer *answer = context;
+  uint32_t key = msg->Id | ((msg->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANINDEX_KEY_EXT);
+
+  answer->Query->Got++;
+  answer->Query->GotSum += frame_sum(time - answer->Start, key, msg);
+}
+
+static void count_frame(void *context, uint64_t time, const struct CANmessage *msg)
+{
+  unsigned long *frames = context;
+
+  (void)time;
+  (void)msg;
+  (*frames)++;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+
+  return (da > db) - (da < db);
+}
+
+/* index the capture with each number of threads, and put the queries to it; returns the number of wrong answers */
+static unsigned bench(const char *name, const char *path, int binary, unsigned max_threads, double megabytes)
+{
+  static double latency[RANDOM_QUERIES];
+  struct canindex_options options = { binary, { 8, 0 }, 1 };
+  struct canindex_stats stats;
+  struct canindex index;
+  struct answer answer;
+  struct test_query scratch;
+  char index_path[4096];
+  const char *kind;
+  unsigned long segments, frames;
+  unsigned threads, number, wrong = 0, count;
+  double start, elapsed, worst, total;
+
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+  printf("\n%s: %.0f MB\n", name, megabytes);
+
+  for (threads = 1; ; threads = (2 * threads < max_threads) ? 2 * threads : max_threads)
+  {
+    options.Threads = threads;
+    start = Bench_Now();
+    if (!CANindex_Build(path, index_path, &options, &stats))
+    {
+      perror(index_path);
+      return QUERIES;
+    }
+    elapsed = Bench_Now() - start;
+    printf("  build, %2u threads %7.2f s  %7.0f MB/s  (%llu frames, %u IDs, %u segments, index %llu bytes, %lu errors)\n", threads, elapsed, megabytes / elapsed, (unsigned long long)stats.Frames, stats.Keys, stats.Segments, (unsigned long long)stats.IndexBytes, stats.Errors);
+    if (stats.Errors)
+      wrong++;
+    if (threads == max_threads)
+      break;
+  }
+
+  if (!CANindex_Open(&index, path, index_path))
+  {
+    perror(index_path);
+    return QUERIES;
+  }
+  answer.Start = index.Segment[0].Time;
+
+  /* the set queries, checked against what was generated */
+  for (number = 0; number < QUERIES; number++)
+  {
+    queries[number].Got = 0;
+    queries[number].GotSum = 0;
+    answer.Query = &queries[number];
+    start = Bench_Now();
+    CANindex_Query(&index, queries[number].Key, answer.Start + queries[number].From, answer.Start + queries[number].To, check_frame, &answer);
+    queries[number].Seconds = Bench_Now() - start;
+    if ( (queries[number].Got != queries[number].Frames) || (queries[number].GotSum != queries[number].Sum) )
+    {
+      printf("  query %u (%s, key %08X) got %lu frames, not %lu\n", number, queries[number].Kind, (unsigned)queries[number].Key, queries[number].Got, queries[number].Frames);
+      wrong++;
+    }
+  }
+  for (number = 0; number < QUERIES; number = count)
+  {
+    kind = queries[number].Kind;
+    total = worst = 0;
+    frames = 0;
+    for (count = number; (count < QUERIES) && (queries[count].Kind == kind); count++)
+    {
+      total += queries[count].Seconds;
+      frames += queries[count].Got;
+      if (queries[count].Seconds > worst)
+        worst = queries[count].Seconds;
+    }
+    printf("  query, %-16s %8.3f ms mean, %8.3f ms worst  (%lu frames each, on average)\n", kind, 1e3 * total / (count - number), 1e3 * worst, frames / (count - number));
+  }
+
+  /* many more of one ID over ten seconds, just timed */
+  for (number = segments = 0; number < RANDOM_QUERIES; number++)
+  {
+    scratch.Got = scratch.GotSum = 0;
+    answer.Query = &scratch;
+    scratch.From = answer.Start + (uint64_t)(rand() / (double)RAND_MAX * (index.Segment[index.Header->Segments - 1].Time - answer.Start));
+    start = Bench_Now();
+    segments += CANindex_Query(&index, keys[rand() % IDS], scratch.From, scratch.From + 10000000, check_frame, &answer);
+    latency[number] = Bench_Now() - start;
+  }
+  qsort(latency, RANDOM_QUERIES, sizeof(latency[0]), compare_doubles);
+  printf("  %u random one-ID 10 s queries: %.3f ms median, %.3f ms 99th percentile (%.1f segments read each)\n", RANDOM_QUERIES, 1e3 * latency[RANDOM_QUERIES / 2], 1e3 * latency[RANDOM_QUERIES * 99 / 100], (double)segments / RANDOM_QUERIES);
+
+  /* against reading all of it */
+  frames = 0;
+  start = Bench_Now();
+  CANindex_Query(&index, CANINDEX_KEY_ANY, 0, UINT64_MAX, count_frame, &frames);
+  elapsed = Bench_Now() - start;
+  printf("  scan of the whole capture       %8.1f ms (%lu frames)\n", 1e3 * elapsed, frames);
+
+  CANindex_Close(&index);
+  return wrong;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long megabytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2048, frames;
+  const char *directory = (argc > 2) ? argv[2] : ".";
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned threads = (argc > 3) ? (unsigned)atoi(argv[3]) : (cores > 0) ? (unsigned)cores : 1, wrong;
+  char text_path[4096], binary_path[4096];
+  uint64_t target = megabytes << 20;
+  double start;
+
+  if ( !megabytes || !threads )
+  {
+    fprintf(stderr, "usage: %s [megabytes [directory [threads]]]\n", argv[0]);
+    return 1;
+  }
+  snprintf(text_path, sizeof(text_path), "%s/capture.log", directory);
+  snprintf(binary_path, sizeof(binary_path), "%s/capture.d4", directory);
+
+  srand(1);
+  make_ids();
+  make_queries(target / TEXT_BYTES_PER_FRAME * FRAME_SPACING);
+
+  start = Bench_Now();
+  generate(text_path, binary_path, target, &frames);
+  printf("generated %lu frames (%.1f hours of traffic) in %.1f s\n", frames, frames * (double)FRAME_SPACING / 3.6e9, Bench_Now() - start);
+
+  wrong = bench("text", text_path, 0, threads, (double)megabytes);
+  {
+    FILE *file = fopen(binary_path, "rb");
+    long size = 0;
+
+    if (file && !fseek(file, 0, SEEK_END))
+      size = ftell(file);
+    if (file)
+      fclose(file);
+    wrong += bench("D4", binary_path, 1, threads, size / 1048576.0);
+  }
+
+  printf("\n%u wrong\n", wrong);
+  return (wrong) ? 1 : 0;
+}
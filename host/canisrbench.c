@@ -0,0 +1,293 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    the CAN receive interrupt, CANx_RX_IRQHandler() of canfast.c as it is, run over a simulated bxCAN
+
+      canisrbench [rounds]
+
+    Built with CANMOCK defined against host/mock, so that canmock.c simulates FIFO 0 behind every register access the
+    interrupt makes, and counts them.  Built with CAN_TRANSMIT as well (and STM32F072xB, as it needs), ST's
+    HAL_CAN_IRQHandler() is stood in for here: a transmission, once pending, is never done, so the driver is called on
+    every entry after that.
+
+    For each case and each burst of 1 to 4 messages arriving together (the 4th overrunning the FIFO), runs rounds
+    (default 1000) of the burst arriving in the empty FIFO and the interrupt entered for as long as a message is
+    pending and FMP0 is enabled.  Then runs rounds more in which a message now and then arrives just after the FIFO
+    was found empty, before the interrupt returns.
+
+    Checks that each message is queued just the once, in order and as it was received (identifier, DLC, data,
+    timestamp and sequence number), or not at all when not collecting; that every overrun is counted and FOVR0 cleared;
+    that FifoWorst is the most ever found waiting; that ST's driver is never called with FMP0 enabled and a message
+    pending (it would take it into pRxMsg, which is NULL); and that FMP0 is left enabled.
+
+    Reports for each case and burst the interrupt entries and register accesses per message, and the cycles these
+    cost at 32 for each exception entry and return and 3 for each access (a load or store over the APB of the
+    Cortex-M0); the rest of the interrupt's time is canfastbench's business.  Exits non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canfast.h"
+#include "canmock.h"
+#include "bench.h"
+
+#define ENTRY_CYCLES  32
+#define ACCESS_CYCLES 3
+#define BURST_MAX     4 /* one more than the FIFO holds */
+
+struct isr_case
+{
+  const char *Name;
+  uint32_t Collecting;  /* as CANfast.Collecting */
+  int Pending;          /* a transmission is pending (its interrupts enabled) throughout */
+};
+
+static const struct isr_case cases[] =
+{
+  { "receive", 1, 0 },
+  { "not collecting", 0, 0 },
+#ifdef CAN_TRANSMIT
+  { "transmit pending", 1, 1 },
+#endif
+};
+
+/* as CANqueue[] is with the code in SRAM */
+static uint32_t CANqueue[SRAM_SHARED_WORDS - FAST_CODE_SRAM_WORDS];
+
+static const struct isr_case *current;
+static unsigned long arrived, queued, entries, failures;
+static uint32_t worst;
+static char failure[160]; /* the first, reported after the case's row */
+static CAN_FIFOMailBox_TypeDef late;
+
+static void fail(const char *what)
+{
+  if (!failures++)
+    snprintf(failure, sizeof(failure), "%s: message %lu: %s\n", current->Name, queued, what);
+}
+
+#ifdef CAN_TRANSMIT
+static CAN_HandleTypeDef hcan;
+
+/* ST's driver, which would take a message itself were FMP0 enabled and one pending */
+void HAL_CAN_IRQHandler(CAN_HandleTypeDef *handle)
+{
+  if (&hcan != handle)
+    fail("ST's driver was called with the wrong handle");
+  if ( (CAN->IER & CAN_IT_FMP0) && CANmock_Pending() )
+    fail("ST's driver was called with FMP0 enabled and a message pending");
+}
+#endif
+
+/* the message numbered: standard and extended identifiers in turn, every DLC, and data to match */
+static void message(unsigned long number, CAN_FIFOMailBox_TypeDef *mailbox)
+{
+  if (number & 1)
+    mailbox->RIR = (((uint32_t)number * 7919UL) & 0x1FFFFFFFUL) << 3 | CAN_RI0R_IDE;
+  else
+    mailbox->RIR = ((uint32_t)number & 0x7FF) << 21;
+  mailbox->RDTR = number % 16;
+  mailbox->RDLR = (uint32_t)number * 2654435761UL;
+  mailbox->RDHR = ~(uint32_t)number;
+}
+
+static void arrive(void)
+{
+  CAN_FIFOMailBox_TypeDef mailbox;
+
+  message(arrived, &mailbox);
+  if (CANmock_Arrive(&mailbox))
+    arrived++;
+}
+
+/* takes whatever the interrupt queued, checking it against what arrived */
+static void drain(void)
+{
+  CAN_FIFOMailBox_TypeDef mailbox;
+  struct CANmessage msg;
+  uint8_t data[8];
+  unsigned index;
+
+  while (CANfast.Queue.ReadIndex != CANfast.Queue.WriteIndex)
+  {
+    CANfast.Queue.ReadIndex = CANqueue_Get(&CANfast.Queue, CANfast.Queue.ReadIndex, &msg);
+    if (!current->Collecting)
+    {
+      fail("queued while not collecting");
+      continue;
+    }
+    if (queued >= arrived)
+    {
+      fail("queued more than arrived");
+      continue;
+    }
+
+    message(queued, &mailbox);
+    for (index = 0; index < 8; index++)
+      data[index] = ((index < 4) ? mailbox.RDLR >> (8 * index) : mailbox.RDHR >> (8 * (index - 4))) & 0xFF;
+    if (mailbox.RIR & CAN_RI0R_IDE)
+    {
+      if ( (msg.Id != mailbox.RIR >> 3) || (msg.flags & CANMESSAGE_FLAG_STDID) )
+        fail("extended identifier wrong");
+    }
+    else if ( (msg.Id != mailbox.RIR >> 21) || !(msg.flags & CANMESSAGE_FLAG_STDID) )
+      fail("standard identifier wrong");
+    if (msg.DLC != (mailbox.RDTR & CAN_RDT0R_DLC))
+      fail("DLC wrong");
+    if (memcmp(msg.Data, data, CANMESSAGE_LENGTH(&msg)))
+      fail("data wrong");
+    if (msg.Timestamp != TIM2->CNT)
+      fail("not timestamped on the entry that took it");
+    if (msg.Sequence != (uint16_t)queued)
+      fail("sequence number wrong");
+    queued++;
+  }
+}
+
+/* as CAN_Config() leaves the peripheral, and HAL_CAN_Transmit_IT() if a transmission is pending */
+static void reset(void)
+{
+  CANmock_Init();
+  CANqueue_Init(&CANfast.Queue, CANqueue, sizeof(CANqueue));
+  CANlimit_Init(&CANfast.Limits);
+  CANfast.RetainRoom = CANFAST_RETAIN_UNLIMITED;
+  CANfast.Sequence = 0;
+  CANfast.QueueDrops = CANfast.FifoWorst = CANfast.FifoOverruns = 0;
+  CANfast.Collecting = current->Collecting;
+#ifdef CAN_TRANSMIT
+  CANfast.Handle = &hcan;
+#endif
+
+  CAN->IER = CAN_IER_FMPIE0;
+  if (current->Pending)
+    CAN->IER |= CAN_IER_TMEIE | CAN_IER_EWGIE | CAN_IER_EPVIE | CAN_IER_BOFIE | CAN_IER_LECIE | CAN_IER_ERRIE;
+
+  arrived = queued = entries = 0;
+  worst = 0;
+}
+
+static void round_of(unsigned burst, int late_now)
+{
+  unsigned index;
+
+  for (index = 0; index < burst; index++)
+    arrive();
+  if (CANmock_Pending() > worst)
+    worst = CANmock_Pending();
+  if (late_now)
+  {
+    message(arrived++, &late);
+    CANmock_Late = &late;
+  }
+
+  while (CANmock_Pending() && (CAN->IER & CAN_IER_FMPIE0))
+  {
+    TIM2->CNT = ++entries;
+    CANx_RX_IRQHandler();
+    drain();
+  }
+
+  if (CANmock_Late)
+    fail("the interrupt returned without looking at the FIFO again");
+  if (CANmock_Pending())
+    fail("left in the FIFO with its interrupt disabled");
+  if (CAN->RF0R & CAN_RF0R_FOVR0)
+    fail("FOVR0 left set");
+}
+
+/* checks what the interrupt has counted, and that every message that arrived was taken */
+static void check(void)
+{
+  if (current->Collecting ? (queued != arrived) : (0 != queued))
+    fail("not every message was queued");
+  if (CANfast.FifoOverruns != CANmock_Counters.Overruns)
+    fail("overruns miscounted");
+  if (CANfast.FifoWorst != worst)
+    fail("FifoWorst wrong");
+  if (CANfast.QueueDrops)
+    fail("queue overflowed");
+  if (!(CAN->IER & CAN_IER_FMPIE0))
+    fail("FMP0 was left disabled");
+}
+
+/* returns the cycles per message of a burst, or a negative number if any check failed */
+static double run(const struct isr_case *isr, unsigned burst, unsigned long rounds)
+{
+  unsigned long round, accesses;
+  double cycles;
+
+  current = isr;
+  reset();
+  for (round = 0; (round < rounds) && !failures; round++)
+    round_of(burst, 0);
+  check();
+  if (failures)
+    return -1;
+
+  accesses = CANmock_Counters.Reads + CANmock_Counters.Writes;
+  cycles = (double)(ENTRY_CYCLES * entries + ACCESS_CYCLES * accesses) / arrived;
+  printf(" %8.2f %8.1f %6.0f", (double)entries / arrived, (double)accesses / arrived, cycles);
+
+  /* and again, with a message arriving late */
+  reset();
+  for (round = 0; (round < rounds) && !failures; round++)
+    round_of(burst, !(rand() % 4));
+  check();
+
+  return failures ? -1 : cycles;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000;
+  unsigned index, burst, passed = 0;
+
+  if (rounds < 1)
+  {
+    fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("per message          burst  entries accesses cycles\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+  {
+    failures = 0;
+    for (burst = 1; burst <= BURST_MAX; burst++)
+    {
+      printf("%-20s %5u", cases[index].Name, burst);
+      if (run(&cases[index], burst, rounds) < 0)
+      {
+        printf("\n%s", failure);
+        break;
+      }
+      printf("\n");
+    }
+    passed += !failures;
+  }
+
+  return Bench_Report(passed, BENCH_CASES(cases), NULL);
+}
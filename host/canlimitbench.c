@@ -0,0 +1,233 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of canlimit.c
+
+      canlimitbench [seconds]
+
+    For each of a set of cases, sets up rules (exact IDs and masks, with periods of 100us to 1s and bursts of 1 to 
+    16) and offers seconds (default 600) of traffic to CANlimit_Admit(): messages at random times, at some multiple 
+    of each rule's rate, with IDs that match a rule or none.  The clock starts just short of wrapping.
+
+    Every answer is checked against a token bucket kept in 64-bit time, and each rule's admissions against the limit 
+    itself: over any stretch of time t, at most Burst + t / Period messages.  Reports, for each case, the messages 
+    admitted against the most the limit allows over the whole run (or against those offered, if fewer), and the 
+    time taken per message (less that of reading the clock around it).  Exits non-zero if any answer or count is 
+    wrong.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canlimit.h"
+#include "bench.h"
+
+#define EPOCH 0xFFF00000UL /* the clock at the start */
+
+/* a rule's mask takes in CANLIMIT_KEY_EXT, so that standard and extended IDs are told apart */
+#define MASK(x) ((x) | CANLIMIT_KEY_EXT)
+
+struct limit_rule
+{
+  uint32_t Key, KeyMask;
+  uint32_t Period, Burst;
+  double Load;       /* offered rate, in multiples of 1 / Period */
+};
+
+struct limit_case
+{
+  const char *Name;
+  unsigned Rules;
+  struct limit_rule Rule[4];
+  double Free;       /* messages a second matching no rule */
+};
+
+static const struct limit_case cases[] =
+{
+  { "one ID, half load", 1, { { 0x100, MASK(0x7FF), 10000, 1, 0.5 } }, 0 },
+  { "one ID, 3x load", 1, { { 0x100, MASK(0x7FF), 10000, 1, 3 } }, 0 },
+  { "one ID, burst 16", 1, { { 0x100, MASK(0x7FF), 100000, 16, 1.5 } }, 500 },
+  { "mask of 16 IDs", 1, { { 0x7F0, MASK(0x7F0), 1000, 4, 5 } }, 1000 },
+  { "extended, 100us", 1, { { 0x18DAF100UL | CANLIMIT_KEY_EXT, MASK(0x1FFFFF00UL), 100, 8, 2 } }, 2000 },
+  { "four rules", 4, { { 0x100, MASK(0x7FF), 20000, 2, 4 }, { 0x200, MASK(0x700), 5000, 1, 1.1 }, { 0x300, MASK(0x7FF), 1000000, 3, 10 }, { 0x18000000UL | CANLIMIT_KEY_EXT, MASK(0x1F000000UL), 500, 5, 0.9 } }, 300 },
+};
+
+/* a token bucket as canlimit.h describes it, in time that never wraps */
+struct reference_bucket
+{
+  uint64_t Credit, Ceiling, Last;
+  uint64_t Admitted, Offered;
+  int64_t LeastSlack;  /* the least of k * Period - time over the k-th admission so far */
+  int Broken;          /* set once the limit is found exceeded */
+};
+
+static double uniform(void)
+{
+  return rand() / ((double)RAND_MAX + 1);
+}
+
+/* a key that matches the rule, chosen at random among those that do */
+static uint32_t matching_key(const struct limit_rule *rule)
+{
+  uint32_t key = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+  key &= (rule->Key & CANLIMIT_KEY_EXT) ? 0x1FFFFFFFUL : 0x7FFUL;
+  return (rule->Key & rule->KeyMask) | (key & ~rule->KeyMask) | (rule->Key & CANLIMIT_KEY_EXT);
+}
+
+static int reference_admit(struct reference_bucket *bucket, const struct limit_rule *rule, uint64_t time)
+{
+  int64_t slack;
+
+  bucket->Credit += time - bucket->Last;
+  if (bucket->Credit > bucket->Ceiling)
+    bucket->Credit = bucket->Ceiling;
+  bucket->Last = time;
+  bucket->Offered++;
+
+  if (bucket->Credit < rule->Period)
+    return 0;
+
+  bucket->Credit -= rule->Period;
+
+  /* over admissions i to j, (j - i + 1) may not exceed Burst + (t[j] - t[i]) / Period */
+  slack = (int64_t)(bucket->Admitted * rule->Period) - (int64_t)time;
+  if (bucket->Admitted && (slack - bucket->LeastSlack > (int64_t)((rule->Burst - 1) * rule->Period)))
+    bucket->Broken = 1;
+  if (!bucket->Admitted || (slack < bucket->LeastSlack))
+    bucket->LeastSlack = slack;
+  bucket->Admitted++;
+
+  return 1;
+}
+
+static int run(const struct limit_case *limit, unsigned seconds, double *elapsed, unsigned long *calls)
+{
+  static struct canlimit_table table;
+  struct reference_bucket bucket[CANLIMIT_RULES];
+  double next[CANLIMIT_RULES + 1], rate[CANLIMIT_RULES + 1], start;
+  uint64_t time, end = (uint64_t)seconds * 1000000;
+  uint32_t key;
+  unsigned index, earliest, answer, expected;
+  unsigned long wrong = 0, free_admitted = 0, free_offered = 0;
+  double allowed, admitted = 0, possible = 0;
+  int passed = 1;
+
+  CANlimit_Init(&table);
+  memset(bucket, 0, sizeof(bucket));
+  for (index = 0; index < limit->Rules; index++)
+  {
+    CANlimit_Set(&table, index, limit->Rule[index].Key, limit->Rule[index].KeyMask, limit->Rule[index].Period, limit->Rule[index].Burst, EPOCH);
+    bucket[index].Ceiling = bucket[index].Credit = (uint64_t)limit->Rule[index].Period * limit->Rule[index].Burst;
+    rate[index] = limit->Rule[index].Load / limit->Rule[index].Period;
+    next[index] = -log(1 - uniform()) / rate[index];
+  }
+  rate[limit->Rules] = limit->Free / 1e6;
+  next[limit->Rules] = (limit->Free) ? -log(1 - uniform()) / rate[limit->Rules] : 1e30;
+
+  for (;;)
+  {
+    /* the next message to arrive, of whichever stream */
+    earliest = 0;
+    for (index = 1; index <= limit->Rules; index++)
+      if (next[index] < next[earliest])
+        earliest = index;
+    time = (uint64_t)next[earliest];
+    if (time >= end)
+      break;
+    next[earliest] += -log(1 - uniform()) / rate[earliest];
+
+    if (earliest < limit->Rules)
+      key = matching_key(&limit->Rule[earliest]);
+    else
+      key = 0x001; /* matches no rule of any case */
+
+    start = Bench_Now();
+    answer = !!CANlimit_Admit(&table, key, (uint32_t)(EPOCH + time));
+    *elapsed += Bench_Now() - start;
+    (*calls)++;
+
+    if (earliest < limit->Rules)
+    {
+      expected = reference_admit(&bucket[earliest], &limit->Rule[earliest], time);
+    }
+    else
+    {
+      expected = 1;
+      free_offered++;
+      free_admitted += answer;
+    }
+
+    if (answer != expected)
+    {
+      if (!wrong)
+        printf("%s: key %08X at %llu us answered %u\n", limit->Name, (unsigned)key, (unsigned long long)time, answer);
+      wrong++;
+    }
+  }
+
+  for (index = 0; index < limit->Rules; index++)
+  {
+    allowed = limit->Rule[index].Burst + (double)end / limit->Rule[index].Period;
+    possible += (bucket[index].Offered < allowed) ? bucket[index].Offered : allowed;
+    admitted += bucket[index].Admitted;
+
+    if (bucket[index].Broken || (bucket[index].Admitted > allowed))
+    {
+      printf("%s: rule %u admitted more than its limit\n", limit->Name, index);
+      passed = 0;
+    }
+    if (bucket[index].Offered - bucket[index].Admitted != table.rule[index].Decimated)
+    {
+      printf("%s: rule %u decimated %u, not %llu\n", limit->Name, index, (unsigned)table.rule[index].Decimated, (unsigned long long)(bucket[index].Offered - bucket[index].Admitted));
+      passed = 0;
+    }
+  }
+
+  printf("%-20s %10.0f %10.0f  %8.3f%%  %9lu  %6lu\n", limit->Name, admitted, possible, 100.0 * admitted / possible, free_offered - free_admitted, wrong);
+
+  return passed && !wrong && (free_admitted == free_offered);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned seconds = (argc > 1) ? atoi(argv[1]) : 600, index, passed = 0;
+  unsigned long calls = 0;
+  double elapsed = 0;
+
+  if (seconds < 1)
+  {
+    fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case                   admitted    allowed  of allowed  free lost  wrong\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], seconds, &elapsed, &calls);
+
+  return Bench_Report(passed, BENCH_CASES(cases), "; %.1f ns per message", 1e9 * (elapsed / calls - Bench_NowOverhead()));
+}
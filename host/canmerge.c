@@ -0,0 +1,312 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "canmerge.h"
+
+int CANmerge_Init(struct canmerge *merge, unsigned devices, uint64_t hold, void (*emit)(void *, const struct canmerge_frame *), void *context)
+{
+  unsigned index;
+
+  memset(merge, 0, sizeof(*merge));
+  merge->Device = calloc(devices, sizeof(*merge->Device));
+  merge->Heap = calloc(devices, sizeof(*merge->Heap));
+  if (!merge->Device || !merge->Heap)
+  {
+    CANmerge_Free(merge);
+    return 0;
+  }
+  merge->Devices = merge->Empty = devices;
+  for (index = 0; index < devices; index++)
+    CANsync_Init(&merge->Device[index].Sync);
+  merge->Hold = hold;
+  merge->Emit = emit;
+  merge->Context = context;
+
+  return 1;
+}
+
+void CANmerge_Free(struct canmerge *merge)
+{
+  unsigned index;
+
+  if (merge->Device)
+    for (index = 0; index < merge->Devices; index++)
+      free(merge->Device[index].Queue);
+  free(merge->Device);
+  free(merge->Heap);
+  merge->Device = NULL;
+  merge->Heap = NULL;
+}
+
+/* heap order: earliest first frame, then lowest device index, so that equal times come out the same way each run */
+static int heap_before(const struct canmerge *merge, unsigned a, unsigned b)
+{
+  const struct canmerge_device *da = &merge->Device[a], *db = &merge->Device[b];
+  uint64_t ta = da->Queue[da->Head].Time, tb = db->Queue[db->Head].Time;
+
+  return (ta < tb) || ( (ta == tb) && (a < b) );
+}
+
+static void heap_up(struct canmerge *merge, unsigned position)
+{
+  unsigned parent, device = merge->Heap[position];
+
+  while (position)
+  {
+    parent = (position - 1) / 2;
+    if (!heap_before(merge, device, merge->Heap[parent]))
+      break;
+    merge->Heap[position] = merge->Heap[parent];
+    position = parent;
+  }
+  merge->Heap[position] = device;
+}
+
+static void heap_down(struct canmerge *merge, unsigned position)
+{
+  unsigned child, device = merge->Heap[position];
+
+  for (;;)
+  {
+    child = 2 * position + 1;
+    if (child >= merge->HeapSize)
+      break;
+    if ( (child + 1 < merge->HeapSize) && heap_before(merge, merge->Heap[child + 1], merge->Heap[child]) )
+      child++;
+    if (!heap_before(merge, merge->Heap[child], device))
+      break;
+    merge->Heap[position] = merge->Heap[child];
+    position = child;
+  }
+  merge->Heap[position] = device;
+}
+
+static int queue_frame(struct canmerge *merge, unsigned index, const struct canmerge_frame *frame)
+{
+  struct canmerge_device *device = &merge->Device[index];
+  struct canmerge_frame *queue;
+  size_t size, first;
+
+  if (device->Count == device->Size)
+  {
+    size = (device->Size) ? 2 * device->Size : 1024;
+    queue = realloc(device->Queue, size * sizeof(*queue));
+    if (!queue)
+      return 0;
+    /* the part of the ring that had wrapped to the start goes after the rest, in the new space */
+    first = device->Size - device->Head;
+    if (device->Count > first)
+      memcpy(queue + device->Size, queue, (device->Count - first) * sizeof(*queue));
+    device->Queue = queue;
+    device->Size = size;
+  }
+
+  device->Queue[(device->Head + device->Count) % device->Size] = *frame;
+  if (0 == device->Count++)
+  {
+    merge->Empty--;
+    merge->Heap[merge->HeapSize++] = index;
+    heap_up(merge, merge->HeapSize - 1);
+  }
+
+  return 1;
+}
+
+static void estimate_offset(struct canmerge_device *device, uint64_t device_time, uint64_t arrival)
+{
+  int64_t delay = (int64_t)(arrival - device_time);
+
+  if ( !device->OffsetKnown || (arrival - device->WindowStart >= CANMERGE_OFFSET_WINDOW) )
+  {
+    device->PreviousLeast = (device->OffsetKnown) ? device->WindowLeast : delay;
+    device->WindowLeast = delay;
+    device->WindowStart = arrival;
+    device->OffsetKnown = 1;
+  }
+  else if (delay < device->WindowLeast)
+  {
+    device->WindowLeast = delay;
+  }
+
+  device->Offset = (device->WindowLeast < device->PreviousLeast) ? device->WindowLeast : device->PreviousLeast;
+}
+
+static int parse_line(struct canmerge *merge, unsigned index, const char *line, uint64_t arrival)
+{
+  struct canmerge_device *device = &merge->Device[index];
+  struct canmerge_frame frame;
+  uint64_t host;
+  int timed;
+
+  if ('u' == line[0])
+  {
+    /* the time of a USB frame, only of use as it arrives */
+    if ( device->Live && !CANsync_Record(&device->Sync, line, arrival) )
+      device->Errors++;
+    return 1;
+  }
+
+  if (!LAWICEL_Parse(line, &device->Format, &frame.Message, &timed))
+  {
+    /* command responses and other records are no concern of ours */
+    if ( ('t' == line[0]) || ('T' == line[0]) || ('d' == line[0]) || ('D' == line[0]) )
+      device->Errors++;
+    return 1;
+  }
+
+  frame.Device = index;
+  if (timed)
+  {
+    frame.DeviceTime = LAWICEL_Unwrap(&device->Clock, frame.Message.Timestamp, LAWICEL_Wrap(&device->Format));
+    if (device->Live)
+      estimate_offset(device, frame.DeviceTime, arrival);
+    frame.Time = frame.DeviceTime + device->Offset;
+    if ( device->Live && (8 == device->Format.TimestampDigits) && CANsync_ToHost(&device->Sync, frame.Message.Timestamp, &host) )
+      frame.Time = host;
+  }
+  else
+  {
+    frame.DeviceTime = 0;
+    frame.Time = (device->Live) ? arrival : device->LastTime;
+  }
+
+  /* a device's own frames stay in the order it sent them, whatever the estimate of its offset did meanwhile */
+  if (frame.Time < device->LastTime)
+    frame.Time = device->LastTime;
+  device->LastTime = frame.Time;
+  device->Frames++;
+
+  return queue_frame(merge, index, &frame);
+}
+
+int CANmerge_Feed(struct canmerge *merge, unsigned index, const char *data, size_t length, uint64_t arrival)
+{
+  struct canmerge_device *device = &merge->Device[index];
+  const char *end = data + length, *cr, *lf;
+  size_t count;
+
+  while (data < end)
+  {
+    /* the sniffer ends lines with CR, but a file may well have had them changed */
+    cr = memchr(data, '\r', end - data);
+    lf = memchr(data, '\n', ((cr) ? cr : end) - data);
+    if (lf)
+      cr = lf;
+
+    if (!cr)
+    {
+      /* keep the start of the line for the next read (a line too long to be a record is cut short, and fails to parse) */
+      count = end - data;
+      if (count > CANMERGE_LINE_MAX - device->LineLength)
+        count = CANMERGE_LINE_MAX - device->LineLength;
+      memcpy(device->Line + device->LineLength, data, count);
+      device->LineLength += count;
+      break;
+    }
+
+    if (device->LineLength)
+    {
+      count = cr - data;
+      if (count > CANMERGE_LINE_MAX - device->LineLength)
+        count = CANMERGE_LINE_MAX - device->LineLength;
+      memcpy(device->Line + device->LineLength, data, count);
+      device->Line[device->LineLength + count] = '\0';
+      device->LineLength = 0;
+      if (!parse_line(merge, index, device->Line, arrival))
+        return 0;
+    }
+    else if (cr > data)
+    {
+      if (!parse_line(merge, index, data, arrival))
+        return 0;
+    }
+
+    data = cr + 1;
+  }
+
+  return 1;
+}
+
+void CANmerge_End(struct canmerge *merge, unsigned index)
+{
+  struct canmerge_device *device = &merge->Device[index];
+
+  if (device->Ended)
+    return;
+  device->Ended = 1;
+  if (0 == device->Count)
+    merge->Empty--;
+}
+
+void CANmerge_Service(struct canmerge *merge, uint64_t now)
+{
+  struct canmerge_device *device;
+  const struct canmerge_frame *frame;
+  unsigned index;
+  int waiting;
+
+  while (merge->HeapSize)
+  {
+    device = &merge->Device[merge->Heap[0]];
+    frame = &device->Queue[device->Head];
+
+    /* a device with nothing queued might yet have something earlier */
+    if (merge->Empty)
+    {
+      waiting = 0;
+      for (index = 0; index < merge->Devices; index++)
+      {
+        if (merge->Device[index].Ended || merge->Device[index].Count)
+          continue;
+        if ( !merge->Device[index].Live || (now < frame->Time + merge->Hold) )
+          waiting = 1;
+      }
+      if (waiting)
+        break;
+    }
+
+    if (frame->Time < merge->Last)
+      merge->Late++;
+    else
+      merge->Last = frame->Time;
+    merge->Emitted++;
+    merge->Emit(merge->Context, frame);
+
+    device->Head = (device->Head + 1) % device->Size;
+    if (--device->Count)
+    {
+      heap_down(merge, 0);
+    }
+    else
+    {
+      merge->Heap[0] = merge->Heap[--merge->HeapSize];
+      if (merge->HeapSize)
+        heap_down(merge, 0);
+      if (!device->Ended)
+        merge->Empty++;
+    }
+  }
+}
@@ -0,0 +1,112 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANMERGE_H_
+#define CANMERGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lawicel.h"
+#include "cansync.h"
+
+/*
+    merging of the output of several sniffers into one stream in order of time
+
+    The bytes read from each device are fed in as they arrive, with the host time of their arrival.  Each message 
+    record is put on the host's clock by adding the device's offset (host time less device time), and waits in that 
+    device's queue until it can be known that no device has an earlier one to come; a heap of the devices, keyed on 
+    the time of the first frame in each queue, gives the next frame to go.
+
+    For a live device, the offset is estimated as the least delay (arrival less device time) seen over the last one 
+    to two CANMERGE_OFFSET_WINDOW: a record can arrive no sooner than it was received, and most USB frames carry at 
+    least one that went out promptly.  Records need a timestamp for that ('Z2', or 'Z1' if one minute of range will 
+    do); without one, a record is taken to have been received when it arrived.  A device that is not live (a file) 
+    keeps whatever offset it is given.  Once a live device with 'Z2' has sent enough 'u' records for cansync.c to 
+    have fitted its clock, that is used instead: it follows drift between records, and does not need the device to 
+    be busy.
+
+    A live device that has nothing queued holds up the others for at most Hold microseconds (after which anything of 
+    its that turns up earlier is emitted out of order, and counted as Late); a device that is not live holds them up 
+    until it has something queued or has ended.
+*/
+
+#define CANMERGE_LINE_MAX 256
+#define CANMERGE_OFFSET_WINDOW 2000000ULL
+
+struct canmerge_frame
+{
+  uint64_t Time;       /* microseconds on the host's clock */
+  uint64_t DeviceTime; /* microseconds on the device's clock, unwrapped */
+  unsigned Device;
+  struct CANmessage Message;
+};
+
+struct canmerge_device
+{
+  const char *Name;
+  struct lawicel_format Format;
+  int Live;
+  int Ended;
+  int64_t Offset;      /* host time less device time */
+  int OffsetKnown;
+  int64_t WindowLeast, PreviousLeast;
+  uint64_t WindowStart;
+  uint64_t LastTime;
+  struct lawicel_clock Clock;
+  struct cansync Sync;
+  char Line[CANMERGE_LINE_MAX + 1];
+  unsigned LineLength;
+  struct canmerge_frame *Queue;
+  size_t Head, Count, Size;
+  unsigned long Frames, Errors;
+};
+
+struct canmerge
+{
+  struct canmerge_device *Device;
+  unsigned Devices;
+  unsigned *Heap;
+  unsigned HeapSize;
+  unsigned Empty;      /* devices not yet ended with nothing queued */
+  uint64_t Hold;
+  uint64_t Last;       /* time of the last frame emitted */
+  unsigned long Emitted, Late;
+  void (*Emit)(void *context, const struct canmerge_frame *frame);
+  void *Context;
+};
+
+/* returns zero if out of memory; the caller then fills in each Device[] with its Name, Format, Live (and Offset) */
+extern int CANmerge_Init(struct canmerge *merge, unsigned devices, uint64_t hold, void (*emit)(void *, const struct canmerge_frame *), void *context);
+extern void CANmerge_Free(struct canmerge *merge);
+
+/* bytes read from a device, arriving at host time arrival (microseconds); returns zero if out of memory */
+extern int CANmerge_Feed(struct canmerge *merge, unsigned device, const char *data, size_t length, uint64_t arrival);
+
+/* no more is to come from a device */
+extern void CANmerge_End(struct canmerge *merge, unsigned device);
+
+/* emit every frame that can be, given that it is now host time now */
+extern void CANmerge_Service(struct canmerge *merge, uint64_t now);
+
+#endif
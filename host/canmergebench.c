@@ -0,0 +1,278 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    benchmark of canmerge.c with file-backed fake devices
+
+      canmergebench [devices [seconds [directory]]]
+
+    Writes a log for each of devices (default 3) fake sniffers into directory (default the current one), as each 
+    would send seconds (default 60) of busy 1Mbit traffic in mode 'Z2': fake0.log, fake1.log, ...  Each device's 
+    clock has an offset and a drift of its own, and fake0's starts just short of wrapping.  The logs are read back 
+    with large reads and merged as canmerged would, each device's records arriving at the end of the USB frame 
+    (millisecond) they went out in, plus a random latency of up to 300us.
+
+    Reports the time taken per frame, how far the merged times were from the true ones, and how far out of order 
+    frames came (by true time).  The logs can also be given to canmerged itself, but being regular files, they will 
+    not then have their offsets estimated.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "canmerge.h"
+#include "bench.h"
+
+#define MAX_DEVICES 16
+#define IDS_PER_DEVICE 48
+#define READ_SIZE 65536
+#define HOST_EPOCH 1600000000000000ULL /* host time (microseconds) of the start of the run */
+#define WARMUP 2000000ULL              /* microseconds before the offset estimates are judged */
+#define LATENCY_MAX 300
+
+struct fake
+{
+  uint64_t *truth;    /* host time (from the start) each frame was received */
+  size_t count;
+  char *text;         /* as read back */
+  size_t length;
+  uint64_t device_start;
+  double drift;       /* parts per million */
+  size_t emitted;
+};
+
+static struct fake fakes[MAX_DEVICES];
+
+struct results
+{
+  unsigned long frames, judged;
+  double error_sum;
+  uint64_t error_max, truth_max, inversion_max;
+  FILE *output;
+};
+
+static uint64_t device_time(const struct fake *fake, uint64_t truth)
+{
+  return fake->device_start + truth + (uint64_t)(truth * fake->drift * 1e-6);
+}
+
+static int compare_times(const void *a, const void *b)
+{
+  uint64_t ta = *(const uint64_t *)a, tb = *(const uint64_t *)b;
+
+  return (ta > tb) - (ta < tb);
+}
+
+/* periodic IDs, as on a vehicle bus, at 1ms to 100ms; about 6200 frames per second */
+static void generate(struct fake *fake, unsigned index, unsigned seconds, const char *path)
+{
+  static const unsigned periods[] = { 2000, 5000, 10000, 10000, 20000, 20000, 50000, 100000 };
+  uint64_t end = seconds * 1000000ULL, time;
+  size_t allocated = 0, frame;
+  unsigned id, dlc, byte;
+  FILE *file;
+
+  fake->count = 0;
+  for (id = 0; id < IDS_PER_DEVICE; id++)
+  {
+    for (time = rand() % periods[id % 8]; time < end; time += periods[id % 8])
+    {
+      if (fake->count == allocated)
+      {
+        allocated = (allocated) ? 2 * allocated : 65536;
+        fake->truth = realloc(fake->truth, allocated * sizeof(*fake->truth));
+        if (!fake->truth)
+        {
+          fprintf(stderr, "out of memory\n");
+          exit(1);
+        }
+      }
+      /* the low bits carry the ID, so that the frame can be made up again once sorted */
+      fake->truth[fake->count++] = ((time + rand() % 200) << 8) | id;
+    }
+  }
+  qsort(fake->truth, fake->count, sizeof(*fake->truth), compare_times);
+
+  file = fopen(path, "w");
+  if (!file)
+  {
+    perror(path);
+    exit(1);
+  }
+  for (frame = 0; frame < fake->count; frame++)
+  {
+    id = fake->truth[frame] & 0xFF;
+    fake->truth[frame] >>= 8;
+    dlc = 8 - (id % 3);
+    fprintf(file, "t%03X%u", 0x100 * (index + 1) + id, dlc);
+    for (byte = 0; byte < dlc; byte++)
+      fprintf(file, "%02X", (unsigned)((frame + byte) & 0xFF));
+    fprintf(file, "%08X\r", (unsigned)device_time(fake, fake->truth[frame]));
+  }
+  fclose(file);
+}
+
+static void load(struct fake *fake, const char *path)
+{
+  size_t allocated = 0;
+  ssize_t got;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(path);
+    exit(1);
+  }
+  fake->length = 0;
+  do
+  {
+    if (allocated - fake->length < READ_SIZE)
+    {
+      allocated = (allocated) ? 2 * allocated : 16 * READ_SIZE;
+      fake->text = realloc(fake->text, allocated);
+      if (!fake->text)
+      {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+      }
+    }
+    got = read(fd, fake->text + fake->length, READ_SIZE);
+    if (got > 0)
+      fake->length += got;
+  } while (got > 0);
+  close(fd);
+}
+
+static void emit(void *context, const struct canmerge_frame *frame)
+{
+  struct results *results = context;
+  struct fake *fake = &fakes[frame->Device];
+  uint64_t truth = fake->truth[fake->emitted++], error;
+
+  char line[LAWICEL_CANDUMP_MAX + 8];
+
+  /* as canmerged would output it */
+  fwrite(line, 1, LAWICEL_FormatCandump(line, frame->Time, "fake", &frame->Message), results->output);
+
+  results->frames++;
+  if (truth > results->truth_max)
+    results->truth_max = truth;
+
+  if (truth >= WARMUP)
+  {
+    if (results->truth_max - truth > results->inversion_max)
+      results->inversion_max = results->truth_max - truth;
+
+    error = (frame->Time > HOST_EPOCH + truth) ? frame->Time - (HOST_EPOCH + truth) : (HOST_EPOCH + truth) - frame->Time;
+    results->error_sum += error;
+    if (error > results->error_max)
+      results->error_max = error;
+    results->judged++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned devices = (argc > 1) ? atoi(argv[1]) : 3;
+  unsigned seconds = (argc > 2) ? atoi(argv[2]) : 60;
+  const char *directory = (argc > 3) ? argv[3] : ".";
+  struct results results = { 0 };
+  struct canmerge merge;
+  double start;
+  size_t position[MAX_DEVICES] = { 0 }, frame[MAX_DEVICES] = { 0 }, bytes = 0, from;
+  uint64_t millisecond, arrival;
+  unsigned device;
+  char path[4096];
+  double elapsed;
+  int more;
+
+  if ( (devices < 1) || (devices > MAX_DEVICES) || (seconds < 1) )
+  {
+    fprintf(stderr, "usage: %s [devices (1 to %u) [seconds [directory]]]\n", argv[0], MAX_DEVICES);
+    return 1;
+  }
+
+  srand(1);
+  for (device = 0; device < devices; device++)
+  {
+    fakes[device].device_start = (0 == device) ? 0xFFF00000ULL : (uint64_t)rand() * 1000;
+    fakes[device].drift = (rand() % 61) - 30;
+    snprintf(path, sizeof(path), "%s/fake%u.log", directory, device);
+    generate(&fakes[device], device, seconds, path);
+    load(&fakes[device], path);
+    bytes += fakes[device].length;
+  }
+
+  results.output = fopen("/dev/null", "w");
+  if ( !results.output || !CANmerge_Init(&merge, devices, 5000, emit, &results) )
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (device = 0; device < devices; device++)
+  {
+    merge.Device[device].Name = "fake";
+    merge.Device[device].Format.TimestampDigits = 8;
+    merge.Device[device].Live = 1;
+  }
+
+  start = Bench_Now();
+  for (millisecond = 1, more = 1; more; millisecond++)
+  {
+    more = 0;
+    for (device = 0; device < devices; device++)
+    {
+      /* this device's records that went out in this USB frame */
+      from = position[device];
+      while ( (frame[device] < fakes[device].count) && (fakes[device].truth[frame[device]] < millisecond * 1000) )
+      {
+        position[device] = (char *)memchr(fakes[device].text + position[device], '\r', fakes[device].length - position[device]) - fakes[device].text + 1;
+        frame[device]++;
+      }
+      arrival = HOST_EPOCH + millisecond * 1000 + rand() % LATENCY_MAX;
+      if (position[device] > from)
+        CANmerge_Feed(&merge, device, fakes[device].text + from, position[device] - from, arrival);
+      if (frame[device] < fakes[device].count)
+        more = 1;
+      else
+        CANmerge_End(&merge, device);
+    }
+    CANmerge_Service(&merge, HOST_EPOCH + millisecond * 1000 + LATENCY_MAX);
+  }
+  elapsed = Bench_Now() - start;
+
+  printf("devices           %u, %u seconds each, %.1f MB\n", devices, seconds, bytes / 1e6);
+  printf("frames            %lu merged (%lu out of order)\n", results.frames, merge.Late);
+  printf("merge             %.1f ns per frame (%.0f frames per second)\n", 1e9 * elapsed / results.frames, results.frames / elapsed);
+  printf("time error        %.1f us mean, %llu us worst (after the first %llu s)\n", results.error_sum / results.judged, (unsigned long long)results.error_max, WARMUP / 1000000);
+  printf("order             worst %llu us behind a frame emitted before it (after the first %llu s)\n", (unsigned long long)results.inversion_max, WARMUP / 1000000);
+  for (device = 0; device < devices; device++)
+    printf("fake%-2u            %lu frames, %.0f ppm drift, %lu errors\n", device, merge.Device[device].Frames, fakes[device].drift, merge.Device[device].Errors);
+
+  CANmerge_Free(&merge);
+  return (results.frames == merge.Emitted) ? 0 : 1;
+}
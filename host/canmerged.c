@@ -0,0 +1,248 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    merge the output of several sniffers into one candump -l log, in order of time (Linux)
+
+      canmerged [-z0|-z1|-z2] [-q] [-h hold_ms] name=path [name=path ...] > merged.log
+
+    Each path is a sniffer's serial port (such as /dev/serial/by-id/usb-..._<serial>-if00, whose serial number the 
+    firmware makes from the chip's unique ID) or a file or FIFO standing in for one.  A serial port is put in raw mode 
+    and sent the 'Z' (and 'q') command for the format given (by default 'Z2', microsecond timestamps), and its offset 
+    from the host's clock is estimated as canmerge.h describes; so is that of a FIFO.  A regular file is taken to be on 
+    the host's clock already, as when the logs of a test run are merged afterwards.
+
+    The merged log names each frame's interface after its device.  When every input has ended (or on SIGINT), what is 
+    left is flushed and a summary of each device goes to stderr.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "canmerge.h"
+
+#define READ_SIZE 65536
+#define DEFAULT_HOLD_MS 50
+#define DEVICE_NAME_MAX 64
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int signal)
+{
+  (void)signal;
+  stopping = 1;
+}
+
+static uint64_t host_time(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+static void emit_candump(void *context, const struct canmerge_frame *frame)
+{
+  const struct canmerge *merge = context;
+  char line[LAWICEL_CANDUMP_MAX + DEVICE_NAME_MAX];
+
+  fwrite(line, 1, LAWICEL_FormatCandump(line, frame->Time, merge->Device[frame->Device].Name, &frame->Message), stdout);
+}
+
+/* raw, non-blocking, and told which timestamp and sequence number to send */
+static int setup_port(int fd, const struct lawicel_format *format)
+{
+  struct termios tio;
+  char command[8];
+  int length;
+
+  if (tcgetattr(fd, &tio))
+    return 0;
+  cfmakeraw(&tio);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tio))
+    return 0;
+  tcflush(fd, TCIFLUSH);
+
+  length = snprintf(command, sizeof(command), "Z%u\rq%u\r", (4 == format->TimestampDigits) ? 1 : (8 == format->TimestampDigits) ? 2 : 0, format->Sequence);
+  return length == write(fd, command, length);
+}
+
+int main(int argc, char *argv[])
+{
+  static char buffer[READ_SIZE];
+  static char output[1 << 20];
+  struct lawicel_format format = { 8, 0 };
+  struct canmerge merge;
+  struct epoll_event event, events[16];
+  struct stat info;
+  uint64_t hold = DEFAULT_HOLD_MS * 1000ULL;
+  int *fds, *polled, epoll_fd, arg, count, index, active, files;
+  unsigned devices, device;
+  ssize_t length;
+  char *name, *path;
+
+  for (arg = 1; (arg < argc) && ('-' == argv[arg][0]); arg++)
+  {
+    if ( !strcmp(argv[arg], "-z0") || !strcmp(argv[arg], "-z1") || !strcmp(argv[arg], "-z2") )
+      format.TimestampDigits = ('0' == argv[arg][2]) ? 0 : ('1' == argv[arg][2]) ? 4 : 8;
+    else if (!strcmp(argv[arg], "-q"))
+      format.Sequence = 1;
+    else if ( !strcmp(argv[arg], "-h") && (arg + 1 < argc) )
+      hold = strtoull(argv[++arg], NULL, 0) * 1000ULL;
+    else
+      break;
+  }
+  if (arg >= argc)
+  {
+    fprintf(stderr, "usage: %s [-z0|-z1|-z2] [-q] [-h hold_ms] name=path [name=path ...]\n", argv[0]);
+    return 1;
+  }
+
+  devices = argc - arg;
+  fds = calloc(devices, sizeof(*fds));
+  polled = calloc(devices, sizeof(*polled));
+  epoll_fd = epoll_create1(0);
+  if ( !fds || !polled || (epoll_fd < 0) || !CANmerge_Init(&merge, devices, hold, emit_candump, &merge) )
+  {
+    perror("canmerged");
+    return 1;
+  }
+  setvbuf(stdout, output, _IOFBF, sizeof(output));
+
+  files = 0;
+  for (device = 0; device < devices; device++, arg++)
+  {
+    name = argv[arg];
+    path = strchr(name, '=');
+    if (path)
+      *path++ = '\0';
+    else
+      path = name;
+    if (strlen(name) > DEVICE_NAME_MAX)
+    {
+      fprintf(stderr, "%s: name too long\n", name);
+      return 1;
+    }
+
+    fds[device] = open(path, O_RDWR | O_NONBLOCK | O_NOCTTY);
+    if (fds[device] < 0)
+      fds[device] = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+    if ( (fds[device] < 0) || fstat(fds[device], &info) )
+    {
+      perror(path);
+      return 1;
+    }
+    if ( isatty(fds[device]) && !setup_port(fds[device], &format) )
+    {
+      perror(path);
+      return 1;
+    }
+
+    merge.Device[device].Name = name;
+    merge.Device[device].Format = format;
+    merge.Device[device].Live = !S_ISREG(info.st_mode);
+
+    /* epoll will not have regular files; they are read whenever the loop comes round instead */
+    event.events = EPOLLIN;
+    event.data.u32 = device;
+    polled[device] = (0 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[device], &event));
+    if (!polled[device])
+      files++;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  active = devices;
+  while (active && !stopping)
+  {
+    count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), (files) ? 0 : (int)(hold / 2000) + 1);
+    if ( (count < 0) && (EINTR != errno) )
+    {
+      perror("epoll_wait");
+      break;
+    }
+
+    for (device = 0; device < devices; device++)
+    {
+      if ( merge.Device[device].Ended || polled[device] )
+        continue;
+      length = read(fds[device], buffer, sizeof(buffer));
+      if (length > 0)
+      {
+        CANmerge_Feed(&merge, device, buffer, length, host_time());
+      }
+      else
+      {
+        CANmerge_End(&merge, device);
+        files--;
+        active--;
+      }
+    }
+
+    for (index = 0; index < count; index++)
+    {
+      device = events[index].data.u32;
+      /* take all there is, in as few reads as it will go in */
+      while ( (length = read(fds[device], buffer, sizeof(buffer))) > 0 )
+      {
+        if (!CANmerge_Feed(&merge, device, buffer, length, host_time()))
+        {
+          fprintf(stderr, "out of memory\n");
+          return 1;
+        }
+      }
+      if ( (0 == length) || ((length < 0) && (EAGAIN != errno) && (EINTR != errno)) || (events[index].events & (EPOLLHUP | EPOLLERR)) )
+      {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[device], NULL);
+        CANmerge_End(&merge, device);
+        active--;
+      }
+    }
+
+    CANmerge_Service(&merge, host_time());
+  }
+
+  for (device = 0; device < devices; device++)
+    CANmerge_End(&merge, device);
+  CANmerge_Service(&merge, host_time());
+  fflush(stdout);
+
+  for (device = 0; device < devices; device++)
+    fprintf(stderr, "%-16s %10lu frames %6lu errors  offset %+lld us\n", merge.Device[device].Name, merge.Device[device].Frames, merge.Device[device].Errors, (long long)merge.Device[device].Offset);
+  fprintf(stderr, "%lu frames merged, %lu out of order\n", merge.Emitted, merge.Late);
+
+  CANmerge_Free(&merge);
+  return 0;
+}
@@ -0,0 +1,339 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test of canqueue.c with mixed message lengths and the receive interrupt breaking in
+
+      canqueuebench [steps]
+
+    For each of a set of cases (mixes of DLC, and in a build with CANMESSAGE_DATA_MAX of 64, of CAN FD lengths too),
+    and for each queue size from the least allowed (2 * CANQUEUE_RECORD_MAX) on through every alignment of a message
+    with the end of the buffer, and those CANbus_Init() gives it, runs steps (default 20000) of the two sides at
+    random, in spells that favour one or the other so that the queue both fills and empties:
+
+      - the producer, as the CAN interrupt, puts a message of random ID, flags, DLC and payload;
+      - the consumer, as CANbus_Service(), takes a snapshot of WriteIndex and takes out up to 8 messages, storing
+        ReadIndex after each; or, as CANbus_TriggerScan(), scans ahead with CANqueue_Get() while keeping up to
+        HISTORY messages behind it, stepping ReadIndex on past the rest with CANqueue_Next(), and stores it once at
+        the end.  Either way, the interrupt may break in between any two of its calls.
+
+    Every message taken out must be the next put, exactly as it was put (DLC, ID, flags, timestamp, sequence number,
+    and as many data bytes as the DLC gives); CANqueue_Next() must step to where CANqueue_Get() does; a message must be
+    put if, and only if, it fits (see fits()), and a put refused must leave the queue as it was; and no byte outside
+    the buffer may be touched.
+
+    Reports, for each case, the messages put and refused over all sizes, and the messages that fill the queue of
+    each size CANbus_Init() gives it.  Exits non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canqueue.h"
+#include "bench.h"
+
+#define GUARD 8           /* bytes after the buffer that must not be touched */
+#define HISTORY 5         /* messages the scan keeps behind it, as a trigger's pre-trigger history */
+#define REFERENCE 1024    /* must be a power of two, more than the messages any queue holds */
+
+struct mix_case
+{
+  const char *Name;
+  uint8_t Lowest, Highest; /* DLC */
+  uint8_t EndsOnly;        /* DLC is Lowest or Highest, nothing between */
+  uint8_t FdShare;         /* percent of messages CAN FD */
+};
+
+static const struct mix_case cases[] =
+{
+  { "DLC 0 to 15", 0, 15, 0, 0 },
+  { "DLC 0 to 4", 0, 4, 0, 0 },
+  { "DLC 0 or 8", 0, 8, 1, 0 },
+#if CANMESSAGE_DATA_MAX > 8
+  { "CAN FD, DLC 0 to 15", 0, 15, 0, 50 },
+  { "CAN FD, 12 or 64 bytes", 9, 15, 1, 100 },
+#endif
+};
+
+/* the queue sizes CANbus_Init() gives: CANqueue[] with code in SRAM and without */
+static const uint32_t firmware_sizes[] = { 4 * (700 - 256), 4 * 700 };
+
+static uint8_t storage[4 * 700 + GUARD], before[4 * 700 + GUARD];
+
+/* the messages put, by sequence number, and how far each side has come through them */
+static struct
+{
+  struct CANmessage Message[REFERENCE];
+  uint32_t Put, Read, Scan, History;
+  uint32_t ScanIndex;
+  unsigned long Failures;
+} reference;
+
+static const struct mix_case *mix;
+static struct canqueue queue;
+static unsigned long put, refused;
+
+static void fail(const char *what)
+{
+  if (!reference.Failures++)
+    printf("%s: queue of %u bytes, message %u: %s\n", mix->Name, (unsigned)queue.Size, (unsigned)reference.Put, what);
+}
+
+static void random_message(struct CANmessage *message)
+{
+  unsigned index;
+
+  memset(message, 0xEE, sizeof(*message));
+  message->flags = ((rand() & 1) ? CANMESSAGE_FLAG_STDID : 0) | ((rand() & 1) ? CANMESSAGE_FLAG_BRS : 0) | ((rand() & 1) ? CANMESSAGE_FLAG_ESI : 0);
+  message->Id = ((uint32_t)rand() << 16 ^ (uint32_t)rand()) & ((message->flags & CANMESSAGE_FLAG_STDID) ? 0x7FFUL : 0x1FFFFFFFUL);
+  if ((unsigned)(rand() % 100) < mix->FdShare)
+    message->flags |= CANMESSAGE_FLAG_FD;
+  if (mix->EndsOnly)
+    message->DLC = (rand() & 1) ? mix->Lowest : mix->Highest;
+  else
+    message->DLC = mix->Lowest + rand() % (mix->Highest - mix->Lowest + 1);
+  message->Timestamp = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+  message->Sequence = (uint16_t)reference.Put;
+  for (index = 0; index < CANMESSAGE_LENGTH(message); index++)
+    message->Data[index] = (uint8_t)rand();
+}
+
+/*
+    whether a message of length bytes in all fits: in one piece, without reaching the oldest message (so that a full 
+    queue is never taken for an empty one), ahead of WriteIndex or else, in place of what is left before the end, 
+    at the beginning
+*/
+static int fits(uint32_t length)
+{
+  uint32_t write_index = queue.WriteIndex, read_index = queue.ReadIndex;
+
+  if (write_index < read_index)
+    return write_index + length < read_index;
+  if (write_index + length < queue.Size)
+    return 1;
+  if (write_index + length == queue.Size)
+    return 0 != read_index;
+  return length < read_index;
+}
+
+/* the receive interrupt */
+static void producer(void)
+{
+  struct CANmessage message;
+  uint32_t write_index = queue.WriteIndex, keep = !(rand() % 16);
+  unsigned index;
+  int room;
+
+  random_message(&message);
+  room = fits(CANQUEUE_HEADER_SIZE + CANMESSAGE_LENGTH(&message));
+  if (keep)
+    memcpy(before, queue.Buffer, queue.Size);
+
+  if (CANqueue_Put(&queue, &message))
+  {
+    reference.Message[reference.Put++ % REFERENCE] = message;
+    put++;
+    if (!room)
+      fail("put with no room");
+    if (reference.Put - reference.Read >= REFERENCE)
+      fail("more messages held than the reference has room for");
+  }
+  else
+  {
+    refused++;
+    if (room)
+      fail("refused with room");
+    if ( (write_index != queue.WriteIndex) || (keep && memcmp(before, queue.Buffer, queue.Size)) )
+      fail("refused, but the queue was altered");
+  }
+
+  for (index = 0; index < GUARD; index++)
+    if (0xA5 != queue.Buffer[queue.Size + index])
+      fail("wrote past the end of the buffer");
+}
+
+/* the interrupt breaks in one time in four */
+static void maybe_interrupt(void)
+{
+  if (!(rand() % 4))
+    producer();
+}
+
+static int same(const struct CANmessage *a, const struct CANmessage *b)
+{
+  return (a->Id == b->Id) && (a->flags == b->flags) && (a->DLC == b->DLC) && (a->Timestamp == b->Timestamp) &&
+    (a->Sequence == b->Sequence) && !memcmp(a->Data, b->Data, CANMESSAGE_LENGTH(a));
+}
+
+/* takes a copy of the message at index, which should be the count-th put, and returns the index of the next */
+static uint32_t get(uint32_t index, uint32_t count)
+{
+  struct CANmessage message;
+  uint32_t next;
+
+  memset(&message, 0x55, sizeof(message));
+  next = CANqueue_Get(&queue, index, &message);
+  if (!same(&message, &reference.Message[count % REFERENCE]))
+    fail("a message came out other than as it went in");
+  if (CANqueue_Next(&queue, index) != next)
+    fail("CANqueue_Next() and CANqueue_Get() differ on where the next message is");
+
+  return next;
+}
+
+/* as CANbus_Service() */
+static void service(void)
+{
+  uint32_t read_index = queue.ReadIndex, write_index = queue.WriteIndex, count = 1 + rand() % 8;
+
+  while (count-- && (read_index != write_index))
+  {
+    maybe_interrupt();
+    read_index = get(read_index, reference.Read++);
+    maybe_interrupt();
+    queue.ReadIndex = read_index;
+  }
+}
+
+/* as CANbus_TriggerScan() */
+static void scan(void)
+{
+  uint32_t read_index = queue.ReadIndex, write_index = queue.WriteIndex, count = 1 + rand() % 8;
+
+  while (count-- && (reference.ScanIndex != write_index))
+  {
+    maybe_interrupt();
+    reference.ScanIndex = get(reference.ScanIndex, reference.Scan++);
+    if (reference.History < HISTORY)
+    {
+      reference.History++;
+    }
+    else
+    {
+      maybe_interrupt();
+      read_index = CANqueue_Next(&queue, read_index);
+      reference.Read++;
+    }
+  }
+
+  maybe_interrupt();
+  queue.ReadIndex = read_index;
+}
+
+static void run_size(uint32_t size, unsigned long steps)
+{
+  unsigned long step;
+  unsigned producer_share = 50, scanning = 0;
+
+  memset(storage, 0xA5, sizeof(storage));
+  CANqueue_Init(&queue, storage, size);
+  memset(&reference, 0, sizeof(reference));
+
+  for (step = 0; (step < steps) && !reference.Failures; step++)
+  {
+    /* a new spell, now and then: the producer ahead or behind, and the consumer servicing or scanning */
+    if (!(rand() % 200))
+    {
+      producer_share = 10 + rand() % 81;
+      if (scanning != !(rand() % 3))
+      {
+        scanning = !scanning;
+        reference.ScanIndex = queue.ReadIndex;
+        reference.Scan = reference.Read;
+        reference.History = 0;
+      }
+    }
+
+    if ((unsigned)(rand() % 100) < producer_share)
+      producer();
+    else if (scanning)
+      scan();
+    else
+      service();
+  }
+}
+
+/* how many messages of the mix fill an empty queue of the given size */
+static unsigned fill(uint32_t size)
+{
+  struct CANmessage message;
+  unsigned count = 0;
+
+  CANqueue_Init(&queue, storage, size);
+  for (;;)
+  {
+    random_message(&message);
+    if (!CANqueue_Put(&queue, &message))
+      return count;
+    count++;
+  }
+}
+
+static int run(const struct mix_case *mixture, unsigned long steps)
+{
+  uint32_t size;
+  unsigned index, sizes = 0;
+
+  mix = mixture;
+  put = refused = 0;
+
+  for (size = 2 * CANQUEUE_RECORD_MAX; size <= 3 * CANQUEUE_RECORD_MAX; size++, sizes++)
+  {
+    run_size(size, steps);
+    if (reference.Failures)
+      return 0;
+  }
+  for (index = 0; index < sizeof(firmware_sizes) / sizeof(firmware_sizes[0]); index++, sizes++)
+  {
+    run_size(firmware_sizes[index], steps);
+    if (reference.Failures)
+      return 0;
+  }
+
+  printf("%-24s %5u %10lu %9.2f%%", mix->Name, sizes, put, 100.0 * refused / (put + refused));
+  for (index = 0; index < sizeof(firmware_sizes) / sizeof(firmware_sizes[0]); index++)
+    printf(" %10u", fill(firmware_sizes[index]));
+  printf("\n");
+
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long steps = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000;
+  unsigned index, passed = 0;
+
+  if (steps < 1)
+  {
+    fprintf(stderr, "usage: %s [steps]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case                     sizes        put   refused  fill %4u  fill %4u\n", (unsigned)firmware_sizes[0], (unsigned)firmware_sizes[1]);
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], steps);
+
+  return Bench_Report(passed, BENCH_CASES(cases), " (CANMESSAGE_DATA_MAX of %u)", CANMESSAGE_DATA_MAX);
+}
@@ -0,0 +1,166 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    find the frames of an ID in a range of time in a capture, by way of a sidecar index (canindex.h)
+
+      canseek [-b] [-z1|-z2] [-q] [-j threads] capture [id|all [from [to]]]
+
+    With just the capture, builds its index (capture.idx) afresh and reports on it.  With an ID (hex; taken as 
+    extended if given with more than 3 digits, or above 7FF) or "all", writes its frames from from to to (seconds 
+    after the first frame of the capture; by default, all of it) to standard output as a candump -l log, building 
+    the index first if there is none, or it is not of the capture as it now is.  Times in the log are those of the 
+    sniffer, unwrapped.
+
+    -b is for a D4 capture; -z and -q say what the text records carry, as the sniffer was told (by default 'Z2' and 
+    no sequence numbers).  -j is how many threads to build with (by default, one per core).
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "canindex.h"
+
+static double now(void)
+{
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+static void emit_candump(void *context, uint64_t time, const struct CANmessage *msg)
+{
+  unsigned long *frames = context;
+  char line[LAWICEL_CANDUMP_MAX + 8];
+
+  fwrite(line, 1, LAWICEL_FormatCandump(line, time, "can0", msg), stdout);
+  (*frames)++;
+}
+
+static int build(const char *path, const char *index_path, const struct canindex_options *options)
+{
+  struct canindex_stats stats;
+  double start = now(), elapsed;
+
+  if (!CANindex_Build(path, index_path, options, &stats))
+  {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  elapsed = now() - start;
+
+  fprintf(stderr, "indexed %s: %llu frames of %u IDs in %u segments, %.1f s with %u threads; %s is %llu bytes", path, (unsigned long long)stats.Frames, stats.Keys, stats.Segments, elapsed, options->Threads, index_path, (unsigned long long)stats.IndexBytes);
+  if (stats.Errors)
+    fprintf(stderr, " (%lu records could not be read)", stats.Errors);
+  fprintf(stderr, "\n");
+
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  struct canindex_options options = { 0, { 8, 0 }, 0 };
+  struct canindex index;
+  const char *path, *id;
+  char index_path[4096];
+  unsigned long frames = 0, segments;
+  uint64_t from = 0, to = UINT64_MAX;
+  uint32_t key;
+  double start;
+  char *end;
+  int arg;
+
+  for (arg = 1; (arg < argc) && ('-' == argv[arg][0]); arg++)
+  {
+    if (!strcmp(argv[arg], "-b"))
+      options.Binary = 1;
+    else if ( !strcmp(argv[arg], "-z1") || !strcmp(argv[arg], "-z2") )
+      options.Format.TimestampDigits = ('1' == argv[arg][2]) ? 4 : 8;
+    else if (!strcmp(argv[arg], "-q"))
+      options.Format.Sequence = 1;
+    else if ( !strcmp(argv[arg], "-j") && (arg + 1 < argc) )
+      options.Threads = atoi(argv[++arg]);
+    else
+      break;
+  }
+  if ( (arg >= argc) || (argc - arg > 4) )
+  {
+    fprintf(stderr, "usage: %s [-b] [-z1|-z2] [-q] [-j threads] capture [id|all [from [to]]]\n", argv[0]);
+    return 1;
+  }
+  if (!options.Threads)
+    options.Threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+
+  path = argv[arg++];
+  snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+  if (arg == argc)
+    return (build(path, index_path, &options)) ? 0 : 1;
+
+  id = argv[arg++];
+  if (!strcmp(id, "all"))
+  {
+    key = CANINDEX_KEY_ANY;
+  }
+  else
+  {
+    key = (uint32_t)strtoul(id, &end, 16);
+    if ( *end || (end == id) || (key > 0x1FFFFFFF) )
+    {
+      fprintf(stderr, "%s: not an ID\n", id);
+      return 1;
+    }
+    if ( (strlen(id) > 3) || (key > 0x7FF) )
+      key |= CANINDEX_KEY_EXT;
+  }
+
+  if (!CANindex_Open(&index, path, index_path))
+  {
+    if ( !build(path, index_path, &options) || !CANindex_Open(&index, path, index_path) )
+    {
+      fprintf(stderr, "%s: %s\n", index_path, strerror(errno));
+      return 1;
+    }
+  }
+
+  /* seconds after the first frame */
+  if (index.Header->Segments)
+  {
+    if (arg < argc)
+      from = index.Segment[0].Time + (uint64_t)(1e6 * strtod(argv[arg++], NULL));
+    if (arg < argc)
+      to = index.Segment[0].Time + (uint64_t)(1e6 * strtod(argv[arg++], NULL));
+  }
+
+  start = now();
+  segments = CANindex_Query(&index, key, from, to, emit_candump, &frames);
+  fprintf(stderr, "%lu frames from %lu of %u segments in %.3f ms\n", frames, segments, index.Header->Segments, 1e3 * (now() - start));
+
+  CANindex_Close(&index);
+  return 0;
+}
@@ -0,0 +1,320 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test of cansettings.c against emulated flash
+
+      cansettingsbench [saves]
+
+    Provides CANsettings_FlashErase() and CANsettings_FlashProgram() over a page in RAM that behaves as the STM32F0's 
+    flash does: erasing sets every bit, programming can only clear bits, and programming a halfword that is not 
+    erased fails (PGERR) and leaves it as it was.  Then, for saves (default 100000) of random settings:
+
+      - with power never lost: each save must be loaded back as it was, a save of what is already there must not
+        touch the flash, and the page must be erased no more than once every CANSETTINGS_SLOTS saves;
+      - with power lost part way through one save in two: at a random erase or program (a torn erase leaves any mix
+        of halfwords erased and not, and a torn program clears only some of the bits it should), after which the 
+        page is loaded as at power up.  What loads must be either the settings saved before or those being saved, 
+        or none at all if there were none before; if the save had begun to erase the page, it may also be none, or 
+        any settings the erase had not yet reached.  The save made next must load back as it was;
+      - a page full of records with a wrong marker or checksum, or of random bits, must load as no settings at all
+        (or as those saved over it since).
+
+    Reports the erases and programs per save, and exits non-zero if any check fails.
+*/
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cansettings.h"
+#include "bench.h"
+
+static uint16_t page[CANSETTINGS_PAGE_SIZE / 2];
+
+static struct
+{
+  unsigned long Erases, Programs, Failures;
+  long Budget;         /* flash operations before power is lost; negative if it never is */
+  int Erased;          /* set once the page has been erased (or begun to be) by the save in progress */
+  jmp_buf PowerLost;
+} flash;
+
+uint32_t CANsettings_FlashErase(const uint16_t *address)
+{
+  unsigned index;
+
+  if (address != page)
+    return 0;
+
+  if (0 == flash.Budget--)
+  {
+    for (index = 0; index < CANSETTINGS_PAGE_SIZE / 2; index++)
+      if (rand() & 1)
+        page[index] = 0xFFFF;
+    flash.Erased = 1;
+    longjmp(flash.PowerLost, 1);
+  }
+
+  flash.Erases++;
+  flash.Erased = 1;
+  memset(page, 0xFF, sizeof(page));
+  return 1;
+}
+
+uint32_t CANsettings_FlashProgram(const uint16_t *address, uint16_t value)
+{
+  uint16_t *target = page + (address - page);
+
+  if ( (address < page) || (address >= page + CANSETTINGS_PAGE_SIZE / 2) )
+    return 0;
+
+  if (0 == flash.Budget--)
+  {
+    *target &= value | (uint16_t)rand();
+    longjmp(flash.PowerLost, 1);
+  }
+
+  flash.Programs++;
+  if (0xFFFF != *target)
+  {
+    flash.Failures++;
+    return 0;
+  }
+
+  *target = value;
+  return 1;
+}
+
+static void random_settings(struct cansettings *settings)
+{
+  memset(settings, 0, sizeof(*settings));
+  settings->Bitrate = rand() % 9;
+  settings->OutputMode = rand() % 5;
+  settings->Autostart = rand() % 2;
+  settings->RetainDepth = rand() % 256;
+  settings->FilterId = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+  settings->FilterMask = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static int same(const struct cansettings *a, const struct cansettings *b)
+{
+  return !memcmp(a, b, sizeof(struct cansettings));
+}
+
+static int steady(unsigned long saves)
+{
+  struct cansettings saved, loaded;
+  unsigned long count, programs;
+
+  memset(page, 0xFF, sizeof(page));
+  memset(&flash, 0, sizeof(flash));
+  flash.Budget = -1;
+
+  if (CANsettings_Load(page, &loaded))
+  {
+    printf("steady: an erased page loaded\n");
+    return 0;
+  }
+
+  for (count = 0; count < saves; count++)
+  {
+    random_settings(&saved);
+    if (!CANsettings_Save(page, &saved) || !CANsettings_Load(page, &loaded) || !same(&saved, &loaded))
+    {
+      printf("steady: save %lu did not load back\n", count);
+      return 0;
+    }
+
+    programs = flash.Programs;
+    if (!CANsettings_Save(page, &saved) || (programs != flash.Programs))
+    {
+      printf("steady: saving save %lu again wrote to the flash\n", count);
+      return 0;
+    }
+  }
+
+  printf("steady     %8lu saves  %6.4f erases  %5.2f programs per save  %lu failed\n", saves, (double)flash.Erases / saves, (double)flash.Programs / saves, flash.Failures);
+
+  return (flash.Erases <= saves / CANSETTINGS_SLOTS + 1) && !flash.Failures;
+}
+
+/* returns non-zero if power was lost part way through the save; *saved is what it returned if not */
+static int power_lost_during(const struct cansettings *settings, uint32_t *saved)
+{
+  if (setjmp(flash.PowerLost))
+    return 1;
+
+  *saved = CANsettings_Save(page, settings);
+  return 0;
+}
+
+/* whether the settings were in a record of the page as it was */
+static int was_saved(const uint16_t *image, const struct cansettings *settings)
+{
+  unsigned slot;
+
+  for (slot = 0; slot < CANSETTINGS_SLOTS; slot++)
+    if (!memcmp(image + slot * CANSETTINGS_RECORD_HALFWORDS, settings, sizeof(struct cansettings)))
+      return 1;
+
+  return 0;
+}
+
+static int torn(unsigned long saves)
+{
+  static uint16_t image[CANSETTINGS_PAGE_SIZE / 2];
+  struct cansettings before, saving, loaded;
+  unsigned long count, tears = 0, kept = 0, taken = 0, older = 0, lost = 0;
+  uint32_t saved;
+  int have_before = 0, loads;
+
+  memset(page, 0xFF, sizeof(page));
+  memset(&flash, 0, sizeof(flash));
+
+  for (count = 0; count < saves; count++)
+  {
+    random_settings(&saving);
+    flash.Budget = (rand() & 1) ? rand() % (CANSETTINGS_RECORD_HALFWORDS + 2) : -1;
+    flash.Erased = 0;
+    memcpy(image, page, sizeof(page));
+
+    if (power_lost_during(&saving, &saved))
+    {
+      /* power up again */
+      tears++;
+      flash.Budget = -1;
+      loads = CANsettings_Load(page, &loaded);
+      if (loads && have_before && same(&loaded, &before))
+      {
+        kept++;
+      }
+      else if (loads && same(&loaded, &saving))
+      {
+        taken++;
+        before = saving;
+        have_before = 1;
+      }
+      else if (loads && flash.Erased && was_saved(image, &loaded))
+      {
+        older++;
+        before = loaded;
+      }
+      else if (!loads && (!have_before || flash.Erased))
+      {
+        lost++;
+        have_before = 0;
+      }
+      else
+      {
+        printf("torn: after save %lu was cut short, %s loaded\n", count, loads ? "something else" : "nothing");
+        return 0;
+      }
+      continue;
+    }
+
+    if (!saved)
+    {
+      printf("torn: save %lu failed\n", count);
+      return 0;
+    }
+    flash.Budget = -1;
+    if (!CANsettings_Load(page, &loaded) || !same(&loaded, &saving))
+    {
+      printf("torn: save %lu did not load back\n", count);
+      return 0;
+    }
+    before = saving;
+    have_before = 1;
+  }
+
+  printf("torn       %8lu saves  %8lu cut short: %lu kept the last, %lu took the new, %lu an older, %lu none\n", saves, tears, kept, taken, older, lost);
+
+  return 1;
+}
+
+static int garbage(void)
+{
+  struct cansettings saved, loaded;
+  unsigned index, round;
+
+  memset(&flash, 0, sizeof(flash));
+  flash.Budget = -1;
+
+  for (round = 0; round < 1000; round++)
+  {
+    /* a page of records from another firmware, of damaged ones, or of random bits */
+    memset(page, 0xFF, sizeof(page));
+    random_settings(&saved);
+    for (index = 0; index < CANSETTINGS_SLOTS; index++)
+    {
+      if (!CANsettings_Save(page, &saved))
+        return 0;
+      saved.FilterId++;
+    }
+    for (index = 0; index < CANSETTINGS_PAGE_SIZE / 2; index++)
+      switch (round % 3)
+      {
+      case 0: if ((CANSETTINGS_RECORD_HALFWORDS - 1) == index % CANSETTINGS_RECORD_HALFWORDS) page[index] ^= 0x0100; break; /* marker */
+      case 1: if ((CANSETTINGS_RECORD_HALFWORDS - 2) == index % CANSETTINGS_RECORD_HALFWORDS) page[index] ^= 1 << (rand() % 16); break; /* checksum */
+      default: page[index] = (uint16_t)rand(); break;
+      }
+
+    if (CANsettings_Load(page, &loaded))
+    {
+      printf("garbage: round %u loaded settings from a page of bad records\n", round);
+      return 0;
+    }
+
+    random_settings(&saved);
+    if (!CANsettings_Save(page, &saved) || !CANsettings_Load(page, &loaded) || !same(&saved, &loaded))
+    {
+      printf("garbage: round %u could not save over a page of bad records\n", round);
+      return 0;
+    }
+  }
+
+  printf("garbage    %8u pages of bad records ignored and saved over\n", round);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long saves = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+  unsigned passed;
+
+  if (saves < CANSETTINGS_SLOTS)
+  {
+    fprintf(stderr, "usage: %s [saves (at least %u)]\n", argv[0], (unsigned)CANSETTINGS_SLOTS);
+    return 1;
+  }
+
+  srand(1);
+  printf("%u byte page, %u slots\n", CANSETTINGS_PAGE_SIZE, (unsigned)CANSETTINGS_SLOTS);
+  passed = steady(saves);
+  passed += torn(saves);
+  passed += garbage();
+
+  return Bench_Report(passed, 3, NULL);
+}
@@ -0,0 +1,151 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    decode the signals of a capture, or of a sniffer as it sends, by a DBC file (candbc.h) into time series
+
+      cansignals [-z0|-z1|-z2] [-q] database.dbc [signal ...] < capture > series.csv
+
+    Reads the sniffer's text output (or a candump -l log) from standard input, and writes a line of CSV to standard 
+    output for each value of each signal (or just those named, as "message.signal"): time in seconds (the 
+    sniffer's, unwrapped, or the log's), signal, value.  -z and -q say what the records carry, as the sniffer was 
+    told (by default 'Z2' and no sequence numbers).  Output is flushed as each read from the input is done with, so 
+    that a live sniffer may be piped through.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "candbc.h"
+#include "lawicel.h"
+
+#define INPUT_SIZE 65536
+#define LINE_MAX_LENGTH 256
+
+int main(int argc, char *argv[])
+{
+  struct lawicel_format format = { 8, 0 };
+  struct lawicel_clock clock = { 0, 0, 0 };
+  struct candbc dbc;
+  struct candbc_sample sample[CANDBC_SAMPLES_MAX];
+  struct CANmessage msg;
+  static char buffer[INPUT_SIZE + 1];
+  unsigned char *wanted = NULL;
+  unsigned length = 0, count, index, start, which;
+  uint64_t wrap, time = 0;
+  int arg, signal, timed, any = 1;
+  ssize_t got;
+
+  for (arg = 1; (arg < argc) && ('-' == argv[arg][0]); arg++)
+  {
+    if ( !strcmp(argv[arg], "-z0") || !strcmp(argv[arg], "-z1") || !strcmp(argv[arg], "-z2") )
+      format.TimestampDigits = ('0' == argv[arg][2]) ? 0 : ('1' == argv[arg][2]) ? 4 : 8;
+    else if (!strcmp(argv[arg], "-q"))
+      format.Sequence = 1;
+    else
+      break;
+  }
+  if (arg >= argc)
+  {
+    fprintf(stderr, "usage: %s [-z0|-z1|-z2] [-q] database.dbc [signal ...] < capture > series.csv\n", argv[0]);
+    return 1;
+  }
+  if (!CANdbc_Load(&dbc, argv[arg]))
+  {
+    fprintf(stderr, "%s: %s\n", argv[arg], strerror(errno));
+    return 1;
+  }
+  if (dbc.Errors)
+    fprintf(stderr, "%s: %lu lines passed over, the first being line %lu\n", argv[arg], dbc.Errors, dbc.FirstError);
+
+  if (arg + 1 < argc)
+  {
+    any = 0;
+    wanted = calloc(dbc.Signals, 1);
+    if (!wanted)
+    {
+      perror(argv[0]);
+      return 1;
+    }
+    for (arg++; arg < argc; arg++)
+    {
+      signal = CANdbc_Find(&dbc, argv[arg]);
+      if (signal < 0)
+      {
+        fprintf(stderr, "%s: no such signal\n", argv[arg]);
+        return 1;
+      }
+      wanted[signal] = 1;
+    }
+  }
+
+  wrap = LAWICEL_Wrap(&format);
+  printf("time,signal,value\n");
+
+  while ((got = read(0, buffer + length, INPUT_SIZE - length)) > 0)
+  {
+    length += (unsigned)got;
+    buffer[length] = '\0';
+
+    for (start = 0, index = 0; index < length; index++)
+    {
+      if ( ('\r' != buffer[index]) && ('\n' != buffer[index]) )
+        continue;
+      buffer[index] = '\0';
+
+      if ( ('(' == buffer[start]) && LAWICEL_ParseCandump(buffer + start, &msg, &time) )
+        timed = 1;
+      else if (LAWICEL_Parse(buffer + start, &format, &msg, &timed))
+      {
+        if (timed)
+          time = LAWICEL_Unwrap(&clock, msg.Timestamp, wrap);
+      }
+      else
+      {
+        start = index + 1;
+        continue;
+      }
+
+      count = CANdbc_Decode(&dbc, &msg, sample);
+      for (which = 0; which < count; which++)
+        if ( any || wanted[sample[which].Signal] )
+          printf("%llu.%06u,%s,%.10g\n", (unsigned long long)(time / 1000000), (unsigned)(time % 1000000), dbc.Signal[sample[which].Signal].Name, sample[which].Value);
+      start = index + 1;
+    }
+
+    /* keep what is left of a line for the next read, unless it is far too long to be a record */
+    length -= start;
+    if (length > LINE_MAX_LENGTH)
+      length = 0;
+    memmove(buffer, buffer + start, length);
+    fflush(stdout);
+  }
+
+  CANdbc_Free(&dbc);
+  free(wanted);
+
+  return 0;
+}
@@ -0,0 +1,312 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of canstats.c under ID churn
+
+      canstatsbench [seconds]
+
+    For each of a set of cases, makes up seconds (default 60) of traffic: a number of periodic standard IDs (periods 
+    of 10ms to 1s, each message up to JITTER late), and a rate of one-shot extended IDs such as a diagnostic scan 
+    sends, never seen again.  The messages go through CANstats_Update() in order of time, and the table is dumped 
+    (and each entry restarted) once a second, as in mode 'D1'.  Built with CANMESSAGE_DATA_MAX of 64, half the 
+    messages are CAN FD, of any length.
+
+    Beside the table is a copy of what each slot should hold: every update is checked against it (count, shortest 
+    and longest interval, data, and that the ID is in the table just the once), each eviction of an entry with 
+    unreported messages must be counted in Evictions, and by the end every message must have been either reported 
+    or lost along with an evicted entry.  Reports the share of each kind lost and the time taken per update (less that of 
+    reading the clock around it).
+
+    Exits non-zero if any check fails, or if any periodic message is lost while fewer IDs are active than half the 
+    table (CANSTATS_ENTRIES).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canstats.h"
+#include "bench.h"
+
+#define SECOND 1000000UL
+#define PERIODIC_MAX 64
+#define JITTER 100 /* microseconds a periodic message may be late by */
+
+struct churn_case
+{
+  const char *Name;
+  unsigned Periodic;      /* standard IDs, each sent at a period of its own */
+  unsigned OneShots;      /* extended IDs a second, each sent once */
+};
+
+static const struct churn_case cases[] =
+{
+  { "4 periodic", 4, 0 },
+  { "16 periodic", 16, 0 },
+  { "32 periodic", 32, 0 },
+  { "48 periodic", 48, 0 },
+  { "16 + 20/s one-shot", 16, 20 },
+  { "24 + 200/s one-shot", 24, 200 },
+  { "8 + 5000/s scan", 8, 5000 },
+};
+
+static const uint32_t periods[] = { 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+
+/* what a slot of the table should hold */
+struct shadow
+{
+  uint32_t Key;
+  uint32_t Count;
+  uint32_t MinInterval;
+  uint32_t MaxInterval;
+  uint32_t LastTimestamp;
+};
+
+struct tally
+{
+  unsigned long Sent;
+  unsigned long Reported;
+  unsigned long Lost;
+};
+
+static int by_timestamp(const void *a, const void *b)
+{
+  const struct CANmessage *x = a, *y = b;
+
+  return (x->Timestamp > y->Timestamp) - (x->Timestamp < y->Timestamp);
+}
+
+static int dump(struct canstats_table *table, struct shadow *shadow, struct tally *tally)
+{
+  unsigned index;
+  struct canstats_entry *entry;
+
+  for (index = 0; index < CANSTATS_ENTRIES; index++)
+  {
+    entry = &table->entry[index];
+    if (0 == entry->Count)
+      continue;
+    if (entry->Count != shadow[index].Count)
+      return 0;
+
+    tally[!!(entry->Key & CANSTATS_KEY_EXT)].Reported += entry->Count;
+    CANstats_Restart(entry);
+    shadow[index].Count = 0;
+    shadow[index].MinInterval = CANSTATS_NO_INTERVAL;
+    shadow[index].MaxInterval = 0;
+  }
+
+  return 1;
+}
+
+/* the message's key is now in the table just the once, in the slot the shadow says, and with the figures it says */
+static int check(const struct canstats_table *table, const struct shadow *shadow, const struct canstats_entry *entry, const struct CANmessage *message, uint32_t key)
+{
+  unsigned index, found = 0, slot = entry - table->entry;
+
+  for (index = 0; index < CANSTATS_ENTRIES; index++)
+    found += (key == table->entry[index].Key);
+
+  return (1 == found) && (key == entry->Key) && (key == shadow[slot].Key) &&
+    (entry->Count == shadow[slot].Count) && (entry->MinInterval == shadow[slot].MinInterval) &&
+    (entry->MaxInterval == shadow[slot].MaxInterval) && (entry->DLC == message->DLC) &&
+    (entry->Length == CANMESSAGE_LENGTH(message)) && !memcmp(entry->Data, message->Data, entry->Length);
+}
+
+static int run(const struct churn_case *churn, unsigned seconds, double overhead)
+{
+  static struct canstats_table table;
+  struct shadow shadow[CANSTATS_ENTRIES];
+  struct tally tally[2]; /* periodic (standard IDs), one-shot (extended IDs) */
+  uint32_t id[PERIODIC_MAX], period[PERIODIC_MAX], phase[PERIODIC_MAX], key, interval, evictions = 0, next_scan = 0;
+  unsigned second, index, count, messages, slot, previous, capacity;
+  unsigned long updates = 0;
+  struct CANmessage *message, *batch;
+  struct canstats_entry *entry;
+  double start, elapsed = 0;
+
+  /* the busiest second: every periodic ID at 100 a second, plus the one-shots */
+  capacity = churn->Periodic * 100 + churn->OneShots;
+  batch = malloc(capacity * sizeof(struct CANmessage));
+  if (!batch)
+    return 0;
+
+  for (index = 0; index < churn->Periodic; index++)
+  {
+    do
+    {
+      id[index] = rand() & 0x7FF;
+      for (count = 0; count < index; count++)
+        if (id[count] == id[index])
+          break;
+    } while (count < index);
+    period[index] = periods[rand() % (sizeof(periods) / sizeof(periods[0]))];
+    phase[index] = rand() % period[index];
+  }
+
+  CANstats_Init(&table);
+  for (index = 0; index < CANSTATS_ENTRIES; index++)
+    shadow[index].Key = CANSTATS_KEY_EMPTY;
+  memset(tally, 0, sizeof(tally));
+
+  for (second = 0; second < seconds; second++)
+  {
+    messages = 0;
+
+    for (index = 0; index < churn->Periodic; index++)
+    {
+      for (interval = phase[index]; interval < SECOND; interval += period[index])
+      {
+        message = &batch[messages++];
+        message->Id = id[index];
+        message->flags = CANMESSAGE_FLAG_STDID;
+        message->Timestamp = second * SECOND + interval;
+        if (interval + JITTER < SECOND)
+          message->Timestamp += rand() % JITTER;
+      }
+      phase[index] = interval - SECOND;
+    }
+
+    for (index = 0; index < churn->OneShots; index++)
+    {
+      message = &batch[messages++];
+      message->Id = (0x18DA0000UL + next_scan++) & 0x1FFFFFFFUL;
+      message->flags = 0;
+      message->Timestamp = second * SECOND + rand() % SECOND;
+    }
+
+    qsort(batch, messages, sizeof(struct CANmessage), by_timestamp);
+
+    for (index = 0; index < messages; index++)
+    {
+      message = &batch[index];
+      message->Timestamp += 0xFFF00000UL; /* so as to wrap early on */
+      message->DLC = rand() % 9;
+      if ((CANMESSAGE_DATA_MAX > 8) && (rand() & 1))
+      {
+        message->flags |= CANMESSAGE_FLAG_FD;
+        message->DLC = rand() % 16;
+      }
+      for (count = 0; count < CANMESSAGE_DATA_MAX; count++)
+        message->Data[count] = (uint8_t)rand();
+
+      key = message->Id | ((message->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANSTATS_KEY_EXT);
+      for (previous = 0; previous < CANSTATS_ENTRIES; previous++)
+        if (key == table.entry[previous].Key)
+          break;
+
+      start = Bench_Now();
+      entry = CANstats_Update(&table, message);
+      elapsed += Bench_Now() - start;
+      updates++;
+
+      slot = entry - table.entry;
+      if (previous < CANSTATS_ENTRIES)
+      {
+        interval = message->Timestamp - shadow[slot].LastTimestamp;
+        if (interval < shadow[slot].MinInterval)
+          shadow[slot].MinInterval = interval;
+        if (interval > shadow[slot].MaxInterval)
+          shadow[slot].MaxInterval = interval;
+      }
+      else
+      {
+        /* a new entry, pushing out whatever was there */
+        if ( (CANSTATS_KEY_EMPTY != shadow[slot].Key) && shadow[slot].Count )
+        {
+          evictions++;
+          tally[!!(shadow[slot].Key & CANSTATS_KEY_EXT)].Lost += shadow[slot].Count;
+        }
+        shadow[slot].Key = key;
+        shadow[slot].Count = 0;
+        shadow[slot].MinInterval = CANSTATS_NO_INTERVAL;
+        shadow[slot].MaxInterval = 0;
+      }
+      shadow[slot].Count++;
+      shadow[slot].LastTimestamp = message->Timestamp;
+      tally[!!(key & CANSTATS_KEY_EXT)].Sent++;
+
+      if (!check(&table, shadow, entry, message, key))
+      {
+        printf("%s: second %u, ID %08X: table disagrees\n", churn->Name, second, (unsigned)key);
+        free(batch);
+        return 0;
+      }
+    }
+
+    if (!dump(&table, shadow, tally))
+    {
+      printf("%s: second %u: dump disagrees\n", churn->Name, second);
+      free(batch);
+      return 0;
+    }
+  }
+
+  free(batch);
+
+  printf("%-22s %5u %6u  %9lu %7.3f%%  %9lu %7.3f%%  %8u  %5.1f ns\n", churn->Name, churn->Periodic, churn->OneShots,
+    tally[0].Sent, 100.0 * tally[0].Lost / tally[0].Sent, tally[1].Sent, tally[1].Sent ? 100.0 * tally[1].Lost / tally[1].Sent : 0.0,
+    (unsigned)table.Evictions, 1e9 * (elapsed / updates - overhead));
+
+  for (index = 0; index < 2; index++)
+    if (tally[index].Reported + tally[index].Lost != tally[index].Sent)
+    {
+      printf("%s: %lu sent, but %lu reported and %lu lost\n", churn->Name, tally[index].Sent, tally[index].Reported, tally[index].Lost);
+      return 0;
+    }
+
+  if (evictions != table.Evictions)
+  {
+    printf("%s: %u evictions counted, but %u made\n", churn->Name, (unsigned)table.Evictions, (unsigned)evictions);
+    return 0;
+  }
+
+  if ( (churn->Periodic + churn->OneShots <= CANSTATS_ENTRIES / 2) && tally[0].Lost )
+  {
+    printf("%s: periodic messages lost with the table no more than half full\n", churn->Name);
+    return 0;
+  }
+
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned seconds = (argc > 1) ? atoi(argv[1]) : 60, index, passed = 0;
+  double overhead;
+
+  if (seconds < 1)
+  {
+    fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  overhead = Bench_NowOverhead();
+  printf("case                   periodic one-shot/s  periodic     lost  one-shot     lost  evictions  update\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], seconds, overhead);
+
+  return Bench_Report(passed, BENCH_CASES(cases), " (%u entries, probing at most %u)", CANSTATS_ENTRIES, CANSTATS_PROBE_LIMIT);
+}
@@ -0,0 +1,175 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "cansync.h"
+
+#define CANSYNC_FIT_MIN 16 /* records needed before the fit is trusted */
+
+void CANsync_Init(struct cansync *sync)
+{
+  memset(sync, 0, sizeof(*sync));
+}
+
+static int64_t round_time(double time)
+{
+  return (int64_t)((time < 0) ? time - 0.5 : time + 0.5);
+}
+
+/* the point count points back from the last */
+static const struct cansync_point *point_back(const struct cansync *sync, unsigned count)
+{
+  return &sync->Point[(sync->Head + sync->Count - 1 - count) % CANSYNC_POINTS];
+}
+
+static void fit(struct cansync *sync)
+{
+  const struct cansync_point *point, *last = point_back(sync, 0), *older, *newer;
+  unsigned count = (sync->Count < CANSYNC_DEVICE_POINTS) ? sync->Count : CANSYNC_DEVICE_POINTS, index, hull;
+  int64_t device_mean = 0, frame_mean = 0, middle;
+  double dd = 0, df = 0, d, f, slope;
+
+  /* frame against device: means first (relative to the last point), so that the sums are of small numbers */
+  for (index = 0; index < count; index++)
+  {
+    point = point_back(sync, index);
+    device_mean += point->Device - last->Device;
+    frame_mean += point->Frame - last->Frame;
+  }
+  device_mean = last->Device + device_mean / (int64_t)count;
+  frame_mean = last->Frame + frame_mean / (int64_t)count;
+
+  for (index = 0; index < count; index++)
+  {
+    point = point_back(sync, index);
+    d = (double)(point->Device - device_mean);
+    f = (double)(point->Frame - frame_mean);
+    dd += d * d;
+    df += d * f;
+  }
+  if ( (dd <= 0) || (sync->Count < 2) )
+    return;
+
+  /*
+      host against frame: the edge of the lower convex hull of the points that spans the middle of the window, 
+      being the line under all of them that is closest to them on the whole
+  */
+  for (hull = index = 0; index < sync->Count; index++)
+  {
+    point = point_back(sync, sync->Count - 1 - index); /* oldest first */
+    while (hull >= 2)
+    {
+      older = &sync->Point[sync->Hull[hull - 2]];
+      newer = &sync->Point[sync->Hull[hull - 1]];
+      if ( (double)(newer->Frame - older->Frame) * (double)(point->Host - older->Host) > (double)(newer->Host - older->Host) * (double)(point->Frame - older->Frame) )
+        break;
+      hull--;
+    }
+    sync->Hull[hull++] = point - sync->Point;
+  }
+
+  middle = (point_back(sync, sync->Count - 1)->Frame + last->Frame) / 2;
+  for (index = 1; (index < hull - 1) && (sync->Point[sync->Hull[index]].Frame < middle); index++);
+  older = &sync->Point[sync->Hull[index - 1]];
+  newer = &sync->Point[sync->Hull[index]];
+  slope = (double)(newer->Host - older->Host) / (double)(newer->Frame - older->Frame);
+
+  sync->FrameSlope = df / dd;
+  sync->HostSlope = slope;
+  sync->DeviceMean = device_mean;
+  sync->FrameMean = frame_mean;
+  sync->HostBase = older->Host + round_time(slope * (double)(frame_mean - older->Frame));
+  sync->Fitted = (sync->Count >= CANSYNC_FIT_MIN);
+}
+
+int CANsync_Record(struct cansync *sync, const char *line, uint64_t arrival)
+{
+  struct cansync_point *point;
+  uint32_t frame, timestamp;
+  int64_t device, expected, step;
+
+  if ( ('u' != line[0]) || !LAWICEL_Hex(line + 1, 3, &frame) || !LAWICEL_Hex(line + 4, 8, &timestamp) || (frame > 0x7FF) )
+    return 0;
+
+  device = (int64_t)LAWICEL_Unwrap(&sync->Clock, timestamp, 1ULL << 32);
+
+  if (sync->Count)
+  {
+    point = &sync->Point[(sync->Head + sync->Count - 1) % CANSYNC_POINTS]; /* the last */
+    if (device <= point->Device)
+    {
+      /* the device went backwards (restarted); start over */
+      sync->Count = sync->Head = 0;
+      sync->Fitted = 0;
+      sync->Errors++;
+    }
+    else
+    {
+      /* the frames the device's clock says went by, corrected to the nearest that ends on this frame number */
+      expected = (device - point->Device + CANSYNC_FRAME / 2) / CANSYNC_FRAME;
+      step = ((int64_t)frame - ((sync->Frames + expected) & 0x7FF)) & 0x7FF;
+      if (step >= 0x400)
+        step -= 0x800;
+      sync->Frames += expected + step;
+    }
+  }
+  if (0 == sync->Count)
+    sync->Frames = frame;
+
+  if (CANSYNC_POINTS == sync->Count)
+  {
+    sync->Head = (sync->Head + 1) % CANSYNC_POINTS;
+    sync->Count--;
+  }
+  point = &sync->Point[(sync->Head + sync->Count++) % CANSYNC_POINTS];
+  point->Frame = sync->Frames * CANSYNC_FRAME;
+  point->Device = device;
+  point->Host = (int64_t)arrival;
+  sync->LastTimestamp = timestamp;
+  sync->Records++;
+
+  fit(sync);
+
+  return 1;
+}
+
+int CANsync_ToHost(const struct cansync *sync, uint32_t timestamp, uint64_t *host)
+{
+  const struct cansync_point *last;
+  int64_t device;
+  double frame;
+
+  if (!sync->Fitted)
+    return 0;
+
+  /* the timestamp is taken to be within half the wrap of the last record's */
+  last = point_back(sync, 0);
+  device = last->Device + (int32_t)(timestamp - sync->LastTimestamp);
+
+  /* both relative to the mean frame time */
+  frame = sync->FrameSlope * (double)(device - sync->DeviceMean);
+  *host = (uint64_t)(sync->HostBase + round_time(sync->HostSlope * frame));
+
+  return 1;
+}
@@ -0,0 +1,86 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANSYNC_H_
+#define CANSYNC_H_
+
+#include <stdint.h>
+#include "lawicel.h"
+
+/*
+    putting a sniffer's timestamps on the host's clock by way of the USB frame counter
+
+    With 'Z2', the sniffer sends a 'u' record once a second: the number of a USB frame and the device time of its SOF.  
+    The host sends the SOFs, from the clock of its USB controller, so the frame counter is a clock both ends see; 
+    the sniffer's HSI48 is trimmed to it by CRS, leaving only what drift the trimming steps allow.
+
+    Two straight lines are fitted.  Frame time against device time is fitted by least squares over the last 
+    CANSYNC_DEVICE_POINTS records, short enough to follow the sniffer's drift as its temperature changes (its SOF 
+    times only jitter by its interrupt latency).  Host time against frame time is fitted over all of the last 
+    CANSYNC_POINTS records, as both clocks are the host's own and drift apart only slowly; each record arrives late 
+    by however long it took to get to us, so the line is drawn under them rather than through them, along the edge 
+    of their lower convex hull that spans the middle of the window (much as canmerge.c takes the least delay as its 
+    offset).  Some records will have gone out promptly.  That least latency (the frame in which the 
+    record went out, and the host's own) is the one thing no fit can see, and remains in the result; it is much 
+    the same for each sniffer on the one host, so it does not come between them.
+
+    Frame numbers wrap every 2.048 seconds; between records, the device's clock says how many frames went by, and 
+    the frame number gives the exact count.
+*/
+
+#define CANSYNC_POINTS 256
+#define CANSYNC_DEVICE_POINTS 16
+#define CANSYNC_FRAME 1000 /* microseconds per USB (full speed) frame */
+
+struct cansync_point
+{
+  int64_t Frame;  /* microseconds on the frame counter, unwrapped */
+  int64_t Device; /* microseconds on the device's clock, unwrapped */
+  int64_t Host;   /* microseconds on the host's clock, when the record arrived */
+};
+
+struct cansync
+{
+  struct cansync_point Point[CANSYNC_POINTS];
+  unsigned Head, Count;
+  struct lawicel_clock Clock;
+  uint32_t LastTimestamp;
+  int64_t Frames;     /* frame number, unwrapped */
+  unsigned Hull[CANSYNC_POINTS]; /* indices into Point[] of the lower convex hull, as last fitted */
+  int Fitted;
+  /* frame = FrameMean + FrameSlope * (device - DeviceMean); host = HostBase + HostSlope * (frame - FrameMean) */
+  int64_t DeviceMean, FrameMean, HostBase;
+  double FrameSlope, HostSlope;
+  unsigned long Records, Errors;
+};
+
+extern void CANsync_Init(struct cansync *sync);
+
+/* a 'u' record (ended by anything other than a hex digit, such as the CR) that arrived at host time arrival; returns zero if it is not one */
+extern int CANsync_Record(struct cansync *sync, const char *line, uint64_t arrival);
+
+/* the host time of a 'Z2' timestamp, if there have been enough records to tell (within half an hour of the last of them) */
+extern int CANsync_ToHost(const struct cansync *sync, uint32_t timestamp, uint64_t *host);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test of cansync.c on synthetic drift
+
+      cansyncbench [seconds]
+
+    For each of a set of cases, makes up seconds (default 3600) of a sniffer's 'u' records and message timestamps: 
+    the host's USB controller sends SOFs off a clock that drifts from the host's own, and the sniffer's clock drifts 
+    from the SOFs (constantly, and by a sine wave as of its temperature changing), starting just short of wrapping.  
+    The SOF is noted after an interrupt latency of a few microseconds (now and then much more), and each record 
+    arrives after a latency of its own: at least LATENCY_LEAST, mostly a few hundred microseconds more, and now and 
+    then many milliseconds more.  Some records go missing for longer than the frame counter takes to wrap.
+
+    Each message timestamp is put on the host's clock as soon as the message would have arrived, with the records 
+    that had arrived by then, and compared with the truth (plus LATENCY_LEAST, which no fit can see).  Exits non-zero 
+    if any case is ERROR_MAX or more out after its first WARMUP.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cansync.h"
+#include "bench.h"
+
+#define HOST_EPOCH 1600000000000000.0 /* host time (microseconds) of the first SOF */
+#define LATENCY_LEAST 1050.0          /* microseconds from SOF to the arrival of its record, at the least */
+#define WARMUP 60000000.0             /* microseconds before the results are judged */
+#define ERROR_MAX 100.0
+#define MESSAGES_PER_SECOND 500
+
+struct drift_case
+{
+  const char *Name;
+  double HostPpm;    /* the SOFs' clock, against the host's */
+  double DevicePpm;  /* the sniffer's clock, against the SOFs */
+  double SwingPpm;   /* and its swing either way */
+  double SwingPeriod; /* seconds */
+};
+
+static const struct drift_case cases[] =
+{
+  { "no drift", 0, 0, 0, 1 },
+  { "host fast", 80, 0, 0, 1 },
+  { "sniffer slow", 0, -50, 0, 1 },
+  { "both, warming", -60, 40, 10, 1800 },
+  { "both, swinging", 35, -20, 30, 900 },
+};
+
+static double uniform(void)
+{
+  return rand() / ((double)RAND_MAX + 1);
+}
+
+/* sniffer time of frame time phi (microseconds since the first SOF) */
+static double device_time(const struct drift_case *drift, double phi)
+{
+  double omega = 2 * M_PI / (drift->SwingPeriod * 1e6);
+
+  return (double)0xFFF00000U + phi + 1e-6 * (drift->DevicePpm * phi + drift->SwingPpm * (1 - cos(omega * phi)) / omega);
+}
+
+/* host time of frame time phi */
+static double host_time(const struct drift_case *drift, double phi)
+{
+  return HOST_EPOCH + phi * (1 + 1e-6 * drift->HostPpm);
+}
+
+static double record_latency(void)
+{
+  double latency = LATENCY_LEAST - 300 * log(1 - uniform());
+
+  return (uniform() < 0.02) ? latency + 20000 * uniform() : latency;
+}
+
+static double sof_latency(void)
+{
+  return (uniform() < 0.05) ? 3 + 40 * uniform() : 3 + 5 * uniform();
+}
+
+static int run(const struct drift_case *drift, unsigned seconds)
+{
+  struct cansync sync;
+  unsigned second, message, records = 0, misses = 0;
+  unsigned long judged = 0, unknown = 0;
+  double phi, arrival = 0, truth, error, error_sum = 0, error_max = 0, next_arrival;
+  uint64_t host;
+  uint32_t frame;
+  char line[16];
+
+  CANsync_Init(&sync);
+
+  for (second = 1; second <= seconds; second++)
+  {
+    /* the record of frame 1000 * second; a few go missing for longer than the frame counter's 2.048 seconds */
+    if ( (second % 600) >= 595 )
+    {
+      misses++;
+    }
+    else
+    {
+      phi = second * 1000.0 * CANSYNC_FRAME;
+      frame = (0x7F0 + second * 1000) & 0x7FF;
+      snprintf(line, sizeof(line), "u%03X%08X\r", (unsigned)frame, (unsigned)(uint32_t)(uint64_t)(device_time(drift, phi) + sof_latency()));
+      arrival = host_time(drift, phi) + record_latency();
+      if (!CANsync_Record(&sync, line, (uint64_t)arrival))
+      {
+        printf("%s: record %s not taken\n", drift->Name, line);
+        return 0;
+      }
+      records++;
+    }
+
+    /* the messages that arrive after this record, and before the next one does (at its least) */
+    next_arrival = host_time(drift, (second + 1) * 1000.0 * CANSYNC_FRAME) + LATENCY_LEAST;
+    for (message = 0; message < MESSAGES_PER_SECOND; message++)
+    {
+      phi = (second + uniform()) * 1000.0 * CANSYNC_FRAME;
+      truth = host_time(drift, phi);
+      if ( (truth + 1000 < arrival) || (truth + 1000 > next_arrival) )
+        continue;
+      if (!CANsync_ToHost(&sync, (uint32_t)(uint64_t)device_time(drift, phi), &host))
+      {
+        unknown++;
+        continue;
+      }
+      if (truth - HOST_EPOCH < WARMUP)
+        continue;
+      error = fabs((double)host - (truth + LATENCY_LEAST));
+      error_sum += error;
+      if (error > error_max)
+        error_max = error;
+      judged++;
+    }
+  }
+
+  printf("%-16s %5.0f ppm %5.0f%+4.0f ppm  %7lu  %6.1f us  %6.1f us\n", drift->Name, drift->HostPpm, drift->DevicePpm, drift->SwingPpm, judged, error_sum / judged, error_max);
+
+  return (error_max < ERROR_MAX) && (sync.Errors == 0) && judged;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned seconds = (argc > 1) ? atoi(argv[1]) : 3600, index, passed = 0;
+
+  if (seconds < 60)
+  {
+    fprintf(stderr, "usage: %s [seconds (at least 60)]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case             SOF clock  sniffer clock  messages  mean error  worst error (after the first %.0f s)\n", WARMUP / 1e6);
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], seconds);
+
+  return Bench_Report(passed, BENCH_CASES(cases), " (within %.0f us)", ERROR_MAX);
+}
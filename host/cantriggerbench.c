@@ -0,0 +1,241 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of cantrigger.c on replayed traffic
+
+      cantriggerbench [trace ...]
+
+    Reads the traces named on the command line (in the forms cancompbench takes), or if none is, makes one up of 
+    TRACE_FRAMES frames with IDs and data like those of a busy bus.  For each of TRIGGERS triggers, matches every 
+    frame of it with CANtrigger_Match() and checks the answer against the condition as cantrigger.h states it, taken 
+    a bit at a time.  Most triggers are made from a frame of the trace, with random masks (so that they match now 
+    and then, by ID, by data, or both, including bytes beyond the DLC of some frames), and the rest are random.
+
+    Reports the share of frames matched and the time taken per match.  Exits non-zero if any answer is wrong.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cantrigger.h"
+#include "lawicel.h"
+#include "bench.h"
+
+#define TRACE_FRAMES 200000
+#define TRIGGERS 500
+
+struct trace
+{
+  struct CANmessage *frame;
+  size_t count, allocated;
+};
+
+static const struct lawicel_format trace_format = { 4, 0 }; /* LAWICEL text is taken to have 'Z1' timestamps, if any */
+
+static volatile unsigned sink;
+
+static uint32_t random32(void)
+{
+  return (uint32_t)(rand() & 0xFFFF) << 16 | (uint32_t)(rand() & 0xFFFF);
+}
+
+static void add_frame(struct trace *trace, const struct CANmessage *msg)
+{
+  if (trace->count == trace->allocated)
+  {
+    trace->allocated = (trace->allocated) ? 2 * trace->allocated : 4096;
+    trace->frame = realloc(trace->frame, trace->allocated * sizeof(*trace->frame));
+    if (!trace->frame)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  trace->frame[trace->count++] = *msg;
+}
+
+static void read_trace(struct trace *trace, FILE *file)
+{
+  char line[256];
+  struct CANmessage msg;
+  uint64_t time;
+  int timed;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    memset(&msg, 0, sizeof(msg));
+    if (LAWICEL_ParseCandump(line, &msg, &time) || LAWICEL_Parse(line, &trace_format, &msg, &timed))
+      add_frame(trace, &msg);
+  }
+}
+
+/* 64 IDs, half of them extended, each with a DLC of its own and data that changes a little from frame to frame */
+static void make_up(struct trace *trace)
+{
+  struct CANmessage ids[64], *msg;
+  unsigned index, byte;
+
+  for (index = 0; index < 64; index++)
+  {
+    memset(&ids[index], 0, sizeof(ids[index]));
+    ids[index].Id = (index & 1) ? random32() & 0x1FFFFFFFUL : rand() & 0x7FF;
+    ids[index].flags = (index & 1) ? 0 : CANMESSAGE_FLAG_STDID;
+    ids[index].DLC = rand() % 9;
+    for (byte = 0; byte < 8; byte++)
+      ids[index].Data[byte] = (uint8_t)rand();
+  }
+
+  for (index = 0; index < TRACE_FRAMES; index++)
+  {
+    msg = &ids[rand() % 64];
+    msg->Data[rand() % 8] ^= (uint8_t)(1 << (rand() % 8));
+    msg->Timestamp = index * 200;
+    add_frame(trace, msg);
+  }
+}
+
+/* cantrigger.h's condition, a bit at a time */
+static int reference_match(const struct cantrigger *trigger, const struct CANmessage *msg)
+{
+  uint32_t key = msg->Id | ((msg->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANTRIGGER_KEY_EXT);
+  unsigned bit, byte;
+
+  for (bit = 0; bit < 32; bit++)
+    if ( ((trigger->KeyMask >> bit) & 1) && (((key >> bit) & 1) != ((trigger->Key >> bit) & 1)) )
+      return 0;
+
+  for (byte = 0; byte < 8; byte++)
+    for (bit = 0; bit < 8; bit++)
+    {
+      if (!((trigger->DataMask[byte] >> bit) & 1))
+        continue;
+      if (byte >= CANMESSAGE_LENGTH(msg))
+        return 0;
+      if (((msg->Data[byte] >> bit) & 1) != ((trigger->Data[byte] >> bit) & 1))
+        return 0;
+    }
+
+  return 1;
+}
+
+static void make_trigger(struct cantrigger *trigger, const struct trace *trace)
+{
+  const struct CANmessage *msg = &trace->frame[rand() % trace->count];
+  unsigned byte, kind = rand() % 8;
+
+  CANtrigger_Init(trigger);
+  if (kind < 6)
+  {
+    /* from a frame: its ID, its data, or both, under masks that may be anything from one bit to all */
+    if (kind != 1)
+    {
+      trigger->Key = msg->Id | ((msg->flags & CANMESSAGE_FLAG_STDID) ? 0 : CANTRIGGER_KEY_EXT);
+      trigger->KeyMask = (kind & 2) ? 0xFFFFFFFFUL : random32();
+    }
+    if (kind != 0)
+      for (byte = 0; byte < 8; byte++)
+      {
+        trigger->Data[byte] = msg->Data[byte];
+        trigger->DataMask[byte] = (rand() % 3) ? 0 : (uint8_t)rand();
+      }
+  }
+  else
+  {
+    trigger->Key = random32();
+    trigger->KeyMask = random32() & random32();
+    for (byte = 0; byte < 8; byte++)
+    {
+      trigger->Data[byte] = (uint8_t)rand();
+      trigger->DataMask[byte] = (uint8_t)(rand() & rand());
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct trace trace = { 0 };
+  struct cantrigger trigger;
+  unsigned long matched = 0, wrong = 0, total = 0;
+  unsigned count, answer;
+  double start, elapsed = 0;
+  size_t index;
+  FILE *file;
+  int arg;
+
+  srand(1);
+  for (arg = 1; arg < argc; arg++)
+  {
+    file = fopen(argv[arg], "r");
+    if (!file)
+    {
+      perror(argv[arg]);
+      return 1;
+    }
+    read_trace(&trace, file);
+    fclose(file);
+  }
+  if (argc < 2)
+    make_up(&trace);
+
+  if (!trace.count)
+  {
+    fprintf(stderr, "no frames found\n");
+    return 1;
+  }
+
+  for (count = 0; count < TRIGGERS; count++)
+  {
+    make_trigger(&trigger, &trace);
+
+    for (index = 0; index < trace.count; index++)
+    {
+      answer = !!CANtrigger_Match(&trigger, &trace.frame[index]);
+      matched += answer;
+      if (answer != (unsigned)reference_match(&trigger, &trace.frame[index]))
+      {
+        if (!wrong)
+          printf("frame %zu, ID %08X: trigger %08X/%08X answers %u\n", index, (unsigned)trace.frame[index].Id, (unsigned)trigger.Key, (unsigned)trigger.KeyMask, answer);
+        wrong++;
+      }
+    }
+
+    /* and again, for the time taken alone */
+    start = Bench_Now();
+    for (index = 0; index < trace.count; index++)
+      answer += CANtrigger_Match(&trigger, &trace.frame[index]);
+    elapsed += Bench_Now() - start;
+    total += trace.count;
+    sink = answer; /* so that the loop is not thrown away */
+  }
+
+  printf("frames            %zu\n", trace.count);
+  printf("triggers          %u\n", TRIGGERS);
+  printf("matched           %.3f%% of frames\n", 100.0 * matched / total);
+  printf("wrong             %lu\n", wrong);
+  printf("match             %.1f ns per frame\n", 1e9 * elapsed / total);
+
+  return wrong ? 1 : 0;
+}
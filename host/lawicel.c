@@ -0,0 +1,271 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "lawicel.h"
+
+static int hex_value(int c)
+{
+  if ( (c >= '0') && (c <= '9') )
+    return c - '0';
+  if ( (c >= 'A') && (c <= 'F') )
+    return c - 'A' + 10;
+  if ( (c >= 'a') && (c <= 'f') )
+    return c - 'a' + 10;
+  return -1;
+}
+
+int LAWICEL_Hex(const char *text, unsigned digits, uint32_t *value)
+{
+  int nibble;
+
+  *value = 0;
+  while (digits--)
+  {
+    nibble = hex_value(*text++);
+    if (nibble < 0)
+      return 0;
+    *value = (*value << 4) | nibble;
+  }
+
+  return 1;
+}
+
+int LAWICEL_Parse(const char *line, const struct lawicel_format *format, struct CANmessage *msg, int *timed)
+{
+  unsigned id_digits, index, trailer;
+  uint32_t value;
+  char type = line[0];
+
+  switch (type)
+  {
+  case 't':
+  case 'd':
+    id_digits = 3;
+    msg->flags = CANMESSAGE_FLAG_STDID;
+    break;
+  case 'T':
+  case 'D':
+    id_digits = 8;
+    msg->flags = 0;
+    break;
+  default:
+    return 0;
+  }
+
+  if (!LAWICEL_Hex(line + 1, id_digits, &msg->Id))
+    return 0;
+  line += 1 + id_digits;
+
+  if ( ('d' == type) || ('D' == type) )
+  {
+    if ( (CANMESSAGE_DATA_MAX <= 8) || !LAWICEL_Hex(line++, 1, &value) )
+      return 0;
+    msg->flags |= CANMESSAGE_FLAG_FD | ((value & 1) ? CANMESSAGE_FLAG_BRS : 0) | ((value & 2) ? CANMESSAGE_FLAG_ESI : 0);
+  }
+
+  if (!LAWICEL_Hex(line++, 1, &value))
+    return 0;
+  msg->DLC = (uint8_t)value;
+
+  for (index = 0; index < CANMESSAGE_LENGTH(msg); index++, line += 2)
+  {
+    if (!LAWICEL_Hex(line, 2, &value))
+      return 0;
+    msg->Data[index] = (uint8_t)value;
+  }
+
+  /* what follows the data is either everything the format says, or nothing */
+  for (trailer = 0; hex_value(line[trailer]) >= 0; trailer++);
+  msg->Timestamp = 0;
+  msg->Sequence = 0;
+  *timed = 0;
+  if (0 == trailer)
+    return 1;
+  if (trailer != format->TimestampDigits + ((format->Sequence) ? 4 : 0))
+    return 0;
+
+  if (format->TimestampDigits)
+  {
+    LAWICEL_Hex(line, format->TimestampDigits, &value);
+    msg->Timestamp = (4 == format->TimestampDigits) ? value * 1000 : value;
+    line += format->TimestampDigits;
+    *timed = 1;
+  }
+  if (format->Sequence)
+  {
+    LAWICEL_Hex(line, 4, &value);
+    msg->Sequence = (uint16_t)value;
+  }
+
+  return 1;
+}
+
+int LAWICEL_ParseCandump(const char *line, struct CANmessage *msg, uint64_t *time)
+{
+  unsigned long long seconds;
+  unsigned long micros;
+  const char *pnt;
+  unsigned digits, length;
+  uint32_t value;
+
+  if (2 != sscanf(line, "(%llu.%lu)", &seconds, &micros))
+    return 0;
+  pnt = strchr(line, ' ');
+  if (!pnt || !(pnt = strchr(pnt + 1, ' ')))
+    return 0;
+  pnt++;
+
+  for (digits = 0; hex_value(pnt[digits]) >= 0; digits++);
+  if ( ('#' != pnt[digits]) || ((3 != digits) && (8 != digits)) )
+    return 0;
+  LAWICEL_Hex(pnt, digits, &msg->Id);
+  msg->flags = (3 == digits) ? CANMESSAGE_FLAG_STDID : 0;
+  pnt += digits + 1;
+
+  if ('#' == *pnt)
+  {
+    if ( (CANMESSAGE_DATA_MAX <= 8) || !LAWICEL_Hex(pnt + 1, 1, &value) )
+      return 0;
+    msg->flags |= CANMESSAGE_FLAG_FD | ((value & 1) ? CANMESSAGE_FLAG_BRS : 0) | ((value & 2) ? CANMESSAGE_FLAG_ESI : 0);
+    pnt += 2;
+  }
+
+  /* remote frames carry no data */
+  for (length = 0; (length < CANMESSAGE_DATA_MAX) && LAWICEL_Hex(pnt, 2, &value); length++, pnt += 2)
+    msg->Data[length] = (uint8_t)value;
+
+  /* a CAN FD frame is padded out to the next length a DLC can give */
+  for (msg->DLC = 0; CANMESSAGE_LENGTH(msg) < length; msg->DLC++);
+  for (; length < CANMESSAGE_LENGTH(msg); length++)
+    msg->Data[length] = 0;
+
+  *time = seconds * 1000000ULL + micros;
+  msg->Timestamp = (uint32_t)*time;
+  msg->Sequence = 0;
+
+  return 1;
+}
+
+unsigned LAWICEL_FormatCandump(char *line, uint64_t time, const char *interface, const struct CANmessage *msg)
+{
+  static const char hexdigits[] = "0123456789ABCDEF";
+  char digits[20];
+  uint64_t seconds = time / 1000000;
+  uint32_t micros = (uint32_t)(time % 1000000);
+  unsigned length = 0, count = 0, index, shift;
+
+  line[length++] = '(';
+  do
+  {
+    digits[count++] = (char)('0' + seconds % 10);
+    seconds /= 10;
+  } while (seconds);
+  while (count)
+    line[length++] = digits[--count];
+  line[length++] = '.';
+  for (index = 6; index--; micros /= 10)
+    line[length + index] = (char)('0' + micros % 10);
+  length += 6;
+  line[length++] = ')';
+  line[length++] = ' ';
+
+  while (*interface)
+    line[length++] = *interface++;
+  line[length++] = ' ';
+
+  for (shift = (msg->flags & CANMESSAGE_FLAG_STDID) ? 8 : 28; ; shift -= 4)
+  {
+    line[length++] = hexdigits[(msg->Id >> shift) & 0xF];
+    if (0 == shift)
+      break;
+  }
+  line[length++] = '#';
+
+  if (msg->flags & CANMESSAGE_FLAG_FD)
+  {
+    line[length++] = '#';
+    line[length++] = hexdigits[((msg->flags & CANMESSAGE_FLAG_BRS) ? 1 : 0) | ((msg->flags & CANMESSAGE_FLAG_ESI) ? 2 : 0)];
+  }
+  for (index = 0; index < CANMESSAGE_LENGTH(msg); index++)
+  {
+    line[length++] = hexdigits[msg->Data[index] >> 4];
+    line[length++] = hexdigits[msg->Data[index] & 0xF];
+  }
+  line[length++] = '\n';
+
+  return length;
+}
+
+uint64_t LAWICEL_Wrap(const struct lawicel_format *format)
+{
+  return (4 == format->TimestampDigits) ? 60000000ULL : 0x100000000ULL;
+}
+
+char LAWICEL_LineEnd(const char *data, size_t size)
+{
+  /* going by the first 64KB */
+  return (size && !memchr(data, '\r', (size < 65536) ? size : 65536)) ? '\n' : '\r';
+}
+
+size_t LAWICEL_LineStart(const char *data, size_t size, char line_end, size_t offset)
+{
+  const char *end;
+
+  if (0 == offset)
+    return 0;
+  if (offset >= size)
+    return size;
+
+  end = memchr(data + offset - 1, line_end, size - (offset - 1));
+  if (!end)
+    return size;
+  offset = end - data + 1;
+  if ( ('\r' == line_end) && (offset < size) && ('\n' == data[offset]) )
+    offset++; /* CR LF */
+
+  return offset;
+}
+
+uint64_t LAWICEL_Unwrap(struct lawicel_clock *clock, uint32_t timestamp, uint64_t wrap)
+{
+  uint64_t elapsed;
+
+  if (!clock->Started)
+  {
+    clock->Time = timestamp;
+    clock->Started = 1;
+  }
+  else
+  {
+    elapsed = (timestamp >= clock->Last) ? timestamp - clock->Last : timestamp + wrap - clock->Last;
+    if (elapsed < wrap / 2)
+      clock->Time += elapsed;
+    /* otherwise it went backwards a little (or the device restarted); the time stands still */
+  }
+  clock->Last = timestamp;
+
+  return clock->Time;
+}
@@ -0,0 +1,83 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef LAWICEL_H_
+#define LAWICEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "canbus.h"
+
+/*
+    host-side parsing of the sniffer's text output (and of candump -l logs), shared by the host tools
+
+    A message record is 't', 'T', 'd' or 'D', the hex digits of ID, (for 'd'/'D') BRS/ESI, DLC and data, and then, as 
+    the sniffer was told with commands 'Z' and 'q', a timestamp and a sequence number, ending with CR.  FD records 
+    ('d'/'D') are only taken in builds with CANMESSAGE_DATA_MAX of 64.
+*/
+
+struct lawicel_format
+{
+  unsigned TimestampDigits; /* 0; 4 as 'Z1' (milliseconds, wrapping at 60000); or 8 as 'Z2' (microseconds) */
+  unsigned Sequence;        /* non-zero as 'q1' */
+};
+
+/* unwraps a device's timestamps into a 64-bit count of microseconds */
+struct lawicel_clock
+{
+  uint64_t Time;
+  uint32_t Last;
+  int Started;
+};
+
+/* value of digits hex digits at text; returns zero if any of them is not one */
+extern int LAWICEL_Hex(const char *text, unsigned digits, uint32_t *value);
+
+/*
+    parse a message record (ended by anything other than a hex digit, such as the CR); returns zero if it is not 
+    one.  Timestamp is in microseconds, and *timed is zero if the record carries none (it may then also lack the 
+    sequence number, as from a sniffer that was never sent 'Z' and 'q').
+*/
+extern int LAWICEL_Parse(const char *line, const struct lawicel_format *format, struct CANmessage *msg, int *timed);
+
+/* parse a candump -l line, "(seconds.micros) interface id#data"; *time is microseconds since the epoch */
+extern int LAWICEL_ParseCandump(const char *line, struct CANmessage *msg, uint64_t *time);
+
+/* write a frame as a candump -l line, "(seconds.micros) interface id#data" and LF, returning its length; line must have room for LAWICEL_CANDUMP_MAX plus the interface's name */
+#define LAWICEL_CANDUMP_MAX (1 + 20 + 1 + 6 + 2 + 1 + 8 + 2 + 1 + 2 * CANMESSAGE_DATA_MAX + 1)
+extern unsigned LAWICEL_FormatCandump(char *line, uint64_t time, const char *interface, const struct CANmessage *msg);
+
+/* the character that ends the lines of a capture: CR as the sniffer sends them, or LF in one converted since (after CR LF, the LF is skipped) */
+extern char LAWICEL_LineEnd(const char *data, size_t size);
+
+/* the first line of a capture to start at or after offset, as found by reading its lines from the start; size if none does */
+extern size_t LAWICEL_LineStart(const char *data, size_t size, char line_end, size_t offset);
+
+/* the period (in microseconds) after which the timestamps of the format go back to zero */
+extern uint64_t LAWICEL_Wrap(const struct lawicel_format *format);
+
+/* the 64-bit time of a timestamp, taking it to be less than half the wrap period after the previous one */
+extern uint64_t LAWICEL_Unwrap(struct lawicel_clock *clock, uint32_t timestamp, uint64_t wrap);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "canmock.h"
+
+struct canmock_counters CANmock_Counters;
+const CAN_FIFOMailBox_TypeDef *CANmock_Late;
+
+static CAN_TypeDef can;
+static TIM_TypeDef tim2;
+CAN_TypeDef *CAN = &can;
+TIM_TypeDef *TIM2 = &tim2;
+
+static struct
+{
+  CAN_FIFOMailBox_TypeDef Fifo[3]; /* pending messages, oldest first */
+  unsigned Pending;
+  int Overrun;                     /* FOVR0 */
+} mock;
+
+void CANmock_Init(void)
+{
+  memset(&can, 0, sizeof(can));
+  memset(&tim2, 0, sizeof(tim2));
+  memset(&mock, 0, sizeof(mock));
+  memset(&CANmock_Counters, 0, sizeof(CANmock_Counters));
+  CANmock_Late = NULL;
+}
+
+int CANmock_Arrive(const CAN_FIFOMailBox_TypeDef *message)
+{
+  if (mock.Pending >= 3)
+  {
+    mock.Overrun = 1;
+    CANmock_Counters.Overruns++;
+    return 0;
+  }
+
+  mock.Fifo[mock.Pending].RIR = message->RIR;
+  mock.Fifo[mock.Pending].RDTR = message->RDTR;
+  mock.Fifo[mock.Pending].RDLR = message->RDLR;
+  mock.Fifo[mock.Pending].RDHR = message->RDHR;
+  mock.Pending++;
+
+  return 1;
+}
+
+unsigned CANmock_Pending(void)
+{
+  return mock.Pending;
+}
+
+static uint32_t rf0r(void)
+{
+  return mock.Pending | ((3 == mock.Pending) ? CAN_RF0R_FULL0 : 0) | (mock.Overrun ? CAN_RF0R_FOVR0 : 0);
+}
+
+uint32_t CANmock_Read(const volatile uint32_t *reg)
+{
+  const volatile uint32_t *head = &can.sFIFOMailBox[0].RIR;
+  uint32_t value;
+
+  CANmock_Counters.Reads++;
+
+  if (reg == &can.RF0R)
+  {
+    value = rf0r();
+    if (!mock.Pending && CANmock_Late)
+    {
+      CANmock_Arrive(CANmock_Late);
+      CANmock_Late = NULL;
+    }
+    return value;
+  }
+
+  /* FIFO 0's output mailbox, holding the oldest message (and what it last held, once empty) */
+  if ( (reg >= head) && (reg < head + 4) )
+    return mock.Pending ? ((const volatile uint32_t *)&mock.Fifo[0])[reg - head] : *reg;
+
+  return *reg;
+}
+
+void CANmock_Write(volatile uint32_t *reg, uint32_t value)
+{
+  CANmock_Counters.Writes++;
+
+  if (reg == &can.RF0R)
+  {
+    if (value & CAN_RF0R_FOVR0)
+      mock.Overrun = 0;
+    if ( (value & CAN_RF0R_RFOM0) && mock.Pending )
+    {
+      can.sFIFOMailBox[0] = mock.Fifo[0];
+      mock.Fifo[0] = mock.Fifo[1];
+      mock.Fifo[1] = mock.Fifo[2];
+      mock.Pending--;
+    }
+    return;
+  }
+
+  *reg = value;
+}
@@ -0,0 +1,65 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    simulated bxCAN receive FIFO 0 and timestamp timer, for running src/canfast.c's receive interrupt on a PC
+
+    Built with CANMOCK defined, host/mock/stm32f0xx.h has READ_REG(), WRITE_REG(), SET_BIT() and CLEAR_BIT() call
+    CANmock_Read() and CANmock_Write(), which count each access and give the FIFO its behaviour: RF0R reports how
+    many of its 3 mailboxes are pending, FULL0 and FOVR0 (set should a 4th message arrive, and cleared by writing a
+    1), and writing RFOM0 releases the oldest at once, so that RFOM0 always reads 0.  The FIFO's output mailbox
+    holds the oldest pending message.  IER, TSR and ESR, and TIM2's CNT, are simply kept.  Nothing is ever
+    interrupted: a message arrives only when the bench calls CANmock_Arrive(), or as CANmock_Late says.
+
+    Build with -DCANMOCK, host/mock ahead of src on the include path, -fshort-enums (as the ARM compiler has it), and
+    src/canfast.c, src/canqueue.c, src/canlimit.c and host/mock/canmock.c.
+*/
+
+#ifndef CANMOCK_H_
+#define CANMOCK_H_
+
+#include <stdint.h>
+#include "stm32f0xx.h"
+
+/* empties the FIFO and clears the registers and counters */
+void CANmock_Init(void);
+
+/* a message arrives in the FIFO, or overruns it if all 3 mailboxes are pending; returns zero if it overran */
+int CANmock_Arrive(const CAN_FIFOMailBox_TypeDef *message);
+
+/* how many messages are pending in the FIFO, without counting an access */
+unsigned CANmock_Pending(void);
+
+struct canmock_counters
+{
+  unsigned long Reads, Writes;  /* accesses to the peripherals' registers */
+  unsigned long Overruns;       /* messages lost for want of a mailbox */
+};
+
+extern struct canmock_counters CANmock_Counters;
+
+/* if set, this message arrives (and CANmock_Late is cleared) just after a read of RF0R has found the FIFO empty */
+extern const CAN_FIFOMailBox_TypeDef *CANmock_Late;
+
+#endif
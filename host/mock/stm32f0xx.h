@@ -0,0 +1,257 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    stand-in for the CMSIS device header, so that the USB code and src/canfast.c can be built and run on a PC
+
+    Only what src/usbd_virtualcdc.c, src/stm32f0xx_hal_pcd.c, src/canfast.c and the HAL headers they pull in need is
+    here.  The USB registers and packet memory sit at their STM32F042 addresses, where usbmock.c maps memory for them,
+    so the HAL's habit of turning them into 32-bit integers and back (which the compiler is told to keep quiet about)
+    does no harm on a 64-bit PC.  The register bits have their true values, as the HAL's endpoint macros depend upon
+    them.  Built with CANMOCK defined, the register access macros go through canmock.c, which simulates the bxCAN.
+*/
+
+#ifndef __STM32F0XX_H
+#define __STM32F0XX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#ifndef STM32F072xB
+#define STM32F042x6 /* unless built as the STM32F072, as for CAN_TRANSMIT */
+#endif
+
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+
+typedef enum
+{
+  NonMaskableInt_IRQn = -14, HardFault_IRQn = -13, SVC_IRQn = -5, PendSV_IRQn = -2, SysTick_IRQn = -1,
+  WWDG_IRQn = 0, RCC_CRS_IRQn = 4, TIM2_IRQn = 15, TIM3_IRQn = 16, TIM14_IRQn = 19, CEC_CAN_IRQn = 30, USB_IRQn = 31
+} IRQn_Type;
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+typedef enum {ERROR = 0, SUCCESS = !ERROR} ErrorStatus;
+#define IS_FUNCTIONAL_STATE(STATE) (((STATE) == DISABLE) || ((STATE) == ENABLE))
+
+typedef struct { __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR; } GPIO_TypeDef;
+typedef struct { __IO uint32_t TIR, TDTR, TDLR, TDHR; } CAN_TxMailBox_TypeDef;
+typedef struct { __IO uint32_t RIR, RDTR, RDLR, RDHR; } CAN_FIFOMailBox_TypeDef;
+typedef struct { __IO uint32_t FR1, FR2; } CAN_FilterRegister_TypeDef;
+typedef struct
+{
+  __IO uint32_t MCR, MSR, TSR, RF0R, RF1R, IER, ESR, BTR;
+  uint32_t RESERVED0[88];
+  CAN_TxMailBox_TypeDef sTxMailBox[3];
+  CAN_FIFOMailBox_TypeDef sFIFOMailBox[2];
+  uint32_t RESERVED1[12];
+  __IO uint32_t FMR, FM1R;
+  uint32_t RESERVED2;
+  __IO uint32_t FS1R;
+  uint32_t RESERVED3;
+  __IO uint32_t FFA1R;
+  uint32_t RESERVED4;
+  __IO uint32_t FA1R;
+  uint32_t RESERVED5[8];
+  CAN_FilterRegister_TypeDef sFilterRegister[28];
+} CAN_TypeDef;
+typedef struct
+{
+  __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR;
+  uint32_t RESERVED0;
+  __IO uint32_t CCR1, CCR2, CCR3, CCR4;
+  uint32_t RESERVED1;
+  __IO uint32_t DCR, DMAR;
+} TIM_TypeDef;
+typedef struct { __IO uint32_t CR, CFGR, CIR, APB2RSTR, APB1RSTR, AHBENR, APB2ENR, APB1ENR, BDCR, CSR, AHBRSTR, CFGR2, CFGR3, CR2; } RCC_TypeDef;
+typedef struct { __IO uint32_t ACR, KEYR, OPTKEYR, SR, CR, AR, RESERVED, OBR, WRPR; } FLASH_TypeDef;
+typedef struct { __IO uint32_t CR, CSR; } PWR_TypeDef;
+typedef struct { __IO uint32_t CR, CFGR, ISR, ICR; } CRS_TypeDef;
+
+typedef struct
+{
+  __IO uint16_t EP0R; uint16_t RESERVED0;
+  __IO uint16_t EP1R; uint16_t RESERVED1;
+  __IO uint16_t EP2R; uint16_t RESERVED2;
+  __IO uint16_t EP3R; uint16_t RESERVED3;
+  __IO uint16_t EP4R; uint16_t RESERVED4;
+  __IO uint16_t EP5R; uint16_t RESERVED5;
+  __IO uint16_t EP6R; uint16_t RESERVED6;
+  __IO uint16_t EP7R; uint16_t RESERVED7[17];
+  __IO uint16_t CNTR; uint16_t RESERVED8;
+  __IO uint16_t ISTR; uint16_t RESERVED9;
+  __IO uint16_t FNR; uint16_t RESERVEDA;
+  __IO uint16_t DADDR; uint16_t RESERVEDB;
+  __IO uint16_t BTABLE; uint16_t RESERVEDC;
+  __IO uint16_t LPMCSR; uint16_t RESERVEDD;
+  __IO uint16_t BCDR; uint16_t RESERVEDE;
+} USB_TypeDef;
+
+typedef struct { __I uint32_t CPUID; __IO uint32_t ICSR; uint32_t RESERVED0; __IO uint32_t AIRCR, SCR, CCR; uint32_t RESERVED1; __IO uint32_t SHP[2]; __IO uint32_t SHCSR; } SCB_Type;
+
+#define FLASH_BASE            0x08000000UL
+#define SRAM_BASE             0x20000000UL
+#define USB_BASE              0x40005C00UL
+#define USB_PMAADDR           0x40006000UL
+
+#define USB                   ((USB_TypeDef *)USB_BASE)
+
+/* usbmock.c keeps these, and canmock.c (or a CAN bench without it) CAN and TIM2 */
+extern SCB_Type *SCB;
+extern CAN_TypeDef *CAN;
+extern TIM_TypeDef *TIM2;
+extern RCC_TypeDef *RCC;
+extern FLASH_TypeDef *FLASH;
+extern PWR_TypeDef *PWR;
+extern GPIO_TypeDef *GPIOA, *GPIOB, *GPIOF;
+
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk (1UL << 27)
+
+/* there is nothing to interrupt the code under test, which usbmock.c calls one handler at a time */
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __NOP(void) {}
+static inline void __DSB(void) {}
+
+#ifdef CANMOCK
+/* canmock.c simulates the bxCAN behind these, and counts each access */
+extern uint32_t CANmock_Read(const volatile uint32_t *reg);
+extern void CANmock_Write(volatile uint32_t *reg, uint32_t value);
+#define SET_BIT(REG, BIT)     CANmock_Write(&(REG), CANmock_Read(&(REG)) | (BIT))
+#define CLEAR_BIT(REG, BIT)   CANmock_Write(&(REG), CANmock_Read(&(REG)) & ~(BIT))
+#define READ_BIT(REG, BIT)    (CANmock_Read(&(REG)) & (BIT))
+#define CLEAR_REG(REG)        CANmock_Write(&(REG), 0x0)
+#define WRITE_REG(REG, VAL)   CANmock_Write(&(REG), (VAL))
+#define READ_REG(REG)         CANmock_Read(&(REG))
+#else
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+#define CLEAR_REG(REG)        ((REG) = (0x0))
+#define WRITE_REG(REG, VAL)   ((REG) = (VAL))
+#define READ_REG(REG)         ((REG))
+#endif
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)  WRITE_REG((REG), (((READ_REG(REG)) & (~(CLEARMASK))) | (SETMASK)))
+
+/* bxCAN receive FIFO and interrupt enable registers */
+#define CAN_RF0R_FMP0         0x00000003UL
+#define CAN_RF0R_FULL0        0x00000008UL
+#define CAN_RF0R_FOVR0        0x00000010UL
+#define CAN_RF0R_RFOM0        0x00000020UL
+#define CAN_RI0R_IDE          0x00000004UL
+#define CAN_RDT0R_DLC         0x0000000FUL
+
+#define CAN_IER_TMEIE         0x00000001UL
+#define CAN_IER_FMPIE0        0x00000002UL
+#define CAN_IER_FFIE0         0x00000004UL
+#define CAN_IER_FOVIE0        0x00000008UL
+#define CAN_IER_FMPIE1        0x00000010UL
+#define CAN_IER_FFIE1         0x00000020UL
+#define CAN_IER_FOVIE1        0x00000040UL
+#define CAN_IER_EWGIE         0x00000100UL
+#define CAN_IER_EPVIE         0x00000200UL
+#define CAN_IER_BOFIE         0x00000400UL
+#define CAN_IER_LECIE         0x00000800UL
+#define CAN_IER_ERRIE         0x00008000UL
+
+/* USB control register */
+#define USB_CNTR_CTRM         0x8000U
+#define USB_CNTR_PMAOVRM      0x4000U
+#define USB_CNTR_ERRM         0x2000U
+#define USB_CNTR_WKUPM        0x1000U
+#define USB_CNTR_SUSPM        0x0800U
+#define USB_CNTR_RESETM       0x0400U
+#define USB_CNTR_SOFM         0x0200U
+#define USB_CNTR_ESOFM        0x0100U
+#define USB_CNTR_L1REQM       0x0080U
+#define USB_CNTR_L1RESUME     0x0020U
+#define USB_CNTR_RESUME       0x0010U
+#define USB_CNTR_FSUSP        0x0008U
+#define USB_CNTR_LPMODE       0x0004U
+#define USB_CNTR_PDWN         0x0002U
+#define USB_CNTR_FRES         0x0001U
+
+/* USB interrupt status register */
+#define USB_ISTR_CTR          0x8000U
+#define USB_ISTR_PMAOVR       0x4000U
+#define USB_ISTR_ERR          0x2000U
+#define USB_ISTR_WKUP         0x1000U
+#define USB_ISTR_SUSP         0x0800U
+#define USB_ISTR_RESET        0x0400U
+#define USB_ISTR_SOF          0x0200U
+#define USB_ISTR_ESOF         0x0100U
+#define USB_ISTR_L1REQ        0x0080U
+#define USB_ISTR_DIR          0x0010U
+#define USB_ISTR_EP_ID        0x000FU
+
+#define USB_FNR_FN            0x07FFU
+#define USB_DADDR_EF          0x0080U
+#define USB_BCDR_DPPU         0x8000U
+
+/* USB endpoint registers */
+#define USB_EP_CTR_RX         0x8000U
+#define USB_EP_DTOG_RX        0x4000U
+#define USB_EPRX_STAT         0x3000U
+#define USB_EP_SETUP          0x0800U
+#define USB_EP_T_FIELD        0x0600U
+#define USB_EP_KIND           0x0100U
+#define USB_EP_CTR_TX         0x0080U
+#define USB_EP_DTOG_TX        0x0040U
+#define USB_EPTX_STAT         0x0030U
+#define USB_EPADDR_FIELD      0x000FU
+
+#define USB_EPREG_MASK        (USB_EP_CTR_RX | USB_EP_SETUP | USB_EP_T_FIELD | USB_EP_KIND | USB_EP_CTR_TX | USB_EPADDR_FIELD)
+
+#define USB_EP_TYPE_MASK      0x0600U
+#define USB_EP_BULK           0x0000U
+#define USB_EP_CONTROL        0x0200U
+#define USB_EP_ISOCHRONOUS    0x0400U
+#define USB_EP_INTERRUPT      0x0600U
+#define USB_EP_T_MASK         (~USB_EP_T_FIELD & USB_EPREG_MASK)
+
+#define USB_EPKIND_MASK       (~USB_EP_KIND & USB_EPREG_MASK)
+
+#define USB_EP_TX_DIS         0x0000U
+#define USB_EP_TX_STALL       0x0010U
+#define USB_EP_TX_NAK         0x0020U
+#define USB_EP_TX_VALID       0x0030U
+#define USB_EPTX_DTOG1        0x0010U
+#define USB_EPTX_DTOG2        0x0020U
+#define USB_EPTX_DTOGMASK     (USB_EPTX_STAT | USB_EPREG_MASK)
+
+#define USB_EP_RX_DIS         0x0000U
+#define USB_EP_RX_STALL       0x1000U
+#define USB_EP_RX_NAK         0x2000U
+#define USB_EP_RX_VALID       0x3000U
+#define USB_EPRX_DTOG1        0x1000U
+#define USB_EPRX_DTOG2        0x2000U
+#define USB_EPRX_DTOGMASK     (USB_EPRX_STAT | USB_EPREG_MASK)
+
+#endif
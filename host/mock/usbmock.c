@@ -0,0 +1,226 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "usbd_virtualcdc.h"
+#include "usbd_desc.h"
+#include "usbmock.h"
+
+#define MAPPED_BASE 0x40005000UL /* the page holding the USB registers, followed by that of the PMA */
+#define MAPPED_SIZE 0x2000UL
+
+struct usbmock_counters USBmock_Counters;
+unsigned USBmock_BusyOneIn;
+
+USBD_HandleTypeDef USBD_Device;
+static PCD_HandleTypeDef hpcd;
+
+static SCB_Type scb;
+SCB_Type *SCB = &scb;
+
+static const uint8_t configuration[9];
+const uint8_t *const USBD_CfgFSDesc_pnt = configuration;
+const uint16_t USBD_CfgFSDesc_len = sizeof(configuration);
+
+static struct
+{
+  uint8_t *Buffer;     /* where USBD_LL_PrepareReceive() said the next OUT packet is to go */
+  uint16_t Size;
+  uint16_t Received;   /* the length of the last OUT packet */
+  uint16_t OutAddress; /* of the OUT endpoint's buffer in PMA */
+  int Armed;
+  uint16_t In;         /* EP1R as the hardware last left it */
+} mock;
+
+/* provided by stm32f0xx_hal_pcd.c */
+extern void PCD_ReadPMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+
+/*
+    the IN endpoint's status bits are toggled by writing ones, so what the code wrote is undone against what the
+    register held before; only one write can happen between two looks, as the class writes VALID and then waits for
+    USBD_CDC_DataIn()
+*/
+static uint16_t in_status(void)
+{
+  uint16_t written = USB->EP1R;
+
+  if (written != mock.In)
+    mock.In = (mock.In & ~USB_EPTX_STAT) | ((mock.In ^ written) & USB_EPTX_STAT);
+  USB->EP1R = mock.In;
+
+  return mock.In & USB_EPTX_STAT;
+}
+
+int USBmock_Init(void)
+{
+  uint32_t pma_address;
+
+  static int mapped;
+
+  if (!mapped && (MAP_FAILED == mmap((void *)MAPPED_BASE, MAPPED_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0)))
+    return 0;
+  mapped = 1;
+
+  memset((void *)MAPPED_BASE, 0, MAPPED_SIZE);
+  memset(&mock, 0, sizeof(mock));
+  memset(&USBmock_Counters, 0, sizeof(USBmock_Counters));
+  USB->BTABLE = 0;
+  mock.In = USB->EP1R = (CDC_EP_DATAIN & 0x7F) | USB_EP_TX_NAK;
+
+  hpcd.Instance = USB;
+  hpcd.pData = &USBD_Device;
+  USBD_Device.pData = &hpcd;
+
+  /* as USBD_LL_Init() lays out the PMA */
+  pma_address = 8 * 8 + 2 * USB_MAX_EP0_SIZE;
+  USBD_CDC_PMAConfig(&hpcd, &pma_address);
+
+  USBD_CDC.Init(&USBD_Device, 1);
+  return 1;
+}
+
+int USBmock_HostOut(const uint8_t *data, unsigned length)
+{
+  unsigned index;
+
+  if (!mock.Armed)
+  {
+    USBmock_Counters.OutNaks++;
+    return 0;
+  }
+
+  /* the hardware puts the packet in PMA, and the HAL reads it out into the buffer it was given */
+  for (index = 0; index < length; index += 2)
+    *(volatile uint16_t *)(USB_PMAADDR + mock.OutAddress + index) = data[index] | ((index + 1 < length) ? data[index + 1] << 8 : 0);
+  if (length > mock.Size)
+    length = mock.Size;
+  PCD_ReadPMA(USB, mock.Buffer, mock.OutAddress, length);
+  mock.Received = length;
+  mock.Armed = 0;
+  USBmock_Counters.OutPackets++;
+  USBmock_Counters.OutBytes += length;
+
+  USBD_CDC.DataOut(&USBD_Device, CDC_EP_DATAOUT);
+  return 1;
+}
+
+int USBmock_HostIn(uint8_t *data)
+{
+  uint16_t address, count, index, word;
+
+  if (USB_EP_TX_VALID != in_status())
+  {
+    USBmock_Counters.InNaks++;
+    return -1;
+  }
+
+  address = PCD_GET_EP_TX_ADDRESS(USB, CDC_EP_DATAIN & 0x7F);
+  count = PCD_GET_EP_TX_CNT(USB, CDC_EP_DATAIN & 0x7F);
+  for (index = 0; index < count; index++)
+  {
+    word = *(volatile uint16_t *)(USB_PMAADDR + ((address + index) & ~1));
+    data[index] = (uint8_t)(word >> (8 * ((address + index) & 1)));
+  }
+
+  /* the hardware goes back to NAK once the packet is sent, and the HAL calls back */
+  mock.In = USB->EP1R = (mock.In & ~USB_EPTX_STAT) | USB_EP_TX_NAK;
+  USBmock_Counters.InPackets++;
+  USBmock_Counters.InBytes += count;
+  USBmock_Counters.InZeroLength += !count;
+
+  USBD_CDC.DataIn(&USBD_Device, CDC_EP_DATAIN & 0x7F);
+  in_status();
+  return count;
+}
+
+void USBmock_Frame(void)
+{
+  USB->FNR = (USB->FNR + 1) & USB_FNR_FN;
+  USBD_CDC.SOF(&USBD_Device);
+  in_status();
+
+  if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk)
+  {
+    SCB->ICSR = 0;
+    USBmock_Counters.PendSVs++;
+    USBD_VirtualCDC_PendSV();
+    in_status();
+  }
+}
+
+/* the HAL and USB device library calls the class makes */
+
+USBD_StatusTypeDef USBD_LL_OpenEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t ep_type, uint16_t ep_mps)
+{
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_CloseEP(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_PrepareReceive(USBD_HandleTypeDef *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t size)
+{
+  if (USBmock_BusyOneIn && !(rand() % USBmock_BusyOneIn))
+  {
+    USBmock_Counters.Busy++;
+    return USBD_BUSY;
+  }
+
+  mock.Buffer = pbuf;
+  mock.Size = size;
+  mock.Armed = 1;
+  return USBD_OK;
+}
+
+uint32_t USBD_LL_GetRxDataSize(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+  return mock.Received;
+}
+
+USBD_StatusTypeDef USBD_CtlSendData(USBD_HandleTypeDef *pdev, uint8_t *buf, uint16_t len)
+{
+  return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_CtlPrepareRx(USBD_HandleTypeDef *pdev, uint8_t *pbuf, uint16_t len)
+{
+  return USBD_OK;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_PMAConfig(PCD_HandleTypeDef *hpcd, uint16_t ep_addr, uint16_t ep_kind, uint32_t pmaadress)
+{
+  if (CDC_EP_DATAOUT == ep_addr)
+    mock.OutAddress = pmaadress;
+  return HAL_OK;
+}
+
+/* the USB interrupt can't happen part way through anything here, so there is nothing for these to hold off */
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {}
@@ -0,0 +1,68 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    emulated USB peripheral and host, for running src/usbd_virtualcdc.c on a PC
+
+    usbmock.c stands in for the hardware, the HAL's interrupt handling and the host: it maps memory at the USB
+    registers and packet memory (PMA), brings the CDC class up as enumeration would, and then plays the host's part
+    one packet at a time, calling the class callbacks (USBD_CDC) as HAL_PCD_IRQHandler() would.  PendSV is run at the
+    end of each frame if it was pended.  Nothing is ever interrupted: the code under test sees the calls in the order
+    the bench makes them.
+
+    Build with host/mock ahead of src on the include path, -fshort-enums (as the ARM compiler has it), and
+    src/usbd_virtualcdc.c, src/stm32f0xx_hal_pcd.c and host/mock/usbmock.c.
+*/
+
+#ifndef USBMOCK_H_
+#define USBMOCK_H_
+
+#include <stdint.h>
+
+/* maps the peripheral (or clears it, if already mapped) and opens the CDC endpoints; zero if the addresses could not be had */
+int USBmock_Init(void);
+
+/* the host offers a packet of up to 64 bytes to the OUT endpoint; returns zero if it was NAKed */
+int USBmock_HostOut(const uint8_t *data, unsigned length);
+
+/* the host polls the IN endpoint; returns the length of the packet taken (which may be zero), or -1 if NAKed */
+int USBmock_HostIn(uint8_t *data);
+
+/* the start of a frame: the SOF callback, and then PendSV if that pended it */
+void USBmock_Frame(void);
+
+struct usbmock_counters
+{
+  unsigned long OutPackets, OutNaks, OutBytes;
+  unsigned long InPackets, InNaks, InBytes, InZeroLength;
+  unsigned long PendSVs;
+  unsigned long Busy;           /* USBD_LL_PrepareReceive() calls answered busy */
+};
+
+extern struct usbmock_counters USBmock_Counters;
+
+/* USBD_LL_PrepareReceive() answers busy (as HAL_PCD_EP_Receive() does if the HAL is locked) one call in this many, or never if zero */
+extern unsigned USBmock_BusyOneIn;
+
+#endif
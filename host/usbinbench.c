@@ -0,0 +1,237 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of the IN path of src/usbd_virtualcdc.c, through an emulated USB layer
+
+      usbinbench [frames]
+
+    Linked with -Wl,--wrap=PCD_WritePMA, so as to count the bytes copied into the PMA.
+
+    For each of a set of cases, user code queues records for frames (default 20000) with 
+    USBD_VirtualCDC_ToHost_Reserve() and _Commit(), at random moments at the case's average rate and of random lengths 
+    in the case's range, while the host (host/mock/usbmock.c) polls the IN endpoint as often as the case allows, up to 
+    PACKETS_PER_FRAME a frame; each frame ends with SOF and PendSV.  A record that finds no room is dropped, as 
+    CANbus_Service() would hold it back.
+
+    What the host receives must be just the records queued, in order, byte for byte; no packet may be longer than 
+    CDC_DATA_IN_MAX_PACKET_SIZE; a transfer that ends in a full packet must not be left open (the host's first poll of 
+    the next frame must find more data or a zero-length packet); once user code stops, the rest must come through 
+    without DRAIN_FRAMES going by in which none of it does; and each byte must have been copied into the PMA just the 
+    once (bar the byte that a copy starting at an odd address reads back from the halfword it shares with the data 
+    before it).
+
+    Reports the records queued and dropped, the packets, the average payload of those that carried any, the share 
+    that were short (neither full nor zero-length, each one ending a transfer), the zero-length packets, and the bytes 
+    copied (written by user code into the space reserved, then into the PMA) for each byte received, and a frame.  
+    Exits non-zero if any check fails.
+
+    Built with INBOUND_RECORD_MAX of 152 (and CANMESSAGE_DATA_MAX of 64), as for CAN FD, a further case has records 
+    longer than a packet, which carry on through more than one slot.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "usbd_virtualcdc.h"
+#include "usbmock.h"
+#include "bench.h"
+
+#define PACKETS_PER_FRAME 19 /* as many 64-byte bulk packets as full speed fits in a frame */
+#define DRAIN_FRAMES 4
+
+struct record_case
+{
+  const char *Name;
+  double Rate;          /* records a frame, on average */
+  unsigned Shortest, Longest;
+  unsigned Polls;       /* times the host polls the IN endpoint a frame */
+};
+
+static const struct record_case cases[] =
+{
+  { "light, 13-31 bytes", 2, 13, 31, PACKETS_PER_FRAME },
+  { "moderate, 13-31 bytes", 15, 13, 31, PACKETS_PER_FRAME },
+  { "high, 13-31 bytes", 45, 13, 31, PACKETS_PER_FRAME },
+  { "over, 13-31 bytes", 80, 13, 31, PACKETS_PER_FRAME },
+  { "slow host", 30, 13, 31, 5 },
+  { "1 to 64 bytes", 20, 1, 64, PACKETS_PER_FRAME },
+#if INBOUND_RECORD_MAX > CDC_DATA_IN_MAX_PACKET_SIZE
+  { "CAN FD, up to 152", 12, 20, INBOUND_RECORD_MAX, PACKETS_PER_FRAME },
+#endif
+};
+
+/* bytes copied by user code into the space reserved, and by PCD_WritePMA() in so many calls */
+static unsigned long encoded, written, writes;
+
+void __real_PCD_WritePMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+
+void __wrap_PCD_WritePMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes)
+{
+  written += wNBytes;
+  writes++;
+  __real_PCD_WritePMA(USBx, pbUsrBuf, wPMABufAddr, wNBytes);
+}
+
+/* what user code has queued, and how far the host has received it */
+static struct
+{
+  uint8_t *Data;
+  unsigned long Length, Allocated, Received;
+} stream;
+
+static double uniform(void)
+{
+  return rand() / ((double)RAND_MAX + 1);
+}
+
+/* queues a record of length bytes, keeping a copy in stream; returns zero if there was no room */
+static int queue_record(unsigned length)
+{
+  uint8_t *wpnt;
+  unsigned index;
+
+  if (stream.Length + length > stream.Allocated)
+  {
+    stream.Allocated = (stream.Allocated) ? 2 * stream.Allocated : 65536;
+    stream.Data = realloc(stream.Data, stream.Allocated);
+    if (!stream.Data)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  wpnt = USBD_VirtualCDC_ToHost_Reserve(length);
+  if (!wpnt)
+    return 0;
+
+  for (index = 0; index < length; index++)
+    stream.Data[stream.Length + index] = wpnt[index] = (uint8_t)rand();
+  stream.Length += length;
+  encoded += length;
+
+  USBD_VirtualCDC_ToHost_Commit(length);
+  return 1;
+}
+
+static int run(const struct record_case *records, unsigned frames)
+{
+  uint8_t packet[2 * CDC_DATA_IN_MAX_PACKET_SIZE];
+  unsigned frame, poll, idle = 0, open = 0, first;
+  unsigned long queued = 0, dropped = 0, short_packets = 0, before;
+  double next = 0, chance;
+  int length;
+
+  memset(&stream, 0, sizeof(stream));
+  encoded = written = writes = 0;
+  if (!USBmock_Init())
+  {
+    fprintf(stderr, "could not map memory at the USB peripheral's addresses\n");
+    exit(1);
+  }
+
+  for (frame = 0; (frame < frames) || ((stream.Received < stream.Length) && (idle < DRAIN_FRAMES)); frame++)
+  {
+    before = stream.Received;
+    first = 1;
+
+    for (poll = 0; poll < PACKETS_PER_FRAME; poll++)
+    {
+      /* the records that come along before this chance of the host's */
+      for (chance = frame + (poll + 1.0) / PACKETS_PER_FRAME; (frame < frames) && (next < chance); next += -log(1 - uniform()) / records->Rate)
+      {
+        if (queue_record(records->Shortest + rand() % (records->Longest - records->Shortest + 1)))
+          queued++;
+        else
+          dropped++;
+      }
+
+      /* the host's polls are spread over the frame */
+      if (poll * records->Polls / PACKETS_PER_FRAME == (poll + 1) * records->Polls / PACKETS_PER_FRAME)
+        continue;
+      length = USBmock_HostIn(packet);
+
+      if (open && first && (length < 0))
+      {
+        printf("%s: frame %u: a transfer ending in a full packet was left open\n", records->Name, frame);
+        return 0;
+      }
+      first = 0;
+      if (length < 0)
+        continue;
+      open = (CDC_DATA_IN_MAX_PACKET_SIZE == length);
+
+      if ( (length > CDC_DATA_IN_MAX_PACKET_SIZE) || (stream.Received + length > stream.Length) || memcmp(packet, stream.Data + stream.Received, length) )
+      {
+        printf("%s: frame %u: packet of %d bytes from byte %lu is not as queued\n", records->Name, frame, length, stream.Received);
+        return 0;
+      }
+      stream.Received += length;
+      short_packets += (length > 0) && (length < CDC_DATA_IN_MAX_PACKET_SIZE);
+    }
+
+    USBmock_Frame();
+    idle = (stream.Received == before) ? idle + 1 : 0;
+  }
+
+  printf("%-22s %9lu %7lu %9lu %7.1f %7.2f%% %7lu %7.2f %8.0f\n", records->Name, queued, dropped, USBmock_Counters.InPackets,
+    (double)USBmock_Counters.InBytes / (USBmock_Counters.InPackets - USBmock_Counters.InZeroLength),
+    100.0 * short_packets / USBmock_Counters.InPackets, USBmock_Counters.InZeroLength, (double)(encoded + written) / stream.Received, (double)(encoded + written) / frames);
+
+  free(stream.Data);
+
+  if (stream.Received != stream.Length)
+  {
+    printf("%s: %lu of %lu bytes received, and then nothing for %u frames\n", records->Name, stream.Received, stream.Length, DRAIN_FRAMES);
+    return 0;
+  }
+
+  if ( (written < stream.Length) || (written > stream.Length + writes) )
+  {
+    printf("%s: %lu bytes copied into the PMA for %lu queued\n", records->Name, written, stream.Length);
+    return 0;
+  }
+
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned frames = (argc > 1) ? atoi(argv[1]) : 20000, index, passed = 0;
+
+  if (frames < 1)
+  {
+    fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case                      records dropped   packets payload   short    ZLPs  copies  a frame\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], frames);
+
+  return Bench_Report(passed, BENCH_CASES(cases), " (%u slots)", INBOUND_SLOTS);
+}
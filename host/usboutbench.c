@@ -0,0 +1,229 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test of the OUT path of src/usbd_virtualcdc.c, with bursts of commands through an emulated USB layer
+
+      usboutbench [frames]
+
+    For each of a set of cases, the host sends frames (default 20000) worth of bursts of LAWICEL command lines (host/mock/usbmock.c 
+    playing the host and the hardware): each line ends in CR (now and then CR/LF), the stream is cut into packets of 1 to 64 
+    bytes with no regard to where lines end, and a packet that is NAKed is offered again at the next chance, up to 
+    PACKETS_PER_FRAME a frame.  After each chance, the service loop reads from the ring with 
+    USBD_VirtualCDC_FromHost_Read() a byte at a time, as CANbus_Command() does, as many bytes as the case allows (or 
+    none while it is stalled); each frame ends with SOF and PendSV.
+
+    What the service loop reads must be just what the host sent, in order, with nothing lost or doubled; what the 
+    device has taken but not yet handed over must never be more than the ring and the packet buffer hold; and once 
+    the host stops sending, the rest must come through without DRAIN_FRAMES going by in which none of it does.  Reports the lines, packets and NAKs, the 
+    most held at once, and the bytes read per frame.  Exits non-zero if any check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usbd_virtualcdc.h"
+#include "usbmock.h"
+#include "bench.h"
+
+#define PACKETS_PER_FRAME 19 /* as many 64-byte bulk packets as full speed fits in a frame */
+#define DRAIN_FRAMES 4
+#define LINE_MAX 40
+
+struct command_case
+{
+  const char *Name;
+  unsigned Reads;         /* bytes the service loop reads after each chance the host has to send */
+  unsigned StallEvery;    /* frames; the service loop stalls for StallFrames of every StallEvery, or never if zero */
+  unsigned StallFrames;
+  unsigned BusyOneIn;     /* USBD_LL_PrepareReceive() answers busy one call in this many, or never if zero */
+};
+
+static const struct command_case cases[] =
+{
+  { "fast loop", 64, 0, 0, 0 },
+  { "8 bytes a chance", 8, 0, 0, 0 },
+  { "1 byte a chance", 1, 0, 0, 0 },
+  { "stalls 20 of 100", 32, 100, 20, 0 },
+  { "HAL busy 1 in 4", 16, 0, 0, 4 },
+  { "slow, stalls, busy", 2, 50, 10, 3 },
+};
+
+/* what the host has sent, and how far the service loop has read it */
+static struct
+{
+  uint8_t *Data;
+  unsigned long Length, Allocated, Offered, Read;
+} stream;
+
+static void add_byte(uint8_t c)
+{
+  if (stream.Length == stream.Allocated)
+  {
+    stream.Allocated = (stream.Allocated) ? 2 * stream.Allocated : 65536;
+    stream.Data = realloc(stream.Data, stream.Allocated);
+    if (!stream.Data)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  stream.Data[stream.Length++] = c;
+}
+
+/* a burst of 1 to 32 command lines, such as a host sends on opening the port */
+static unsigned add_burst(void)
+{
+  static const char first[] = "SsOCtTrRFfDQqYZVNI";
+  static const char rest[] = "0123456789ABCDEF";
+  unsigned lines = 1 + rand() % 32, line, length, index;
+
+  for (line = 0; line < lines; line++)
+  {
+    add_byte(first[rand() % (sizeof(first) - 1)]);
+    length = rand() % LINE_MAX;
+    for (index = 0; index < length; index++)
+      add_byte(rest[rand() % (sizeof(rest) - 1)]);
+    add_byte(13);
+    if (!(rand() % 8))
+      add_byte(10);
+  }
+
+  return lines;
+}
+
+static int run(const struct command_case *command, unsigned frames)
+{
+  uint8_t packet[64], c;
+  unsigned frame, chance, count, packet_length = 0, lines = 0, lines_read = 0, line_length = 0, stalled, idle = 0;
+  unsigned long held, most_held = 0, last = 0, before;
+  int passed = 1;
+
+  memset(&stream, 0, sizeof(stream));
+  if (!USBmock_Init())
+  {
+    fprintf(stderr, "could not map memory at the USB peripheral's addresses\n");
+    exit(1);
+  }
+  USBmock_BusyOneIn = command->BusyOneIn;
+
+  for (frame = 0; (frame < frames) || ((stream.Read < stream.Length) && (idle < DRAIN_FRAMES)); frame++)
+  {
+    before = stream.Read;
+
+    /* a new burst every so often, so that there are quiet frames as well as busy ones */
+    if ( (frame < frames) && (stream.Offered == stream.Length) && !(rand() % 4) )
+      lines += add_burst();
+
+    stalled = command->StallEvery && ((frame % command->StallEvery) < command->StallFrames) && (frame < frames);
+
+    for (chance = 0; chance < PACKETS_PER_FRAME; chance++)
+    {
+      if (!packet_length && (stream.Offered < stream.Length))
+      {
+        packet_length = 1 + rand() % 64;
+        if (packet_length > stream.Length - stream.Offered)
+          packet_length = stream.Length - stream.Offered;
+        memcpy(packet, stream.Data + stream.Offered, packet_length);
+      }
+      if (packet_length && USBmock_HostOut(packet, packet_length))
+      {
+        stream.Offered += packet_length;
+        packet_length = 0;
+      }
+
+      for (count = 0; !stalled && (count < command->Reads); count++)
+      {
+        if (0 == USBD_VirtualCDC_FromHost_Read(&c, 1))
+          break;
+        if ( (stream.Read >= stream.Offered) || (c != stream.Data[stream.Read]) )
+        {
+          printf("%s: byte %lu read as %02X, not as sent\n", command->Name, stream.Read, c);
+          return 0;
+        }
+        stream.Read++;
+
+        /* as CANbus_Command() gathers lines */
+        if (13 == c)
+        {
+          if (line_length > LINE_MAX + 1)
+            passed = 0;
+          lines_read++;
+          line_length = 0;
+        }
+        else if (10 != c)
+        {
+          line_length++;
+        }
+      }
+
+      held = stream.Offered - stream.Read;
+      if (held > most_held)
+        most_held = held;
+    }
+
+    USBmock_Frame();
+
+    if (frame == frames - 1)
+      last = stream.Read;
+    idle = (stream.Read == before) ? idle + 1 : 0;
+  }
+
+  printf("%-20s %9lu %7u %9lu %8lu %6lu %6lu %8.1f\n", command->Name, stream.Length, lines, USBmock_Counters.OutPackets,
+    USBmock_Counters.OutNaks, USBmock_Counters.Busy, most_held, (double)last / frames);
+
+  if (most_held > (OUTBOUND_RING_SIZE - 1) + CDC_DATA_OUT_MAX_PACKET_SIZE)
+  {
+    printf("%s: %lu bytes held, more than the ring and packet buffer have room for\n", command->Name, most_held);
+    passed = 0;
+  }
+
+  if ( (stream.Read != stream.Length) || (lines_read != lines) )
+  {
+    printf("%s: %lu of %lu bytes (%u of %u lines) read, and then nothing for %u frames\n", command->Name, stream.Read, stream.Length, lines_read, lines, DRAIN_FRAMES);
+    passed = 0;
+  }
+
+  free(stream.Data);
+  return passed;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned frames = (argc > 1) ? atoi(argv[1]) : 20000, index, passed = 0;
+
+  if (frames < 1)
+  {
+    fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  printf("case                     bytes   lines   packets   NAKed   busy   held  per frame\n");
+  for (index = 0; index < BENCH_CASES(cases); index++)
+    passed += run(&cases[index], frames);
+
+  return Bench_Report(passed, BENCH_CASES(cases), NULL);
+}
@@ -0,0 +1,224 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+    regression test and benchmark of PCD_WritePMA() and PCD_ReadPMA() in src/stm32f0xx_hal_pcd.c
+
+      usbpmabench
+
+    Copies between a buffer in RAM and the PMA (mapped by host/mock/usbmock.c) at every halfword address of the PMA, 
+    for every length that fits there, and from or to the buffer at each of the four alignments a word has, checking 
+    each against the PMA taken a byte at a time: the byte at address a is the low byte of the halfword at a & ~1 if a 
+    is even, the high byte if odd.
+
+      - PCD_WritePMA() must leave the PMA holding the bytes copied, from the address on, and touch no halfword outside 
+        them; with an odd length, the last halfword's high byte is the byte after the buffer (as with ST's original).
+      - PCD_ReadPMA() must leave the buffer holding the bytes copied, and touch nothing outside them.  ST's original 
+        stored whole halfwords, and so one byte past the end of the buffer with an odd length; the buffers the HAL 
+        reads into are sized to allow for that, but other callers' need not be.
+
+    Each copy is checked against the PMA around it, and the whole PMA once for each address.  Reports the copies 
+    checked, and the time taken per byte over 64-byte packets against ST's original, which went a halfword at a time 
+    whatever the buffer's alignment.  Exits non-zero if any copy is wrong.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usbd_virtualcdc.h"
+#include "usbmock.h"
+#include "bench.h"
+
+#define PMA_SIZE 1024
+#define GUARD 8 /* bytes either side of the buffer that must not be touched */
+#define TIMING_ROUNDS 200000
+
+/* provided by stm32f0xx_hal_pcd.c */
+extern void PCD_WritePMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+extern void PCD_ReadPMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+
+static volatile uint16_t *const pma = (volatile uint16_t *)USB_PMAADDR;
+
+/* what the PMA should hold, as bytes */
+static uint8_t image[PMA_SIZE];
+
+/* random bytes, to be taken from at random so as to fill buffers quickly */
+static uint8_t noise[2 * (PMA_SIZE + 2 * GUARD + 4)];
+
+static void fill_pma(void)
+{
+  unsigned index;
+
+  for (index = 0; index < PMA_SIZE; index++)
+    image[index] = (uint8_t)rand();
+  for (index = 0; index < PMA_SIZE / 2; index++)
+    pma[index] = image[2 * index] | (image[2 * index + 1] << 8);
+}
+
+/* the PMA from first to last (bytes), or as much of it as there is */
+static int pma_is_image(int first, int last)
+{
+  int index;
+
+  if (first < 0)
+    first = 0;
+  if (last > PMA_SIZE)
+    last = PMA_SIZE;
+
+  for (index = first / 2; index < last / 2; index++)
+    if (pma[index] != (image[2 * index] | (image[2 * index + 1] << 8)))
+      return 0;
+
+  return 1;
+}
+
+/* ST's original copies, which the word and halfword ones replaced */
+static void original_write(uint8_t *buffer, uint16_t address, uint16_t length)
+{
+  volatile uint16_t *target = (volatile uint16_t *)(USB_PMAADDR + address);
+  uint32_t n;
+
+  for (n = (length + 1) >> 1; n != 0; n--, buffer += 2)
+    *target++ = buffer[0] | (uint16_t)buffer[1] << 8;
+}
+
+static void original_read(uint8_t *buffer, uint16_t address, uint16_t length)
+{
+  volatile uint16_t *source = (volatile uint16_t *)(USB_PMAADDR + address);
+  uint16_t temp;
+  uint32_t n;
+
+  for (n = (length + 1) >> 1; n != 0; n--)
+  {
+    temp = *source++;
+    *buffer++ = (uint8_t)temp;
+    *buffer++ = (uint8_t)(temp >> 8);
+  }
+}
+
+static int check_write(uint8_t *area, unsigned offset, unsigned address, unsigned length)
+{
+  uint8_t *buffer = area + GUARD + offset;
+
+  memcpy(buffer, noise + rand() % (sizeof(noise) / 2), length + 1);
+
+  PCD_WritePMA(USB, buffer, address, length);
+
+  memcpy(image + address, buffer, length);
+  if (length & 1)
+    image[address + length] = buffer[length];
+
+  return pma_is_image(address - GUARD, address + length + GUARD);
+}
+
+static int check_read(uint8_t *area, unsigned offset, unsigned address, unsigned length)
+{
+  static uint8_t before[PMA_SIZE + 2 * GUARD + 4];
+  uint8_t *buffer = area + GUARD + offset;
+
+  memcpy(area, noise + rand() % (sizeof(noise) / 2), length + 2 * GUARD + 4);
+  memcpy(before, area, length + 2 * GUARD + 4);
+
+  PCD_ReadPMA(USB, buffer, address, length);
+
+  return !memcmp(buffer, image + address, length) && !memcmp(area, before, GUARD + offset) &&
+    !memcmp(buffer + length, before + GUARD + offset + length, GUARD + 4 - offset) &&
+    pma_is_image(address - GUARD, address + length + GUARD);
+}
+
+static double time_copies(void (*copy)(USB_TypeDef *, uint8_t *, uint16_t, uint16_t), void (*bytes)(uint8_t *, uint16_t, uint16_t), uint8_t *buffer)
+{
+  double start;
+  unsigned round;
+
+  start = Bench_Now();
+  for (round = 0; round < TIMING_ROUNDS; round++)
+  {
+    if (copy)
+      copy(USB, buffer, (round & 7) * 64, 64);
+    else
+      bytes(buffer, (round & 7) * 64, 64);
+  }
+
+  return 1e9 * (Bench_Now() - start) / (TIMING_ROUNDS * 64.0);
+}
+
+int main(void)
+{
+  static uint8_t area[PMA_SIZE + 2 * GUARD + 4];
+  unsigned address, length, offset;
+  unsigned long copies = 0, wrong = 0;
+
+  srand(1);
+  for (address = 0; address < sizeof(noise); address++)
+    noise[address] = (uint8_t)rand();
+  if (!USBmock_Init())
+  {
+    fprintf(stderr, "could not map memory at the USB peripheral's addresses\n");
+    return 1;
+  }
+
+  fill_pma();
+  for (address = 0; address < PMA_SIZE; address += 2)
+  {
+    for (length = 0; address + length <= PMA_SIZE; length++)
+      for (offset = 0; offset < 4; offset++)
+      {
+        /* an odd write takes in the byte after the buffer, so it mustn't run off the end of the PMA */
+        if ( (length & 1) && (address + length == PMA_SIZE) )
+          continue;
+
+        copies += 2;
+        if (!check_write(area, offset, address, length))
+        {
+          if (!wrong++)
+            printf("PCD_WritePMA() of %u bytes from an address %u past a word, to %03X, is wrong\n", length, offset, address);
+          fill_pma();
+        }
+        if (!check_read(area, offset, address, length))
+        {
+          if (!wrong++)
+            printf("PCD_ReadPMA() of %u bytes from %03X, to an address %u past a word, is wrong\n", length, address, offset);
+          fill_pma();
+        }
+      }
+
+    if (!pma_is_image(0, PMA_SIZE))
+    {
+      if (!wrong++)
+        printf("copies to and from %03X touched the PMA outside them\n", address);
+      fill_pma();
+    }
+  }
+
+  printf("copies checked    %lu\n", copies);
+  printf("wrong             %lu\n", wrong);
+  printf("                  word-aligned    odd      ST's original\n");
+  printf("PCD_WritePMA()    %6.2f ns   %6.2f ns   %6.2f ns per byte\n", time_copies(PCD_WritePMA, NULL, area + GUARD),
+    time_copies(PCD_WritePMA, NULL, area + GUARD + 1), time_copies(NULL, original_write, area + GUARD));
+  printf("PCD_ReadPMA()     %6.2f ns   %6.2f ns   %6.2f ns per byte\n", time_copies(PCD_ReadPMA, NULL, area + GUARD),
+    time_copies(PCD_ReadPMA, NULL, area + GUARD + 1), time_copies(NULL, original_read, area + GUARD));
+
+  return wrong ? 1 : 0;
+}
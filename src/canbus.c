@@ -1,6 +1,16 @@
 #include "stm32f0xx_hal.h"
 #include "usbd_virtualcdc.h" 
 #include "canconfig.h"
+#include "canbus.h"
+#include "canstats.h"
+#include "candelta.h"
+#include "cantrigger.h"
+#include "canlimit.h"
+#include "cansettings.h"
+#include "cangen.h"
+#include "cancomp.h"
+#include "canqueue.h"
+#include "canfast.h"
 
 /*
     CANbus sniffer using STM32F042
@@ -31,211 +41,1385 @@
 
     Routines are initialized with a call to CANbus_Init() and regular calls to CANbus_Service() whenever the CPU is idle.
 
-    ST's CAN driver calls HAL_CAN_RxCpltCallback() and HAL_CAN_ErrorCallback().
-    The former indicates a received packet; the latter indicates some sort of error condition.
-
-    The HAL_CAN_RxCpltCallback() implementation writes the data into a queue (CANqueue[]) and re-enables reception ASAP.
+    The CAN interrupt (CANx_RX_IRQHandler(), in canfast.c with the rest of the code run for every message) empties the 
+    bxCAN receive FIFO itself rather than through ST's driver: it takes every message pending in one go, writes each 
+    into a queue (CANqueue[], see canqueue.h) and releases the mailbox, leaving the FIFO interrupt enabled throughout.  
+    A burst of back-to-back frames thus costs one exception entry rather than one per frame, with none of the driver's 
+    re-arming in between.  Should the FIFO have overrun regardless, that is counted once it is empty.  Transmission and 
+    errors are still left to ST's driver, which calls HAL_CAN_ErrorCallback(); the FIFO interrupt is masked only while 
+    the driver runs, so that it never takes a message itself.
+    Before queueing, each message is checked against the rate limiting rules (canlimit.c); messages in excess of a rule's
+    rate are counted and discarded there, so that high-rate IDs cannot crowd out everything else.
 
     CANbus_Service() services the queue, converts it to LAWICEL protocol form, and outputs it to the virtual CDC routines.
 
-    Data collection (outputting of CAN messages via virtual CDC serial port) is enabled only when DTR is active (CDC_SET_CONTROL_LINE_STATE).
+    When built with CAN_TRANSMIT (see canconfig.h), the controller is a full participant on the bus, and the LAWICEL 
+    't' and 'T' commands queue frames in CANtxqueue[].  Only one frame is in a mailbox at a time, so they go out in order; 
+    HAL_CAN_TxCpltCallback() loads the next one straight away, so back-to-back frames (such as an ISO-TP transfer) don't 
+    wait on CANbus_Service().  CANbus_Service() sends an 'a' record to the host as each frame leaves.
+
+    The CAN interrupt is the most urgent in the system (see stm32f0xx_hal_conf.h), as the bxCAN FIFO holds only 3 messages.
+    To keep tabs on how long it might wait regardless, a compare interrupt of TIMESTAMPx at the same priority fires every 
+    LATENCY_PROBE_INTERVAL microseconds and records how late it ran; the CAN interrupt also records how full the FIFO was 
+    on entry.  Both worst cases are reported by command 'I'.
+
+    Data collection (outputting of CAN messages via virtual CDC serial port) is enabled only when DTR is active (CDC_SET_CONTROL_LINE_STATE), 
+    unless autostart (command 'Q1') is in effect, in which case it is enabled from power-up.
+
+    With autostart, whenever the port is not open CANbus_Service() leaves CANqueue[] alone rather than outputting it, and 
+    the receive interrupt stops queueing after the first RetainDepth messages (command 'B').  
+    Those messages are retained until the host opens the port and are then output like any other, so the traffic 
+    right after power-up (often the most interesting) is not lost while the host gets around to asserting DTR.
+
+    The bitrate ('S'), acceptance filter ('f'), output mode ('D') and autostart ('Q') are saved to flash by the 'Q' command, 
+    and CANbus_Init() applies the saved values (cansettings.c) before the host has had a chance to enumerate the device.
+
+    Data from the host is buffered by the virtual CDC routines; CANbus_Service() reads it (USBD_VirtualCDC_FromHost_Read()), 
+    gathers it a line at a time, and executes each line as a command.
+    Each command is answered with CR (success) or BELL (failure), as per LAWICEL.
+
+    The output mode (command 'D') selects what CANbus_Service() sends to the host:
+    D0: every received message in LAWICEL form (the default)
+    D1: per-ID statistics, dumped every CANSTATS_DUMP_INTERVAL microseconds
+    D2: only messages whose payload differs from the previous one with that ID, plus a count of suppressed repeats 
+        every CANDELTA_HEARTBEAT_INTERVAL microseconds
+
+    D3: arm the trigger; nothing is output until a message matches the trigger condition, and then the PreTrigger
+        messages before it, the trigger message itself, and the PostTrigger messages after it are output
+
+    D4: every received message in the compressed binary form of cancomp.c, in blocks of "\0", a length byte, and then 
+        that many bytes of records; anything else sent (such as command responses) is as text outside the blocks
+
+    Modes D1, D2 and D4 keep a per-ID table in the tail of CANqueue[], shortening the queue accordingly.
+    Mode D3 uses CANqueue[] itself as the pre-trigger history; while armed, CANbus_Service() scans each new message 
+    against the trigger and discards all but the most recent PreTrigger messages.
+
+    For benchmarking, command 'Y' has a second compare channel of TIMESTAMPx make up messages (cangen.c) and feed them 
+    to the same path as received ones (CANfast_Enqueue()), at most 3 per interrupt as that is all the bxCAN FIFO could 
+    have held.  CANbus_Service() first counts its own passes for BENCH_INTERVAL with the generator off, as a measure 
+    of the idle main loop, and then reports a 'b' record every BENCH_INTERVAL of what became of the messages.
+
+    Every message reaching CANfast_Enqueue() is numbered, including those then discarded by rate limiting or for want 
+    of space in CANqueue[]; with command 'q1', each message record ends with its number, so the host can tell exactly 
+    where messages went missing.
+
+    With 'Z2', every SYNC_INTERVAL_FRAMES USB frames the SOF interrupt (USBD_VirtualCDC_FrameStart()) notes the frame 
+    number and the time, and CANbus_Service() sends them as a 'u' record.  HSI48 is trimmed by CRS to the host's SOF, 
+    so the frame counter is a clock that both ends share; the host fits the timestamps against it (host/cansync.c).
 */
 
-#define CANQUEUE_SIZE 128 /* how many entries in the CAN queue; chosen to use as much RAM as we can afford */
+/*
+    CANqueue[] has the part of SRAM_SHARED_WORDS (see canbus.h) that FAST_CODE does not take.  The code's exact size is only 
+    known once linked, so CANbus_Init() checks it fits, and the 'I' command reports it (counter 0C) along with the part of 
+    CANqueue[] the queue has in the current output mode (counter 0D).
+
+    Modes D1, D2 and D4 take their per-ID table out of CANqueue[] (see CANbus_SetOutputMode()), so with code in SRAM, the 
+    queue holds 93 messages of 8 data bytes in modes D0 and D3, but only 46 in D1, 39 in D2 and 33 in D4 (or with no data 
+    bytes, 161, and 79, 67 and 58).
+*/
+#define STRINGIFY(x) #x
+#define SRAM_REPORT(code, shared) "SRAM: " STRINGIFY(code) " of " STRINGIFY(shared) " words set aside for FAST_CODE (checked against the linked size at startup), the rest for CANqueue[]"
+#pragma message(SRAM_REPORT(FAST_CODE_WORDS, SRAM_SHARED_WORDS))
+
 #define ERROR_CONDITION() __BKPT()
 
-struct CANmessage
+#define CANSTATS_DUMP_INTERVAL 1000000UL /* microseconds between dumps of the statistics table */
+#define CANDELTA_HEARTBEAT_INTERVAL 1000000UL /* microseconds between reports of suppressed repeats */
+
+/* number of CANqueue[] words that must be given over to hold a per-ID table of the given type */
+#define CANQUEUE_RESERVE(type) ((sizeof(type) + sizeof(uint32_t) - 1) / sizeof(uint32_t))
+
+/* whichever table a mode reserves, CANqueue[] must keep room for at least CANQUEUE_MIN_MESSAGES of the longest messages */
+#define CANQUEUE_MIN_MESSAGES 8
+#define CANQUEUE_MIN_WORDS ((CANQUEUE_MIN_MESSAGES * CANQUEUE_RECORD_MAX + sizeof(uint32_t) - 1) / sizeof(uint32_t))
+
+#define COMPRESSED_BLOCK_SIZE (INBOUND_RECORD_MAX - 2) /* most bytes of records in a D4 block, so that a block with its framing is one record to the host */
+
+/* longest message record CANfast_EncodeMessage() makes */
+#define MESSAGE_RECORD_MAX (1 /* start char */ + 8 /* extendedId */ + 1 /* FD flags */ + 1 /* DLC */ + 2 * CANMESSAGE_DATA_MAX /* data */ + 8 /* timestamp */ + 4 /* sequence */ + 1 /* CR */)
+
+#if (MESSAGE_RECORD_MAX > INBOUND_RECORD_MAX) || (CANCOMP_RECORD_MAX > COMPRESSED_BLOCK_SIZE)
+#error "INBOUND_RECORD_MAX must be defined big enough for the longest message record (152 for CANMESSAGE_DATA_MAX of 64)"
+#endif
+
+#define COMMAND_LINE_SIZE 40 /* longest command line accepted from the host, excluding the CR */
+
+#define CANTXQUEUE_SIZE 16 /* frames from the host awaiting transmission, or awaiting the 'a' record that reports it */
+
+#define BENCH_INTERVAL 1000000UL /* microseconds between benchmark reports */
+#define BENCH_PERIOD_MIN 10 /* shortest period between generated messages that still leaves the main loop some time */
+#define BENCH_FIFO_DEPTH 3 /* most generated messages delivered per interrupt, as per the bxCAN FIFO */
+
+#define SYNC_INTERVAL_FRAMES 1000 /* USB frames (milliseconds) between 'u' records */
+
+#define LATENCY_PROBE_INTERVAL 997 /* microseconds between latency probes; deliberately not in step with the 1ms USB frame */
+
+enum output_modes
+{
+  OUTPUT_MODE_FRAMES = 0,
+  OUTPUT_MODE_STATS = 1,
+  OUTPUT_MODE_DELTA = 2,
+  OUTPUT_MODE_TRIGGER = 3,
+  OUTPUT_MODE_COMPRESSED = 4,
+};
+
+enum trigger_states
+{
+  TRIGGER_ARMED,
+  TRIGGER_FIRED,
+  TRIGGER_DONE,
+};
+
+enum bench_states
 {
-  uint32_t Id;
-  uint8_t flags;
-  uint8_t DLC;
-  uint8_t Data[8];
+  BENCH_OFF,
+  BENCH_CALIBRATING,
+  BENCH_RUNNING,
 };
 
+#if FAST_CODE_WORDS
+extern const uint8_t __fast_start__[], __fast_end__[]; /* the code in SRAM, as placed by the CrossWorks linker */
+#endif
+#ifdef __CROSSWORKS_ARM
+extern const uint8_t __FLASH_segment_end__[]; /* the end of the flash the linker may fill, per the memory map */
+#endif
+
 static CAN_HandleTypeDef CanHandle;
-static struct CANmessage CANqueue[CANQUEUE_SIZE];
-static uint32_t CANqueue_write_index, CANqueue_read_index;
-static uint32_t collection_active;
+static uint32_t CANqueue[CANQUEUE_WORDS];
+static uint32_t port_open, retaining;
+static uint32_t output_mode;
+
+/* a compile error here means the table named is too big for CANqueue[]: make its ENTRIES smaller, or CANQUEUE_WORDS bigger */
+typedef char canqueue_room_for_canstats_table[(CANQUEUE_RESERVE(struct canstats_table) + CANQUEUE_MIN_WORDS <= CANQUEUE_WORDS) ? 1 : -1];
+typedef char canqueue_room_for_candelta_cache[(CANQUEUE_RESERVE(struct candelta_cache) + CANQUEUE_MIN_WORDS <= CANQUEUE_WORDS) ? 1 : -1];
+
+static struct canstats_table *stats;
+static uint32_t stats_dump_time, stats_dump_index;
+
+static struct candelta_cache *delta;
+static uint32_t delta_heartbeat_time;
+
+/* D4 encoder state, and the block being filled for the host; Full is the length of the leading part of Block ready to go */
+struct compressed_output
+{
+  struct cancomp_state state;
+  uint32_t Length, Full;
+  uint8_t Block[COMPRESSED_BLOCK_SIZE + CANCOMP_RECORD_MAX];
+};
+
+typedef char canqueue_room_for_compressed_output[(CANQUEUE_RESERVE(struct compressed_output) + CANQUEUE_MIN_WORDS <= CANQUEUE_WORDS) ? 1 : -1];
+
+static struct compressed_output *compressed;
+
+static struct cantrigger trigger;
+static uint32_t trigger_state, trigger_scan_index, trigger_history, trigger_remaining, trigger_announce;
+
+static char command_line[COMMAND_LINE_SIZE];
+static uint32_t command_length, command_ready;
+static char command_response[1 /* start char */ + 2 /* index */ + 8 /* value */ + 1 /* CR */];
+static uint32_t command_response_length;
+
+#ifdef CAN_TRANSMIT
+static struct CANmessage CANtxqueue[CANTXQUEUE_SIZE];
+static uint32_t CANtxqueue_write_index, CANtxqueue_send_index, CANtxqueue_ack_index;
+static uint32_t CANtx_busy;
+#endif
+
+static struct cansettings settings;
+
+static volatile uint32_t latency_worst;
+static volatile uint32_t sync_pending, sync_frame, sync_time; /* the SOF noted for the next 'u' record */
+static uint32_t sync_frames;
+
+static struct cangen bench;
+static volatile uint32_t bench_generated, bench_fifo_drops;
+static uint32_t bench_state, bench_period, bench_dlc_mask, bench_time, bench_passes, bench_baseline, bench_delivered;
+static uint32_t bench_last_generated, bench_last_fifo_drops, bench_last_limit_drops, bench_last_queue_drops;
+
+/* bxCAN prescaler for each LAWICEL 'S' bitrate (10k, 20k, 50k, 100k, 125k, 250k, 500k, 800k, 1M), given 12 quanta per bit */
+static const uint16_t bitrate_prescalers[] = { 400, 200, 80, 40, 32, 16, 8, 5, 4 };
+
+#ifndef FLASH_KEY1
+#define FLASH_KEY1 0x45670123UL
+#define FLASH_KEY2 0xCDEF89ABUL
+#endif
 
-static void CAN_Receive(void);
 static void CAN_Config(void);
+static void Timestamp_Config(void);
+static void CANbus_SetOutputMode(uint32_t mode);
+static uint32_t CANbus_RetainRoom(void);
 
 void CANbus_Init(void)
 {
   /* initialize the queue to empty */
-  CANqueue_write_index = CANqueue_read_index = 0;
+  CANqueue_Init(&CANfast.Queue, CANqueue, sizeof(CANqueue));
+  CANfast.RetainRoom = CANFAST_RETAIN_UNLIMITED;
 
-  collection_active = 0;
+#ifdef __CROSSWORKS_ARM
+  /* linked against a memory map that takes in the settings page, the image could be erased by the first save */
+  if ((uint32_t)__FLASH_segment_end__ > CANSETTINGS_PAGE_ADDRESS)
+    ERROR_CONDITION();
+#endif
 
-  CAN_Config();
+#if FAST_CODE_WORDS
+  /* should the code in SRAM have outgrown what was set aside for it, it takes RAM that SRAM_SHARED_WORDS counted on */
+  if ((uint32_t)(__fast_end__ - __fast_start__) > sizeof(uint32_t) * FAST_CODE_WORDS)
+    ERROR_CONDITION();
+#endif
+
+  /* whatever the host last saved, or the defaults if nothing (valid) was */
+  if ( !CANsettings_Load((const uint16_t *)CANSETTINGS_PAGE_ADDRESS, &settings) || (settings.Bitrate >= sizeof(bitrate_prescalers) / sizeof(bitrate_prescalers[0])) || (settings.OutputMode > OUTPUT_MODE_COMPRESSED) )
+    CANsettings_Default(&settings);
+
+  port_open = 0;
+  CANfast.Collecting = settings.Autostart;
+
+  command_length = command_ready = 0;
+  command_response_length = 0;
+
+#ifdef CAN_TRANSMIT
+  CANtxqueue_write_index = CANtxqueue_send_index = CANtxqueue_ack_index = 0;
+  CANtx_busy = 0;
+  CANfast.Handle = &CanHandle;
+#endif
+
+  CANlimit_Init(&CANfast.Limits);
+
+  CANtrigger_Init(&trigger);
 
-  /* 'prime the pump' for CAN messages */
-  CAN_Receive();
+  CANfast.QueueDrops = 0;
+  CANfast.Sequence = 0;
+  CANfast.SequenceOutput = 0;
+  CANfast.TimestampOutput = 0;
+  sync_pending = sync_frames = 0;
+  bench_state = BENCH_OFF;
 
+  Timestamp_Config();
+
+  CANbus_SetOutputMode(settings.OutputMode);
+
+  /* with autostart, retention starts right away, before CANbus_Service() has had a chance to run */
+  if (settings.Autostart)
+  {
+    CANfast.RetainRoom = CANbus_RetainRoom();
+    retaining = 1;
+  }
+
+  CAN_Config();
 }
 
 static void CAN_Config(void)
 {
   CAN_FilterConfTypeDef  sFilterConfig;
-  static CanRxMsgTypeDef RxMessage;
+#ifdef CAN_TRANSMIT
+  static CanTxMsgTypeDef TxMessage;
+#endif
 
   CanHandle.Instance = CANx;
+#ifdef CAN_TRANSMIT
+  CanHandle.pTxMsg = &TxMessage;
+#else
   CanHandle.pTxMsg = NULL;
-  CanHandle.pRxMsg = &RxMessage;
+#endif
+  CanHandle.pRxMsg = NULL; /* CANx_RX_IRQHandler() reads the FIFO itself */
 
   CanHandle.Init.TTCM = DISABLE;
+#ifdef CAN_TRANSMIT
+  CanHandle.Init.ABOM = ENABLE; /* as an active node, recover from bus-off without intervention */
+#else
   CanHandle.Init.ABOM = DISABLE;
+#endif
   CanHandle.Init.AWUM = DISABLE;
   CanHandle.Init.NART = DISABLE;
   CanHandle.Init.RFLM = DISABLE;
   CanHandle.Init.TXFP = DISABLE;
+#ifdef CAN_TRANSMIT
+  CanHandle.Init.Mode = CAN_MODE_NORMAL;
+#else
   CanHandle.Init.Mode = CAN_MODE_SILENT;
+#endif
   CanHandle.Init.SJW = CAN_SJW_1TQ;
-  /* 500k */
+  /* 1 + 5 + 6 = 12 quanta per bit */
   CanHandle.Init.BS1 = CAN_BS1_5TQ;
   CanHandle.Init.BS2 = CAN_BS2_6TQ;
-  CanHandle.Init.Prescaler = 8;
+  CanHandle.Init.Prescaler = bitrate_prescalers[settings.Bitrate];
 
   if (HAL_CAN_Init(&CanHandle) != HAL_OK)
     ERROR_CONDITION();
 
-  /* set filter to receive all */
+  /* set filter as per command 'f'; by default, it receives all */
   sFilterConfig.FilterNumber = 0;
   sFilterConfig.FilterMode = CAN_FILTERMODE_IDMASK;
   sFilterConfig.FilterScale = CAN_FILTERSCALE_32BIT;
-  sFilterConfig.FilterIdHigh = 0x0000;
-  sFilterConfig.FilterIdLow = 0x0000;
-  sFilterConfig.FilterMaskIdHigh = 0x0000;
-  sFilterConfig.FilterMaskIdLow = 0x0000;
+  sFilterConfig.FilterIdHigh = settings.FilterId >> 16;
+  sFilterConfig.FilterIdLow = settings.FilterId & 0xFFFF;
+  sFilterConfig.FilterMaskIdHigh = settings.FilterMask >> 16;
+  sFilterConfig.FilterMaskIdLow = settings.FilterMask & 0xFFFF;
   sFilterConfig.FilterFIFOAssignment = 0;
   sFilterConfig.FilterActivation = ENABLE;
   sFilterConfig.BankNumber = 14;
 
   if (HAL_CAN_ConfigFilter(&CanHandle, &sFilterConfig) != HAL_OK)
     ERROR_CONDITION();
+
+  /* from here on, a message in the FIFO interrupts; CANx_RX_IRQHandler() masks this only while ST's driver runs */
+  __HAL_CAN_ENABLE_IT(&CanHandle, CAN_IT_FMP0);
+}
+
+static void Timestamp_Config(void)
+{
+  /* free-running 32-bit counter ticking once per microsecond */
+  TIMESTAMPx_CLK_ENABLE();
+  TIMESTAMPx->PSC = (SystemCoreClock / 1000000) - 1;
+  TIMESTAMPx->ARR = 0xFFFFFFFF;
+  TIMESTAMPx->EGR = TIM_EGR_UG; /* load the prescaler now rather than at the first overflow */
+  TIMESTAMPx->CR1 = TIM_CR1_CEN;
+
+  /* latency probe */
+  latency_worst = CANfast.FifoWorst = 0;
+  TIMESTAMPx->CCR1 = TIMESTAMPx->CNT + LATENCY_PROBE_INTERVAL;
+  TIMESTAMPx->SR = ~TIM_SR_CC1IF;
+  TIMESTAMPx->DIER = TIM_DIER_CC1IE;
+  HAL_NVIC_SetPriority(TIMESTAMPx_IRQn, CAN_INT_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIMESTAMPx_IRQn);
+}
+
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+  /* acknowledge the peripheral's error */
+  hcan->Instance->MSR = CAN_MSR_ERRI;
+}
+
+static void CAN_Reconfig(void)
+{
+  /* start over with the new bitrate and filter; HAL_CAN_DeInit() resets the peripheral and HAL_CAN_Init() sets it up again */
+  HAL_CAN_DeInit(&CanHandle);
+  CAN_Config();
+
+#ifdef CAN_TRANSMIT
+  /* any frame that was in a mailbox went with the reset; CANbus_Service() will load it again */
+  CANtx_busy = 0;
+#endif
+}
+
+#ifdef CAN_TRANSMIT
+
+/* load the next frame of CANtxqueue[] into a mailbox; the caller ensures the CAN interrupt can't intervene */
+
+static void CAN_TransmitNext(void)
+{
+  const struct CANmessage *pnt = &CANtxqueue[CANtxqueue_send_index];
+  unsigned index;
+
+  if (pnt->flags & CANMESSAGE_FLAG_STDID)
+  {
+    CanHandle.pTxMsg->IDE = CAN_ID_STD;
+    CanHandle.pTxMsg->StdId = pnt->Id;
+  }
+  else
+  {
+    CanHandle.pTxMsg->IDE = CAN_ID_EXT;
+    CanHandle.pTxMsg->ExtId = pnt->Id;
+  }
+  CanHandle.pTxMsg->RTR = CAN_RTR_DATA;
+  CanHandle.pTxMsg->DLC = pnt->DLC;
+  for (index = 0; index < pnt->DLC; index++)
+    CanHandle.pTxMsg->Data[index] = pnt->Data[index];
+
+  /* if the HAL is busy (after an error, say), CANbus_Service() tries again */
+  CANtx_busy = (HAL_OK == HAL_CAN_Transmit_IT(&CanHandle));
+}
+
+void HAL_CAN_TxCpltCallback(CAN_HandleTypeDef *CanHandle)
+{
+  uint32_t next_send_index;
+
+  CANtxqueue[CANtxqueue_send_index].Timestamp = TIMESTAMPx->CNT;
+
+  next_send_index = CANtxqueue_send_index + 1;
+  if (CANTXQUEUE_SIZE == next_send_index)
+    next_send_index = 0;
+  CANtxqueue_send_index = next_send_index;
+
+  /* keep the bus busy; a turnaround through CANbus_Service() would leave a gap between frames */
+  if (CANtxqueue_send_index != CANtxqueue_write_index)
+    CAN_TransmitNext();
+  else
+    CANtx_busy = 0;
+}
+
+#endif
+
+/* start the D4 stream over (with a reset record), for the benefit of a host that is only now listening */
+
+static void CANbus_CompressedRestart(void)
+{
+  CANcomp_Init(&compressed->state);
+  compressed->Length = compressed->Full = 0;
+}
+
+static void CANbus_SetOutputMode(uint32_t mode)
+{
+  uint32_t reserve, primask;
+
+  switch (mode)
+  {
+  case OUTPUT_MODE_STATS:
+    reserve = CANQUEUE_RESERVE(struct canstats_table);
+    break;
+  case OUTPUT_MODE_DELTA:
+    reserve = CANQUEUE_RESERVE(struct candelta_cache);
+    break;
+  case OUTPUT_MODE_COMPRESSED:
+    reserve = CANQUEUE_RESERVE(struct compressed_output);
+    break;
+  default:
+    reserve = 0;
+    break;
+  }
+
+  /* anything still queued was destined for the old mode, so discard it; CANbus_Init() calls this with interrupts already off */
+  primask = __get_PRIMASK();
+  __disable_irq();
+  CANqueue_Init(&CANfast.Queue, CANqueue, sizeof(uint32_t) * (CANQUEUE_WORDS - reserve));
+  CANfast.RetainRoom = CANFAST_RETAIN_UNLIMITED;
+  __set_PRIMASK(primask);
+
+  trigger_scan_index = trigger_history = 0;
+  retaining = 0; /* CANbus_Service() starts retaining again if it should */
+
+  switch (mode)
+  {
+  case OUTPUT_MODE_STATS:
+    stats = (struct canstats_table *)&CANqueue[CANQUEUE_WORDS - reserve];
+    CANstats_Init(stats);
+    stats_dump_time = TIMESTAMPx->CNT;
+    stats_dump_index = CANSTATS_ENTRIES + 1; /* idle until the first interval has elapsed */
+    break;
+  case OUTPUT_MODE_DELTA:
+    delta = (struct candelta_cache *)&CANqueue[CANQUEUE_WORDS - reserve];
+    CANdelta_Init(delta);
+    delta_heartbeat_time = TIMESTAMPx->CNT;
+    break;
+  case OUTPUT_MODE_TRIGGER:
+    trigger_state = TRIGGER_ARMED;
+    break;
+  case OUTPUT_MODE_COMPRESSED:
+    compressed = (struct compressed_output *)&CANqueue[CANQUEUE_WORDS - reserve];
+    CANbus_CompressedRestart();
+    break;
+  }
+
+  output_mode = mode;
+}
+
+/* while retaining, the receive interrupt stops queueing once RetainDepth messages are held */
+
+static uint32_t CANbus_RetainRoom(void)
+{
+  return (settings.RetainDepth) ? settings.RetainDepth : CANFAST_RETAIN_UNLIMITED;
+}
+
+static uint32_t CANbus_ParseHex(const char *text, unsigned digits, uint32_t *value)
+{
+  uint32_t result = 0;
+  char c;
+
+  while (digits--)
+  {
+    c = *text++;
+    if ( (c >= '0') && (c <= '9') )
+      result = (result << 4) | (c - '0');
+    else if ( (c >= 'A') && (c <= 'F') )
+      result = (result << 4) | (c - 'A' + 10);
+    else if ( (c >= 'a') && (c <= 'f') )
+      result = (result << 4) | (c - 'a' + 10);
+    else
+      return 0;
+  }
+
+  *value = result;
+  return 1;
+}
+
+/*
+    counters reported by command 'I':
+    00 to 07: messages discarded by rate limiting rules 0 to 7
+    08: worst latency (in microseconds) of an interrupt at CAN priority since the last time this was reported
+    09: most messages found waiting in the bxCAN FIFO on entry to the CAN interrupt since the last time this was reported
+    0A: messages discarded for want of space in CANqueue[]
+    0B: times the bxCAN FIFO overran, losing a message, because the CAN interrupt did not empty it in time
+    0C: bytes of SRAM taken by code placed there by FAST_CODE
+    0D: bytes of CANqueue[] the queue has, less any per-ID table of the output mode
+*/
+
+static uint32_t CANbus_Counter(uint32_t index, uint32_t *value)
+{
+  if (index < CANLIMIT_RULES)
+  {
+    *value = CANfast.Limits.rule[index].Decimated;
+    return 1;
+  }
+
+  switch (index)
+  {
+  case 0x08:
+    __disable_irq();
+    *value = latency_worst;
+    latency_worst = 0;
+    __enable_irq();
+    return 1;
+  case 0x09:
+    __disable_irq();
+    *value = CANfast.FifoWorst;
+    CANfast.FifoWorst = 0;
+    __enable_irq();
+    return 1;
+  case 0x0A:
+    *value = CANfast.QueueDrops;
+    return 1;
+  case 0x0B:
+    *value = CANfast.FifoOverruns;
+    return 1;
+  case 0x0C:
+#if FAST_CODE_WORDS
+    *value = __fast_end__ - __fast_start__;
+#else
+    *value = 0;
+#endif
+    return 1;
+  case 0x0D:
+    *value = CANfast.Queue.Size;
+    return 1;
+  }
+
+  return 0;
+}
+
+#ifdef CAN_TRANSMIT
+
+static uint32_t CANbus_Transmit(const char *line, uint32_t length)
+{
+  unsigned id_digits = ('t' == line[0]) ? 3 : 8;
+  uint32_t id, dlc, value, index, next_write_index;
+  struct CANmessage *pnt;
+
+  if ( (length < 2 + id_digits) || !CANbus_ParseHex(line + 1, id_digits, &id) || !CANbus_ParseHex(line + 1 + id_digits, 1, &dlc) )
+    return 0;
+  if ( (dlc > 8) || (length != 2 + id_digits + 2 * dlc) || (id > (('t' == line[0]) ? 0x7FF : 0x1FFFFFFF)) )
+    return 0;
+
+  next_write_index = CANtxqueue_write_index + 1;
+  if (CANTXQUEUE_SIZE == next_write_index)
+    next_write_index = 0;
+
+  if (next_write_index == CANtxqueue_ack_index) /* full */
+    return 0;
+
+  pnt = &CANtxqueue[CANtxqueue_write_index];
+  pnt->Id = id;
+  pnt->flags = ('t' == line[0]) ? CANMESSAGE_FLAG_STDID : 0;
+  pnt->DLC = dlc;
+  for (index = 0; index < dlc; index++)
+  {
+    if (!CANbus_ParseHex(line + 2 + id_digits + 2 * index, 2, &value))
+      return 0;
+    pnt->Data[index] = value;
+  }
+
+  /* if nothing is in a mailbox, this frame goes straight in, rather than waiting for the next CANbus_Service() */
+  __disable_irq();
+  CANtxqueue_write_index = next_write_index;
+  if (!CANtx_busy)
+    CAN_TransmitNext();
+  __enable_irq();
+
+  /* as per LAWICEL, the response is 'z' (or 'Z' for extended ID) before the CR */
+  command_response[command_response_length++] = ('t' == line[0]) ? 'z' : 'Z';
+  return 1;
 }
 
-void HAL_CAN_RxCpltCallback(CAN_HandleTypeDef *CanHandle)
+/* report each frame that has left a mailbox, in the order they were queued, with the time that it did so */
+
+static void CANbus_TransmitAcks(void)
 {
-  uint32_t next_write_index, index;
+  static char scratchpad[1 /* start char */ + 8 /* timestamp */ + 1 /* CR */];
+  unsigned length;
+  uint32_t send_index;
+
+  __disable_irq();
+  send_index = CANtxqueue_send_index;
+  if ( !CANtx_busy && (send_index != CANtxqueue_write_index) ) /* a frame the HAL couldn't take the first time */
+    CAN_TransmitNext();
+  __enable_irq();
 
-  if (collection_active)
+  while (CANtxqueue_ack_index != send_index)
   {
-    next_write_index = CANqueue_write_index + 1;
-    if (CANQUEUE_SIZE == next_write_index)
-      next_write_index = 0;
-  
-    if (next_write_index != CANqueue_read_index) /* only write if space left in queue */
+    length = 0;
+    scratchpad[length++] = 'a';
+    length += CANfast_Hex(scratchpad + length, CANtxqueue[CANtxqueue_ack_index].Timestamp, 8);
+    scratchpad[length++] = 13; /* CR */
+
+    if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+      return;
+
+    CANtxqueue_ack_index++;
+    if (CANTXQUEUE_SIZE == CANtxqueue_ack_index)
+      CANtxqueue_ack_index = 0;
+  }
+}
+
+#endif
+
+/* start (after calibrating the idle main loop) or stop (period 0) the benchmark */
+
+static void CANbus_BenchStart(uint32_t period, uint32_t dlc_mask)
+{
+  __disable_irq();
+  TIMESTAMPx->DIER &= ~TIM_DIER_CC2IE;
+  __enable_irq();
+
+  bench_period = period;
+  bench_dlc_mask = dlc_mask;
+  bench_state = (period) ? BENCH_CALIBRATING : BENCH_OFF;
+  bench_time = TIMESTAMPx->CNT;
+  bench_passes = 0;
+}
+
+static uint32_t CANbus_Execute(const char *line, uint32_t length)
+{
+  uint32_t value, mask, period, burst, index;
+  struct cantrigger pattern;
+
+  /* an empty line is harmless; LAWICEL tools often send a few CRs to flush any partial command */
+  if (0 == length)
+    return 1;
+
+  switch (line[0])
+  {
+  case 'D':
+    if ( (2 != length) || (line[1] < '0') || (line[1] > '4') )
+      return 0;
+    CANbus_SetOutputMode(line[1] - '0');
+    return 1;
+
+  case 'g': /* giiimmm: trigger on standard ID iii under mask mmm */
+    if ( (7 != length) || !CANbus_ParseHex(line + 1, 3, &value) || !CANbus_ParseHex(line + 4, 3, &mask) )
+      return 0;
+    trigger.Key = value & 0x7FF;
+    trigger.KeyMask = (mask & 0x7FF) | CANTRIGGER_KEY_EXT;
+    return 1;
+
+  case 'G': /* Giiiiiiiimmmmmmmm: trigger on extended ID iiiiiiii under mask mmmmmmmm */
+    if ( (17 != length) || !CANbus_ParseHex(line + 1, 8, &value) || !CANbus_ParseHex(line + 9, 8, &mask) )
+      return 0;
+    trigger.Key = (value & 0x1FFFFFFF) | CANTRIGGER_KEY_EXT;
+    trigger.KeyMask = (mask & 0x1FFFFFFF) | CANTRIGGER_KEY_EXT;
+    return 1;
+
+  case 'P': /* Pdddddddddddddddddmmmmmmmmmmmmmmmm: trigger on data bytes d under mask bytes m */
+    if (33 != length)
+      return 0;
+    pattern = trigger; /* only committed if the whole line is valid */
+    for (index = 0; index < 8; index++)
     {
-      CANqueue[CANqueue_write_index].Id = CanHandle->pRxMsg->StdId;
-      CANqueue[CANqueue_write_index].flags = (CAN_ID_STD == CanHandle->pRxMsg->IDE) ? 0x01: 0x00;
-      CANqueue[CANqueue_write_index].DLC = CanHandle->pRxMsg->DLC;
-      for (index = 0; index < CANqueue[CANqueue_write_index].DLC; index++)
-        CANqueue[CANqueue_write_index].Data[index] = CanHandle->pRxMsg->Data[index]; /* ST's CAN driver stores byte data in uint32_t for some unexplained reason */
-      CANqueue_write_index = next_write_index;
+      if ( !CANbus_ParseHex(line + 1 + 2 * index, 2, &value) || !CANbus_ParseHex(line + 17 + 2 * index, 2, &mask) )
+        return 0;
+      pattern.Data[index] = value;
+      pattern.DataMask[index] = mask;
     }
+    trigger = pattern;
+    return 1;
+
+  case 'H': /* Hppppqqqq: output pppp messages before the trigger and qqqq after it */
+    if ( (9 != length) || !CANbus_ParseHex(line + 1, 4, &value) || !CANbus_ParseHex(line + 5, 4, &mask) )
+      return 0;
+    if (value > sizeof(CANqueue) / CANQUEUE_RECORD_MAX - 3) /* there must be room in CANqueue[] for the history plus the trigger message, however long */
+      return 0;
+    trigger.PreTrigger = value;
+    trigger.PostTrigger = mask;
+    return 1;
+
+  case 'j': /* jniiimmmppppppppbb: rate limit rule n; standard ID iii under mask mmm, one message per pppppppp us, bursts of bb */
+    if ( (18 != length) || !CANbus_ParseHex(line + 1, 1, &index) || (index >= CANLIMIT_RULES) )
+      return 0;
+    if ( !CANbus_ParseHex(line + 2, 3, &value) || !CANbus_ParseHex(line + 5, 3, &mask) || !CANbus_ParseHex(line + 8, 8, &period) || !CANbus_ParseHex(line + 16, 2, &burst) )
+      return 0;
+    __disable_irq();
+    CANlimit_Set(&CANfast.Limits, index, value & 0x7FF, (mask & 0x7FF) | CANLIMIT_KEY_EXT, period, burst, TIMESTAMPx->CNT);
+    __enable_irq();
+    return 1;
+
+  case 'J': /* Jniiiiiiiimmmmmmmmppppppppbb: rate limit rule n; as above, but for extended ID iiiiiiii under mask mmmmmmmm */
+    if ( (28 != length) || !CANbus_ParseHex(line + 1, 1, &index) || (index >= CANLIMIT_RULES) )
+      return 0;
+    if ( !CANbus_ParseHex(line + 2, 8, &value) || !CANbus_ParseHex(line + 10, 8, &mask) || !CANbus_ParseHex(line + 18, 8, &period) || !CANbus_ParseHex(line + 26, 2, &burst) )
+      return 0;
+    __disable_irq();
+    CANlimit_Set(&CANfast.Limits, index, (value & 0x1FFFFFFF) | CANLIMIT_KEY_EXT, (mask & 0x1FFFFFFF) | CANLIMIT_KEY_EXT, period, burst, TIMESTAMPx->CNT);
+    __enable_irq();
+    return 1;
+
+  case 'S': /* Sn: bitrate n, as per LAWICEL */
+    if ( (2 != length) || (line[1] < '0') || (line[1] >= '0' + sizeof(bitrate_prescalers) / sizeof(bitrate_prescalers[0])) )
+      return 0;
+    settings.Bitrate = line[1] - '0';
+    CAN_Reconfig();
+    return 1;
+
+  case 'f': /* fiiiiiiiimmmmmmmm: acceptance filter with bxCAN identifier register iiiiiiii and mask register mmmmmmmm */
+    if ( (17 != length) || !CANbus_ParseHex(line + 1, 8, &value) || !CANbus_ParseHex(line + 9, 8, &mask) )
+      return 0;
+    settings.FilterId = value;
+    settings.FilterMask = mask;
+    CAN_Reconfig();
+    return 1;
+
+  case 'Q': /* Qn: autostart off (0) or on (1), and save the present settings to flash */
+    if ( (2 != length) || (line[1] < '0') || (line[1] > '1') )
+      return 0;
+    settings.Autostart = line[1] - '0';
+    settings.OutputMode = output_mode;
+    CANfast.Collecting = port_open || settings.Autostart;
+    return CANsettings_Save((const uint16_t *)CANSETTINGS_PAGE_ADDRESS, &settings);
+
+  case 'B': /* Bnn: with autostart, retain up to nn messages while the port is not open (00 for as many as fit) */
+    if ( (3 != length) || !CANbus_ParseHex(line + 1, 2, &value) )
+      return 0;
+    settings.RetainDepth = value; /* takes effect the next time retention starts */
+    return 1;
+
+#ifdef CAN_TRANSMIT
+  case 't': /* tiiildd..: transmit standard ID iii with l data bytes dd.. */
+  case 'T': /* Tiiiiiiiildd..: transmit extended ID iiiiiiii with l data bytes dd.. */
+    return CANbus_Transmit(line, length);
+#endif
+
+  case 'Y': /* Ypppppppplll: benchmark with a message every pppppppp microseconds, of the DLCs in mask lll (Y00000000000 to stop) */
+    if ( (12 != length) || !CANbus_ParseHex(line + 1, 8, &value) || !CANbus_ParseHex(line + 9, 3, &mask) )
+      return 0;
+    if (value && (value < BENCH_PERIOD_MIN))
+      return 0;
+    CANbus_BenchStart(value, mask);
+    return 1;
+
+  case 'q': /* qn: end each message record with its sequence number (1) or not (0, the default) */
+    if ( (2 != length) || (line[1] < '0') || (line[1] > '1') )
+      return 0;
+    CANfast.SequenceOutput = line[1] - '0';
+    return 1;
+
+  case 'Z': /* Zn: end each message record with its time of reception, in milliseconds (1), microseconds (2), or not (0, the default) */
+    if ( (2 != length) || (line[1] < '0') || (line[1] > '2') )
+      return 0;
+    CANfast.TimestampOutput = line[1] - '0';
+    return 1;
+
+  case 'I': /* Ixx: report counter xx */
+    if ( (3 != length) || !CANbus_ParseHex(line + 1, 2, &index) || !CANbus_Counter(index, &value) )
+      return 0;
+    command_response[command_response_length++] = 'I';
+    command_response_length += CANfast_Hex(command_response + command_response_length, index, 2);
+    command_response_length += CANfast_Hex(command_response + command_response_length, value, 8);
+    return 1;
   }
 
-  CAN_Receive();
+  return 0;
 }
 
-void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+static void CANbus_Command(void)
 {
-  /* acknowledge the peripheral's error */
-  hcan->Instance->MSR = CAN_MSR_ERRI;
+  uint8_t c;
+
+  /* gather the next line from the host, unless the previous one is still awaiting its response */
+  while (!command_ready)
+  {
+    if (0 == USBD_VirtualCDC_FromHost_Read(&c, 1))
+      return;
+
+    if (13 == c) /* CR */
+    {
+      command_ready = 1;
+    }
+    else if (10 != c) /* ignore LF from terminals that send CR/LF */
+    {
+      if (command_length < COMMAND_LINE_SIZE)
+        command_line[command_length++] = c;
+      else
+        command_length = COMMAND_LINE_SIZE + 1; /* too long; it will be rejected */
+    }
+  }
+
+  /* the response to a successful command is whatever CANbus_Execute() put in command_response[], followed by CR */
+  if (!command_response_length)
+  {
+    if ( (command_length <= COMMAND_LINE_SIZE) && CANbus_Execute(command_line, command_length) )
+    {
+      command_response[command_response_length++] = 13; /* CR */
+    }
+    else
+    {
+      command_response_length = 0;
+      command_response[command_response_length++] = 7; /* BELL */
+    }
+  }
+
+  /* if the buffer to the PC is too full, retry the response (but not the command) next time */
+  if (0 == USBD_VirtualCDC_ToHost_Append(command_response, command_response_length))
+    return;
+
+  command_response_length = 0;
+  command_length = 0;
+  command_ready = 0; /* allow the next line to be gathered */
 }
 
-static void CAN_Receive(void)
+static void CANbus_DumpStats(void)
 {
-  /* request to receive another CAN message */
-  if (HAL_CAN_Receive_IT(&CanHandle, CAN_FIFO0) != HAL_OK)
-    ERROR_CONDITION();
+  static char scratchpad[1 /* start char */ + 8 /* extendedId */ + 4 /* count */ + 8 /* min */ + 8 /* max */ + 1 /* DLC */ + 2 * CANMESSAGE_DATA_MAX /* data */ + 1 /* CR */];
+  unsigned length, index;
+  struct canstats_entry *entry;
+
+  if (stats_dump_index > CANSTATS_ENTRIES)
+  {
+    if ((TIMESTAMPx->CNT - stats_dump_time) < CANSTATS_DUMP_INTERVAL)
+      return;
+
+    stats_dump_time += CANSTATS_DUMP_INTERVAL;
+    stats_dump_index = 0;
+  }
+
+  /* output every ID heard from since the last dump; if the buffer to the PC fills, resume from the same entry next time */
+  for (; stats_dump_index < CANSTATS_ENTRIES; stats_dump_index++)
+  {
+    entry = &stats->entry[stats_dump_index];
+
+    if (0 == entry->Count)
+      continue;
+
+    length = 0;
+
+    if (entry->Key & CANSTATS_KEY_EXT)
+    {
+      scratchpad[length++] = 'S';
+      length += CANfast_Hex(scratchpad + length, entry->Key & ~CANSTATS_KEY_EXT, 8);
+    }
+    else
+    {
+      scratchpad[length++] = 's';
+      length += CANfast_Hex(scratchpad + length, entry->Key, 3);
+    }
+
+    length += CANfast_Hex(scratchpad + length, entry->Count, 4);
+    length += CANfast_Hex(scratchpad + length, entry->MinInterval, 8);
+    length += CANfast_Hex(scratchpad + length, entry->MaxInterval, 8);
+    length += CANfast_Hex(scratchpad + length, entry->DLC, 1);
+
+    for (index = 0; index < entry->Length; index++)
+      length += CANfast_Hex(scratchpad + length, entry->Data[index], 2);
+
+    scratchpad[length++] = 13; /* CR */
+
+    if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+      return;
+
+    CANstats_Restart(entry);
+  }
+
+  /* the dump ends with a count of IDs that were evicted before they could be reported */
+  length = 0;
+  scratchpad[length++] = 'x';
+  length += CANfast_Hex(scratchpad + length, stats->Evictions, 8);
+  scratchpad[length++] = 13; /* CR */
+
+  if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+    return;
+
+  stats->Evictions = 0;
+  stats_dump_index = CANSTATS_ENTRIES + 1;
+}
+
+/* exactly how long CANfast_EncodeMessage() will make the record, so that no more space than that need be reserved for it */
+
+static unsigned CANbus_MessageLength(const struct CANmessage *pnt)
+{
+  return 1 /* start char */ + ((pnt->flags & CANMESSAGE_FLAG_STDID) ? 3 : 8) /* Id */ + ((pnt->flags & CANMESSAGE_FLAG_FD) ? 1 : 0) /* FD flags */ + 1 /* DLC */ + 2 * CANMESSAGE_LENGTH(pnt) /* data */ + ((2 == CANfast.TimestampOutput) ? 8 : (CANfast.TimestampOutput) ? 4 : 0) /* timestamp */ + ((CANfast.SequenceOutput) ? 4 : 0) /* sequence */ + 1 /* CR */;
+}
+
+/* send the ready part of the D4 block (or, if none is, all of it) to the host */
+
+static uint32_t CANbus_CompressedFlush(void)
+{
+  uint8_t *wpnt;
+  uint32_t length, index;
+
+  length = (compressed->Full) ? compressed->Full : compressed->Length;
+
+  wpnt = USBD_VirtualCDC_ToHost_Reserve(2 + length);
+  if (NULL == wpnt)
+    return 0;
+
+  wpnt[0] = 0;
+  wpnt[1] = (uint8_t)length;
+  for (index = 0; index < length; index++)
+    wpnt[2 + index] = compressed->Block[index];
+  USBD_VirtualCDC_ToHost_Commit(2 + length);
+
+  /* whatever was encoded after the ready part starts the next block */
+  for (index = length; index < compressed->Length; index++)
+    compressed->Block[index - length] = compressed->Block[index];
+  compressed->Length -= length;
+  compressed->Full = 0;
+
+  return 1;
+}
+
+/* the 'u' record of the SOF noted by USBD_VirtualCDC_FrameStart(); until it is sent, no other SOF is noted */
+
+static void CANbus_Sync(void)
+{
+  static char scratchpad[1 /* start char */ + 3 /* frame */ + 8 /* time */ + 1 /* CR */];
+  unsigned length = 0;
+
+  if (!sync_pending)
+    return;
+
+  scratchpad[length++] = 'u';
+  length += CANfast_Hex(scratchpad + length, sync_frame, 3);
+  length += CANfast_Hex(scratchpad + length, sync_time, 8);
+  scratchpad[length++] = 13; /* CR */
+
+  if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+    return;
+
+  sync_pending = 0;
+}
+
+static void CANbus_Heartbeat(void)
+{
+  static char scratchpad[1 /* start char */ + 8 /* count */ + 1 /* CR */];
+  unsigned length = 0;
+
+  if ((TIMESTAMPx->CNT - delta_heartbeat_time) < CANDELTA_HEARTBEAT_INTERVAL)
+    return;
+
+  scratchpad[length++] = 'h';
+  length += CANfast_Hex(scratchpad + length, delta->Suppressed, 8);
+  scratchpad[length++] = 13; /* CR */
+
+  if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+    return;
+
+  delta->Suppressed = 0;
+  delta_heartbeat_time += CANDELTA_HEARTBEAT_INTERVAL;
+}
+
+/* once per BENCH_INTERVAL, finish calibrating, or report what became of the generated messages */
+
+static void CANbus_BenchReport(void)
+{
+  static char scratchpad[1 /* start char */ + 5 * 8 /* counts */ + 4 /* headroom */ + 1 /* CR */];
+  uint32_t generated, fifo_drops, limit_drops, queue_dropped, headroom, index;
+  unsigned length = 0;
+
+  if ((TIMESTAMPx->CNT - bench_time) < BENCH_INTERVAL)
+    return;
+
+  __disable_irq();
+  generated = bench_generated;
+  fifo_drops = bench_fifo_drops;
+  queue_dropped = CANfast.QueueDrops;
+  for (limit_drops = index = 0; index < CANLIMIT_RULES; index++)
+    limit_drops += CANfast.Limits.rule[index].Decimated;
+  __enable_irq();
+
+  if (BENCH_CALIBRATING == bench_state)
+  {
+    bench_baseline = (bench_passes) ? bench_passes : 1;
+    bench_state = BENCH_RUNNING;
+    bench_delivered = 0;
+  }
+  else
+  {
+    headroom = bench_passes * 1000 / bench_baseline; /* the main loop can't manage anywhere near 4 million passes per second */
+    if (headroom > 1000)
+      headroom = 1000;
+
+    scratchpad[length++] = 'b';
+    length += CANfast_Hex(scratchpad + length, generated - bench_last_generated, 8);
+    length += CANfast_Hex(scratchpad + length, bench_delivered, 8);
+    length += CANfast_Hex(scratchpad + length, fifo_drops - bench_last_fifo_drops, 8);
+    length += CANfast_Hex(scratchpad + length, limit_drops - bench_last_limit_drops, 8);
+    length += CANfast_Hex(scratchpad + length, queue_dropped - bench_last_queue_drops, 8);
+    length += CANfast_Hex(scratchpad + length, headroom, 4);
+    scratchpad[length++] = 13; /* CR */
+
+    if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+      return;
+
+    bench_delivered = 0;
+  }
+
+  bench_last_generated = generated;
+  bench_last_fifo_drops = fifo_drops;
+  bench_last_limit_drops = limit_drops;
+  bench_last_queue_drops = queue_dropped;
+  bench_passes = 0;
+  bench_time += BENCH_INTERVAL;
+
+  /* the generator runs from the end of calibration onwards */
+  if (0 == (TIMESTAMPx->DIER & TIM_DIER_CC2IE))
+  {
+    __disable_irq();
+    CANgen_Start(&bench, bench_period, bench_dlc_mask, TIMESTAMPx->CNT);
+    TIMESTAMPx->CCR2 = bench.NextTime;
+    TIMESTAMPx->SR = ~TIM_SR_CC2IF;
+    TIMESTAMPx->DIER |= TIM_DIER_CC2IE;
+    __enable_irq();
+  }
+}
+
+/* while armed, look for the trigger message, discarding all but the most recent PreTrigger messages before it */
+
+static void CANbus_TriggerScan(uint32_t write_index)
+{
+  uint32_t read_index = CANfast.Queue.ReadIndex; /* only CANbus_Service() alters this, so no snapshot is needed */
+  uint32_t next_scan_index;
+  struct CANmessage message;
+
+  while (trigger_scan_index != write_index)
+  {
+    next_scan_index = CANqueue_Get(&CANfast.Queue, trigger_scan_index, &message);
+
+    if (CANtrigger_Match(&trigger, &message))
+    {
+      trigger_state = TRIGGER_FIRED;
+      trigger_remaining = trigger_history + 1 + trigger.PostTrigger;
+      trigger_announce = 1;
+      break;
+    }
+
+    trigger_scan_index = next_scan_index;
+
+    if (trigger_history < trigger.PreTrigger)
+      trigger_history++;
+    else
+      read_index = CANqueue_Next(&CANfast.Queue, read_index);
+  }
+
+  /* update read index as atomic operation */
+  __disable_irq();
+  CANfast.Queue.ReadIndex = read_index;
+  __enable_irq();
+}
+
+/* announce how many messages of pre-trigger history (and post-trigger messages) are about to follow */
+
+static uint32_t CANbus_TriggerAnnounce(void)
+{
+  static char scratchpad[1 /* start char */ + 4 /* history */ + 4 /* post-trigger */ + 1 /* CR */];
+  unsigned length = 0;
+
+  scratchpad[length++] = 'k';
+  length += CANfast_Hex(scratchpad + length, trigger_history, 4);
+  length += CANfast_Hex(scratchpad + length, trigger.PostTrigger, 4);
+  scratchpad[length++] = 13; /* CR */
+
+  if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
+    return 0;
+
+  trigger_announce = 0;
+  return 1;
 }
 
 void CANbus_Service(void)
 {
   uint32_t read_index, write_index;
-  static char scratchpad[1 /* start char */ + 8 /* extendedId */ + 1 /* DLC */ + 16 /* data */ + 1 /* CR */];
-  unsigned length, index;
-  static const char hexdigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-  struct CANmessage *pnt;
+  char *record;
+  unsigned length;
+  uint32_t next_read_index;
+  struct CANmessage message, *pnt = &message;
+  struct candelta_entry *delta_entry;
+
+  /* host commands are acted upon whether or not collection is active */
+  CANbus_Command();
+
+  if (BENCH_OFF != bench_state)
+  {
+    bench_passes++;
+    CANbus_BenchReport();
+  }
+
+#ifdef CAN_TRANSMIT
+  CANbus_TransmitAcks();
+#endif
 
-  if (!collection_active)
+  if (settings.Autostart && !port_open)
   {
+    /* nobody to output to; start over retaining the first messages that arrive from here on */
+    if (!retaining)
+    {
+      __disable_irq();
+      CANfast.Queue.ReadIndex = CANfast.Queue.WriteIndex = 0;
+      CANfast.RetainRoom = CANbus_RetainRoom();
+      __enable_irq();
+      trigger_scan_index = trigger_history = 0;
+      retaining = 1;
+      if (OUTPUT_MODE_COMPRESSED == output_mode)
+        CANbus_CompressedRestart();
+    }
+    return;
+  }
+
+  if (retaining)
+  {
+    /* the host has arrived, so the retained messages are output and the receive interrupt may queue without limit again */
     __disable_irq();
-    CANqueue_read_index = CANqueue_write_index = 0;
+    CANfast.RetainRoom = CANFAST_RETAIN_UNLIMITED;
     __enable_irq();
+    retaining = 0;
+  }
+
+  CANbus_Sync();
+
+  /* with nothing to do, the queue is kept empty (this includes once a trigger capture has completed) */
+  if ( !CANfast.Collecting || ( (OUTPUT_MODE_TRIGGER == output_mode) && (TRIGGER_DONE == trigger_state) ) )
+  {
+    __disable_irq();
+    CANfast.Queue.ReadIndex = CANfast.Queue.WriteIndex = 0;
+    __enable_irq();
+    trigger_scan_index = trigger_history = 0;
+    if ( (OUTPUT_MODE_COMPRESSED == output_mode) && compressed->state.Started )
+      CANbus_CompressedRestart();
     return;
   }
 
+  if (OUTPUT_MODE_TRIGGER == output_mode)
+  {
+    if (TRIGGER_ARMED == trigger_state)
+    {
+      __disable_irq();
+      write_index = CANfast.Queue.WriteIndex;
+      __enable_irq();
+
+      CANbus_TriggerScan(write_index);
+
+      if (TRIGGER_ARMED == trigger_state)
+        return;
+    }
+
+    if (trigger_announce && !CANbus_TriggerAnnounce())
+      return;
+  }
+
   /* make snapshot of CANqueue state */
   __disable_irq();
-  read_index = CANqueue_read_index;
-  write_index = CANqueue_write_index;
+  read_index = CANfast.Queue.ReadIndex;
+  write_index = CANfast.Queue.WriteIndex;
   __enable_irq();
 
   while (read_index != write_index)
   {
-    pnt = &CANqueue[read_index];
-    length = 0;
+    next_read_index = CANqueue_Get(&CANfast.Queue, read_index, pnt);
+
+    if (OUTPUT_MODE_STATS == output_mode)
+    {
+      CANstats_Update(stats, pnt);
+    }
+    else if (OUTPUT_MODE_COMPRESSED == output_mode)
+    {
+      /* a full block must be on its way before there is room to encode more */
+      if (compressed->Full && !CANbus_CompressedFlush())
+        break;
 
-    if (pnt->DLC <= 8)
+      length = CANcomp_Encode(&compressed->state, compressed->Block + compressed->Length, pnt);
+      if (compressed->Length + length > COMPRESSED_BLOCK_SIZE)
+        compressed->Full = compressed->Length;
+      compressed->Length += length;
+    }
+    else
     {
-      if (pnt->flags)
+      delta_entry = NULL;
+
+      if (OUTPUT_MODE_DELTA == output_mode)
+        delta_entry = CANdelta_Lookup(delta, pnt);
+
+      if (delta_entry && CANdelta_Repeated(delta_entry, pnt))
       {
-        scratchpad[length++] = 't';
-        scratchpad[length++] = hexdigits[(pnt->Id >> 8) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 4) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 0) & 0xF];
+        delta->Suppressed++;
       }
       else
       {
-        scratchpad[length++] = 'T';
-        scratchpad[length++] = hexdigits[(pnt->Id >> 28) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 24) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 20) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 16) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 12) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 8) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 4) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Id >> 0) & 0xF];
-      }
+        /* bail loop if the buffer to the PC is too full */
+        record = (char *)USBD_VirtualCDC_ToHost_Reserve(CANbus_MessageLength(pnt));
+        if (NULL == record)
+          break;
 
-      scratchpad[length++] = hexdigits[pnt->DLC & 0xF];
+        /* the record is encoded straight into the stage for the USB packet memory */
+        USBD_VirtualCDC_ToHost_Commit(CANfast_EncodeMessage(record, pnt));
 
-      for (index = 0; index < pnt->DLC; index++)
-      {
-        scratchpad[length++] = hexdigits[(pnt->Data[index] >> 4) & 0xF];
-        scratchpad[length++] = hexdigits[(pnt->Data[index] >> 0) & 0xF];
+        /* only once the message is on its way does it become the reference for later repeats */
+        if (delta_entry)
+          CANdelta_Store(delta_entry, pnt);
       }
-
-      scratchpad[length++] = 13; /* CR */
-
-      /* bail loop if the buffer to the PC is too full */
-      if (0 == USBD_VirtualCDC_ToHost_Append(scratchpad, length))
-        break;
     }
 
+    bench_delivered++;
+
     /* calculate next read index */
-    read_index++;
-    if (read_index == CANQUEUE_SIZE)
-      read_index = 0;
+    read_index = next_read_index;
 
     /* update read index as atomic operation */
     __disable_irq();
-    CANqueue_read_index = read_index;
+    CANfast.Queue.ReadIndex = read_index;
     __enable_irq();
+
+    /* a trigger capture is complete once the last post-trigger message is output */
+    if ( (OUTPUT_MODE_TRIGGER == output_mode) && (0 == --trigger_remaining) )
+    {
+      trigger_state = TRIGGER_DONE;
+      break;
+    }
+  }
+
+  if (OUTPUT_MODE_STATS == output_mode)
+    CANbus_DumpStats();
+  else if (OUTPUT_MODE_DELTA == output_mode)
+    CANbus_Heartbeat();
+  else if ( (OUTPUT_MODE_COMPRESSED == output_mode) && compressed->Length )
+    CANbus_CompressedFlush(); /* rather than have what is encoded wait for a full block */
+}
+
+/* benchmark: deliver the generated messages now due, as many as the bxCAN FIFO would have held */
+
+static void CANbus_Generate(void)
+{
+  static struct CANmessage msg;
+  uint32_t due, delivered, index;
+
+  due = CANgen_Due(&bench, TIMESTAMPx->CNT);
+  delivered = (due > BENCH_FIFO_DEPTH) ? BENCH_FIFO_DEPTH : due;
+
+  bench_generated += due;
+  bench_fifo_drops += due - delivered;
+
+  for (index = 0; index < delivered; index++)
+  {
+    CANgen_Next(&bench, &msg);
+    if (CANfast.Collecting)
+      CANfast_Enqueue(&msg);
   }
+
+  /* the rest would have been lost to a FIFO overrun */
+  CANgen_Skip(&bench, due - delivered);
+
+  TIMESTAMPx->CCR2 = bench.NextTime;
+
+  /* should the next one already be due, the compare match has been missed; have it happen anyway */
+  if (CANgen_Due(&bench, TIMESTAMPx->CNT))
+    TIMESTAMPx->EGR = TIM_EGR_CC2G;
 }
 
-void CANx_RX_IRQHandler(void) /* using the macro defined in canconfig.h, provide a wrapper for the CAN IRQ routine */
+void TIMESTAMPx_IRQHandler(void) /* latency probe: how long after the compare match did we get here? (and the benchmark generator) */
 {
-  HAL_CAN_IRQHandler(&CanHandle);
+  uint32_t latency, pending = TIMESTAMPx->SR & TIMESTAMPx->DIER;
+
+  if (pending & TIM_SR_CC2IF)
+  {
+    TIMESTAMPx->SR = ~TIM_SR_CC2IF;
+    CANbus_Generate();
+  }
+
+  if (0 == (pending & TIM_SR_CC1IF))
+    return;
+
+  latency = TIMESTAMPx->CNT - TIMESTAMPx->CCR1;
+
+  TIMESTAMPx->SR = ~TIM_SR_CC1IF;
+
+  if (latency > latency_worst)
+    latency_worst = latency;
+
+  /* schedule relative to now rather than to the last compare, so that a probe delayed past the interval can't stall them all */
+  TIMESTAMPx->CCR1 = TIMESTAMPx->CNT + LATENCY_PROBE_INTERVAL;
 }
 
 /* this handler of CDC_SET_CONTROL_LINE_STATE enables/disables collection */
 
 void USBD_VirtualCDC_LineState(uint16_t state)
 {
-  collection_active = (state & 1);
+  port_open = (state & 1);
+  CANfast.Collecting = port_open || settings.Autostart;
+  sync_pending = 0;
+}
+
+/* at each USB SOF, note the time every SYNC_INTERVAL_FRAMES for a 'u' record; the timer is read first, as close to the SOF as we get */
+
+void USBD_VirtualCDC_FrameStart(uint32_t frame)
+{
+  uint32_t now = TIMESTAMPx->CNT;
+
+  if ( sync_pending || !port_open || (2 != CANfast.TimestampOutput) )
+    return;
+  if (++sync_frames < SYNC_INTERVAL_FRAMES)
+    return;
+
+  sync_frames = 0;
+  sync_frame = frame;
+  sync_time = now;
+  sync_pending = 1;
+}
+
+/*
+    flash access for cansettings.c; ST's flash driver is not part of this project, so the controller is driven directly
+    the CPU stalls on any flash fetch while the controller is busy, so nothing else (interrupts included) runs meanwhile
+*/
+
+static uint32_t CANbus_FlashWait(void)
+{
+  uint32_t status;
+
+  while (FLASH->SR & FLASH_SR_BSY);
+
+  status = FLASH->SR;
+  FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR; /* these are cleared by writing one */
+
+  return !(status & (FLASH_SR_PGERR | FLASH_SR_WRPERR));
+}
+
+static void CANbus_FlashUnlock(void)
+{
+  if (FLASH->CR & FLASH_CR_LOCK)
+  {
+    FLASH->KEYR = FLASH_KEY1;
+    FLASH->KEYR = FLASH_KEY2;
+  }
+}
+
+uint32_t CANsettings_FlashErase(const uint16_t *page)
+{
+  uint32_t result;
+
+  CANbus_FlashUnlock();
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = (uint32_t)page;
+  FLASH->CR |= FLASH_CR_STRT;
+  result = CANbus_FlashWait();
+  FLASH->CR &= ~FLASH_CR_PER;
+  FLASH->CR |= FLASH_CR_LOCK;
+
+  return result;
+}
+
+uint32_t CANsettings_FlashProgram(const uint16_t *address, uint16_t value)
+{
+  uint32_t result;
+
+  CANbus_FlashUnlock();
+  FLASH->CR |= FLASH_CR_PG;
+  *(volatile uint16_t *)address = value;
+  result = CANbus_FlashWait();
+  FLASH->CR &= ~FLASH_CR_PG;
+  FLASH->CR |= FLASH_CR_LOCK;
+
+  return result;
 }
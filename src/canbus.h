@@ -25,6 +25,65 @@
 #ifndef CANBUS_H_
 #define CANBUS_H_
 
+#include <stdint.h>
+
+/*
+    FAST_CODE marks the code run for every message, which the firmware places in SRAM (the CrossWorks .fast section, 
+    copied there from flash by the startup code): at 48 MHz, flash costs a wait state on each branch and literal load, 
+    and the Cortex-M0 has no cache to hide it.  Elsewhere (such as the host tools), or with FAST_CODE_IN_FLASH defined, 
+    it is left where the compiler puts it.
+*/
+#if defined(__CROSSWORKS_ARM) && !defined(FAST_CODE_IN_FLASH)
+#define FAST_CODE __attribute__((section(".fast")))
+#define FAST_CODE_IN_SRAM
+#else
+#define FAST_CODE
+#endif
+
+/*
+    SRAM_SHARED_WORDS is as much RAM as we can afford (data to the host is buffered in PMA rather than RAM), shared between 
+    the code placed in SRAM by FAST_CODE (canfast.c, canqueue.c and canlimit.c) and canbus.c's CANqueue[].  
+    FAST_CODE_SRAM_WORDS is what is set aside for the code when it is there, which takes about 1KB.
+*/
+#define SRAM_SHARED_WORDS 700
+#define FAST_CODE_SRAM_WORDS 256
+#ifdef FAST_CODE_IN_SRAM
+#define FAST_CODE_WORDS FAST_CODE_SRAM_WORDS
+#else
+#define FAST_CODE_WORDS 0
+#endif
+#define CANQUEUE_WORDS (SRAM_SHARED_WORDS - FAST_CODE_WORDS) /* size of CANqueue[], per-ID table and all */
+
+/* flags member of struct CANmessage */
+#define CANMESSAGE_FLAG_STDID 0x01 /* standard (11-bit) identifier; otherwise extended (29-bit) */
+#define CANMESSAGE_FLAG_FD    0x02 /* CAN FD frame, for which DLC 9 to 15 stand for 12, 16, 20, 24, 32, 48 and 64 data bytes */
+#define CANMESSAGE_FLAG_BRS   0x04 /* (CAN FD) data phase sent at the faster bitrate */
+#define CANMESSAGE_FLAG_ESI   0x08 /* (CAN FD) sender was error passive */
+
+/* most data bytes a message may carry: 8 with bxCAN (classic CAN only); a build for an FD-capable controller defines 64 */
+#ifndef CANMESSAGE_DATA_MAX
+#define CANMESSAGE_DATA_MAX 8
+#endif
+
+/* number of data bytes a message carries, given its DLC (a classic frame with DLC 9 to 15 has 8) */
+#define CANMESSAGE_FD_LENGTH(dlc) (((dlc) <= 8) ? (dlc) : ((dlc) <= 12) ? (8 + 4 * ((dlc) - 8)) : (16 * ((dlc) - 11)))
+#define CANMESSAGE_LENGTH(msg)    ((uint32_t)(((msg)->DLC <= 8) ? (msg)->DLC : (((msg)->flags & CANMESSAGE_FLAG_FD) && (CANMESSAGE_DATA_MAX > 8)) ? CANMESSAGE_FD_LENGTH((msg)->DLC) : 8))
+
+/*
+    The fixed fields come first, so that CANqueue[] need only hold as many of Data[] as the message has (see 
+    canqueue.h); anything with a struct CANmessage of its own has room for the longest.
+*/
+
+struct CANmessage
+{
+  uint32_t Id;
+  uint32_t Timestamp; /* microseconds, sampled from free-running TIMESTAMPx at reception */
+  uint16_t Sequence;  /* count of messages received, assigned at reception whether or not the message is then discarded */
+  uint8_t flags;
+  uint8_t DLC;        /* as on the bus; CANMESSAGE_LENGTH() gives the number of data bytes */
+  uint8_t Data[CANMESSAGE_DATA_MAX];
+};
+
 extern void CANbus_Init(void);
 extern void CANbus_Service(void);
 
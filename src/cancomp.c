@@ -0,0 +1,157 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+#include "cancomp.h"
+
+typedef char cancomp_key_first[(0 == offsetof(struct cancomp_entry, Key)) ? 1 : -1];
+
+static int CANcomp_Evict(void *entry, const void *victim)
+{
+  return CANidtable_SecondChance(&((struct cancomp_entry *)entry)->Referenced, victim);
+}
+
+static unsigned CANcomp_Varint(uint8_t *output, uint32_t value)
+{
+  unsigned length = 0;
+
+  while (value >= 0x80)
+  {
+    output[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  output[length++] = (uint8_t)value;
+
+  return length;
+}
+
+static void CANcomp_Empty(struct cancomp_state *state)
+{
+  CANidtable_Empty(state->entry, CANCOMP_ENTRIES, sizeof(state->entry[0]));
+}
+
+void CANcomp_Init(struct cancomp_state *state)
+{
+  CANcomp_Empty(state);
+  state->Started = 0;
+}
+
+unsigned CANcomp_Encode(struct cancomp_state *state, uint8_t *output, const struct CANmessage *message)
+{
+  unsigned length = 0, index, hit, dlc, count, changed, tag_index, mask_index, data_index;
+  uint32_t key;
+  uint16_t lost;
+  struct cancomp_entry *entry;
+
+  /* the DLC goes as it is, along with whatever of the flags a hit must match */
+  dlc = message->DLC & 0x0F;
+  if (message->flags & CANMESSAGE_FLAG_FD)
+    dlc |= CANCOMP_DLC_FD;
+  if (message->flags & CANMESSAGE_FLAG_BRS)
+    dlc |= CANCOMP_DLC_BRS;
+  if (message->flags & CANMESSAGE_FLAG_ESI)
+    dlc |= CANCOMP_DLC_ESI;
+  count = CANMESSAGE_LENGTH(message);
+
+  if (!state->Started || ((message->Timestamp - state->ResetTime) >= CANCOMP_RESET_INTERVAL))
+  {
+    CANcomp_Empty(state);
+    output[length++] = CANCOMP_TAG_RESET;
+    length += CANcomp_Varint(output + length, message->Timestamp);
+    state->LastTime = state->ResetTime = message->Timestamp;
+
+    /* there is nothing to compare the first message's sequence number with */
+    if (!state->Started)
+      state->Sequence = message->Sequence;
+    state->Started = 1;
+  }
+
+  lost = message->Sequence - state->Sequence;
+  if (lost)
+  {
+    output[length++] = CANCOMP_TAG_GAP;
+    length += CANcomp_Varint(output + length, lost);
+  }
+  state->Sequence = message->Sequence + 1;
+
+  key = CANidtable_Key(message);
+  entry = CANidtable_Lookup(state->entry, CANCOMP_ENTRIES, sizeof(state->entry[0]), key, CANcomp_Evict, &hit);
+  entry->Referenced = 1;
+
+  if (hit && (entry->DLC == dlc))
+  {
+    tag_index = mask_index = length;
+    output[length++] = CANCOMP_TAG_HIT | (uint8_t)(entry - state->entry);
+    length += CANcomp_Varint(output + length, message->Timestamp - state->LastTime);
+    data_index = length;
+
+    changed = 0;
+    for (index = 0; index < count; index++)
+    {
+      /* each 8 data bytes have a mask byte of their own */
+      if (0 == (index & 7))
+      {
+        mask_index = length++;
+        output[mask_index] = 0;
+      }
+
+      if (entry->Data[index] != message->Data[index])
+      {
+        output[mask_index] |= (uint8_t)(1U << (index & 7));
+        output[length++] = entry->Data[index] ^ message->Data[index];
+        entry->Data[index] = message->Data[index];
+        changed = 1;
+      }
+    }
+
+    if (!changed)
+    {
+      /* nothing changed, so the mask bytes are dropped in favour of the tag bit */
+      output[tag_index] |= CANCOMP_TAG_UNCHANGED;
+      length = data_index;
+    }
+  }
+  else
+  {
+    output[length++] = CANCOMP_TAG_DEFINE | (uint8_t)(entry - state->entry);
+    output[length++] = (uint8_t)dlc | ((key & CANCOMP_KEY_EXT) ? CANCOMP_DLC_EXT : 0);
+    output[length++] = (uint8_t)(message->Id);
+    output[length++] = (uint8_t)(message->Id >> 8);
+    if (key & CANCOMP_KEY_EXT)
+    {
+      output[length++] = (uint8_t)(message->Id >> 16);
+      output[length++] = (uint8_t)(message->Id >> 24);
+    }
+    length += CANcomp_Varint(output + length, message->Timestamp - state->LastTime);
+
+    entry->Key = key;
+    entry->DLC = (uint8_t)dlc;
+    for (index = 0; index < count; index++)
+      output[length++] = entry->Data[index] = message->Data[index];
+  }
+
+  state->LastTime = message->Timestamp;
+
+  return length;
+}
@@ -0,0 +1,106 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANCOMP_H_
+#define CANCOMP_H_
+
+#include "canbus.h"
+#include "canidtable.h"
+
+/*
+    compressed binary encoding of CAN messages (output mode D4)
+
+    Each ID seen is given one of CANCOMP_ENTRIES dictionary entries, held in one of canidtable.c's hashes, evicted 
+    second-chance like those of candelta.c.  Once the host has been told what ID and payload an entry holds, later messages with that ID 
+    refer to the entry by its index, and send only the payload bytes that changed.  Timestamps are sent as the 
+    difference from the previous message's, as a varint (7 bits per byte, least significant first, top bit set on 
+    all but the last byte).
+
+    Records, each starting with a tag byte:
+
+    00iiiiii: define entry i: a byte with the DLC in bits 0-3, bits 4, 5 and 6 set for CAN FD, BRS and ESI, and bit 7 
+              set for an extended ID, the ID (2 bytes for a standard ID, 4 for extended, least significant first), 
+              the timestamp difference, and then the payload
+    1Uiiiiii: message with the ID of entry i and the same DLC and flags as last time: the timestamp difference, and 
+              then (unless U is set, meaning the payload is unchanged) for each 8 data bytes, a mask byte with bit n 
+              set for each of those bytes n that changed, followed by each such byte XORed with its previous value
+    01000000: reset: the dictionary is emptied, and the absolute timestamp (varint) is the base for the next difference
+    01000001: gap: a varint count of messages lost (discarded by rate limiting, or for want of space) before the next
+
+    A reset begins the stream and recurs every CANCOMP_RESET_INTERVAL microseconds, so that a host that starts 
+    reading part way through needs to discard no more than that before it can decode everything.
+
+    host/cancompbench.c encodes recorded traffic with it into blocks as CANbus_Service() does, and decodes them again 
+    with host/candecomp.c to check that every message comes back as it went in.
+*/
+
+#if CANMESSAGE_DATA_MAX > 8
+#define CANCOMP_ENTRIES        8  /* must be a power of two, and no more than 64; with CAN FD payloads the dictionary comes out of CANqueue[] 8 times as big per entry */
+#else
+#define CANCOMP_ENTRIES        64 /* must be a power of two, and no more than 64 */
+#endif
+#define CANCOMP_PROBE_LIMIT    CANIDTABLE_PROBE_LIMIT
+#define CANCOMP_RESET_INTERVAL 1000000UL
+
+#define CANCOMP_KEY_EXT        CANIDTABLE_KEY_EXT
+#define CANCOMP_KEY_EMPTY      CANIDTABLE_KEY_EMPTY
+
+#define CANCOMP_TAG_DEFINE     0x00
+#define CANCOMP_TAG_RESET      0x40
+#define CANCOMP_TAG_GAP        0x41
+#define CANCOMP_TAG_HIT        0x80
+#define CANCOMP_TAG_UNCHANGED  0x40 /* in a CANCOMP_TAG_HIT */
+#define CANCOMP_INDEX_MASK     0x3F
+
+#define CANCOMP_DLC_FD         0x10 /* in the DLC byte of a define record */
+#define CANCOMP_DLC_BRS        0x20
+#define CANCOMP_DLC_ESI        0x40
+#define CANCOMP_DLC_EXT        0x80
+
+/* most bytes CANcomp_Encode() produces for one message: a reset, a gap, and a define record or a hit with every byte changed */
+#define CANCOMP_DEFINE_MAX     (1 + 1 + 4 + 5 + CANMESSAGE_DATA_MAX)
+#define CANCOMP_HIT_MAX        (1 + 5 + (CANMESSAGE_DATA_MAX + 7) / 8 + CANMESSAGE_DATA_MAX)
+#define CANCOMP_RECORD_MAX     ((1 + 5) + (1 + 3) + ((CANCOMP_DEFINE_MAX > CANCOMP_HIT_MAX) ? CANCOMP_DEFINE_MAX : CANCOMP_HIT_MAX))
+
+struct cancomp_entry
+{
+  uint32_t Key;          /* CAN ID, ORed with CANCOMP_KEY_EXT for extended IDs; must come first, for canidtable.c */
+  uint8_t DLC;           /* of the most recent message, with the CANCOMP_DLC_FD, _BRS and _ESI bits of its flags */
+  uint8_t Referenced;    /* set on each hit; cleared when passed over for eviction */
+  uint8_t Data[CANMESSAGE_DATA_MAX]; /* of the most recent message */
+};
+
+struct cancomp_state
+{
+  struct cancomp_entry entry[CANCOMP_ENTRIES];
+  uint32_t LastTime;     /* timestamp of the previous message, or of the reset */
+  uint32_t ResetTime;
+  uint16_t Sequence;     /* expected of the next message */
+  uint8_t Started;       /* zero until the first message, which is preceded by a reset */
+};
+
+extern void CANcomp_Init(struct cancomp_state *state);
+extern unsigned CANcomp_Encode(struct cancomp_state *state, uint8_t *output, const struct CANmessage *message);
+
+#endif
@@ -22,4 +22,32 @@
 #define CANx_RX_IRQn                   CEC_CAN_IRQn
 #define CANx_RX_IRQHandler             CEC_CAN_IRQHandler
 
+/*
+  transmit support (CAN_MODE_NORMAL and the LAWICEL 't' and 'T' commands) is only possible where CAN_TX has a pin 
+  of its own; on the STM32F042, it shares pins with USB.  Build for the STM32F072 with CAN_TRANSMIT defined to enable it.
+*/
+
+#if defined(CAN_TRANSMIT) && !defined(STM32F072xB)
+#error "CAN_TRANSMIT needs a part with CAN_TX on a pin not used by USB, such as PB9 on the STM32F072"
+#endif
+
+/* free-running 32-bit timer used to timestamp received messages (its compare interrupt also probes interrupt latency) */
+
+#define TIMESTAMPx                     TIM2
+#define TIMESTAMPx_CLK_ENABLE()        __TIM2_CLK_ENABLE()
+#define TIMESTAMPx_IRQn                TIM2_IRQn
+#define TIMESTAMPx_IRQHandler          TIM2_IRQHandler
+
+/*
+  flash page holding the saved settings (see cansettings.h): the last page, which the project's memory maps 
+  (STM32F042K6_MemoryMap.xml, STM32F072RB_MemoryMap.xml) leave out of FLASH, so that the linker cannot place the 
+  image over it
+*/
+
+#if defined(STM32F072xB)
+#define CANSETTINGS_PAGE_ADDRESS       0x0801F800
+#else
+#define CANSETTINGS_PAGE_ADDRESS       0x08007C00
+#endif
+
 #endif
@@ -0,0 +1,84 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+#include "candelta.h"
+
+typedef char candelta_key_first[(0 == offsetof(struct candelta_entry, Key)) ? 1 : -1];
+
+static int CANdelta_Evict(void *entry, const void *victim)
+{
+  return CANidtable_SecondChance(&((struct candelta_entry *)entry)->Referenced, victim);
+}
+
+void CANdelta_Init(struct candelta_cache *cache)
+{
+  CANidtable_Empty(cache->entry, CANDELTA_ENTRIES, sizeof(cache->entry[0]));
+  cache->Suppressed = 0;
+}
+
+struct candelta_entry *CANdelta_Lookup(struct candelta_cache *cache, const struct CANmessage *message)
+{
+  uint32_t key;
+  unsigned hit;
+  struct candelta_entry *entry;
+
+  key = CANidtable_Key(message);
+  entry = CANidtable_Lookup(cache->entry, CANDELTA_ENTRIES, sizeof(cache->entry[0]), key, CANdelta_Evict, &hit);
+
+  if (!hit)
+  {
+    entry->Key = key;
+    entry->DLC = CANDELTA_DLC_NONE;
+  }
+  entry->Referenced = 1;
+
+  return entry;
+}
+
+uint32_t CANdelta_Repeated(const struct candelta_entry *entry, const struct CANmessage *message)
+{
+  unsigned index, length;
+
+  if ( (entry->DLC != message->DLC) || (entry->Flags != (message->flags & CANDELTA_FLAGS)) )
+    return 0;
+
+  length = CANMESSAGE_LENGTH(message);
+  for (index = 0; index < length; index++)
+    if (entry->Data[index] != message->Data[index])
+      return 0;
+
+  return 1;
+}
+
+void CANdelta_Store(struct candelta_entry *entry, const struct CANmessage *message)
+{
+  unsigned index, length;
+
+  entry->DLC = message->DLC;
+  entry->Flags = message->flags & CANDELTA_FLAGS;
+  length = CANMESSAGE_LENGTH(message);
+  for (index = 0; index < length; index++)
+    entry->Data[index] = message->Data[index];
+}
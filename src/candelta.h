@@ -0,0 +1,77 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANDELTA_H_
+#define CANDELTA_H_
+
+#include "canbus.h"
+#include "canidtable.h"
+
+/*
+    per-ID payload cache used to suppress repeated messages
+
+    Like the statistics table, this is one of canidtable.c's hashes keyed by CAN ID with a bounded probe window.
+    Entries are kept as small as possible so that many IDs fit; eviction within a full probe window is second-chance 
+    (an entry that has been hit since it was last passed over is spared once).
+
+    A cache miss or eviction can only cause a message to be forwarded unnecessarily, never to be wrongly suppressed.
+
+    host/candeltabench.c replays traces through the cache and checks each message dropped against the last sent.
+*/
+
+#if CANMESSAGE_DATA_MAX > 8
+#define CANDELTA_ENTRIES     8  /* must be a power of two; with CAN FD payloads the cache comes out of CANqueue[] 8 times as big per entry */
+#else
+#define CANDELTA_ENTRIES     64 /* must be a power of two */
+#endif
+#define CANDELTA_PROBE_LIMIT CANIDTABLE_PROBE_LIMIT
+
+#define CANDELTA_KEY_EXT     CANIDTABLE_KEY_EXT
+#define CANDELTA_KEY_EMPTY   CANIDTABLE_KEY_EMPTY
+
+#define CANDELTA_DLC_NONE    0xFF /* DLC value of an entry whose payload has not yet been sent */
+
+#define CANDELTA_FLAGS       (CANMESSAGE_FLAG_FD | CANMESSAGE_FLAG_BRS | CANMESSAGE_FLAG_ESI) /* a change in any of these is no repeat */
+
+struct candelta_entry
+{
+  uint32_t Key;          /* CAN ID, ORed with CANDELTA_KEY_EXT for extended IDs; must come first, for canidtable.c */
+  uint8_t DLC;           /* of the most recently sent message, or CANDELTA_DLC_NONE */
+  uint8_t Flags;         /* CAN FD flags of the most recently sent message */
+  uint8_t Referenced;    /* set on each hit; cleared when passed over for eviction */
+  uint8_t Data[CANMESSAGE_DATA_MAX]; /* of the most recently sent message */
+};
+
+struct candelta_cache
+{
+  struct candelta_entry entry[CANDELTA_ENTRIES];
+  uint32_t Suppressed;   /* repeated messages not sent */
+};
+
+extern void CANdelta_Init(struct candelta_cache *cache);
+extern struct candelta_entry *CANdelta_Lookup(struct candelta_cache *cache, const struct CANmessage *message);
+extern uint32_t CANdelta_Repeated(const struct candelta_entry *entry, const struct CANmessage *message);
+extern void CANdelta_Store(struct candelta_entry *entry, const struct CANmessage *message);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "canfast.h"
+
+struct canfast CANfast;
+
+/* not const: read for every digit of every record, it is quicker in SRAM than in flash */
+static char hexdigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+/* called at CAN priority (only) for each message, received or generated, to apply the rate limits and queue it */
+
+FAST_CODE void CANfast_Enqueue(struct CANmessage *msg)
+{
+  uint32_t key;
+
+  msg->Sequence = CANfast.Sequence++;
+
+  key = (msg->flags & CANMESSAGE_FLAG_STDID) ? msg->Id : (msg->Id | CANLIMIT_KEY_EXT);
+
+  if (!CANlimit_Admit(&CANfast.Limits, key, msg->Timestamp))
+    return;
+
+  if ( !CANfast.RetainRoom || !CANqueue_Put(&CANfast.Queue, msg) ) /* only write if space left in queue */
+  {
+    CANfast.QueueDrops++;
+    return;
+  }
+
+  if (CANFAST_RETAIN_UNLIMITED != CANfast.RetainRoom)
+    CANfast.RetainRoom--;
+}
+
+/*
+    The bxCAN and timer registers are only ever reached through CMSIS's READ_REG(), WRITE_REG(), SET_BIT() and
+    CLEAR_BIT(), which host/mock/canmock.c takes over to simulate the FIFO and count each access.
+*/
+
+/* copy the message at the head of the bxCAN FIFO 0 into the queue; the caller releases the mailbox */
+
+FAST_CODE void CANfast_Receive(const CAN_FIFOMailBox_TypeDef *mailbox, uint32_t timestamp)
+{
+  struct CANmessage msg;
+  uint32_t rir, data;
+
+  msg.Timestamp = timestamp;
+  rir = READ_REG(mailbox->RIR);
+  if (rir & CAN_RI0R_IDE)
+  {
+    msg.Id = rir >> 3;
+    msg.flags = 0;
+  }
+  else
+  {
+    msg.Id = rir >> 21;
+    msg.flags = CANMESSAGE_FLAG_STDID;
+  }
+  msg.DLC = READ_REG(mailbox->RDTR) & CAN_RDT0R_DLC; /* as on the bus; 9 to 15 still mean 8 data bytes */
+
+  /* the data registers are read whatever the DLC; it takes no longer than testing it */
+  data = READ_REG(mailbox->RDLR);
+  msg.Data[0] = data; msg.Data[1] = data >> 8; msg.Data[2] = data >> 16; msg.Data[3] = data >> 24;
+  data = READ_REG(mailbox->RDHR);
+  msg.Data[4] = data; msg.Data[5] = data >> 8; msg.Data[6] = data >> 16; msg.Data[7] = data >> 24;
+
+  CANfast_Enqueue(&msg);
+}
+
+FAST_CODE unsigned CANfast_Hex(char *buffer, uint32_t value, unsigned digits)
+{
+  unsigned index = digits;
+
+  while (index--)
+  {
+    buffer[index] = hexdigits[value & 0xF];
+    value >>= 4;
+  }
+
+  return digits;
+}
+
+FAST_CODE unsigned CANfast_EncodeMessage(char *scratchpad, const struct CANmessage *pnt)
+{
+  unsigned length = 0, index, count;
+
+  if (pnt->flags & CANMESSAGE_FLAG_STDID)
+  {
+    scratchpad[length++] = (pnt->flags & CANMESSAGE_FLAG_FD) ? 'd' : 't';
+    scratchpad[length++] = hexdigits[(pnt->Id >> 8) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 4) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 0) & 0xF];
+  }
+  else
+  {
+    scratchpad[length++] = (pnt->flags & CANMESSAGE_FLAG_FD) ? 'D' : 'T';
+    scratchpad[length++] = hexdigits[(pnt->Id >> 28) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 24) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 20) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 16) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 12) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 8) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 4) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Id >> 0) & 0xF];
+  }
+
+  /* a CAN FD record has a digit of its own for BRS (bit 0) and ESI (bit 1) */
+  if (pnt->flags & CANMESSAGE_FLAG_FD)
+    scratchpad[length++] = hexdigits[((pnt->flags & CANMESSAGE_FLAG_BRS) ? 1 : 0) | ((pnt->flags & CANMESSAGE_FLAG_ESI) ? 2 : 0)];
+
+  scratchpad[length++] = hexdigits[pnt->DLC & 0xF];
+
+  count = CANMESSAGE_LENGTH(pnt);
+  for (index = 0; index < count; index++)
+  {
+    scratchpad[length++] = hexdigits[(pnt->Data[index] >> 4) & 0xF];
+    scratchpad[length++] = hexdigits[(pnt->Data[index] >> 0) & 0xF];
+  }
+
+  if (2 == CANfast.TimestampOutput)
+    length += CANfast_Hex(scratchpad + length, pnt->Timestamp, 8);
+  else if (CANfast.TimestampOutput)
+    length += CANfast_Hex(scratchpad + length, (pnt->Timestamp / 1000) % 60000, 4); /* as LAWICEL has it, wrapping at 60000 */
+
+  if (CANfast.SequenceOutput)
+    length += CANfast_Hex(scratchpad + length, pnt->Sequence, 4);
+
+  scratchpad[length++] = 13; /* CR */
+
+  return length;
+}
+
+FAST_CODE void CANx_RX_IRQHandler(void) /* using the macro defined in canconfig.h, provide a wrapper for the CAN IRQ routine */
+{
+  uint32_t rf0r = READ_REG(CANx->RF0R);
+  uint32_t pending = rf0r & CAN_RF0R_FMP0;
+
+  if (pending > CANfast.FifoWorst)
+    CANfast.FifoWorst = pending;
+
+  /* take everything in the FIFO, including whatever arrives meanwhile, before returning */
+  while (rf0r & CAN_RF0R_FMP0)
+  {
+    if (CANfast.Collecting)
+      CANfast_Receive(&CANx->sFIFOMailBox[CAN_FIFO0], READ_REG(TIMESTAMPx->CNT));
+    WRITE_REG(CANx->RF0R, CAN_RF0R_RFOM0); /* release the mailbox; the next message, if any, moves up */
+    do
+      rf0r = READ_REG(CANx->RF0R);
+    while (rf0r & CAN_RF0R_RFOM0); /* FMP0 is only up to date once the release is done */
+  }
+
+  if (rf0r & CAN_RF0R_FOVR0)
+  {
+    CANfast.FifoOverruns++;
+    WRITE_REG(CANx->RF0R, CAN_RF0R_FOVR0); /* write 1 to clear */
+  }
+
+#ifdef CAN_TRANSMIT
+  /*
+  mailbox empty and error interrupts are only ever enabled by HAL_CAN_Transmit_IT(), and left to ST's driver; FMP0 is 
+  masked meanwhile, as the driver would otherwise take a message arriving since the loop above (into pRxMsg, which is 
+  NULL) and disable FMP0 after it; such a message has the interrupt pending again as soon as FMP0 is unmasked
+  */
+  if (READ_REG(CANx->IER) & (CAN_IT_TME | CAN_IT_ERR))
+  {
+    CLEAR_BIT(CANx->IER, CAN_IT_FMP0);
+    HAL_CAN_IRQHandler(CANfast.Handle);
+    SET_BIT(CANx->IER, CAN_IT_FMP0);
+  }
+#endif
+}
@@ -0,0 +1,69 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANFAST_H_
+#define CANFAST_H_
+
+#include "canconfig.h"
+#include "canbus.h"
+#include "canqueue.h"
+#include "canlimit.h"
+
+/*
+    the code run for every message, which FAST_CODE places in SRAM: the CAN receive interrupt, which applies the rate 
+    limits and queues what it takes, and the encoding of each message as a record for the host
+
+    canbus.c sets up CANfast and owns everything else.  Nothing here needs more of the hardware than the device header 
+    describes, so it builds on the host against host/mock: host/canfastbench.c charges it for the flash wait states 
+    SRAM saves, and host/canisrbench.c runs the interrupt over a simulated bxCAN.
+*/
+
+#define CANFAST_RETAIN_UNLIMITED 0xFFFFFFFFUL /* RetainRoom when not retaining, or when retaining as many messages as fit */
+
+struct canfast
+{
+  struct canqueue Queue;            /* over the part of CANqueue[] not reserved for a per-ID table */
+  struct canlimit_table Limits;
+  volatile uint32_t RetainRoom;     /* how many more messages the receive interrupt may queue */
+  volatile uint32_t QueueDrops;     /* messages discarded for want of space in the queue */
+  volatile uint32_t FifoWorst;      /* most messages found waiting in the bxCAN FIFO on entry to the interrupt */
+  volatile uint32_t FifoOverruns;   /* times the bxCAN FIFO overran */
+  uint32_t Collecting;              /* messages are taken from the FIFO and discarded unless this is set */
+  uint32_t TimestampOutput;         /* 0: none, 1: LAWICEL milliseconds (4 digits), 2: microseconds (8 digits) */
+  uint32_t SequenceOutput;          /* whether each record ends with the message's sequence number */
+  uint16_t Sequence;                /* given to the next message received */
+#ifdef CAN_TRANSMIT
+  CAN_HandleTypeDef *Handle;        /* ST's driver, which handles the mailbox empty and error interrupts */
+#endif
+};
+
+extern struct canfast CANfast;
+
+extern void CANfast_Enqueue(struct CANmessage *msg);
+extern void CANfast_Receive(const CAN_FIFOMailBox_TypeDef *mailbox, uint32_t timestamp);
+extern unsigned CANfast_Hex(char *buffer, uint32_t value, unsigned digits);
+extern unsigned CANfast_EncodeMessage(char *scratchpad, const struct CANmessage *pnt);
+extern void CANx_RX_IRQHandler(void);
+
+#endif
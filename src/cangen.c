@@ -0,0 +1,69 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "cangen.h"
+
+void CANgen_Start(struct cangen *gen, uint32_t period, uint32_t dlc_mask, uint32_t now)
+{
+  gen->Period = period;
+  gen->NextTime = now + period;
+  gen->Sequence = 0;
+  gen->DLCMask = (dlc_mask & 0x1FF) ? (dlc_mask & 0x1FF) : 0x1FF; /* DLC 0 to 8 */
+  gen->DLC = 8; /* so that the first message has the lowest DLC in the mask */
+}
+
+uint32_t CANgen_Due(const struct cangen *gen, uint32_t now)
+{
+  uint32_t elapsed = now - gen->NextTime;
+
+  if ((int32_t)elapsed < 0)
+    return 0;
+
+  return elapsed / gen->Period + 1;
+}
+
+void CANgen_Next(struct cangen *gen, struct CANmessage *msg)
+{
+  unsigned index;
+
+  do
+  {
+    gen->DLC = (gen->DLC >= 8) ? 0 : gen->DLC + 1;
+  } while (!(gen->DLCMask & (1U << gen->DLC)));
+
+  msg->Id = CANGEN_ID_BASE + (gen->Sequence % CANGEN_IDS);
+  msg->Timestamp = gen->NextTime;
+  msg->flags = CANMESSAGE_FLAG_STDID;
+  msg->DLC = gen->DLC;
+  for (index = 0; index < 8; index++)
+    msg->Data[index] = (uint8_t)(gen->Sequence >> (8 * (index & 3)));
+
+  CANgen_Skip(gen, 1);
+}
+
+void CANgen_Skip(struct cangen *gen, uint32_t count)
+{
+  gen->Sequence += count;
+  gen->NextTime += count * gen->Period;
+}
@@ -0,0 +1,60 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANGEN_H_
+#define CANGEN_H_
+
+#include <stdint.h>
+#include "canbus.h"
+
+/*
+    synthetic message generator for benchmarking
+
+    Messages are due every Period microseconds; CANgen_Due() says how many are due at a given time, and CANgen_Next() 
+    makes up the next one.  Standard IDs cycle through CANGEN_ID_BASE to CANGEN_ID_BASE + CANGEN_IDS - 1, and the DLC 
+    cycles through those set in DLCMask; the data bytes are taken from the sequence number, so that no two consecutive 
+    messages with the same ID have the same payload.
+
+    host/cangenbench.c drives it as the compare interrupt does, entered late by varying amounts, and checks that each 
+    message due is delivered or skipped just the once.
+*/
+
+#define CANGEN_ID_BASE 0x100
+#define CANGEN_IDS     32
+
+struct cangen
+{
+  uint32_t Period;    /* microseconds between messages */
+  uint32_t NextTime;  /* when the next message is due */
+  uint32_t Sequence;  /* messages made up (or skipped) so far */
+  uint16_t DLCMask;   /* bit n set if messages of DLC n are to be made up */
+  uint8_t DLC;        /* DLC of the most recent message */
+};
+
+extern void CANgen_Start(struct cangen *gen, uint32_t period, uint32_t dlc_mask, uint32_t now);
+extern uint32_t CANgen_Due(const struct cangen *gen, uint32_t now);
+extern void CANgen_Next(struct cangen *gen, struct CANmessage *msg);
+extern void CANgen_Skip(struct cangen *gen, uint32_t count);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "canidtable.h"
+
+static uint32_t CANidtable_Hash(uint32_t key, unsigned entries)
+{
+  /* Fibonacci hashing; the upper bits of the product are the best mixed, and scaling them by a power of two takes the top ones */
+  return (((key * 2654435761UL) >> 16) * entries) >> 16;
+}
+
+uint32_t CANidtable_Key(const struct CANmessage *message)
+{
+  uint32_t key = message->Id;
+
+  if (!(message->flags & CANMESSAGE_FLAG_STDID))
+    key |= CANIDTABLE_KEY_EXT;
+
+  return key;
+}
+
+void CANidtable_Empty(void *table, unsigned entries, size_t size)
+{
+  unsigned index;
+
+  for (index = 0; index < entries; index++)
+    *(uint32_t *)((uint8_t *)table + size * index) = CANIDTABLE_KEY_EMPTY;
+}
+
+/* the entry for the key, with *hit set, if there is one; otherwise, with *hit cleared, a victim for the caller to give the key to */
+
+void *CANidtable_Lookup(void *table, unsigned entries, size_t size, uint32_t key, canidtable_evict evict, unsigned *hit)
+{
+  uint32_t hash;
+  unsigned probe;
+  uint8_t *entry, *victim;
+
+  hash = CANidtable_Hash(key, entries);
+  victim = NULL;
+
+  for (probe = 0; probe < CANIDTABLE_PROBE_LIMIT; probe++)
+  {
+    entry = (uint8_t *)table + size * ((hash + probe) & (entries - 1));
+
+    if (key == *(uint32_t *)entry)
+    {
+      *hit = 1;
+      return entry;
+    }
+
+    /* slots are only ever emptied all at once, so an empty slot means the key is not further along either */
+    if (CANIDTABLE_KEY_EMPTY == *(uint32_t *)entry)
+    {
+      victim = entry;
+      break;
+    }
+
+    if (evict(entry, victim))
+      victim = entry;
+  }
+
+  /* the eviction function may have spared every entry in the window */
+  if (!victim)
+    victim = (uint8_t *)table + size * (hash & (entries - 1));
+
+  *hit = 0;
+
+  return victim;
+}
+
+/* eviction function for tables with a Referenced flag, set on each hit: the first entry not referenced since it was last passed over is the victim */
+
+int CANidtable_SecondChance(uint8_t *referenced, const void *victim)
+{
+  if (victim)
+    return 0;
+
+  if (*referenced)
+  {
+    *referenced = 0;
+    return 0;
+  }
+
+  return 1;
+}
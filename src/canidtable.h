@@ -0,0 +1,53 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANIDTABLE_H_
+#define CANIDTABLE_H_
+
+#include <stddef.h>
+#include "canbus.h"
+
+/*
+    fixed-size open-addressing hash keyed by CAN ID, shared by the per-ID tables (canstats.c, candelta.c, cancomp.c)
+
+    Each table is an array of its own entries, the first member of which must be the uint32_t key: the CAN ID, ORed 
+    with CANIDTABLE_KEY_EXT for extended IDs, or CANIDTABLE_KEY_EMPTY in a slot never used.  A lookup examines at 
+    most CANIDTABLE_PROBE_LIMIT slots from where the key hashes to, so it stays bounded however the ID space churns; 
+    if the key is in none of them, the table's eviction function picks which of them the key takes over.
+*/
+
+#define CANIDTABLE_PROBE_LIMIT 8 /* maximum slots examined per lookup */
+
+#define CANIDTABLE_KEY_EXT     0x80000000UL
+#define CANIDTABLE_KEY_EMPTY   0xFFFFFFFFUL
+
+/* whether entry (occupied by some other key) should be given up in preference to victim, or to nothing if that is NULL */
+typedef int (*canidtable_evict)(void *entry, const void *victim);
+
+extern uint32_t CANidtable_Key(const struct CANmessage *message);
+extern void CANidtable_Empty(void *table, unsigned entries, size_t size);
+extern void *CANidtable_Lookup(void *table, unsigned entries, size_t size, uint32_t key, canidtable_evict evict, unsigned *hit);
+extern int CANidtable_SecondChance(uint8_t *referenced, const void *victim);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "canbus.h"
+#include "canlimit.h"
+
+void CANlimit_Init(struct canlimit_table *table)
+{
+  unsigned index;
+
+  for (index = 0; index < CANLIMIT_RULES; index++)
+  {
+    table->rule[index].Period = 0;
+    table->rule[index].Decimated = 0;
+  }
+}
+
+void CANlimit_Set(struct canlimit_table *table, unsigned index, uint32_t key, uint32_t mask, uint32_t period, uint32_t burst, uint32_t now)
+{
+  struct canlimit_rule *rule = &table->rule[index];
+
+  if (0 == burst)
+    burst = 1;
+
+  rule->Key = key & mask;
+  rule->KeyMask = mask;
+  rule->Period = period;
+  rule->Ceiling = (period > 0xFFFFFFFFUL / burst) ? 0xFFFFFFFFUL : period * burst;
+  rule->Credit = rule->Ceiling; /* start with a full bucket */
+  rule->LastTimestamp = now;
+  rule->Decimated = 0;
+}
+
+FAST_CODE uint32_t CANlimit_Admit(struct canlimit_table *table, uint32_t key, uint32_t timestamp)
+{
+  struct canlimit_rule *rule;
+  uint32_t elapsed;
+  unsigned index;
+
+  for (index = 0, rule = table->rule; index < CANLIMIT_RULES; index++, rule++)
+  {
+    if (0 == rule->Period)
+      continue;
+
+    if ((key ^ rule->Key) & rule->KeyMask)
+      continue;
+
+    elapsed = timestamp - rule->LastTimestamp;
+    rule->LastTimestamp = timestamp;
+
+    if (elapsed >= rule->Ceiling - rule->Credit)
+      rule->Credit = rule->Ceiling;
+    else
+      rule->Credit += elapsed;
+
+    if (rule->Credit >= rule->Period)
+    {
+      rule->Credit -= rule->Period;
+      return 1;
+    }
+
+    rule->Decimated++;
+    return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,66 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANLIMIT_H_
+#define CANLIMIT_H_
+
+#include <stdint.h>
+
+/*
+    per-ID (or per-mask) rate limiting, applied by the receive interrupt before a message is queued
+
+    Each rule is a token bucket: a message whose key matches a rule is admitted only if a token is available, and 
+    tokens accrue at one per Period microseconds up to a maximum of Burst.  To avoid division in interrupt context, 
+    the bucket is kept in units of time (Credit, capped at Ceiling = Period * Burst) rather than tokens.
+
+    The first matching rule applies; all IDs matching a rule share its bucket.  Messages matching no rule are 
+    always admitted.
+
+    host/canlimitbench.c checks every answer against a bucket kept in 64-bit time, across the wrap of the timestamp.
+*/
+
+#define CANLIMIT_RULES   8
+
+#define CANLIMIT_KEY_EXT 0x80000000UL
+
+struct canlimit_rule
+{
+  uint32_t Key, KeyMask;   /* CAN ID (ORed with CANLIMIT_KEY_EXT for extended IDs) and the bits of it compared */
+  uint32_t Period;         /* microseconds per token; zero if the rule is unused */
+  uint32_t Ceiling;        /* Period * Burst */
+  uint32_t Credit;         /* microseconds of accrued tokens */
+  uint32_t LastTimestamp;  /* time of the last message matching this rule */
+  uint32_t Decimated;      /* messages not admitted */
+};
+
+struct canlimit_table
+{
+  struct canlimit_rule rule[CANLIMIT_RULES];
+};
+
+extern void CANlimit_Init(struct canlimit_table *table);
+extern void CANlimit_Set(struct canlimit_table *table, unsigned index, uint32_t key, uint32_t mask, uint32_t period, uint32_t burst, uint32_t now);
+extern uint32_t CANlimit_Admit(struct canlimit_table *table, uint32_t key, uint32_t timestamp);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "canqueue.h"
+
+/* the FD flags ride in the top three bits of the ID, which is never more than 29 bits long */
+#define CANQUEUE_ID_FD  0x20000000UL
+#define CANQUEUE_ID_BRS 0x40000000UL
+#define CANQUEUE_ID_ESI 0x80000000UL
+#define CANQUEUE_ID_MASK 0x1FFFFFFFUL
+
+void CANqueue_Init(struct canqueue *queue, void *buffer, uint32_t size)
+{
+  queue->Buffer = (uint8_t *)buffer;
+  queue->Size = size;
+  queue->WriteIndex = queue->ReadIndex = 0;
+}
+
+static void CANqueue_Write32(uint8_t *pnt, uint32_t value)
+{
+  pnt[0] = (uint8_t)(value >> 0);
+  pnt[1] = (uint8_t)(value >> 8);
+  pnt[2] = (uint8_t)(value >> 16);
+  pnt[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t CANqueue_Read32(const uint8_t *pnt)
+{
+  return (uint32_t)pnt[0] | ((uint32_t)pnt[1] << 8) | ((uint32_t)pnt[2] << 16) | ((uint32_t)pnt[3] << 24);
+}
+
+/* called by the producer; returns zero (leaving the queue as it was) if there is no room for the message */
+
+FAST_CODE uint32_t CANqueue_Put(struct canqueue *queue, const struct CANmessage *message)
+{
+  uint32_t write_index, read_index, next_write_index, length, id, index;
+  uint8_t *pnt;
+
+  write_index = queue->WriteIndex;
+  read_index = queue->ReadIndex;
+
+  length = CANMESSAGE_LENGTH(message);
+
+  if ((write_index + CANQUEUE_HEADER_SIZE + length) > queue->Size)
+  {
+    /* it doesn't fit before the end, so it goes at the beginning, and must stop short of the oldest message there */
+    if ((CANQUEUE_HEADER_SIZE + length) >= read_index)
+      return 0;
+    if (write_index < read_index) /* nor may it pass that message on the way */
+      return 0;
+
+    queue->Buffer[write_index] = CANQUEUE_SKIP;
+    write_index = 0;
+  }
+  else if ( (write_index < read_index) && ((write_index + CANQUEUE_HEADER_SIZE + length) >= read_index) )
+  {
+    return 0;
+  }
+
+  next_write_index = write_index + CANQUEUE_HEADER_SIZE + length;
+  if (next_write_index == queue->Size)
+  {
+    /* filling the buffer exactly leaves nowhere for a CANQUEUE_SKIP, and no need of one */
+    if (0 == read_index)
+      return 0;
+    next_write_index = 0;
+  }
+
+  id = message->Id & CANQUEUE_ID_MASK;
+  if (message->flags & CANMESSAGE_FLAG_FD)
+    id |= CANQUEUE_ID_FD;
+  if (message->flags & CANMESSAGE_FLAG_BRS)
+    id |= CANQUEUE_ID_BRS;
+  if (message->flags & CANMESSAGE_FLAG_ESI)
+    id |= CANQUEUE_ID_ESI;
+
+  pnt = &queue->Buffer[write_index];
+  pnt[0] = (message->DLC & 0x0F) | ((message->flags & CANMESSAGE_FLAG_STDID) ? CANQUEUE_HEADER_STDID : 0);
+  CANqueue_Write32(pnt + 1, id);
+  CANqueue_Write32(pnt + 5, message->Timestamp);
+  pnt[9] = (uint8_t)(message->Sequence >> 0);
+  pnt[10] = (uint8_t)(message->Sequence >> 8);
+  pnt += CANQUEUE_HEADER_SIZE;
+  for (index = 0; index < length; index++)
+    pnt[index] = message->Data[index];
+
+  queue->WriteIndex = next_write_index;
+
+  return 1;
+}
+
+/* called by the consumer to take a copy of the message at index (which it must have reached from ReadIndex), returning the index of the next */
+
+FAST_CODE uint32_t CANqueue_Get(const struct canqueue *queue, uint32_t index, struct CANmessage *message)
+{
+  const uint8_t *pnt;
+  uint32_t id, length, count;
+
+  if (CANQUEUE_SKIP == queue->Buffer[index])
+    index = 0;
+
+  pnt = &queue->Buffer[index];
+  id = CANqueue_Read32(pnt + 1);
+  message->Id = id & CANQUEUE_ID_MASK;
+  message->flags = ((pnt[0] & CANQUEUE_HEADER_STDID) ? CANMESSAGE_FLAG_STDID : 0) | ((id & CANQUEUE_ID_FD) ? CANMESSAGE_FLAG_FD : 0) | ((id & CANQUEUE_ID_BRS) ? CANMESSAGE_FLAG_BRS : 0) | ((id & CANQUEUE_ID_ESI) ? CANMESSAGE_FLAG_ESI : 0);
+  message->DLC = pnt[0] & 0x0F;
+  message->Timestamp = CANqueue_Read32(pnt + 5);
+  message->Sequence = (uint16_t)(pnt[9] | (pnt[10] << 8));
+
+  length = CANMESSAGE_LENGTH(message);
+  pnt += CANQUEUE_HEADER_SIZE;
+  for (count = 0; count < length; count++)
+    message->Data[count] = pnt[count];
+
+  index += CANQUEUE_HEADER_SIZE + length;
+  return (index == queue->Size) ? 0 : index;
+}
+
+/* called by the consumer to step past the message at index without taking a copy */
+
+FAST_CODE uint32_t CANqueue_Next(const struct canqueue *queue, uint32_t index)
+{
+  uint32_t dlc, length;
+
+  if (CANQUEUE_SKIP == queue->Buffer[index])
+    index = 0;
+
+  dlc = queue->Buffer[index] & 0x0F;
+  length = (dlc <= 8) ? dlc : ((queue->Buffer[index + 4] & (CANQUEUE_ID_FD >> 24)) && (CANMESSAGE_DATA_MAX > 8)) ? CANMESSAGE_FD_LENGTH(dlc) : 8;
+
+  index += CANQUEUE_HEADER_SIZE + length;
+  return (index == queue->Size) ? 0 : index;
+}
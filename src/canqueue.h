@@ -0,0 +1,66 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANQUEUE_H_
+#define CANQUEUE_H_
+
+#include "canbus.h"
+
+/*
+    single-producer single-consumer queue of received messages, each taking only the space its data needs
+
+    Messages are packed byte by byte: a header byte (CANQUEUE_HEADER_STDID and the DLC), the ID (with the CAN FD 
+    flags in its top three bits), the timestamp and the sequence number (each least significant byte first), and 
+    then exactly CANMESSAGE_LENGTH() data bytes; 11 bytes plus the data, against the 20 of a struct CANmessage with 
+    room for 8.  A message is never split at the end of the buffer: should it not fit in what is left, the producer 
+    writes CANQUEUE_SKIP there (if there is room for it) and puts the message at the beginning instead.
+
+    The producer (the CAN interrupt) alone alters WriteIndex, and the consumer (CANbus_Service()) alone ReadIndex.
+    As the Cortex-M0 faults on unaligned word accesses, and a message may start on any byte, everything is copied a 
+    byte at a time; messages are taken out into a struct CANmessage rather than used in place.
+
+    host/canqueuebench.c puts and takes out messages of mixed lengths, with the interrupt breaking in between the 
+    consumer's calls, over every alignment of a message with the end of the buffer.
+*/
+
+#define CANQUEUE_HEADER_STDID 0x10 /* in the header byte, along with the DLC in bits 0-3 */
+#define CANQUEUE_SKIP         0xFF /* header byte of no message; the next starts at the beginning of the buffer */
+
+#define CANQUEUE_HEADER_SIZE  (1 + 4 + 4 + 2)
+#define CANQUEUE_RECORD_MAX   (CANQUEUE_HEADER_SIZE + CANMESSAGE_DATA_MAX)
+
+struct canqueue
+{
+  uint8_t *Buffer;
+  uint32_t Size;                 /* in bytes; at least 2 * CANQUEUE_RECORD_MAX */
+  volatile uint32_t WriteIndex;  /* byte at which the next message will be put */
+  volatile uint32_t ReadIndex;   /* byte at which the oldest message (or a CANQUEUE_SKIP) starts; equal to WriteIndex when empty */
+};
+
+extern void CANqueue_Init(struct canqueue *queue, void *buffer, uint32_t size);
+extern uint32_t CANqueue_Put(struct canqueue *queue, const struct CANmessage *message);
+extern uint32_t CANqueue_Get(const struct canqueue *queue, uint32_t index, struct CANmessage *message);
+extern uint32_t CANqueue_Next(const struct canqueue *queue, uint32_t index);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "cansettings.h"
+
+/*
+    record layout: the settings as halfwords, then the checksum, then the marker
+    the marker's low byte is a layout version, so records written by an incompatible firmware are ignored
+*/
+
+#define PAYLOAD_HALFWORDS (sizeof(struct cansettings) / 2)
+#define CHECK_OFFSET (CANSETTINGS_RECORD_HALFWORDS - 2)
+#define MARKER_OFFSET (CANSETTINGS_RECORD_HALFWORDS - 1)
+
+#define MARKER 0xC501
+#define ERASED 0xFFFF
+
+/* the settings must exactly fill the halfwords ahead of the checksum */
+typedef char cansettings_layout_check[(PAYLOAD_HALFWORDS == CHECK_OFFSET) && (0 == sizeof(struct cansettings) % 2) ? 1 : -1];
+
+static uint16_t CANsettings_Check(const uint16_t *payload)
+{
+  uint16_t sum = MARKER;
+  unsigned index;
+
+  for (index = 0; index < PAYLOAD_HALFWORDS; index++)
+    sum = (uint16_t)((sum << 1) | (sum >> 15)) ^ payload[index];
+
+  return ~sum;
+}
+
+static uint32_t CANsettings_Erased(const uint16_t *record)
+{
+  unsigned index;
+
+  for (index = 0; index < CANSETTINGS_RECORD_HALFWORDS; index++)
+    if (ERASED != record[index])
+      return 0;
+
+  return 1;
+}
+
+/*
+    finds the last valid record and the first slot that has never been written since the page was erased
+    an erase cut short by power loss can leave erased slots ahead of written ones; writing into one of those would 
+    leave the new record hidden behind an old one, so there is then no free slot, and the next save erases the page
+*/
+
+static const uint16_t *CANsettings_Scan(const uint16_t *page, const uint16_t **free_slot)
+{
+  const uint16_t *record, *latest = NULL;
+  unsigned slot;
+
+  *free_slot = NULL;
+
+  for (slot = 0, record = page; slot < CANSETTINGS_SLOTS; slot++, record += CANSETTINGS_RECORD_HALFWORDS)
+  {
+    if (CANsettings_Erased(record))
+    {
+      *free_slot = record;
+      break;
+    }
+
+    if ( (MARKER == record[MARKER_OFFSET]) && (CANsettings_Check(record) == record[CHECK_OFFSET]) )
+      latest = record;
+  }
+
+  for (; slot < CANSETTINGS_SLOTS; slot++, record += CANSETTINGS_RECORD_HALFWORDS)
+  {
+    if (!CANsettings_Erased(record))
+    {
+      *free_slot = NULL;
+      break;
+    }
+  }
+
+  return latest;
+}
+
+void CANsettings_Default(struct cansettings *settings)
+{
+  settings->Bitrate = 6; /* 500k */
+  settings->OutputMode = 0;
+  settings->Autostart = 0;
+  settings->RetainDepth = 0; /* as many as fit */
+  settings->FilterId = settings->FilterMask = 0; /* accept everything */
+}
+
+uint32_t CANsettings_Load(const uint16_t *page, struct cansettings *settings)
+{
+  const uint16_t *latest, *free_slot;
+
+  latest = CANsettings_Scan(page, &free_slot);
+
+  if (NULL == latest)
+    return 0;
+
+  memcpy(settings, latest, sizeof(struct cansettings));
+  return 1;
+}
+
+uint32_t CANsettings_Save(const uint16_t *page, const struct cansettings *settings)
+{
+  const uint16_t *latest, *record;
+  uint16_t image[CANSETTINGS_RECORD_HALFWORDS];
+  unsigned index;
+
+  memcpy(image, settings, sizeof(struct cansettings));
+  image[CHECK_OFFSET] = CANsettings_Check(image);
+  image[MARKER_OFFSET] = MARKER;
+
+  latest = CANsettings_Scan(page, &record);
+
+  /* re-saving what is already there would only wear the flash */
+  if ( latest && (0 == memcmp(latest, image, sizeof(image))) )
+    return 1;
+
+  if (NULL == record)
+  {
+    if (!CANsettings_FlashErase(page))
+      return 0;
+
+    for (index = 0; index < CANSETTINGS_SLOTS; index++)
+      if (!CANsettings_Erased(page + index * CANSETTINGS_RECORD_HALFWORDS))
+        return 0;
+
+    record = page;
+  }
+
+  /* the marker goes last, so that an interrupted save never looks valid */
+  for (index = 0; index < CANSETTINGS_RECORD_HALFWORDS; index++)
+  {
+    if (!CANsettings_FlashProgram(record + index, image[index]) || (record[index] != image[index]))
+      return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,65 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANSETTINGS_H_
+#define CANSETTINGS_H_
+
+#include <stdint.h>
+
+/*
+    settings that survive a power cycle, kept in a page of flash set aside for them
+
+    The page is treated as a log of fixed-size records.  Saving appends a record after the last one written, so the 
+    page is only erased once every CANSETTINGS_SLOTS saves; loading takes the last valid record.  Each record's 
+    marker halfword is programmed last, and the record carries a checksum, so a save interrupted by power loss leaves 
+    the previous record in effect (or, if it strikes while the full page is being erased, the defaults or an older 
+    record the erase had not reached).
+
+    The flash itself is reached through CANsettings_FlashErase() and CANsettings_FlashProgram(), which the caller 
+    provides; host/cansettingsbench.c provides them over an emulated page, and cuts saves short at random.
+*/
+
+#define CANSETTINGS_PAGE_SIZE 1024 /* bytes of the page used; the smallest page of the STM32F0 family */
+
+#define CANSETTINGS_RECORD_HALFWORDS 8
+#define CANSETTINGS_SLOTS (CANSETTINGS_PAGE_SIZE / (2 * CANSETTINGS_RECORD_HALFWORDS))
+
+struct cansettings
+{
+  uint8_t Bitrate;              /* LAWICEL 'S' command index */
+  uint8_t OutputMode;           /* 'D' command */
+  uint8_t Autostart;            /* 'Q' command */
+  uint8_t RetainDepth;          /* 'B' command */
+  uint32_t FilterId, FilterMask; /* bxCAN filter bank 0 (32-bit identifier mask mode) */
+};
+
+extern void CANsettings_Default(struct cansettings *settings);
+extern uint32_t CANsettings_Load(const uint16_t *page, struct cansettings *settings);
+extern uint32_t CANsettings_Save(const uint16_t *page, const struct cansettings *settings);
+
+/* provided by the caller; each returns non-zero on success */
+extern uint32_t CANsettings_FlashErase(const uint16_t *page);
+extern uint32_t CANsettings_FlashProgram(const uint16_t *address, uint16_t value);
+
+#endif
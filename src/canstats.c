@@ -0,0 +1,95 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stddef.h>
+#include "canstats.h"
+
+typedef char canstats_key_first[(0 == offsetof(struct canstats_entry, Key)) ? 1 : -1];
+
+static int CANstats_LessActive(const struct canstats_entry *a, const struct canstats_entry *b)
+{
+  if (a->Count != b->Count)
+    return (a->Count < b->Count);
+
+  /* on a tie, the one heard from least recently loses */
+  return ((int32_t)(a->LastTimestamp - b->LastTimestamp) < 0);
+}
+
+static int CANstats_Evict(void *entry, const void *victim)
+{
+  return !victim || CANstats_LessActive(entry, victim);
+}
+
+void CANstats_Init(struct canstats_table *table)
+{
+  CANidtable_Empty(table->entry, CANSTATS_ENTRIES, sizeof(table->entry[0]));
+  table->Evictions = 0;
+}
+
+void CANstats_Restart(struct canstats_entry *entry)
+{
+  /* LastTimestamp is deliberately kept, so that the next interval measured spans the restart */
+  entry->Count = 0;
+  entry->MinInterval = CANSTATS_NO_INTERVAL;
+  entry->MaxInterval = 0;
+}
+
+struct canstats_entry *CANstats_Update(struct canstats_table *table, const struct CANmessage *message)
+{
+  uint32_t key, interval;
+  unsigned index, length, hit;
+  struct canstats_entry *entry;
+
+  key = CANidtable_Key(message);
+  entry = CANidtable_Lookup(table->entry, CANSTATS_ENTRIES, sizeof(table->entry[0]), key, CANstats_Evict, &hit);
+
+  if (hit)
+  {
+    interval = message->Timestamp - entry->LastTimestamp;
+    if (interval < entry->MinInterval)
+      entry->MinInterval = interval;
+    if (interval > entry->MaxInterval)
+      entry->MaxInterval = interval;
+  }
+  else
+  {
+    if ( (CANSTATS_KEY_EMPTY != entry->Key) && entry->Count )
+      table->Evictions++;
+
+    entry->Key = key;
+    CANstats_Restart(entry);
+  }
+
+  if (entry->Count < 0xFFFF)
+    entry->Count++;
+  entry->LastTimestamp = message->Timestamp;
+
+  length = CANMESSAGE_LENGTH(message);
+  entry->DLC = message->DLC;
+  entry->Length = (uint8_t)length;
+  for (index = 0; index < length; index++)
+    entry->Data[index] = message->Data[index];
+
+  return entry;
+}
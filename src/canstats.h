@@ -0,0 +1,75 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANSTATS_H_
+#define CANSTATS_H_
+
+#include "canbus.h"
+#include "canidtable.h"
+
+/*
+    per-ID statistics table
+
+    The table is one of canidtable.c's fixed-size open-addressing hashes keyed by CAN ID.  Slots are never freed, only 
+    recycled: when all CANSTATS_PROBE_LIMIT slots in an ID's probe window are occupied by other IDs, the least active 
+    of them is evicted to make room.  This keeps lookups bounded even as the ID space churns.
+
+    host/canstatsbench.c checks the table against a copy kept alongside it, through bursts of IDs never seen again.
+*/
+
+#if CANMESSAGE_DATA_MAX > 8
+#define CANSTATS_ENTRIES     8  /* must be a power of two; with CAN FD payloads the table comes out of CANqueue[] 8 times as big per entry */
+#else
+#define CANSTATS_ENTRIES     32 /* must be a power of two */
+#endif
+#define CANSTATS_PROBE_LIMIT CANIDTABLE_PROBE_LIMIT
+
+#define CANSTATS_KEY_EXT     CANIDTABLE_KEY_EXT
+#define CANSTATS_KEY_EMPTY   CANIDTABLE_KEY_EMPTY
+
+#define CANSTATS_NO_INTERVAL 0xFFFFFFFFUL /* MinInterval value until two messages have been seen */
+
+struct canstats_entry
+{
+  uint32_t Key;            /* CAN ID, ORed with CANSTATS_KEY_EXT for extended IDs; must come first, for canidtable.c */
+  uint32_t LastTimestamp;  /* reception time (microseconds) of most recent message */
+  uint32_t MinInterval;    /* shortest inter-arrival time (microseconds) since last restart */
+  uint32_t MaxInterval;    /* longest inter-arrival time (microseconds) since last restart */
+  uint16_t Count;          /* messages since last restart */
+  uint8_t DLC;             /* of most recent message */
+  uint8_t Length;          /* data bytes of most recent message */
+  uint8_t Data[CANMESSAGE_DATA_MAX]; /* of most recent message */
+};
+
+struct canstats_table
+{
+  struct canstats_entry entry[CANSTATS_ENTRIES];
+  uint32_t Evictions;      /* IDs that were pushed out of the table while they still had unreported messages */
+};
+
+extern void CANstats_Init(struct canstats_table *table);
+extern struct canstats_entry *CANstats_Update(struct canstats_table *table, const struct CANmessage *message);
+extern void CANstats_Restart(struct canstats_entry *entry);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#include "cantrigger.h"
+
+void CANtrigger_Init(struct cantrigger *trigger)
+{
+  unsigned index;
+
+  /* by default, any message is a trigger */
+  trigger->Key = trigger->KeyMask = 0;
+  for (index = 0; index < 8; index++)
+    trigger->Data[index] = trigger->DataMask[index] = 0;
+
+  trigger->PreTrigger = 16;
+  trigger->PostTrigger = 64;
+}
+
+uint32_t CANtrigger_Match(const struct cantrigger *trigger, const struct CANmessage *message)
+{
+  uint32_t key;
+  unsigned index;
+
+  key = message->Id;
+  if (!(message->flags & CANMESSAGE_FLAG_STDID))
+    key |= CANTRIGGER_KEY_EXT;
+
+  if ((key ^ trigger->Key) & trigger->KeyMask)
+    return 0;
+
+  for (index = 0; index < 8; index++)
+  {
+    if (!trigger->DataMask[index])
+      continue;
+
+    if (index >= message->DLC)
+      return 0;
+
+    if ((message->Data[index] ^ trigger->Data[index]) & trigger->DataMask[index])
+      return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,53 @@
+/*
+    CANbus sniffer using STM32F042
+
+    Copyright (C) 2015,2016,2017 Peter Lawrence
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the "Software"), 
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL 
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CANTRIGGER_H_
+#define CANTRIGGER_H_
+
+#include "canbus.h"
+
+/*
+    trigger condition for the pre/post-trigger capture mode
+
+    A message matches when its ID (ORed with CANTRIGGER_KEY_EXT for extended IDs) agrees with Key in every bit set 
+    in KeyMask, and each data byte agrees with Data[] in every bit set in DataMask[].  A byte with a non-zero mask 
+    beyond the message's DLC cannot match.
+
+    host/cantriggerbench.c checks CANtrigger_Match() against this description, a bit at a time, over replayed traces.
+*/
+
+#define CANTRIGGER_KEY_EXT 0x80000000UL
+
+struct cantrigger
+{
+  uint32_t Key, KeyMask;
+  uint8_t Data[8], DataMask[8];
+  uint16_t PreTrigger;   /* messages before the trigger message to output */
+  uint16_t PostTrigger;  /* messages after the trigger message to output */
+};
+
+extern void CANtrigger_Init(struct cantrigger *trigger);
+extern uint32_t CANtrigger_Match(const struct cantrigger *trigger, const struct CANmessage *message);
+
+#endif
@@ -44,6 +44,9 @@ void main(void)
 
   /* STM32F0xx HAL library initialization */
   HAL_Init();
+
+  /* PendSV carries the USB work deferred from SOF (see usbd_virtualcdc.c), below all else in stm32f0xx_hal_conf.h's plan */
+  HAL_NVIC_SetPriority(PendSV_IRQn, PENDSV_INT_PRIORITY, 0);
   
   /* Configure the system clock to get correspondent USB clock source */
   SystemClock_Config();
@@ -155,9 +155,17 @@
   * @brief This is the HAL system configuration section
   */     
 #define  VDD_VALUE                    ((uint32_t)3300) /*!< Value of VDD in mv */           
-#define  TICK_INT_PRIORITY            0  /*!< tick interrupt priority (lowest by default)             */
+/*
+  interrupt priority plan (0 is the most urgent; the Cortex-M0 implements 0 to 3)
+  CAN reception must never wait on USB, since the bxCAN FIFO is only 3 messages deep, and USB must not wait on the 
+  millisecond tick; the SOF housekeeping (flushing the ring to the host) is deferred from the USB interrupt to PendSV
+*/
+#define  CAN_INT_PRIORITY             0  /*!< CAN reception, and the latency probe that shares its priority */
+#define  USB_INT_PRIORITY             1
+#define  TICK_INT_PRIORITY            2  /*!< tick interrupt priority                                 */
                                          /*  Warning: Must be set to higher priority for HAL_Delay()  */
                                          /*  and HAL_GetTick() usage under interrupt context          */
+#define  PENDSV_INT_PRIORITY          3
 #define  USE_RTOS                     0
 #define  PREFETCH_ENABLE              1
 #define  INSTRUCTION_CACHE_ENABLE     0
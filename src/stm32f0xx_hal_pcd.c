@@ -477,11 +477,7 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
         /* IN double Buffering*/
         if (ep->doublebuffer == 0)
         {
-          ep->xfer_count = PCD_GET_EP_TX_CNT(hpcd->Instance, ep->num);
-          if (ep->xfer_count != 0)
-          {
-            PCD_WritePMA(hpcd->Instance, ep->xfer_buff, ep->pmaadress, ep->xfer_count);
-          }
+          /* nothing to do: the packet just sent was written to PMA by HAL_PCD_EP_Transmit() (or by the class directly) */
         }
         else
         {
@@ -1273,12 +1269,47 @@ HAL_StatusTypeDef HAL_PCD_DeActiveRemoteWakeup(PCD_HandleTypeDef *hpcd)
 void PCD_WritePMA(USB_TypeDef  *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes)
 {
   uint32_t n = (wNBytes + 1) >> 1; 
-  uint32_t i;
+  uint32_t word;
   uint16_t temp1, temp2;
-  uint16_t *pdwVal;
-  pdwVal = (uint16_t *)(wPMABufAddr + (uint32_t)USBx + 0x400);
+  const uint32_t *pWord;
+  const uint16_t *pHalf;
+  volatile uint16_t *pdwVal; /* volatile, so that the compiler can't merge halfword stores: the PMA forbids word access */
+  pdwVal = (volatile uint16_t *)(wPMABufAddr + (uint32_t)USBx + 0x400);
   
-  for (i = n; i != 0; i--)
+  if (0 == ((uint32_t)pbUsrBuf & 3))
+  {
+    /* word-aligned source (such as the CDC InboundStage): one load per two PMA halfwords, unrolled by four */
+    pWord = (const uint32_t *)pbUsrBuf;
+    for (; n >= 8; n -= 8)
+    {
+      word = pWord[0]; pdwVal[0] = (uint16_t)word; pdwVal[1] = (uint16_t)(word >> 16);
+      word = pWord[1]; pdwVal[2] = (uint16_t)word; pdwVal[3] = (uint16_t)(word >> 16);
+      word = pWord[2]; pdwVal[4] = (uint16_t)word; pdwVal[5] = (uint16_t)(word >> 16);
+      word = pWord[3]; pdwVal[6] = (uint16_t)word; pdwVal[7] = (uint16_t)(word >> 16);
+      pWord += 4; pdwVal += 8;
+    }
+    for (; n >= 2; n -= 2)
+    {
+      word = *pWord++;
+      *pdwVal++ = (uint16_t)word;
+      *pdwVal++ = (uint16_t)(word >> 16);
+    }
+    pbUsrBuf = (uint8_t *)pWord;
+  }
+  else if (0 == ((uint32_t)pbUsrBuf & 1))
+  {
+    /* halfword-aligned source */
+    pHalf = (const uint16_t *)pbUsrBuf;
+    for (; n >= 4; n -= 4)
+    {
+      pdwVal[0] = pHalf[0]; pdwVal[1] = pHalf[1]; pdwVal[2] = pHalf[2]; pdwVal[3] = pHalf[3];
+      pHalf += 4; pdwVal += 4;
+    }
+    pbUsrBuf = (uint8_t *)pHalf;
+  }
+
+  /* unaligned source, and whatever is left over from the above */
+  for (; n != 0; n--)
   {
     temp1 = (uint16_t) * pbUsrBuf;
     pbUsrBuf++;
@@ -1298,15 +1329,55 @@ void PCD_WritePMA(USB_TypeDef  *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, u
   */
 void PCD_ReadPMA(USB_TypeDef  *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes)
 {
-  uint32_t n = (wNBytes + 1) >> 1;
-  uint32_t i;
-  uint16_t *pdwVal;
-  pdwVal = (uint16_t *)(wPMABufAddr + (uint32_t)USBx + 0x400);
-  for (i = n; i != 0; i--)
+  uint32_t n = wNBytes >> 1; /* whole halfwords; an odd last byte is dealt with separately */
+  uint32_t *pWord;
+  uint16_t *pHalf;
+  uint16_t temp;
+  volatile uint16_t *pdwVal; /* volatile, so that the compiler can't merge halfword loads: the PMA forbids word access */
+  pdwVal = (volatile uint16_t *)(wPMABufAddr + (uint32_t)USBx + 0x400);
+
+  if (0 == ((uint32_t)pbUsrBuf & 3))
   {
-    *(uint16_t*)pbUsrBuf++ = *pdwVal++;
-    pbUsrBuf++;
+    /* word-aligned destination: two PMA halfwords per store, unrolled by four */
+    pWord = (uint32_t *)pbUsrBuf;
+    for (; n >= 8; n -= 8)
+    {
+      pWord[0] = pdwVal[0] | ((uint32_t)pdwVal[1] << 16);
+      pWord[1] = pdwVal[2] | ((uint32_t)pdwVal[3] << 16);
+      pWord[2] = pdwVal[4] | ((uint32_t)pdwVal[5] << 16);
+      pWord[3] = pdwVal[6] | ((uint32_t)pdwVal[7] << 16);
+      pWord += 4; pdwVal += 8;
+    }
+    for (; n >= 2; n -= 2)
+    {
+      *pWord++ = pdwVal[0] | ((uint32_t)pdwVal[1] << 16);
+      pdwVal += 2;
+    }
+    pbUsrBuf = (uint8_t *)pWord;
+  }
+
+  if (0 == ((uint32_t)pbUsrBuf & 1))
+  {
+    /* halfword-aligned destination, and what is left over from the above */
+    pHalf = (uint16_t *)pbUsrBuf;
+    for (; n != 0; n--)
+      *pHalf++ = *pdwVal++;
+    pbUsrBuf = (uint8_t *)pHalf;
   }
+  else
+  {
+    /* unaligned destination; the Cortex-M0 faults on unaligned halfword stores */
+    for (; n != 0; n--)
+    {
+      temp = *pdwVal++;
+      *pbUsrBuf++ = (uint8_t)temp;
+      *pbUsrBuf++ = (uint8_t)(temp >> 8);
+    }
+  }
+
+  /* an odd last byte is stored alone, rather than a halfword that spills past the end of the user buffer */
+  if (wNBytes & 1)
+    *pbUsrBuf = (uint8_t)*pdwVal;
 }
 /**
   * @}
@@ -29,6 +29,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_core.h"
+#include "usbd_virtualcdc.h"
 #include "stm32f0xx_it.h"
 
 /* Private typedef -----------------------------------------------------------*/
@@ -85,6 +86,7 @@ void SVC_Handler(void)
   */
 void PendSV_Handler(void)
 {
+  USBD_VirtualCDC_PendSV();
 }
 
 /**
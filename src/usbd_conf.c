@@ -68,7 +68,7 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef *hpcd)
   __USB_CLK_ENABLE();
   
   /* Set USB FS Interrupt priority */
-  HAL_NVIC_SetPriority(USB_IRQn, 3 /* hard-coded: customize if needed */, 0);
+  HAL_NVIC_SetPriority(USB_IRQn, USB_INT_PRIORITY, 0);
   
   /* Enable USB FS Interrupt */
   HAL_NVIC_EnableIRQ(USB_IRQn);
@@ -235,8 +235,10 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
   pma_address = 8 * MAX((sizeof(hpcd.IN_ep) / sizeof(*hpcd.IN_ep)), (sizeof(hpcd.OUT_ep) / sizeof(*hpcd.OUT_ep)));
 
   /* PMA allocation for EP0 */
-  HAL_PCDEx_PMAConfig(pdev->pData, 0x00, PCD_SNG_BUF, pma_address =+ USB_MAX_EP0_SIZE);
-  HAL_PCDEx_PMAConfig(pdev->pData, 0x80, PCD_SNG_BUF, pma_address =+ USB_MAX_EP0_SIZE);
+  HAL_PCDEx_PMAConfig(pdev->pData, 0x00, PCD_SNG_BUF, pma_address);
+  pma_address += USB_MAX_EP0_SIZE;
+  HAL_PCDEx_PMAConfig(pdev->pData, 0x80, PCD_SNG_BUF, pma_address);
+  pma_address += USB_MAX_EP0_SIZE;
 
   /* PMA allocation for other endpoints */
   USBD_CDC_PMAConfig(pdev->pData, &pma_address);
@@ -39,7 +39,8 @@ static uint8_t USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev);
 static const uint8_t *USBD_CDC_GetFSCfgDesc (uint16_t *length);
 static uint8_t USBD_CDC_SOF (USBD_HandleTypeDef *pdev);
 static USBD_StatusTypeDef USBD_CDC_ReceivePacket (USBD_HandleTypeDef *pdev);
-static USBD_StatusTypeDef USBD_CDC_TransmitPacket (USBD_HandleTypeDef *pdev, uint16_t offset, uint16_t length);
+static USBD_StatusTypeDef USBD_CDC_TransmitPacket (USBD_HandleTypeDef *pdev, uint32_t slot, uint16_t length);
+static void USBD_CDC_Service_DataIn (USBD_HandleTypeDef *pdev);
 static int8_t CDC_Itf_Control (USBD_CDC_HandleTypeDef *hcdc, uint8_t cmd, uint8_t* pbuf, uint16_t length);
 
 /* CDC interface class callbacks structure that is used by main.c */
@@ -58,6 +59,9 @@ const USBD_ClassTypeDef USBD_CDC =
   .GetFSConfigDescriptor = USBD_CDC_GetFSCfgDesc,    
 };
 
+/* provided by stm32f0xx_hal_pcd.c */
+extern void PCD_WritePMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+
 /* context for each and every UART managed by this CDC implementation */
 static USBD_CDC_HandleTypeDef context;
 
@@ -73,10 +77,14 @@ static uint8_t USBD_CDC_Init (USBD_HandleTypeDef *pdev, uint8_t cfgidx)
   USBD_LL_OpenEP(pdev, CDC_EP_COMMAND, USBD_EP_TYPE_INTR, CDC_CMD_PACKET_SIZE);
   
   /* initialize the context */
-  context.InboundBufferReadIndex = context.InboundBufferWriteIndex = 0;
+  context.InboundSlotFillIndex = context.InboundSlotSendIndex = 0;
+  context.InboundSlotLength[0] = 0;
+  context.InboundSlotReserved = 0;
   context.InboundTransferInProgress = 0;
+  context.InboundTransferLength = context.InboundTransferNeedsZLP = 0;
   context.OutboundTransferNeedsRenewal = 0;
   context.OutboundTransferOutstanding = 0;
+  context.OutboundRingReadIndex = context.OutboundRingWriteIndex = 0;
 
   /* Prepare Out endpoint to receive next packet */
   USBD_CDC_ReceivePacket(pdev);
@@ -138,41 +146,54 @@ static uint8_t USBD_CDC_DataIn (USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
   if (CDC_EP_DATAIN == (epnum | 0x80))
   {
+    /* the slot has been sent, so it is free to be filled again (a ZLP isn't from any slot) */
+    if (context.InboundTransferLength)
+      context.InboundSlotSendIndex = (context.InboundSlotSendIndex + 1) % INBOUND_SLOTS;
+
     context.InboundTransferInProgress = 0;
+
+    /* go straight on to the next slot, if one is queued, so that a busy stream isn't held to a packet per SOF */
+    USBD_CDC_Service_DataIn(pdev);
   }
 
   return USBD_OK;
 }
 
-static void USBD_CDC_Service_DataOut(void)
+static void USBD_CDC_Service_DataOut(USBD_HandleTypeDef *pdev)
 {
-  uint32_t HandledLength;
-  uint8_t *buffer_ptr = (uint8_t *)context.OutboundBuffer;
+  uint32_t free_space, write_index, index;
+  const uint8_t *buffer_ptr = (const uint8_t *)context.OutboundBuffer;
 
-  HandledLength = USBD_VirtualCDC_FromHost_Append(buffer_ptr, context.OutboundTransferOutstanding);
+  free_space = context.OutboundRingReadIndex + OUTBOUND_RING_SIZE - context.OutboundRingWriteIndex - 1;
+  if (free_space >= OUTBOUND_RING_SIZE)
+    free_space -= OUTBOUND_RING_SIZE;
 
-  if (HandledLength >= context.OutboundTransferOutstanding)
-  {
-    context.OutboundTransferOutstanding = 0;
-    context.OutboundTransferNeedsRenewal = 1;
-  }
-  else
+  /* the packet is taken whole or not at all; until there is room, the endpoint is left NAKing the host */
+  if (free_space < context.OutboundTransferOutstanding)
+    return;
+
+  write_index = context.OutboundRingWriteIndex;
+  for (index = 0; index < context.OutboundTransferOutstanding; index++)
   {
-    context.OutboundTransferOutstanding -= HandledLength;
-    memmove(buffer_ptr, buffer_ptr + HandledLength, context.OutboundTransferOutstanding);
+    context.OutboundRing[write_index++] = buffer_ptr[index];
+    if (OUTBOUND_RING_SIZE == write_index)
+      write_index = 0;
   }
+  context.OutboundRingWriteIndex = write_index;
+
+  /* OutboundBuffer is free again, so the host can send the next packet straight away */
+  context.OutboundTransferOutstanding = 0;
+  USBD_CDC_ReceivePacket(pdev);
 }
 
 static uint8_t USBD_CDC_DataOut (USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
-  uint32_t RxLength, HandledLength;
-
   if (CDC_EP_DATAOUT == epnum)
   {
     /* Get the received data length */
     context.OutboundTransferOutstanding = USBD_LL_GetRxDataSize (pdev, epnum);
 
-    USBD_CDC_Service_DataOut();
+    USBD_CDC_Service_DataOut(pdev);
   }
 
   return USBD_OK;
@@ -180,39 +201,50 @@ static uint8_t USBD_CDC_DataOut (USBD_HandleTypeDef *pdev, uint8_t epnum)
 
 static uint8_t USBD_CDC_SOF (USBD_HandleTypeDef *pdev)
 {
-  uint32_t buffsize;
+  USBD_VirtualCDC_FrameStart(USB->FNR & USB_FNR_FN);
 
-  if(context.InboundBufferReadIndex != context.InboundBufferWriteIndex)
+  /* the copying to PMA is left to PendSV, so as to keep the USB interrupt short */
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+
+  return USBD_OK;
+}
+
+void USBD_VirtualCDC_PendSV(void)
+{
+  USBD_HandleTypeDef *pdev = &USBD_Device;
+  uint32_t send_index;
+
+  /* the USB interrupt is held off, as this pokes at the same endpoints and context as it does; CAN is not */
+  HAL_NVIC_DisableIRQ(USB_IRQn);
+
+  if (!context.InboundTransferInProgress)
   {
-    if(context.InboundBufferReadIndex > context.InboundBufferWriteIndex)
-    {
-      /* write index has looped around, so send partial data from the write index to the end of the buffer */
-      buffsize = INBOUND_BUFFER_SIZE - context.InboundBufferReadIndex;
-    }
-    else 
+    send_index = context.InboundSlotSendIndex;
+
+    /* with nothing queued, a partly filled slot is sent as it is, unless user code is part way through writing to it */
+    if ( (send_index == context.InboundSlotFillIndex) && context.InboundSlotLength[send_index] && !context.InboundSlotReserved )
     {
-      /* send all data between read index and write index */
-      buffsize = context.InboundBufferWriteIndex - context.InboundBufferReadIndex;
+      context.InboundSlotFillIndex = (send_index + 1) % INBOUND_SLOTS;
+      context.InboundSlotLength[context.InboundSlotFillIndex] = 0;
     }
 
-    if(USBD_CDC_TransmitPacket(pdev, context.InboundBufferReadIndex, buffsize) == USBD_OK)
+    USBD_CDC_Service_DataIn(pdev);
+
+    if (!context.InboundTransferInProgress && context.InboundTransferNeedsZLP)
     {
-      context.InboundBufferReadIndex += buffsize;
-      /* if we've reached the end of the buffer, loop around to the beginning */
-      if (context.InboundBufferReadIndex == INBOUND_BUFFER_SIZE)
-      {
-        context.InboundBufferReadIndex = 0;
-      }
+      /* nothing followed a full packet, so end the transfer for the host with a zero-length one */
+      if (USBD_OK == USBD_CDC_TransmitPacket(pdev, send_index, 0))
+        context.InboundTransferNeedsZLP = 0;
     }
   }
 
-  if (context.OutboundTransferOutstanding)
-    USBD_CDC_Service_DataOut();
+  if (context.OutboundTransferOutstanding) /* if a packet was held back for want of room in the ring, retry it */
+    USBD_CDC_Service_DataOut(pdev);
 
   if (context.OutboundTransferNeedsRenewal) /* if there is a lingering request needed due to a HAL_BUSY, retry it */
     USBD_CDC_ReceivePacket(pdev);
 
-  return USBD_OK;
+  HAL_NVIC_EnableIRQ(USB_IRQn);
 }
 
 static uint8_t USBD_CDC_EP0_RxReady (USBD_HandleTypeDef *pdev)
@@ -240,23 +272,40 @@ uint8_t USBD_CDC_RegisterInterface  (USBD_HandleTypeDef   *pdev)
   return USBD_OK;
 }
 
-static uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev, uint16_t offset, uint16_t length)
+static void USBD_CDC_Service_DataIn(USBD_HandleTypeDef *pdev)
+{
+  uint32_t length;
+
+  if ( context.InboundTransferInProgress || (context.InboundSlotSendIndex == context.InboundSlotFillIndex) )
+    return;
+
+  length = context.InboundSlotLength[context.InboundSlotSendIndex];
+
+  if (USBD_OK == USBD_CDC_TransmitPacket(pdev, context.InboundSlotSendIndex, length))
+    context.InboundTransferNeedsZLP = (CDC_DATA_IN_MAX_PACKET_SIZE == length); /* a full packet doesn't end the transfer for the host */
+}
+
+static uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev, uint32_t slot, uint16_t length)
 {      
-  USBD_StatusTypeDef outcome;
+  USB_TypeDef *USBx = ((PCD_HandleTypeDef *)pdev->pData)->Instance;
+  uint32_t ep_num = CDC_EP_DATAIN & 0x7F;
 
   if (context.InboundTransferInProgress)
     return USBD_BUSY;
 
-  /* Transmit next packet */
-  outcome = USBD_LL_Transmit(pdev, CDC_EP_DATAIN, (uint8_t *)(context.InboundBuffer) + offset, length);
-  
-  if (USBD_OK == outcome)
-  {
-    /* Tx Transfer in progress */
-    context.InboundTransferInProgress = 1;
-  }
+  /*
+  the data is already in PMA, so rather than USBD_LL_Transmit(), the endpoint is pointed at it directly; the HAL's 
+  CTR handling then sees nothing more to send (xfer_len stays zero) and calls USBD_CDC_DataIn()
+  */
+  PCD_SET_EP_TX_ADDRESS(USBx, ep_num, context.InboundSlotAddress + slot * CDC_DATA_IN_MAX_PACKET_SIZE);
+  PCD_SET_EP_TX_CNT(USBx, ep_num, length);
+  PCD_SET_EP_TX_STATUS(USBx, ep_num, USB_EP_TX_VALID);
 
-  return outcome;
+  /* Tx Transfer in progress */
+  context.InboundTransferInProgress = 1;
+  context.InboundTransferLength = length;
+
+  return USBD_OK;
 }
 
 static uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
@@ -287,53 +336,134 @@ static int8_t CDC_Itf_Control (USBD_CDC_HandleTypeDef *hcdc, uint8_t cmd, uint8_
 void USBD_CDC_PMAConfig(PCD_HandleTypeDef *hpcd, uint32_t *pma_address)
 {
   /* allocate PMA memory for all endpoints associated with CDC */
-  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_DATAIN,  PCD_SNG_BUF, *pma_address =+ CDC_DATA_IN_MAX_PACKET_SIZE);
-  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_DATAOUT, PCD_SNG_BUF, *pma_address =+ CDC_DATA_OUT_MAX_PACKET_SIZE);
-  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_COMMAND,  PCD_SNG_BUF, *pma_address =+ CDC_CMD_PACKET_SIZE);
+  context.InboundSlotAddress = *pma_address;
+  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_DATAIN,  PCD_SNG_BUF, *pma_address);
+  *pma_address += INBOUND_SLOTS * CDC_DATA_IN_MAX_PACKET_SIZE;
+  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_DATAOUT, PCD_SNG_BUF, *pma_address);
+  *pma_address += CDC_DATA_OUT_MAX_PACKET_SIZE;
+  HAL_PCDEx_PMAConfig(hpcd, CDC_EP_COMMAND,  PCD_SNG_BUF, *pma_address);
+  *pma_address += CDC_CMD_PACKET_SIZE;
 }
 
-uint32_t USBD_VirtualCDC_ToHost_Append(const uint8_t *data, uint32_t length)
+uint8_t *USBD_VirtualCDC_ToHost_Reserve(uint32_t length)
 {
-  uint32_t write_index, next_write_index, read_index, countdown;
-  uint8_t *wpnt;
-  unsigned overrun = 0;
+  uint8_t *wpnt = NULL;
+  uint32_t free_slots;
+
+  if (length > INBOUND_RECORD_MAX)
+    return NULL;
 
-  /* sample current state of inbound buffer */
   __disable_irq();
-  write_index = context.InboundBufferWriteIndex;
-  read_index = context.InboundBufferReadIndex;
+
+  /*
+  a record that doesn't fit in what is left of the fill slot carries on into as many of those after it (already sent) 
+  as it needs, so that every packet but the last of a transfer is full; moving on to a fresh slot instead would leave 
+  most packets short, each one ending a transfer (host/usbinbench.c)
+  */
+  free_slots = (context.InboundSlotSendIndex + INBOUND_SLOTS - context.InboundSlotFillIndex - 1) % INBOUND_SLOTS;
+
+  if (context.InboundSlotLength[context.InboundSlotFillIndex] + length <= (1 + free_slots) * CDC_DATA_IN_MAX_PACKET_SIZE)
+  {
+    /* USBD_VirtualCDC_PendSV() leaves the fill slot alone until the corresponding commit */
+    context.InboundSlotReserved = 1;
+
+    /* staged at the same halfword alignment as the data will have in PMA, so USBD_VirtualCDC_ToHost_Commit() can write it as halfwords */
+    wpnt = (uint8_t *)context.InboundStage + (context.InboundSlotLength[context.InboundSlotFillIndex] & 1);
+  }
+
   __enable_irq();
 
-  /* try to write data to inbound buffer, bailing early if we run out of space (overrun = 1) */
-  countdown = length;
-  while (countdown)
+  return wpnt;
+}
+
+void USBD_VirtualCDC_ToHost_Commit(uint32_t length)
+{
+  uint8_t *stage = (uint8_t *)context.InboundStage;
+  uint32_t address, count, written;
+
+  for (;;)
   {
-    next_write_index = write_index + 1;
-    if (next_write_index == INBOUND_BUFFER_SIZE)
-        next_write_index = 0;
-    if (next_write_index == read_index)
+    written = CDC_DATA_IN_MAX_PACKET_SIZE - context.InboundSlotLength[context.InboundSlotFillIndex];
+    if (written > length)
+      written = length;
+    count = written;
+
+    /* no lock is needed to write the data, as nothing else touches the fill slot while it is reserved */
+    address = context.InboundSlotAddress + context.InboundSlotFillIndex * CDC_DATA_IN_MAX_PACKET_SIZE + context.InboundSlotLength[context.InboundSlotFillIndex];
+
+    if (count && (address & 1))
     {
-      overrun = 1;
-      break;
+      /* an odd start shares its halfword with the end of the previous data, so that byte is read back into the stage */
+      address--; count++;
+      stage[0] = (uint8_t)*(volatile uint16_t *)((uint32_t)USB + 0x400 + address);
     }
-    wpnt = (uint8_t *)(context.InboundBuffer) + write_index;
-    *wpnt = *data;
-    data++; write_index = next_write_index; countdown--;
+
+    if (count)
+      PCD_WritePMA(USB, stage, address, count);
+
+    length -= written;
+    if (0 == length)
+      break;
+
+    /* the rest of a long record goes in the next slot (which always starts on a halfword), once this full one is queued */
+    stage += count;
+
+    __disable_irq();
+    context.InboundSlotLength[context.InboundSlotFillIndex] = CDC_DATA_IN_MAX_PACKET_SIZE;
+    context.InboundSlotFillIndex = (context.InboundSlotFillIndex + 1) % INBOUND_SLOTS;
+    context.InboundSlotLength[context.InboundSlotFillIndex] = 0;
+    USBD_CDC_Service_DataIn(&USBD_Device);
+    __enable_irq();
   }
 
-  /* if we overran, bail and let the caller know we failed */
-  if (overrun)
+  __disable_irq();
+  context.InboundSlotLength[context.InboundSlotFillIndex] += written;
+  context.InboundSlotReserved = 0;
+  __enable_irq();
+}
+
+uint32_t USBD_VirtualCDC_ToHost_Append(const uint8_t *data, uint32_t length)
+{
+  uint8_t *wpnt;
+  uint32_t index;
+
+  /* if there isn't room, bail and let the caller know we failed */
+  wpnt = USBD_VirtualCDC_ToHost_Reserve(length);
+  if (NULL == wpnt)
     return 0;
 
-  /* adding the data was successful, so we update the write index */
+  for (index = 0; index < length; index++)
+    wpnt[index] = data[index];
+
+  USBD_VirtualCDC_ToHost_Commit(length);
+  return length;
+}
+
+uint32_t USBD_VirtualCDC_FromHost_Read(uint8_t *data, uint32_t length)
+{
+  uint32_t write_index, read_index, count = 0;
+
+  /* sample current state of outbound ring */
   __disable_irq();
-  context.InboundBufferWriteIndex = write_index;
+  write_index = context.OutboundRingWriteIndex;
+  read_index = context.OutboundRingReadIndex;
   __enable_irq();
-  return length;
+
+  while ( (count < length) && (read_index != write_index) )
+  {
+    data[count++] = context.OutboundRing[read_index++];
+    if (OUTBOUND_RING_SIZE == read_index)
+      read_index = 0;
+  }
+
+  /* the space is handed back to USBD_CDC_Service_DataOut(), which next runs no later than the next SOF */
+  __disable_irq();
+  context.OutboundRingReadIndex = read_index;
+  __enable_irq();
+  return count;
 }
 
 /* optionally overridden by user code */
 __weak void USBD_VirtualCDC_LineState(uint16_t state) {}
 
-/* optionally overridden by user code */
-__weak uint32_t USBD_VirtualCDC_FromHost_Append(const uint8_t *data, uint32_t length) { return length; /* throw away data to allow new dataout */}
+__weak void USBD_VirtualCDC_FrameStart(uint32_t frame) {}
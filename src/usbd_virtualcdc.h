@@ -11,14 +11,31 @@
 #define CDC_EP_DATAIN   0x81
 
 #define CDC_DATA_OUT_MAX_PACKET_SIZE        USB_FS_MAX_PACKET_SIZE /* don't exceed USB_FS_MAX_PACKET_SIZE; Linux data loss happens otherwise */
-#define CDC_DATA_IN_MAX_PACKET_SIZE         256
+#define CDC_DATA_IN_MAX_PACKET_SIZE         USB_FS_MAX_PACKET_SIZE
 #define CDC_CMD_PACKET_SIZE                 8 /* this may need to be enlarged for advanced CDC commands */
 
 /*
-INBOUND_BUFFER_SIZE should be 2x or more (bigger is better) of CDC_DATA_IN_MAX_PACKET_SIZE to ensure 
-adequate time for the service routine to copy the data to the relevant USB IN endpoint PMA memory
+data to the host is written straight into one slot of CDC_DATA_IN_MAX_PACKET_SIZE in PMA while the others are queued 
+or being transmitted, the IN endpoint being pointed at each slot in turn; INBOUND_SLOTS should be 2 or more (bigger 
+is better, within the 1kB of PMA) to ride out the host not polling the endpoint for a while
 */
-#define INBOUND_BUFFER_SIZE                 (4*CDC_DATA_IN_MAX_PACKET_SIZE)
+#define INBOUND_SLOTS                       8
+
+/*
+the PMA only takes halfword writes, so each record is put together in InboundStage and then written to PMA; 
+this limits the records user code may queue to INBOUND_RECORD_MAX bytes (a multiple of 4); a record that doesn't fit 
+in what is left of one slot carries on into the next
+*/
+#ifndef INBOUND_RECORD_MAX
+#define INBOUND_RECORD_MAX                  CDC_DATA_IN_MAX_PACKET_SIZE
+#endif
+#define INBOUND_STAGE_SIZE                  (INBOUND_RECORD_MAX + sizeof(uint32_t))
+
+/*
+OUTBOUND_RING_SIZE should be 2x or more of CDC_DATA_OUT_MAX_PACKET_SIZE, so that the OUT endpoint can be re-armed 
+while the user code is still working through the previous packet
+*/
+#define OUTBOUND_RING_SIZE                  (2*CDC_DATA_OUT_MAX_PACKET_SIZE)
 
 /* listing CDC commands handled by switch statement in usbd_cdc.c */
 #define CDC_SEND_ENCAPSULATED_COMMAND       0x00
@@ -40,13 +57,18 @@ typedef struct
   */
   uint32_t                   SetupBuffer[(CDC_CMD_PACKET_SIZE)/sizeof(uint32_t)];
   uint32_t                   OutboundBuffer[(CDC_DATA_OUT_MAX_PACKET_SIZE)/sizeof(uint32_t)];
-  uint32_t                   InboundBuffer[(INBOUND_BUFFER_SIZE)/sizeof(uint32_t)];
+  uint32_t                   InboundStage[(INBOUND_STAGE_SIZE)/sizeof(uint32_t)];
+  uint8_t                    OutboundRing[OUTBOUND_RING_SIZE];
   uint8_t                    CmdOpCode;
   uint8_t                    CmdLength;
-  uint32_t                   InboundBufferReadIndex, InboundBufferWriteIndex;
+  uint16_t                   InboundSlotLength[INBOUND_SLOTS];
+  uint32_t                   InboundSlotAddress; /* in PMA, of the first of the slots */
+  uint32_t                   InboundSlotFillIndex, InboundSlotSendIndex, InboundSlotReserved;
   volatile uint32_t          InboundTransferInProgress;
+  uint32_t                   InboundTransferLength, InboundTransferNeedsZLP;
   volatile uint32_t          OutboundTransferNeedsRenewal;
   volatile uint32_t          OutboundTransferOutstanding;
+  uint32_t                   OutboundRingReadIndex, OutboundRingWriteIndex;
 } USBD_CDC_HandleTypeDef;
 
 /* array of callback functions invoked by USBD_RegisterClass() in main.c */
@@ -55,13 +77,27 @@ extern const USBD_ClassTypeDef USBD_CDC;
 uint8_t USBD_CDC_RegisterInterface(USBD_HandleTypeDef *pdev);
 void USBD_CDC_PMAConfig(PCD_HandleTypeDef *hpcd, uint32_t *pma_address);
 
+/* PendSV_Handler() calls this to carry out the work requested at each SOF */
+extern void USBD_VirtualCDC_PendSV(void);
+
 /* user code calls this to add data to queue to host; a return value of zero indicates the action was not possible */
 extern uint32_t USBD_VirtualCDC_ToHost_Append(const uint8_t *data, uint32_t length);
 
+/* 
+alternatively, user code calls Reserve to get somewhere to write up to length (at most INBOUND_RECORD_MAX) bytes 
+of data (NULL if there isn't room), and then Commit with how many it actually wrote (which may be zero) before anything 
+else is queued to host
+*/
+extern uint8_t *USBD_VirtualCDC_ToHost_Reserve(uint32_t length);
+extern void USBD_VirtualCDC_ToHost_Commit(uint32_t length);
+
 /* user code optionally implements this to act upon CDC LineState events */
 extern void USBD_VirtualCDC_LineState(uint16_t state);
 
-/* user code optionally implements this to process data from the host; return value must be 0 to length and indicates number of bytes handled */
-extern uint32_t USBD_VirtualCDC_FromHost_Append(const uint8_t *data, uint32_t length);
+/* user code optionally implements this, called from the USB interrupt at each SOF with the (11-bit) frame number */
+extern void USBD_VirtualCDC_FrameStart(uint32_t frame);
+
+/* user code calls this to take up to length bytes of data from the host; the return value is the number of bytes taken */
+extern uint32_t USBD_VirtualCDC_FromHost_Read(uint8_t *data, uint32_t length);
 
 #endif  // __USB_VIRTUALCDC_H_